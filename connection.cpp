@@ -1,3 +1,8 @@
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
 extern "C" {
 #include "postgres.h"
 #include "access/htup_details.h"
@@ -15,7 +20,17 @@ extern "C" {
 
 #include "connection.hpp"
 
-typedef Oid ConnCacheKey;
+/*
+ * 连接缓存键
+ * 同一用户映射可以持有多条连接，slot为0的是默认连接，
+ * 从TDENGINE_LEASED_CONNECTION_SLOT起的连接按需借给在途的异步扫描、
+ * 扇出扫描的各路查询和异步写入。
+ */
+typedef struct ConnCacheKey
+{
+    Oid umid;   /* 用户映射OID */
+    int slot;   /* 连接编号 */
+} ConnCacheKey;
 
 /*
  * 连接缓存条目结构体，用于管理TDengine连接缓存
@@ -24,6 +39,8 @@ typedef Oid ConnCacheKey;
  * @key 哈希键值，必须是第一个成员，用于在哈希表中快速查找
  * @conn TDengine连接指针，NULL表示无有效连接
  * @invalidated 连接失效标志，true表示需要重新建立连接
+ * @busy 连接已借出，归还之前不再借给其他查询，也不在失效回调中关闭
+ * @conn_id 服务端的连接ID，终止放弃的查询时按其查找，0表示未知
  * @server_hashvalue 外部服务器OID的哈希值，用于缓存失效检测
  * @mapping_hashvalue 用户映射OID的哈希值，用于缓存失效检测
  * 
@@ -37,17 +54,36 @@ typedef struct ConnCacheEntry
     ConnCacheKey key;           /* 哈希键值(必须是第一个成员) */
     WS_TAOS *conn;             /* TDengine服务器连接指针，NULL表示无有效连接 */
     bool invalidated;          /* 连接失效标志，true表示需要重新连接 */
+    bool busy;                 /* 连接是否已借出 */
+    int64 conn_id;             /* 服务端连接ID，0表示未知 */
     uint32 server_hashvalue;   /* 外部服务器OID的哈希值，用于缓存失效检测 */
     uint32 mapping_hashvalue;  /* 用户映射OID的哈希值，用于缓存失效检测 */
 } ConnCacheEntry;
 
 static HTAB *ConnectionHash = NULL;
 
+/*
+ * 已移出缓存、仍被放弃的远程调用使用的连接
+ * 后台线程返回之前连接既不能复用也不能关闭，returned由线程返回后置位，
+ * 之后由后端在下次取连接时关闭。
+ */
+struct TDengineRetiredConn
+{
+    WS_TAOS *conn;
+    std::shared_ptr<std::atomic<bool>> returned;
+};
+
+static std::vector<TDengineRetiredConn> tdengine_retired_conns;
+
 /* Function prototypes */
+static void tdengine_init_connection_hash(void);
+static WS_TAOS* tdengine_get_connection_slot(UserMapping *user, tdengine_opt *options, int slot);
 static void tdengine_make_new_connection(ConnCacheEntry *entry, UserMapping *user, tdengine_opt *options);
 static WS_TAOS* tdengine_connect_server(tdengine_opt *options);
 static void tdengine_disconnect_server(ConnCacheEntry *entry);
 static void tdengine_inval_callback(Datum arg, int cacheid, uint32 hashvalue);
+static void tdengine_close_retired_connections(void);
+static int64 tdengine_fetch_connection_id(WS_TAOS *conn);
 
 /*
  * 获取或创建与TDengine服务器的连接
@@ -64,31 +100,35 @@ static void tdengine_inval_callback(Datum arg, int cacheid, uint32 hashvalue);
  */
 WS_TAOS*
 tdengine_get_connection(UserMapping *user, tdengine_opt *options)
+{
+    return tdengine_get_connection_slot(user, options, 0);
+}
+
+/*
+ * 获取或创建用户映射的第slot号连接
+ *
+ * @param user 用户映射信息
+ * @param options 连接选项
+ * @param slot 连接编号，0为默认连接
+ * @return 返回已建立的WS_TAOS连接对象
+ *
+ * 各编号的连接相互独立地缓存，可以同时执行查询。
+ */
+static WS_TAOS*
+tdengine_get_connection_slot(UserMapping *user, tdengine_opt *options, int slot)
 {
     bool found;
     ConnCacheEntry *entry;
     ConnCacheKey key;
 
     /* 首次调用时初始化连接缓存哈希表 */
-    if (ConnectionHash == NULL)
-    {
-        HASHCTL ctl;
-
-        ctl.keysize = sizeof(ConnCacheKey);
-        ctl.entrysize = sizeof(ConnCacheEntry);
-        ConnectionHash = hash_create("tdengine_fdw connections", 8,
-                                   &ctl,
-                                   HASH_ELEM | HASH_BLOBS);
-
-        /* 注册回调函数用于连接清理 */
-        CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
-                                    tdengine_inval_callback, (Datum) 0);
-        CacheRegisterSyscacheCallback(USERMAPPINGOID,
-                                    tdengine_inval_callback, (Datum) 0);
-    }
+    tdengine_init_connection_hash();
+    tdengine_close_retired_connections();
 
-    /* 使用用户映射ID作为哈希键 */
-    key = user->umid;
+    /* 使用用户映射ID和连接编号作为哈希键 */
+    MemSet(&key, 0, sizeof(key));
+    key.umid = user->umid;
+    key.slot = slot;
 
     /* 在哈希表中查找或创建项 */
     entry = (ConnCacheEntry *)hash_search(ConnectionHash, &key, HASH_ENTER, &found);
@@ -96,6 +136,8 @@ tdengine_get_connection(UserMapping *user, tdengine_opt *options)
     {
         /* 新项初始化连接为NULL */
         entry->conn = NULL;
+        entry->busy = false;
+        entry->conn_id = 0;
     }
 
     /* 检查连接是否无效(如配置变更) */
@@ -113,6 +155,257 @@ tdengine_get_connection(UserMapping *user, tdengine_opt *options)
     return entry->conn;
 }
 
+/*
+ * 借出用户映射的一条空闲连接
+ *
+ * @param user 用户映射信息
+ * @param options 连接选项
+ * @param slot 输出借出连接的编号，归还时使用
+ * @return 返回已建立的WS_TAOS连接对象
+ *
+ * 功能说明：
+ * 1. 从TDENGINE_LEASED_CONNECTION_SLOT起找到第一条未借出的连接，没有时新建一项
+ * 2. 连接失效时先关闭再重新建立
+ * 3. 归还之前该连接只供借用者使用，后台线程在其上执行查询时
+ *    不会与其他扫描的远程调用交错
+ */
+WS_TAOS*
+tdengine_acquire_connection(UserMapping *user, tdengine_opt *options, int *slot)
+{
+    ConnCacheKey key;
+
+    tdengine_init_connection_hash();
+    tdengine_close_retired_connections();
+
+    MemSet(&key, 0, sizeof(key));
+    key.umid = user->umid;
+    for (key.slot = TDENGINE_LEASED_CONNECTION_SLOT;; key.slot++)
+    {
+        bool found;
+        ConnCacheEntry *entry;
+
+        entry = (ConnCacheEntry *)hash_search(ConnectionHash, &key, HASH_ENTER, &found);
+        if (!found)
+        {
+            entry->conn = NULL;
+            entry->busy = false;
+            entry->conn_id = 0;
+        }
+        if (entry->busy)
+            continue;
+
+        if (entry->conn != NULL && entry->invalidated)
+            tdengine_disconnect_server(entry);
+        if (entry->conn == NULL)
+            tdengine_make_new_connection(entry, user, options);
+
+        /* 借出的连接可能被放弃，记下服务端连接ID以便只终止它上面的查询 */
+        if (entry->conn_id == 0)
+            entry->conn_id = tdengine_fetch_connection_id(entry->conn);
+
+        entry->busy = true;
+        *slot = key.slot;
+        return entry->conn;
+    }
+}
+
+/*
+ * 归还借出的连接
+ *
+ * @param umid 用户映射OID
+ * @param slot 借出连接的编号
+ *
+ * 只清除借出标记，连接留在缓存中供下次借用。
+ * 在内存上下文重置回调中调用，不能抛出错误。
+ */
+void
+tdengine_release_connection(Oid umid, int slot)
+{
+    ConnCacheKey key;
+    ConnCacheEntry *entry;
+
+    if (ConnectionHash == NULL)
+        return;
+
+    MemSet(&key, 0, sizeof(key));
+    key.umid = umid;
+    key.slot = slot;
+    entry = (ConnCacheEntry *)hash_search(ConnectionHash, &key, HASH_FIND, NULL);
+    if (entry != NULL)
+        entry->busy = false;
+}
+
+/*
+ * 返回缓存连接的服务端连接ID
+ *
+ * @param conn 连接对象
+ * @return 借出时查询到的连接ID，连接不在缓存中或ID未知时返回0
+ */
+int64
+tdengine_connection_id(WS_TAOS *conn)
+{
+    HASH_SEQ_STATUS scan;
+    ConnCacheEntry *entry;
+    int64 conn_id = 0;
+
+    if (ConnectionHash == NULL || conn == NULL)
+        return 0;
+
+    hash_seq_init(&scan, ConnectionHash);
+    while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+    {
+        if (entry->conn == conn)
+        {
+            conn_id = entry->conn_id;
+            hash_seq_term(&scan);
+            break;
+        }
+    }
+
+    return conn_id;
+}
+
+/*
+ * 查询连接在服务端的连接ID
+ *
+ * @param conn 连接对象
+ * @return SELECT CONNECTION_ID()的结果，失败时返回0
+ *
+ * 与performance_schema.perf_queries的conn_id列对应。
+ */
+static int64
+tdengine_fetch_connection_id(WS_TAOS *conn)
+{
+    WS_RES *res = ws_query(conn, "SELECT CONNECTION_ID()");
+    const void *data = NULL;
+    int32_t rows = 0;
+    int64 conn_id = 0;
+
+    if (ws_errno(res) == 0 && ws_fetch_raw_block(res, &data, &rows) == 0 && rows > 0 &&
+        !ws_is_null(res, 0, 0))
+    {
+        uint8_t type = 0;
+        uint32_t len = 0;
+        const void *val = ws_get_value_in_block(res, 0, 0, &type, &len);
+
+        if (val != NULL)
+        {
+            switch (type)
+            {
+                case TSDB_DATA_TYPE_INT:
+                case TSDB_DATA_TYPE_UINT:
+                    conn_id = *(const uint32_t *) val;
+                    break;
+                case TSDB_DATA_TYPE_BIGINT:
+                case TSDB_DATA_TYPE_UBIGINT:
+                    conn_id = *(const int64_t *) val;
+                    break;
+                default:
+                {
+                    std::string text((const char *) val, len);
+
+                    conn_id = strtoll(text.c_str(), NULL, 10);
+                    break;
+                }
+            }
+        }
+    }
+    if (conn_id == 0)
+        elog(DEBUG1, "tdengine_fdw: could not get the server-side id of connection %p", conn);
+    ws_free_result(res);
+
+    return conn_id;
+}
+
+/*
+ * 把放弃的远程调用仍在使用的连接移出缓存
+ *
+ * @param conn 连接对象
+ * @param returned 后台线程返回后置位的标志
+ *
+ * 功能说明：
+ * 1. 缓存项不再指向该连接，之后取连接或借用连接时建立新连接
+ * 2. 连接记入待关闭清单，线程返回后由后端关闭，期间不会被其他查询复用，
+ *    也不会在失效回调中关闭
+ *
+ * 在内存上下文重置回调中调用，不能抛出错误。
+ */
+void
+tdengine_retire_connection(WS_TAOS *conn, const std::shared_ptr<std::atomic<bool>> &returned)
+{
+    if (ConnectionHash != NULL)
+    {
+        HASH_SEQ_STATUS scan;
+        ConnCacheEntry *entry;
+
+        hash_seq_init(&scan, ConnectionHash);
+        while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+        {
+            if (entry->conn == conn)
+            {
+                entry->conn = NULL;
+                entry->conn_id = 0;
+                entry->invalidated = true;
+                hash_seq_term(&scan);
+                break;
+            }
+        }
+    }
+
+    try
+    {
+        tdengine_retired_conns.push_back({conn, returned});
+    }
+    catch (...)
+    {
+        /* 无法记录时只能泄漏该连接，线程返回之前不能关闭 */
+    }
+}
+
+/*
+ * 关闭后台线程已经返回的待关闭连接，连同连接上缓存的预编译语句
+ */
+static void
+tdengine_close_retired_connections(void)
+{
+    for (auto it = tdengine_retired_conns.begin(); it != tdengine_retired_conns.end();)
+    {
+        if (it->returned->load(std::memory_order_acquire))
+        {
+            elog(DEBUG3, "tdengine_fdw: closing abandoned connection %p", it->conn);
+            tdengine_stmt_cache_forget(it->conn);
+            ws_close(it->conn);
+            it = tdengine_retired_conns.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+/*
+ * 初始化连接缓存哈希表并注册失效回调，已初始化时直接返回
+ */
+static void
+tdengine_init_connection_hash(void)
+{
+    HASHCTL ctl;
+
+    if (ConnectionHash != NULL)
+        return;
+
+    ctl.keysize = sizeof(ConnCacheKey);
+    ctl.entrysize = sizeof(ConnCacheEntry);
+    ConnectionHash = hash_create("tdengine_fdw connections", 8,
+                               &ctl,
+                               HASH_ELEM | HASH_BLOBS);
+
+    /* 注册回调函数用于连接清理 */
+    CacheRegisterSyscacheCallback(FOREIGNSERVEROID,
+                                tdengine_inval_callback, (Datum) 0);
+    CacheRegisterSyscacheCallback(USERMAPPINGOID,
+                                tdengine_inval_callback, (Datum) 0);
+}
+
 /*
  * 创建新的TDengine服务器连接并初始化连接缓存项
  * 
@@ -157,30 +450,32 @@ tdengine_make_new_connection(ConnCacheEntry *entry, UserMapping *user, tdengine_
  * 创建并返回一个TDengine服务器连接
  * 
  * @param dsn 连接字符串，包含服务器地址、端口、认证信息等
+ * @param connect_timeout 连接超时时间(毫秒)，0表示不限
  * @return 成功返回WS_TAOS连接对象，失败抛出ERROR异常
  * 
  * 功能说明：
- * 1. 使用提供的DSN字符串建立TDengine连接
- * 2. 检查连接是否成功建立
- * 3. 连接失败时获取错误信息并抛出PostgreSQL异常
+ * 1. 由后台线程建立连接，后端在锁存器上等待，可以响应取消请求
+ * 2. 超过connect_timeout时放弃这次连接
+ * 3. 连接失败时先处理挂起的中断，再抛出PostgreSQL异常
  * 4. 返回已建立的连接对象
  */
 WS_TAOS*
-create_tdengine_connection(char* dsn)
+create_tdengine_connection(char* dsn, int connect_timeout)
 {
+    char *errstr = NULL;
+
     /* 尝试建立TDengine连接 */
-    WS_TAOS* taos = ws_connect(dsn);
+    WS_TAOS* taos = tdengine_connect_interruptible(dsn, connect_timeout, &errstr);
     
     /* 检查连接是否成功 */
     if (taos == NULL)
     {
-        /* 获取连接错误信息 */
-        int errno = ws_errno(NULL);
-        const char* errstr = ws_errstr(NULL);
-        
-        /* 抛出PostgreSQL错误，包含错误描述和错误码 */
-        elog(ERROR, "could not connect to TDengine: %s (error code: %d)",
-             errstr, errno);
+        /* 因取消请求放弃连接时按取消报告 */
+        CHECK_FOR_INTERRUPTS();
+
+        /* 抛出PostgreSQL错误，包含错误描述 */
+        elog(ERROR, "could not connect to TDengine: %s",
+             errstr ? errstr : "unknown error");
     }
     
     /* 返回已建立的连接对象 */
@@ -189,15 +484,10 @@ create_tdengine_connection(char* dsn)
 
 // TODO: 添加对table字段的处理
 /*
- * 根据连接选项创建TDengine服务器连接
+ * 根据连接选项生成TDengine连接字符串(DSN)
  * 
  * @param opts 连接选项结构体，包含驱动、协议、认证信息等
- * @return 返回已建立的WS_TAOS连接对象
- * 
- * 功能说明：
- * 1. 格式化生成TDengine连接字符串(DSN)
- * 2. 使用默认值填充可选参数
- * 3. 调用create_tdengine_connection创建实际连接
+ * @return 返回连接字符串
  * 
  * 连接字符串格式说明：
  * %s[+%s]://[%s:%s@]%s:%d/%s?%s
@@ -209,9 +499,13 @@ create_tdengine_connection(char* dsn)
  * 5. 服务器地址(默认localhost)
  * 6. 服务器端口(默认6030)
  * 7. 数据库名称
+ * 8. 连接参数(目前为空)
+ *
+ * 连接超时由connect_timeout选项在客户端控制，不依赖DSN参数。
+ * 终止放弃的查询时以同样的连接字符串另建连接。
  */
-static WS_TAOS*
-tdengine_connect_server(tdengine_opt *opts)
+std::string
+tdengine_connection_dsn(tdengine_opt *opts)
 {
     /* 分配缓冲区用于存储连接字符串 */
     char dsn[1024];
@@ -225,10 +519,29 @@ tdengine_connect_server(tdengine_opt *opts)
              opts->svr_password ? opts->svr_password : "", // 密码
              opts->svr_address ? opts->svr_address : "localhost", // 服务器地址
              opts->svr_port ? opts->svr_port : 6030,    // 服务器端口
-             opts->svr_database ? opts->svr_database : ""); // 数据库名称
+             opts->svr_database ? opts->svr_database : "", // 数据库名称
+             "");                                       // 连接参数
     
+    return std::string(dsn);
+}
+
+/*
+ * 根据连接选项创建TDengine服务器连接
+ * 
+ * @param opts 连接选项结构体，包含驱动、协议、认证信息等
+ * @return 返回已建立的WS_TAOS连接对象
+ * 
+ * 功能说明：
+ * 1. 由tdengine_connection_dsn生成连接字符串
+ * 2. 调用create_tdengine_connection创建实际连接
+ */
+static WS_TAOS*
+tdengine_connect_server(tdengine_opt *opts)
+{
+    std::string dsn = tdengine_connection_dsn(opts);
+
     /* 调用底层连接创建函数 */
-    return create_tdengine_connection(dsn);
+    return create_tdengine_connection((char *) dsn.c_str(), opts->connect_timeout);
 }
 
 /*
@@ -238,7 +551,7 @@ tdengine_connect_server(tdengine_opt *opts)
  * 
  * 功能说明：
  * 1. 检查连接项和连接对象是否有效
- * 2. 调用ws_close关闭底层连接
+ * 2. 关闭该连接上缓存的预编译语句，再调用ws_close关闭底层连接
  * 3. 将连接指针置为NULL防止重复关闭
  * 4. 安全处理可能的空指针情况
  */
@@ -248,10 +561,12 @@ tdengine_disconnect_server(ConnCacheEntry *entry)
     /* 检查连接项和连接对象是否有效 */
     if (entry && entry->conn != NULL)
     {
-        /* 关闭底层TDengine连接 */
+        /* 关闭底层TDengine连接，预编译语句随连接失效 */
+        tdengine_stmt_cache_forget(entry->conn);
         ws_close(entry->conn);
         /* 清空连接指针防止重复关闭 */
         entry->conn = NULL;
+        entry->conn_id = 0;
     }
 }
 
@@ -299,6 +614,9 @@ tdengine_inval_callback(Datum arg, int cacheid, uint32 hashvalue)
         {
             /* 标记连接为失效状态 */
             entry->invalidated = true;
+            /* 借出的连接上可能有后台线程在执行查询，留到下次借出时再关闭 */
+            if (entry->busy)
+                continue;
             /* 记录调试日志 */
             elog(DEBUG3, "tdengine_fdw: discarding connection %p", entry->conn);
             /* 关闭连接 */
@@ -327,6 +645,9 @@ tdengine_cleanup_connection(void)
     HASH_SEQ_STATUS scan;
     ConnCacheEntry *entry;
 
+    /* 后台线程已返回的待关闭连接一并关闭，其余的随进程退出释放 */
+    tdengine_close_retired_connections();
+
     /* 检查连接哈希表是否已初始化 */
     if (ConnectionHash == NULL)
         return;
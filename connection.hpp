@@ -1,6 +1,10 @@
 #ifndef CONNECTION_HPP
 #define CONNECTION_HPP
 
+#include <atomic>
+#include <memory>
+#include <string>
+
 extern "C" {
 #include "tdengine_fdw.h"
 #include <taosws.h>
@@ -9,8 +13,29 @@ extern "C" {
 /* Get a connection for TDengine server */
 extern WS_TAOS* tdengine_get_connection(UserMapping *user, tdengine_opt *options);
 
+/* Lease an idle connection for exclusive use, the slot number is returned in *slot */
+extern WS_TAOS* tdengine_acquire_connection(UserMapping *user, tdengine_opt *options, int *slot);
+
+/* Return a leased connection to the cache */
+extern void tdengine_release_connection(Oid umid, int slot);
+
+/* Hand over a connection still used by an abandoned remote call, closed once *returned is set */
+extern void tdengine_retire_connection(WS_TAOS *conn, const std::shared_ptr<std::atomic<bool>> &returned);
+
+/* Server-side id of a cached connection recorded when it was leased, 0 if unknown */
+extern int64 tdengine_connection_id(WS_TAOS *conn);
+
+/* Build the connection string for the given options */
+extern std::string tdengine_connection_dsn(tdengine_opt *opts);
+
 /* Create a new TDengine connection */
-extern WS_TAOS* create_tdengine_connection(char* dsn);
+extern WS_TAOS* create_tdengine_connection(char* dsn, int connect_timeout);
+
+/* Connect on a helper thread while waiting on the latch (defined in query.cpp) */
+extern WS_TAOS* tdengine_connect_interruptible(const char *dsn, int connect_timeout, char **error);
+
+/* Close the prepared statements cached on a connection (defined in query.cpp) */
+extern void tdengine_stmt_cache_forget(WS_TAOS *conn);
 
 /* Clean up all connections */
 extern void tdengine_cleanup_connection(void);
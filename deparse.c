@@ -34,6 +34,7 @@ static const char *TDengineStableStarFunction[] = {
 	"stddev_all",
 	"first_all",
 	"last_all",
+	"last_row_all",
 	"percentile_all",
 	"sample_all",
 	"abs_all",
@@ -338,6 +339,7 @@ static void tdengine_deparse_from_expr(List *quals, deparse_expr_cxt *context);
 static void tdengine_deparse_aggref(Aggref *node, deparse_expr_cxt *context);
 static void tdengine_append_conditions(List *exprs, deparse_expr_cxt *context);
 static void tdengine_append_group_by_clause(List *tlist, deparse_expr_cxt *context);
+static void tdengine_append_partition_by_clause(List *exprs, deparse_expr_cxt *context);
 static void tdengine_append_order_by_clause(List *pathkeys, deparse_expr_cxt *context);
 static Node *tdengine_deparse_sort_group_clause(Index ref, List *tlist,
 												deparse_expr_cxt *context);
@@ -1496,6 +1498,7 @@ tdengine_foreign_expr_walker(Node *node,
 			 strcmp(opername, "sample") == 0 ||
 			 strcmp(opername, "first") == 0 ||
 			 strcmp(opername, "last") == 0 ||
+			 strcmp(opername, "last_row") == 0 ||
 			 strcmp(opername, "integral") == 0 ||
 			 strcmp(opername, "mean") == 0 ||
 			 strcmp(opername, "median") == 0 ||
@@ -1660,7 +1663,8 @@ tdengine_foreign_expr_walker(Node *node,
 			 * functions are converted from func(time, value) to
 			 * func(value) when deparsing.
 			 */
-			if (is_time_column && !(strcmp(opername, "last") == 0 || strcmp(opername, "first") == 0))
+			if (is_time_column && !(strcmp(opername, "last") == 0 || strcmp(opername, "first") == 0 ||
+									strcmp(opername, "last_row") == 0))
 			{
 				is_time_column = false;
 				return false;
@@ -1973,6 +1977,143 @@ tdengine_build_tlist_to_deparse(RelOptInfo *foreignrel)
 	return tlist;
 }
 
+/*
+ * 反解析INSERT语句的列清单
+ * 功能: 按目标属性的顺序输出带引号的列名，以逗号分隔
+ *
+ * 参数:
+ *   @buf: 输出缓冲区
+ *   @relid: 外部表OID
+ *   @targetAttrs: 目标属性编号列表
+ *   @tags: true时只输出标签列，false时只输出时间列和字段列
+ *
+ * 返回值: 输出的列数
+ *
+ * 注意事项:
+ *   - time与time_text都对应远程的time列，只出现一次
+ */
+static int
+tdengine_deparse_insert_columns(StringInfo buf, Oid relid, List *targetAttrs, bool tags)
+{
+    bool        time_listed = false;    // 时间列是否已加入列清单
+    int         ncols = 0;              // 列清单中的列数
+    ListCell   *lc;
+
+    foreach(lc, targetAttrs)
+    {
+        int         attnum = lfirst_int(lc);
+        char       *colname = tdengine_get_column_name(relid, attnum);
+        bool        is_tag = tdengine_is_tag_key(colname, relid);
+
+        if (is_tag != tags)
+            continue;
+        if (TDENGINE_IS_TIME_COLUMN(colname))
+        {
+            if (time_listed)
+                continue;
+            time_listed = true;
+            colname = TDENGINE_TIME_COLUMN;
+        }
+
+        if (ncols > 0)
+            appendStringInfoString(buf, ", ");
+        appendStringInfoString(buf, tdengine_quote_identifier(colname, QUOTE));
+        ncols++;
+    }
+
+    return ncols;
+}
+
+/*
+ * 输出n个以逗号分隔的"?"占位符
+ */
+static void
+tdengine_deparse_insert_placeholders(StringInfo buf, int n)
+{
+    int         i;
+
+    for (i = 0; i < n; i++)
+        appendStringInfoString(buf, i == 0 ? "?" : ", ?");
+}
+
+/*
+ * 反解析远程INSERT语句
+ * 功能: 构建参数绑定用的INSERT语句并输出到缓冲区
+ *
+ * 参数:
+ *   @buf: 输出缓冲区，用于存储生成的SQL语句
+ *   @root: 规划器信息
+ *   @rtindex: 范围表索引，标识要插入的表
+ *   @rel: 关系描述符，包含表结构信息
+ *   @targetAttrs: 目标属性编号列表
+ *
+ * 处理流程:
+ *   1. 添加INSERT INTO和表名
+ *   2. 依次添加时间列和字段列
+ *   3. 每列添加一个"?"占位符
+ *
+ * 注意事项:
+ *   - 标签列不在列清单中，子表的标签在建表时已确定；
+ *     映射超级表时改用tdengine_deparse_stable_insert
+ *   - 占位符的顺序与列清单一致，由query.cpp按列绑定参数数组
+ */
+void
+tdengine_deparse_insert(StringInfo buf, PlannerInfo *root,
+                        Index rtindex, Relation rel,
+                        List *targetAttrs)
+{
+    int         ncols;
+
+    appendStringInfoString(buf, "INSERT INTO ");
+    tdengine_deparse_relation(buf, rel);
+    appendStringInfoString(buf, " (");
+    ncols = tdengine_deparse_insert_columns(buf, RelationGetRelid(rel), targetAttrs, false);
+    appendStringInfoString(buf, ") VALUES (");
+    tdengine_deparse_insert_placeholders(buf, ncols);
+    appendStringInfoChar(buf, ')');
+
+    elog(DEBUG1, "insert:%s", buf->data);
+}
+
+/*
+ * 反解析写入超级表的INSERT语句
+ * 功能: 构建按子表路由的参数绑定INSERT语句
+ *
+ * 参数:
+ *   @buf: 输出缓冲区
+ *   @rel: 关系描述符，映射的远程表为超级表
+ *   @targetAttrs: 目标属性编号列表
+ *
+ * 处理流程:
+ *   1. 生成"INSERT INTO ? USING 超级表 (标签列) TAGS (?, ...)"
+ *   2. 追加时间列和字段列的列清单及"?"占位符
+ *
+ * 注意事项:
+ *   - 子表名和标签值由query.cpp按每组行调用ws_stmt_set_tbname_tags设置，
+ *     子表不存在时由服务端按标签值自动创建
+ */
+void
+tdengine_deparse_stable_insert(StringInfo buf, Relation rel, List *targetAttrs)
+{
+    Oid         relid = RelationGetRelid(rel);
+    int         ntags;
+    int         ncols;
+
+    appendStringInfoString(buf, "INSERT INTO ? USING ");
+    tdengine_deparse_relation(buf, rel);
+    appendStringInfoString(buf, " (");
+    ntags = tdengine_deparse_insert_columns(buf, relid, targetAttrs, true);
+    appendStringInfoString(buf, ") TAGS (");
+    tdengine_deparse_insert_placeholders(buf, ntags);
+    appendStringInfoString(buf, ") (");
+    ncols = tdengine_deparse_insert_columns(buf, relid, targetAttrs, false);
+    appendStringInfoString(buf, ") VALUES (");
+    tdengine_deparse_insert_placeholders(buf, ncols);
+    appendStringInfoChar(buf, ')');
+
+    elog(DEBUG1, "insert:%s", buf->data);
+}
+
 /*
  * 反解析远程DELETE语句
  * 功能: 构建TDengine兼容的DELETE语句并输出到缓冲区
@@ -2024,6 +2165,90 @@ tdengine_deparse_delete(StringInfo buf, PlannerInfo *root,
     elog(DEBUG1, "delete:%s", buf->data);
 }
 
+/*
+ * 反解析直接下推的DELETE语句
+ * 功能: 把DELETE的WHERE条件整体下推，构建一条在远程执行的DELETE语句
+ *
+ * 参数:
+ *   @buf: 输出缓冲区
+ *   @root: 规划器信息
+ *   @rtindex: 范围表索引
+ *   @rel: 关系描述符
+ *   @foreignrel: 扫描目标表的外部关系
+ *   @remote_conds: 下推到远程的条件
+ *   @params_list: 输出参数，需要作为参数传递的表达式列表
+ *   @retrieved_attrs: 输出参数，DELETE不返回列，总是NIL
+ *
+ * 返回值:
+ *   WHERE条件只涉及时间列和标签列时为true；否则TDengine无法执行，
+ *   调用者应退回逐行删除
+ *
+ * 注意事项:
+ *   - 语句以WHERE子句结尾，执行时可在末尾追加按时间分块的条件
+ */
+bool
+tdengine_deparse_direct_delete_sql(StringInfo buf, PlannerInfo *root,
+                                   Index rtindex, Relation rel,
+                                   RelOptInfo *foreignrel,
+                                   List *remote_conds,
+                                   List **params_list,
+                                   List **retrieved_attrs)
+{
+    deparse_expr_cxt context;
+
+    /* 初始化反解析上下文 */
+    context.buf = buf;
+    context.root = root;
+    context.foreignrel = foreignrel;
+    context.scanrel = foreignrel;
+    context.params_list = params_list;
+    context.op_type = UNKNOWN_OPERATOR;
+    context.is_tlist = false;
+    context.can_skip_cast = false;
+    context.convert_to_timestamp = false;
+    context.has_bool_cmp = false;
+    context.can_delete_directly = true;
+
+    appendStringInfoString(buf, "DELETE FROM ");
+    tdengine_deparse_relation(buf, rel);
+
+    if (remote_conds != NIL)
+    {
+        appendStringInfoString(buf, " WHERE ");
+        tdengine_append_conditions(remote_conds, &context);
+    }
+
+    *retrieved_attrs = NIL;
+
+    elog(DEBUG1, "delete:%s", buf->data);
+
+    return context.can_delete_directly;
+}
+
+/*
+ * 反解析TRUNCATE对应的远程语句
+ * 功能: 生成不带条件的"DELETE FROM 表"，删除表中的所有行
+ *
+ * 参数:
+ *   @buf: 输出缓冲区，DELETE语句
+ *   @bounds: 输出缓冲区，查询表中数据时间范围的语句，按时间分块删除时使用
+ *   @rel: 关系描述符
+ *
+ * 注意事项:
+ *   - 映射的是超级表时删除所有子表的数据，子表及其标签值保留
+ */
+void
+tdengine_deparse_truncate(StringInfo buf, StringInfo bounds, Relation rel)
+{
+    appendStringInfoString(buf, "DELETE FROM ");
+    tdengine_deparse_relation(buf, rel);
+
+    appendStringInfoString(bounds, "SELECT FIRST(time), LAST(time) FROM ");
+    tdengine_deparse_relation(bounds, rel);
+
+    elog(DEBUG1, "truncate:%s", buf->data);
+}
+
 
 /*
  * 反解析SELECT语句
@@ -2040,6 +2265,8 @@ tdengine_deparse_delete(StringInfo buf, PlannerInfo *root,
  *   @retrieved_attrs: 输出参数，返回选择的列索引列表
  *   @params_list: 输出参数，返回需要作为参数传递的值列表
  *   @has_limit: 是否包含LIMIT子句
+ *   @cond_pos: 输出参数(可为NULL)，返回FROM/WHERE子句结束的位置，
+ *              执行时可在此处插入附加条件
  *
  * 处理流程:
  *   1. 初始化反解析上下文(context)
@@ -2052,7 +2279,7 @@ tdengine_deparse_delete(StringInfo buf, PlannerInfo *root,
  *   4. 构建WHERE/HAVING子句:
  *      a. 上层关系: 使用HAVING子句
  *      b. 其他关系: 使用WHERE子句
- *   5. 构建GROUP BY子句(上层关系)
+ *   5. 构建PARTITION BY子句(LAST_ROW下推)和GROUP BY子句(上层关系)
  *   6. 构建ORDER BY子句(如果有pathkeys)
  *   7. 构建LIMIT子句(如果有)
  */
@@ -2060,7 +2287,7 @@ void tdengine_deparse_select_stmt_for_rel(StringInfo buf, PlannerInfo *root, Rel
                                          List *tlist, List *remote_conds, List *pathkeys,
                                          bool is_subquery, List **retrieved_attrs,
                                          List **params_list,
-                                         bool has_limit)
+                                         bool has_limit, int *cond_pos)
 {
     // 反解析上下文结构体
     deparse_expr_cxt context;
@@ -2114,9 +2341,17 @@ void tdengine_deparse_select_stmt_for_rel(StringInfo buf, PlannerInfo *root, Rel
     /* 构建FROM和WHERE子句 */
     tdengine_deparse_from_expr(quals, &context);
 
+    /* 记录附加条件的插入位置(GROUP BY/ORDER BY/LIMIT之前) */
+    if (cond_pos != NULL)
+        *cond_pos = buf->len;
+
     /* 处理上层关系的特殊子句 */
     if (rel->reloptkind == RELOPT_UPPER_REL)
     {
+        /* LAST_ROW按分区取最新一行时添加PARTITION BY子句 */
+        if (fpinfo->last_row_partition)
+            tdengine_append_partition_by_clause(fpinfo->last_row_partition, &context);
+
         /* 添加GROUP BY子句 */
         tdengine_append_group_by_clause(tlist, &context);
 
@@ -2138,6 +2373,109 @@ void tdengine_deparse_select_stmt_for_rel(StringInfo buf, PlannerInfo *root, Rel
 }
 
 
+/*
+ * tdengine_deparse_time_bounds - 反解析查询扫描时间范围的语句
+ *
+ * 参数:
+ *   @buf: 输出缓冲区
+ *   @root: 规划器信息
+ *   @rel: 基础外部表关系
+ *   @remote_conds: 下推到远程的条件(与扫描语句相同)
+ *   @params_list: 参数列表，与扫描语句共用以保持参数编号一致
+ *
+ * 生成"SELECT FIRST(time), LAST(time) FROM ... WHERE ..."，
+ * 并行扫描时由leader据此将时间范围切分为若干块。
+ */
+void
+tdengine_deparse_time_bounds(StringInfo buf, PlannerInfo *root, RelOptInfo *rel,
+							 List *remote_conds, List **params_list)
+{
+	deparse_expr_cxt context;
+
+	Assert(rel->reloptkind == RELOPT_BASEREL ||
+		   rel->reloptkind == RELOPT_OTHER_MEMBER_REL);
+
+	context.buf = buf;
+	context.root = root;
+	context.foreignrel = rel;
+	context.scanrel = rel;
+	context.params_list = params_list;
+	context.op_type = UNKNOWN_OPERATOR;
+	context.is_tlist = false;
+	context.can_skip_cast = false;
+	context.convert_to_timestamp = false;
+	context.has_bool_cmp = false;
+
+	appendStringInfoString(buf, "SELECT FIRST(time), LAST(time)");
+	tdengine_deparse_from_expr(remote_conds, &context);
+}
+
+/*
+ * tdengine_fanout_merge_for_pathkeys - 确定扇出扫描合并各路结果的方式
+ *
+ * 参数:
+ *   @root: 规划器信息
+ *   @rel: 基础外部表关系
+ *   @pathkeys: 路径要求的排序
+ *
+ * 返回值:
+ *   没有排序要求时各路结果可以任意交错；只按时间列排序时按时间做多路归并；
+ *   其他排序无法由各路的有序结果合并得到，不能扇出
+ */
+TDengineFanoutMerge
+tdengine_fanout_merge_for_pathkeys(PlannerInfo *root, RelOptInfo *rel, List *pathkeys)
+{
+	PathKey    *pathkey;
+
+	if (pathkeys == NIL)
+		return TDENGINE_FANOUT_UNORDERED;
+	if (list_length(pathkeys) != 1)
+		return TDENGINE_FANOUT_DISABLED;
+
+	pathkey = linitial(pathkeys);
+	if (!tdengine_is_time_pathkey(root, rel, pathkey))
+		return TDENGINE_FANOUT_DISABLED;
+
+	return pathkey->pk_strategy == BTLessStrategyNumber ?
+		TDENGINE_FANOUT_TIME_ASC : TDENGINE_FANOUT_TIME_DESC;
+}
+
+/*
+ * tdengine_is_time_pathkey - 判断排序键是否为外部表的时间列
+ *
+ * 参数:
+ *   @root: 规划器信息
+ *   @rel: 基础外部表关系
+ *   @pathkey: 排序键
+ *
+ * 返回值:
+ *   排序键的等价类中有直接引用rel时间列的成员时为true。
+ *   TDengine按时间戳顺序存储数据，按时间列排序的代价很低，
+ *   时间列也不会为NULL，NULLS FIRST/LAST不影响结果
+ */
+bool
+tdengine_is_time_pathkey(PlannerInfo *root, RelOptInfo *rel, PathKey *pathkey)
+{
+	Expr	   *em_expr;
+	Var		   *var;
+	RangeTblEntry *rte;
+	char	   *colname;
+
+	em_expr = tdengine_find_em_expr_for_rel(pathkey->pk_eclass, rel);
+	if (em_expr == NULL || !IsA(em_expr, Var))
+		return false;
+
+	var = (Var *) em_expr;
+	if (!bms_is_member(var->varno, rel->relids) || var->varattno <= 0 ||
+		var->varlevelsup != 0)
+		return false;
+
+	rte = planner_rt_fetch(var->varno, root);
+	colname = tdengine_get_column_name(rte->relid, var->varattno);
+
+	return TDENGINE_IS_TIME_COLUMN(colname);
+}
+
 /**
  * get_proname - 根据函数OID获取函数名称并添加到输出缓冲区
  *
@@ -2470,8 +2808,19 @@ tdengine_deparse_explicit_target_list(List *tlist, List **retrieved_attrs,
 				else
 				{
 					first = false;
-					/* 反解析表达式到输出缓冲区 */
-					tdengine_deparse_expr((Expr *)tle->expr, context);
+					if (fpinfo->last_row && IsA((Expr *)tle->expr, Var) &&
+						!list_member(fpinfo->last_row_partition, tle->expr))
+					{
+						/* 取分区内最新一行的列值 */
+						appendStringInfoString(buf, "last_row(");
+						tdengine_deparse_expr((Expr *)tle->expr, context);
+						appendStringInfoChar(buf, ')');
+					}
+					else
+					{
+						/* 反解析表达式到输出缓冲区 */
+						tdengine_deparse_expr((Expr *)tle->expr, context);
+					}
 					is_need_comma = true;
 				}
 			}
@@ -3484,6 +3833,8 @@ tdengine_replace_function(char *in)
 		return "first";
 	else if (strcmp(in, "last_all") == 0)
 		return "last";
+	else if (strcmp(in, "last_row_all") == 0)
+		return "last_row";
 	else if (strcmp(in, "tdengine_max") == 0 || strcmp(in, "tdengine_max_all") == 0)
 		return "max";
 	else if (strcmp(in, "tdengine_min") == 0 || strcmp(in, "tdengine_min_all") == 0)
@@ -4318,6 +4669,8 @@ tdengine_deparse_array_expr(ArrayExpr *node, deparse_expr_cxt *context)
  *   1. 不直接使用类型OID，避免远程和本地类型OID不一致的问题
  *   2. 参数类型检查由上层调用者保证
  *   3. 使用StringInfo缓冲区避免内存分配问题
+ *   4. 带编号的占位符允许同一参数出现多次；执行带参数的SELECT时，
+ *      query.cpp按出现顺序改写为预编译语句的"?"并记录对应的参数下标
  */
 static void
 tdengine_print_remote_param(int paramindex, Oid paramtype, int32 paramtypmod,
@@ -4500,14 +4853,14 @@ tdengine_is_supported_builtin_func(Oid funcid, char *in)
  *
  * 处理流程:
  *   1. 检查聚合函数是否支持(仅支持基本聚合)
- *   2. 处理特殊聚合函数(first/last)
+ *   2. 处理特殊聚合函数(first/last/last_row)
  *   3. 处理星号函数(需要添加*参数)
  *   4. 处理普通聚合函数参数
  *   5. 处理DISTINCT和VARIADIC修饰符
  *
  * 注意事项:
  *   - 仅支持AGGSPLIT_SIMPLE类型的聚合
- *   - 特殊处理first/last函数，去掉时间参数
+ *   - 特殊处理first/last/last_row函数，去掉时间参数
  *   - 星号函数需要添加*作为第一个参数
  */
 static void
@@ -4530,10 +4883,14 @@ tdengine_deparse_aggref(Aggref *node, deparse_expr_cxt *context)
 	/* 特殊处理first/last函数 */
 	if (!node->aggstar)
 	{
-		if ((strcmp(func_name, "last") == 0 || strcmp(func_name, "first") == 0) &&
+		if ((strcmp(func_name, "last") == 0 || strcmp(func_name, "first") == 0 ||
+			 strcmp(func_name, "last_row") == 0) &&
 			list_length(node->args) == 2)
 		{
-			/* 将first(time,value)/last(time,value)转换为first(value)/last(value) */
+			/*
+			 * 将first(time,value)/last(time,value)/last_row(time,value)
+			 * 转换为first(value)/last(value)/last_row(value)
+			 */
 			Assert(list_length(node->args) == 2);
 			appendStringInfo(buf, "%s(", func_name);
 			// 只反解析第二个参数(value)
@@ -4623,6 +4980,33 @@ tdengine_deparse_aggref(Aggref *node, deparse_expr_cxt *context)
 	appendStringInfoChar(buf, ')');
 }
 
+/*
+ * 反解析PARTITION BY子句
+ * 功能: 输出LAST_ROW下推时的分区键，每个分区返回最新的一行
+ *
+ * 参数:
+ *   @exprs: 分区键表达式列表
+ *   @context: 反解析上下文，包含输出缓冲区和相关状态
+ */
+static void
+tdengine_append_partition_by_clause(List *exprs, deparse_expr_cxt *context)
+{
+	StringInfo buf = context->buf; // 输出缓冲区
+	ListCell *lc;				   // 列表迭代器
+	bool first = true;			   // 标记是否是第一个分区键
+
+	appendStringInfoString(buf, " PARTITION BY ");
+
+	foreach (lc, exprs)
+	{
+		if (!first)
+			appendStringInfoString(buf, ", ");
+		first = false;
+
+		tdengine_deparse_expr((Expr *)lfirst(lc), context);
+	}
+}
+
 /*
  * 反解析GROUP BY子句
  * 功能: 将PostgreSQL的GROUP BY子句转换为TDengine兼容的SQL语法
@@ -4819,7 +5203,8 @@ tdengine_find_em_expr_for_rel(EquivalenceClass *ec, RelOptInfo *rel)
  *   4. 恢复原始传输模式
  *
  * 注意事项:
- *   - 不支持NULLS FIRST语法，遇到会抛出错误
+ *   - 不支持NULLS FIRST语法，遇到会抛出错误；时间列不会为NULL，
+ *     DESC默认的NULLS FIRST按普通的DESC输出
  *   - 使用tdengine_set_transmission_modes确保常量可移植
  *   - 排序表达式必须完全来自基表
  */
@@ -4858,8 +5243,9 @@ tdengine_append_order_by_clause(List *pathkeys, deparse_expr_cxt *context)
 		else
 			appendStringInfoString(buf, " DESC"); // 降序
 
-		/* 检查并处理NULLS FIRST(不支持则报错) */
-		if (pathkey->pk_nulls_first)
+		/* 检查并处理NULLS FIRST(不支持则报错)，时间列不会为NULL，不受影响 */
+		if (pathkey->pk_nulls_first &&
+			!tdengine_is_time_pathkey(context->root, baserel, pathkey))
 			elog(ERROR, "NULLS FIRST not supported");
 
 		/* 后续项使用逗号分隔 */
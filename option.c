@@ -43,6 +43,21 @@ static struct TDengineFdwOption valid_options[] = {
     {"host", ForeignServerRelationId},
     {"dbname", ForeignServerRelationId},
     {"port", ForeignServerRelationId},
+    {"fetch_size", ForeignServerRelationId},
+    {"prefetch", ForeignServerRelationId},
+    {"async_capable", ForeignServerRelationId},
+    {"parallel_workers", ForeignServerRelationId},
+    {"fanout_connections", ForeignServerRelationId},
+    {"query_timeout", ForeignServerRelationId},
+    {"connect_timeout", ForeignServerRelationId},
+    {"schemaless_precision", ForeignServerRelationId},
+    {"flush_rows", ForeignServerRelationId},
+    {"flush_bytes", ForeignServerRelationId},
+    {"batch_size", ForeignServerRelationId},
+    {"batch_bytes", ForeignServerRelationId},
+    {"async_insert", ForeignServerRelationId},
+    {"write_buffer", ForeignServerRelationId},
+    {"delete_chunk_interval", ForeignServerRelationId},
 
 	/* User options */
     {"username", UserMappingRelationId},
@@ -53,6 +68,19 @@ static struct TDengineFdwOption valid_options[] = {
 	{"column_name", AttributeRelationId},
 	{"tags", ForeignTableRelationId},
 	{"schemaless", ForeignTableRelationId},
+	{"fetch_size", ForeignTableRelationId},
+	{"prefetch", ForeignTableRelationId},
+	{"async_capable", ForeignTableRelationId},
+	{"parallel_workers", ForeignTableRelationId},
+	{"fanout_connections", ForeignTableRelationId},
+	{"schemaless_precision", ForeignTableRelationId},
+	{"flush_rows", ForeignTableRelationId},
+	{"flush_bytes", ForeignTableRelationId},
+	{"batch_size", ForeignTableRelationId},
+	{"batch_bytes", ForeignTableRelationId},
+	{"async_insert", ForeignTableRelationId},
+	{"write_buffer", ForeignTableRelationId},
+	{"delete_chunk_interval", ForeignTableRelationId},
 
 	/* sql options */
 	{"tags", AttributeRelationId},
@@ -122,6 +150,130 @@ tdengine_fdw_validator(PG_FUNCTION_ARGS)
                          errmsg("port number must be between 1 and 65535")));
         }
 
+        // 校验：扫描预取缓冲的行数上限，按行物化结果时每批拉取的行数
+        if (strcmp(def->defname, "fetch_size") == 0)
+        {
+            char *value = defGetString(def);
+            int fetch_size;
+
+            if (!parse_int(value, &fetch_size, 0, NULL) || fetch_size <= 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be an integer value greater than zero",
+                                def->defname)));
+        }
+
+        // 校验：是否启用后台预取
+        if (strcmp(def->defname, "prefetch") == 0)
+            (void) defGetBoolean(def);
+
+        // 校验：是否允许异步执行
+        if (strcmp(def->defname, "async_capable") == 0)
+            (void) defGetBoolean(def);
+
+        // 校验：是否异步写入
+        if (strcmp(def->defname, "async_insert") == 0)
+            (void) defGetBoolean(def);
+
+        // 校验：插入缓冲的范围
+        if (strcmp(def->defname, "write_buffer") == 0)
+        {
+            char *value = defGetString(def);
+
+            if (strcmp(value, TDENGINE_WRITE_BUFFER_STATEMENT) != 0 &&
+                strcmp(value, TDENGINE_WRITE_BUFFER_TRANSACTION) != 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be either \"%s\" or \"%s\"",
+                                def->defname, TDENGINE_WRITE_BUFFER_STATEMENT,
+                                TDENGINE_WRITE_BUFFER_TRANSACTION)));
+        }
+
+        // 校验：并行扫描的worker数
+        if (strcmp(def->defname, "parallel_workers") == 0)
+        {
+            char *value = defGetString(def);
+            int parallel_workers;
+
+            if (!parse_int(value, &parallel_workers, 0, NULL) || parallel_workers < 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be an integer value greater than or equal to zero",
+                                def->defname)));
+        }
+
+        // 校验：远程查询和建立连接的超时时间，接受带单位的值(如'30s')
+        if (strcmp(def->defname, "query_timeout") == 0 ||
+            strcmp(def->defname, "connect_timeout") == 0)
+        {
+            char *value = defGetString(def);
+            int timeout;
+
+            if (!parse_int(value, &timeout, GUC_UNIT_MS, NULL) || timeout < 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be a non-negative time value",
+                                def->defname)));
+        }
+
+        // 校验：直接DELETE按时间分块时每块的跨度，接受带单位的值(如'1d')
+        if (strcmp(def->defname, "delete_chunk_interval") == 0)
+        {
+            char *value = defGetString(def);
+            int interval;
+
+            if (!parse_int(value, &interval, GUC_UNIT_S, NULL) || interval < 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be a non-negative time value",
+                                def->defname)));
+        }
+
+        // 校验：超级表扇出扫描的并发连接数
+        if (strcmp(def->defname, "fanout_connections") == 0)
+        {
+            char *value = defGetString(def);
+            int fanout_connections;
+
+            if (!parse_int(value, &fanout_connections, 0, NULL) ||
+                fanout_connections < 0 || fanout_connections > TDENGINE_MAX_FANOUT_CONNECTIONS)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be an integer value between 0 and %d",
+                                def->defname, TDENGINE_MAX_FANOUT_CONNECTIONS)));
+        }
+
+        // 校验：无模式写入的时间戳精度
+        if (strcmp(def->defname, "schemaless_precision") == 0)
+        {
+            char *value = defGetString(def);
+
+            if (tdengine_schemaless_time_unit(value) == 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be one of h, m, s, ms, us, ns",
+                                def->defname)));
+        }
+
+        // 校验：写入缓冲区攒够多少行或多少字节后发送，以及每批插入的行数和字节数，
+        // 字节数接受带单位的值(如'4MB')
+        if (strcmp(def->defname, "flush_rows") == 0 ||
+            strcmp(def->defname, "flush_bytes") == 0 ||
+            strcmp(def->defname, "batch_size") == 0 ||
+            strcmp(def->defname, "batch_bytes") == 0)
+        {
+            char *value = defGetString(def);
+            int limit;
+            int flags = (strcmp(def->defname, "flush_bytes") == 0 ||
+                         strcmp(def->defname, "batch_bytes") == 0) ? GUC_UNIT_BYTE : 0;
+
+            if (!parse_int(value, &limit, flags, NULL) || limit <= 0)
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                         errmsg("\"%s\" must be an integer value greater than zero",
+                                def->defname)));
+        }
+
         // TODO: 超级表支持
 		// 校验：是否使用超级表
         // if (strcmp(def->defname, "using_stable") == 0)
@@ -203,9 +355,22 @@ tdengine_get_options(Oid foreigntableid, Oid userid)
     List *options;
     ListCell *lc;
     tdengine_opt *opt;
+    bool prefetch_set = false;
+    bool async_capable_set = false;
+    bool parallel_workers_set = false;
+    bool fanout_connections_set = false;
+    bool schemaless_precision_set = false;
+    bool flush_rows_set = false;
+    bool flush_bytes_set = false;
+    bool batch_bytes_set = false;
+    bool async_insert_set = false;
+    bool write_buffer_set = false;
+    bool delete_chunk_interval_set = false;
 
     /* 分配并初始化选项结构体 */
     opt = (tdengine_opt *) palloc0(sizeof(tdengine_opt));
+    opt->query_timeout = INTERACTIVE_TIMEOUT;
+    opt->connect_timeout = WAIT_TIMEOUT;
 
     /* 
      * 尝试获取外部表和服务器信息
@@ -233,7 +398,11 @@ tdengine_get_options(Oid foreigntableid, Oid userid)
     options = list_concat(options, f_server->options);
     options = list_concat(options, f_mapping->options);
 
-    /* 遍历并解析每个选项 */
+    /*
+     * 遍历并解析每个选项。表选项排在服务器选项之前，同时可在表和服务器上
+     * 设置的选项只取第一次出现的值(由对应的*_set标志或非零值判断)，
+     * 因此表选项优先生效
+     */
     foreach(lc, options)
     {
         DefElem *def = (DefElem *) lfirst(lc);
@@ -273,6 +442,93 @@ tdengine_get_options(Oid foreigntableid, Oid userid)
         /* 无模式选项 */
         if (strcmp(def->defname, "schemaless") == 0)
             opt->schemaless = defGetBoolean(def);
+
+        /* 按行物化结果的批大小选项 */
+        if (strcmp(def->defname, "fetch_size") == 0 && opt->fetch_size == 0)
+            (void) parse_int(defGetString(def), &opt->fetch_size, 0, NULL);
+
+        /* 后台预取选项 */
+        if (strcmp(def->defname, "prefetch") == 0 && !prefetch_set)
+        {
+            opt->prefetch = defGetBoolean(def);
+            prefetch_set = true;
+        }
+
+        /* 异步执行选项 */
+        if (strcmp(def->defname, "async_capable") == 0 && !async_capable_set)
+        {
+            opt->async_capable = defGetBoolean(def);
+            async_capable_set = true;
+        }
+
+        /* 并行扫描选项 */
+        if (strcmp(def->defname, "parallel_workers") == 0 && !parallel_workers_set)
+        {
+            (void) parse_int(defGetString(def), &opt->parallel_workers, 0, NULL);
+            parallel_workers_set = true;
+        }
+
+        /* 远程查询和建立连接的超时时间(毫秒)，只能在服务器上设置 */
+        if (strcmp(def->defname, "query_timeout") == 0)
+            (void) parse_int(defGetString(def), &opt->query_timeout, GUC_UNIT_MS, NULL);
+
+        if (strcmp(def->defname, "connect_timeout") == 0)
+            (void) parse_int(defGetString(def), &opt->connect_timeout, GUC_UNIT_MS, NULL);
+
+        /* 超级表扇出扫描选项 */
+        if (strcmp(def->defname, "fanout_connections") == 0 && !fanout_connections_set)
+        {
+            (void) parse_int(defGetString(def), &opt->fanout_connections, 0, NULL);
+            fanout_connections_set = true;
+        }
+
+        /* 无模式写入的时间戳精度 */
+        if (strcmp(def->defname, "schemaless_precision") == 0 && !schemaless_precision_set)
+        {
+            opt->schemaless_precision = defGetString(def);
+            schemaless_precision_set = true;
+        }
+
+        /* 写入缓冲区的发送阈值 */
+        if (strcmp(def->defname, "flush_rows") == 0 && !flush_rows_set)
+        {
+            (void) parse_int(defGetString(def), &opt->flush_rows, 0, NULL);
+            flush_rows_set = true;
+        }
+
+        if (strcmp(def->defname, "flush_bytes") == 0 && !flush_bytes_set)
+        {
+            (void) parse_int(defGetString(def), &opt->flush_bytes, GUC_UNIT_BYTE, NULL);
+            flush_bytes_set = true;
+        }
+
+        /* 每批插入的估算字节数上限 */
+        if (strcmp(def->defname, "batch_bytes") == 0 && !batch_bytes_set)
+        {
+            (void) parse_int(defGetString(def), &opt->batch_bytes, GUC_UNIT_BYTE, NULL);
+            batch_bytes_set = true;
+        }
+
+        /* 异步写入选项 */
+        if (strcmp(def->defname, "async_insert") == 0 && !async_insert_set)
+        {
+            opt->async_insert = defGetBoolean(def);
+            async_insert_set = true;
+        }
+
+        /* 插入缓冲的范围 */
+        if (strcmp(def->defname, "write_buffer") == 0 && !write_buffer_set)
+        {
+            opt->write_buffer = defGetString(def);
+            write_buffer_set = true;
+        }
+
+        /* 直接DELETE的时间分块跨度(秒) */
+        if (strcmp(def->defname, "delete_chunk_interval") == 0 && !delete_chunk_interval_set)
+        {
+            (void) parse_int(defGetString(def), &opt->delete_chunk_interval, GUC_UNIT_S, NULL);
+            delete_chunk_interval_set = true;
+        }
     }
 
     /* 如果没有显式设置表名，使用PostgreSQL中的表名 */
@@ -297,9 +553,58 @@ tdengine_get_options(Oid foreigntableid, Oid userid)
     if (!opt->svr_port)
         opt->svr_port = 6041;  /* TDengine REST API默认端口 */
 
+    /* 设置默认批大小 */
+    if (opt->fetch_size <= 0)
+        opt->fetch_size = TDENGINE_DEFAULT_FETCH_SIZE;
+
+    /* 设置无模式写入的默认时间戳精度 */
+    if (opt->schemaless_precision == NULL)
+        opt->schemaless_precision = TDENGINE_DEFAULT_SCHEMALESS_PRECISION;
+
+    /* 设置写入缓冲区的默认发送阈值 */
+    if (opt->flush_rows <= 0)
+        opt->flush_rows = TDENGINE_DEFAULT_FLUSH_ROWS;
+
+    if (opt->flush_bytes <= 0)
+        opt->flush_bytes = TDENGINE_DEFAULT_FLUSH_BYTES;
+
+    if (opt->batch_bytes <= 0)
+        opt->batch_bytes = TDENGINE_DEFAULT_BATCH_BYTES;
+
+    /* 默认在每条语句结束时发送插入的行 */
+    if (opt->write_buffer == NULL)
+        opt->write_buffer = TDENGINE_WRITE_BUFFER_STATEMENT;
+
     return opt;
 }
 
+/*
+ * tdengine_schemaless_time_unit: 无模式写入时间戳精度对应的纳秒数
+ *
+ * 参数:
+ *   @precision: 精度名称(h/m/s/ms/us/ns，与行协议的精度参数一致)
+ *
+ * 返回值:
+ *   每个时间单位的纳秒数，无效的精度返回0
+ */
+int64
+tdengine_schemaless_time_unit(const char *precision)
+{
+    if (strcmp(precision, "h") == 0)
+        return INT64CONST(3600000000000);
+    if (strcmp(precision, "m") == 0)
+        return INT64CONST(60000000000);
+    if (strcmp(precision, "s") == 0)
+        return INT64CONST(1000000000);
+    if (strcmp(precision, "ms") == 0)
+        return INT64CONST(1000000);
+    if (strcmp(precision, "us") == 0)
+        return INT64CONST(1000);
+    if (strcmp(precision, "ns") == 0)
+        return INT64CONST(1);
+    return 0;
+}
+
 /*
  * tdengineExtractTagsList: 解析逗号分隔的字符串并返回标签键列表
  *
@@ -1,86 +1,3905 @@
-
 #include <sstream>
+#include <cctype>
+#include <cfloat>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 
 #include "connection.hpp"
 #include <taosws.h>
+#include "date/date.h"
 extern "C"
 {
 #include "query_cxx.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/pg_bswap.h"
+#include "storage/latch.h"
+#include "utils/memutils.h"
 }
 
 /*
- * bindParameter
- *      bind parameter to prepare for query exection
+ * TDengine 3.x 原始数据块头部:
+ * int32 version, int32 length, int32 rows, int32 cols, int32 flagSeg, uint64 groupId
+ */
+#define TDENGINE_RAW_BLOCK_HEADER_SIZE 28
+/* 每列的类型描述: int8 type + int32 bytes */
+#define TDENGINE_RAW_BLOCK_COLUMN_META_SIZE 5
+
+/*
+ * 预取环形缓冲区的槽位数: 后端消费一个数据块的同时后台线程拉取后续数据块。
+ * 预读深度从2开始(一个在用、一个预读)，后端每取走一个数据块翻倍，直到用满槽位。
+ */
+#define TDENGINE_PREFETCH_SLOTS 4
+#define TDENGINE_PREFETCH_INITIAL_DEPTH 2
+
+/* 看护线程检查取消请求和超时的间隔(毫秒) */
+#define TDENGINE_GUARD_INTERVAL_MS 50
+
+/* 等待远程调用的结果 */
+enum TDengineWaitStatus
+{
+    TDENGINE_WAIT_READY,    /* 远程调用已返回 */
+    TDENGINE_WAIT_TIMEOUT,  /* 超过截止时间 */
+    TDENGINE_WAIT_CANCELED, /* 后端收到取消或终止请求 */
+};
+
+/*
+ * 预取槽位
+ * 保存后台线程拉取的一个原始数据块副本及其列描述，所有内存均由malloc分配，
+ * 不使用PostgreSQL的内存上下文。
+ */
+struct TDenginePrefetchSlot
+{
+    char *arena;          /* 原始数据块副本 */
+    size_t capacity;      /* arena的容量 */
+    int32_t rows;         /* 数据块行数，0表示远程结果已读完 */
+    TDengineColumn *cols; /* 指向arena的列描述 */
+    char *error;          /* 拉取失败时的错误信息 */
+};
+
+/*
+ * 后台预取状态
+ * 后台线程是唯一的生产者，后端是唯一的消费者，槽位的归属只通过head/tail
+ * 两个原子计数传递；互斥锁和条件变量只用于环满或环空时的休眠与唤醒。
+ *
+ * 后台线程只调用taosws接口和libc，不调用elog、palloc等PostgreSQL函数。
+ */
+struct TDenginePrefetch
+{
+    std::thread worker;
+    WS_RES *res = NULL;             /* 预取的结果集 */
+    std::atomic<uint32_t> head{0};  /* 消费者下一个读取的槽位 */
+    std::atomic<uint32_t> tail{0};  /* 生产者下一个写入的槽位 */
+    std::atomic<bool> stop{false};  /* 要求后台线程退出 */
+    std::atomic<bool> finished{false}; /* 后台线程是否已读完结果 */
+    std::atomic<uint32_t> depth{TDENGINE_PREFETCH_INITIAL_DEPTH}; /* tail领先head的上限 */
+    int64_t max_rows = 0;           /* 槽位中缓冲行数的上限(fetch_size)，0表示不限 */
+    std::atomic<int64_t> buffered_rows{0}; /* 已拉取、后端尚未归还的槽位中的行数 */
+    std::mutex lock;
+    std::condition_variable cv;
+    int pipefd[2] = {-1, -1};       /* 新数据块就绪通知管道，后端在锁存器上等待其读端 */
+    bool holding = false;           /* 后端是否仍在使用head处的槽位 */
+    TDenginePrefetchSlot slots[TDENGINE_PREFETCH_SLOTS] = {};
+};
+
+/*
+ * 一次执行的参数绑定
+ * 每个"?"占一个WS_STMT2_BIND，值保存在本结构自己的数组中，
+ * 后台线程绑定参数时不引用后端的palloc内存。
+ */
+struct TDengineStmtBinds
+{
+    std::vector<WS_STMT2_BIND> cols;
+    std::vector<int64_t> ints;
+    std::vector<double> doubles;
+    std::vector<int8_t> bools;
+    std::vector<std::string> strs;
+    std::vector<int32_t> lengths;
+    std::vector<char> nulls;
+};
+
+/*
+ * 预编译语句缓存项
+ * 参数化的SELECT在每个连接上按SQL文本只准备一次，之后每次执行只绑定参数值。
+ * 语句的结果集归语句所有，同一时刻只能有一个游标读取，读取期间busy为true。
+ */
+struct TDenginePreparedStmt
+{
+    WS_TAOS *conn = NULL;
+    std::string query;        /* 带"$n"占位符的原始查询，缓存的键 */
+    std::string sql;          /* 发给服务端准备的语句，带"?"占位符 */
+    WS_STMT2 *stmt = NULL;    /* NULL表示服务端不能准备该语句，直接拼接参数 */
+    std::vector<int> order;   /* 第i个"?"对应的参数下标 */
+    int precision = -1;       /* 数据库时间精度: 0毫秒/1微秒/2纳秒，-1表示未知 */
+    bool busy = false;
+};
+
+typedef std::unordered_map<std::string, TDenginePreparedStmt *> TDengineStmtMap;
+
+/* 各连接上的预编译语句 */
+static std::unordered_map<WS_TAOS *, TDengineStmtMap> tdengine_stmt_cache;
+
+/* 各连接所用数据库的时间精度，-1表示查询失败，与预编译语句一起随连接释放 */
+static std::unordered_map<WS_TAOS *, int> tdengine_precision_cache;
+
+/* 插入语句中绑定的一列 */
+struct TDengineInsertColumn
+{
+    int param;  /* 每行参数中的下标，-1表示时间列(取第一个非空的时间参数) */
+    int type;   /* 远程列类型(TSDB_DATA_TYPE_*) */
+    int bytes;  /* 远程列宽 */
+};
+
+/* 标签值 -> 子表名 */
+typedef std::unordered_map<std::string, std::string> TDengineChildMap;
+
+/*
+ * 一列的绑定缓冲区，在各次写入之间复用，容纳不下时按倍数扩大。
+ * 以malloc分配，后端放弃等待异步写入时可以连同语句一起转交给写入线程。
+ */
+struct TDengineBindBuffer
+{
+    char *is_null;                /* 空值标记 */
+    int32_t *lengths;             /* 各值的长度 */
+    char **texts;                 /* 变长列各值的文本 */
+    size_t rows;                  /* 以上数组可容纳的行数 */
+    char *data;                   /* 值，变长列按步长排列 */
+    size_t bytes;                 /* data的字节数 */
+};
+
+/*
+ * 本后端写入过的超级表的子表，键为"地址:端口/数据库.超级表"。
+ * 首次写入某个超级表时载入其已有子表的标签值，之后新出现的标签组合
+ * 按标签值推导子表名并记入缓存。
+ */
+static std::unordered_map<std::string, TDengineChildMap> tdengine_child_cache;
+
+/*
+ * 一次写入
+ * 各组(子表)的绑定描述指向同一组绑定缓冲区中的连续片段。
+ * 由后台线程依次设置子表、绑定并执行，完成后向管道写入一个字节；
+ * 与异步查询一样，后台线程不调用任何PostgreSQL函数。
+ * 后端放弃等待时语句和在用的绑定缓冲区转归本结构所有，由后到的一方释放。
+ */
+struct TDengineInsertFlight
+{
+    std::thread worker;
+    WS_STMT *stmt = NULL;
+    int ncol = 0;
+    int ntag = 0;
+    std::vector<std::string> names;         /* 各组的子表名，写入普通表时为空 */
+    std::vector<WS_MULTI_BIND> col_binds;   /* 各组的时间列和字段列，每组ncol个 */
+    std::vector<WS_MULTI_BIND> tag_binds;   /* 各组的标签列，每组ntag个 */
+    bool own = false;                       /* 语句和owned是否归本结构所有 */
+    std::vector<TDengineBindBuffer> owned;  /* 后端放弃等待后转交的绑定缓冲区 */
+    bool failed = false;                    /* 写入是否失败 */
+    std::string error;                      /* 写入失败时的错误信息 */
+    std::atomic<bool> done{false};          /* 写入是否已返回 */
+    std::atomic<bool> released{false};      /* 后台线程或后端之一已放手 */
+    std::shared_ptr<std::atomic<bool>> returned; /* 线程不再使用连接后置位 */
+    int pipefd[2] = {-1, -1};               /* 完成通知管道 */
+};
+
+/*
+ * 插入用的预编译语句
+ * 在修改状态的内存上下文中分配，语句在BeginForeignModify中准备一次，
+ * 之后每个批次只按列绑定参数并执行；上下文重置时关闭语句。
+ * 异步写入时有两组绑定缓冲区，一组在途时后端向另一组填充下一批。
+ * 异步写入的语句准备在借来的独占连接上，不同语句的写入线程互不交错。
+ */
+struct TDengineInsertStmt
+{
+    WS_STMT *stmt;                /* 预编译语句，NULL表示已关闭 */
+    WS_TAOS *conn;                /* 语句所在的连接 */
+    Oid lease_umid;               /* 借用连接所属的用户映射 */
+    int lease_slot;               /* 借用连接的编号，0表示使用默认连接 */
+    int ncol;                     /* 绑定的列数 */
+    TDengineInsertColumn *cols;   /* 与INSERT列清单一一对应 */
+    int ntag;                     /* 标签列数，0表示直接写入普通表或子表 */
+    TDengineInsertColumn *tags;   /* 与USING子句的标签清单一一对应 */
+    char *stable;                 /* 超级表名，推导子表名时使用 */
+    TDengineChildMap *children;   /* 该超级表的子表缓存 */
+    int ntime;                    /* 时间参数(time/time_text)的个数 */
+    int *time_params;             /* 时间参数在每行参数中的下标 */
+    int precision;                /* 数据库时间精度: 0毫秒/1微秒/2纳秒 */
+    int nparam;                   /* 每行的参数个数 */
+    TDengineBindBuffer *bufs;     /* 两组绑定缓冲区，每组依次对应cols和tags */
+    int fill_set;                 /* 下一次写入填充的缓冲区组 */
+    bool async;                   /* 是否不等写入返回即继续，false时发起后随即等待 */
+    int query_timeout;            /* 等待写入返回的超时时间(毫秒) */
+    TDengineInsertFlight *flight; /* 进行中的写入，NULL表示没有 */
+    int flight_set;               /* 进行中的写入使用的缓冲区组 */
+    MemoryContext pending_cxt;    /* 写入缓冲区所在的内存上下文，每次发送后重置 */
+    TDengineType *pending_types;  /* 尚未发送的各行参数类型，按行排列 */
+    TDengineValue *pending_values; /* 尚未发送的各行参数值 */
+    int pending_rows;             /* 尚未发送的行数 */
+    int pending_cap;              /* 缓冲区可容纳的行数 */
+    int64_t pending_bytes;        /* 尚未发送数据的估算字节数 */
+    int64 sent_rows;              /* 已发起写入的累计行数，与pending_rows合起来是写入位置 */
+    int flush_rows;               /* 攒够多少行后发送 */
+    int64_t flush_bytes;          /* 攒够多少字节后发送 */
+    MemoryContextCallback cb;     /* 内存上下文重置时关闭语句 */
+};
+
+/*
+ * 异步提交的查询
+ * 后台线程执行ws_query(conn为NULL时执行ws_connect，stmt不为NULL时绑定参数并执行
+ * 预编译语句)，完成后向管道写入一个字节，
+ * 后端把管道的读端注册到WaitEventSet或锁存器等待中，从而让Append下的多个
+ * 外部扫描同时在远端执行，等待期间也能响应取消请求。
+ * 与预取线程一样，后台线程不调用任何PostgreSQL函数。
+ *
+ * 后端因取消或超时放弃等待时不再等待线程结束，由released决定谁释放本结构:
+ * 后到的一方负责释放结果和管道。查询所用的连接移出缓存，线程返回后置位returned，
+ * 此后连接才由后端关闭；同时另建连接终止远端仍在执行的查询。
+ */
+struct TDenginePendingQuery
+{
+    std::thread worker;
+    WS_TAOS *conn = NULL;
+    std::string sql;                 /* 普通查询的语句，执行预编译语句时为准备的语句，无模式写入时为行协议记录 */
+    int sml_precision = -1;          /* 不小于0时以行协议写入sql，值为时间戳精度 */
+    std::string dsn;                 /* 连接字符串，建立连接或终止放弃的查询时使用 */
+    int64 conn_id = 0;               /* 服务端连接ID，终止放弃的查询时按其查找，0表示未知 */
+    std::shared_ptr<std::atomic<bool>> returned; /* 远程调用返回后由后台线程置位 */
+    WS_RES *res = NULL;              /* 查询结果，由后台线程写入 */
+    WS_TAOS *taos = NULL;            /* 新建立的连接，由后台线程写入 */
+    WS_STMT2 *stmt = NULL;           /* 要执行的预编译语句，其结果归语句所有 */
+    bool own_stmt = false;           /* 后端放弃等待后由本结构关闭预编译语句 */
+    TDengineStmtBinds binds;         /* 预编译语句本次绑定的参数 */
+    std::string error;               /* 建立连接或执行预编译语句失败时的错误信息 */
+    std::atomic<bool> done{false};   /* 查询是否已返回 */
+    std::atomic<bool> released{false}; /* 后台线程或后端之一已放手 */
+    int pipefd[2] = {-1, -1};        /* 完成通知管道 */
+};
+
+/*
+ * 远程调用看护线程
+ * 后端同步调用ws_fetch_raw_block之类可能长时间阻塞的接口之前登记结果集和截止时间，
+ * 看护线程周期性地检查取消请求(包括statement_timeout)和query_timeout，
+ * 需要时调用ws_stop_query使阻塞的调用返回。每个后端最多一个看护线程。
+ */
+struct TDengineGuard
+{
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable cv;
+    WS_RES *res = NULL;          /* 正在看护的结果集，NULL表示空闲 */
+    int64_t deadline = 0;        /* 截止时间(单调时钟毫秒)，0表示不限 */
+    TDengineWaitStatus stopped = TDENGINE_WAIT_READY; /* 本次调用被停止的原因 */
+};
+
+static TDengineGuard *tdengine_guard = NULL;
+
+/*
+ * 流式游标
+ * 封装一次远程查询的WS_RES，结果按数据块从服务端按需拉取。
+ * 外部表扫描以服务端数据块为单位读取，块的大小由服务端决定；预取的数据块
+ * 合计不超过fetch_size行(至少一块)。按行物化的调用方每次取至多fetch_size行。
+ *
+ * 游标在打开时所处的内存上下文中分配，并在该上下文上注册重置回调，
+ * 因此即使查询因错误中止，WS_RES也会随上下文一起释放。
+ */
+struct TDengineCursor
+{
+    WS_RES *res;              /* 远程结果集句柄，NULL表示已关闭 */
+    int ncol;                 /* 结果列数 */
+    char **columns;           /* 结果列名 */
+    int precision;            /* 时间戳精度: 0毫秒/1微秒/2纳秒 */
+    int32_t block_rows;       /* 当前数据块的行数 */
+    int32_t block_pos;        /* 当前数据块中下一个待读取的行 */
+    bool eof;                 /* 远程结果是否已读完 */
+    TDenginePrefetch *prefetch; /* 后台预取状态，NULL表示同步拉取 */
+    TDenginePendingQuery *pending; /* 尚未完成的异步查询，NULL表示查询已返回 */
+    bool want_prefetch;       /* 第一个数据块返回后是否启动预取 */
+    int prefetch_rows;        /* 预取缓冲的行数上限(fetch_size)，0表示不限 */
+    uint32_t nblocks;         /* 已同步返回的数据块数 */
+    int64_t deadline;         /* query_timeout的截止时间(单调时钟毫秒)，0表示不限 */
+    TDenginePreparedStmt *prepared; /* 结果所属的预编译语句，NULL表示结果归游标所有 */
+    bool failed;              /* 远程调用是否出错，出错的预编译语句不再复用 */
+    Oid lease_umid;           /* 借用连接所属的用户映射 */
+    int lease_slot;           /* 借用连接的编号，0表示没有借用连接 */
+    MemoryContextCallback cb; /* 内存上下文重置时释放WS_RES */
+};
+
+/*
+ * tdengine_format_timestamp
+ *      将TDengine时间戳(按结果集精度)格式化为PostgreSQL可解析的UTC时间字符串
+ *
+ * PostgreSQL时间戳精度为微秒，纳秒精度的值会被截断到微秒。
+ */
+static char *
+tdengine_format_timestamp(int64_t ts, int precision)
+{
+    using namespace std::chrono;
+    date::sys_time<microseconds> tp;
+
+    switch (precision)
+    {
+        case 1: /* 微秒 */
+            tp = date::sys_time<microseconds>(microseconds(ts));
+            break;
+        case 2: /* 纳秒 */
+            tp = date::floor<microseconds>(date::sys_time<nanoseconds>(nanoseconds(ts)));
+            break;
+        default: /* 毫秒 */
+            tp = date::sys_time<microseconds>(duration_cast<microseconds>(milliseconds(ts)));
+            break;
+    }
+
+    return pstrdup((date::format("%F %T", tp) + "+00").c_str());
+}
+
+/*
+ * tdengine_format_param_time
+ *      将纳秒时间戳格式化为RFC3339字符串，用作查询中的时间常量
+ */
+static std::string
+tdengine_format_param_time(long long nanos)
+{
+    using namespace std::chrono;
+    date::sys_time<nanoseconds> tp{nanoseconds(nanos)};
+
+    return "'" + date::format("%FT%TZ", tp) + "'";
+}
+
+/*
+ * tdengine_insert_time_value
+ *      把纳秒时间戳换算为数据库精度，写入和绑定查询参数时使用
+ */
+static int64_t
+tdengine_insert_time_value(long long nanos, int precision)
+{
+    switch (precision)
+    {
+        case 0:
+            return nanos / 1000000;
+        case 1:
+            return nanos / 1000;
+        default:
+            return nanos;
+    }
+}
+
+/*
+ * tdengine_quote_literal
+ *      为字符串参数添加单引号，并转义其中的单引号和反斜杠
+ */
+static std::string
+tdengine_quote_literal(const char *val)
+{
+    std::string out("'");
+
+    for (const char *p = val; *p; p++)
+    {
+        if (*p == '\'' || *p == '\\')
+            out.push_back('\\');
+        out.push_back(*p);
+    }
+    out.push_back('\'');
+    return out;
+}
+
+/*
+ * tdengine_quote_identifier
+ *      为表名、列名添加双引号，与deparse.c中的引用方式一致
+ */
+static std::string
+tdengine_quote_identifier(const char *name)
+{
+    std::string out("\"");
+
+    for (const char *p = name; *p; p++)
+    {
+        if (*p == '"')
+            out.push_back('"');
+        out.push_back(*p);
+    }
+    out.push_back('"');
+    return out;
+}
+
+/*
+ * tdengine_rewrite_params
+ *      扫描查询中的"$1"、"$2"...占位符，由emit追加每个占位符的替换内容
+ *
+ * 引号内的"$"和超出参数个数的占位符原样保留。
  */
-static influxdb::InfluxDBParams
-bindParameter(InfluxDBType *param_type, InfluxDBValue *param_val, int param_num)
+template <typename Emit>
+static std::string
+tdengine_rewrite_params(const char *query, int param_num, Emit emit)
 {
-    influxdb::InfluxDBParams params;
+    std::string sql;
+    char quote = '\0';
 
-    if (param_num > 0)
+    for (const char *p = query; *p; p++)
     {
-        for (int i = 0; i < param_num; i++)
+        int idx = 0;
+        const char *q;
+
+        /* 跳过字符串常量和带引号的标识符 */
+        if (quote != '\0')
         {
-            /* Each placeholder is "$1", "$2",...,so set "1","2",... to map key */
-            switch (param_type[i])
-            {
-                case INFLUXDB_STRING:
-                    params.addParam(std::to_string(i + 1), std::string(param_val[i].s));
-                    break;
-                case INFLUXDB_INT64:
-                case INFLUXDB_TIME:
-                    params.addParam(std::to_string(i + 1), param_val[i].i);
-                    break;
-                case INFLUXDB_BOOLEAN:
-                    params.addParam(std::to_string(i + 1), (bool) param_val[i].b);
-                    break;
-                case INFLUXDB_DOUBLE:
-                    params.addParam(std::to_string(i + 1), param_val[i].d);
-                    break;
-                case INFLUXDB_NULL:
-                    params.addParam(std::to_string(i + 1), "\"\"");
+            if (*p == quote)
+                quote = '\0';
+            sql.push_back(*p);
+            continue;
+        }
+        if (*p == '\'' || *p == '"' || *p == '`')
+        {
+            quote = *p;
+            sql.push_back(*p);
+            continue;
+        }
+
+        if (*p != '$' || !isdigit((unsigned char) p[1]))
+        {
+            sql.push_back(*p);
+            continue;
+        }
+
+        for (q = p + 1; isdigit((unsigned char) *q); q++)
+            idx = idx * 10 + (*q - '0');
+
+        if (idx < 1 || idx > param_num)
+        {
+            sql.append(p, q - p);
+            p = q - 1;
+            continue;
+        }
+
+        /* Each placeholder is "$1", "$2",...,so parameter index is idx - 1 */
+        emit(sql, idx - 1);
+        p = q - 1;
+    }
+
+    return sql;
+}
+
+/*
+ * bindParameter
+ *      将查询中的"$1"、"$2"...占位符替换为参数常量
+ *
+ * 不能使用预编译语句时，参数值按类型格式化为SQL常量后直接写入查询文本。
+ */
+static std::string
+bindParameter(const char *query, TDengineType *param_type, TDengineValue *param_val, int param_num)
+{
+    if (param_num <= 0)
+        return std::string(query);
+
+    return tdengine_rewrite_params(query, param_num, [&](std::string &sql, int i) {
+        switch (param_type[i])
+        {
+            case TDENGINE_STRING:
+                sql += tdengine_quote_literal(param_val[i].s);
+                break;
+            case TDENGINE_INT64:
+                sql += std::to_string(param_val[i].i);
+                break;
+            case TDENGINE_TIME:
+                sql += tdengine_format_param_time(param_val[i].i);
+                break;
+            case TDENGINE_BOOLEAN:
+                sql += param_val[i].b ? "true" : "false";
+                break;
+            case TDENGINE_DOUBLE:
+                {
+                    char buf[64];
+
+                    snprintf(buf, sizeof(buf), "%.*g", DBL_DIG + 3, param_val[i].d);
+                    sql += buf;
                     break;
-                default:
-                    elog(ERROR, "Unexpected type: %d", param_type[i]);
-            }
+                }
+            case TDENGINE_NULL:
+                sql += "NULL";
+                break;
+            default:
+                elog(ERROR, "Unexpected type: %d", param_type[i]);
         }
+    });
+}
+
+/*
+ * tdengine_cursor_value
+ *      将当前数据块中(row, col)处的值转换为文本，NULL值返回NULL
+ */
+static char *
+tdengine_cursor_value(TDengineCursor *cursor, int32_t row, int32_t col)
+{
+    uint8_t type = 0;
+    uint32_t len = 0;
+    const void *val;
+
+    if (ws_is_null(cursor->res, row, col))
+        return NULL;
+
+    val = ws_get_value_in_block(cursor->res, row, col, &type, &len);
+    if (val == NULL)
+        return NULL;
+
+    switch (type)
+    {
+        case TSDB_DATA_TYPE_BOOL:
+            return pstrdup(*(const int8_t *) val ? "true" : "false");
+        case TSDB_DATA_TYPE_TINYINT:
+            return psprintf("%d", *(const int8_t *) val);
+        case TSDB_DATA_TYPE_SMALLINT:
+            return psprintf("%d", *(const int16_t *) val);
+        case TSDB_DATA_TYPE_INT:
+            return psprintf("%d", *(const int32_t *) val);
+        case TSDB_DATA_TYPE_BIGINT:
+            return psprintf(INT64_FORMAT, (int64) *(const int64_t *) val);
+        case TSDB_DATA_TYPE_UTINYINT:
+            return psprintf("%u", *(const uint8_t *) val);
+        case TSDB_DATA_TYPE_USMALLINT:
+            return psprintf("%u", *(const uint16_t *) val);
+        case TSDB_DATA_TYPE_UINT:
+            return psprintf("%u", *(const uint32_t *) val);
+        case TSDB_DATA_TYPE_UBIGINT:
+            return psprintf(UINT64_FORMAT, (uint64) *(const uint64_t *) val);
+        case TSDB_DATA_TYPE_FLOAT:
+            return psprintf("%.*g", FLT_DIG + 3, (double) *(const float *) val);
+        case TSDB_DATA_TYPE_DOUBLE:
+            return psprintf("%.*g", DBL_DIG + 3, *(const double *) val);
+        case TSDB_DATA_TYPE_TIMESTAMP:
+            return tdengine_format_timestamp(*(const int64_t *) val, cursor->precision);
+        default:
+            /* BINARY/VARCHAR/NCHAR/JSON等变长类型 */
+            return pnstrdup((const char *) val, len);
     }
+}
 
-    return params;
+/*
+ * tdengine_is_var_type
+ *      判断TDengine类型在原始数据块中是否按变长格式(偏移数组+数据区)存储
+ */
+static bool
+tdengine_is_var_type(int type)
+{
+    return type == TSDB_DATA_TYPE_BINARY ||
+           type == TSDB_DATA_TYPE_NCHAR ||
+           type == TSDB_DATA_TYPE_JSON ||
+           type == 16 || /* VARBINARY */
+           type == 20;   /* GEOMETRY */
 }
+
 /*
- * TDengineQuery
- *      execute single InfluxQL query
+ * tdengine_is_decodable_type
+ *      判断TDengine类型能否直接从原始数据块的列缓冲区读取
+ *
+ * JSON等内部格式特殊的类型退化为逐行调用ws_get_value_in_block。
  */
-extern "C" struct TDengineQuery_return
-TDengineQuery(char* cquery, UserMapping *user, tdengine_opt *opts, TDengineType* ctypes, TDengineValue* cvalues, int cparamNum)
+static bool
+tdengine_is_decodable_type(int type)
+{
+    switch (type)
+    {
+        case TSDB_DATA_TYPE_BOOL:
+        case TSDB_DATA_TYPE_TINYINT:
+        case TSDB_DATA_TYPE_SMALLINT:
+        case TSDB_DATA_TYPE_INT:
+        case TSDB_DATA_TYPE_BIGINT:
+        case TSDB_DATA_TYPE_FLOAT:
+        case TSDB_DATA_TYPE_DOUBLE:
+        case TSDB_DATA_TYPE_TIMESTAMP:
+        case TSDB_DATA_TYPE_UTINYINT:
+        case TSDB_DATA_TYPE_USMALLINT:
+        case TSDB_DATA_TYPE_UINT:
+        case TSDB_DATA_TYPE_UBIGINT:
+        case TSDB_DATA_TYPE_BINARY:
+        case TSDB_DATA_TYPE_NCHAR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * tdengine_fill_column_values
+ *      退化模式: 逐行调用ws_get_value_in_block取得一列的值指针
+ */
+static void
+tdengine_fill_column_values(TDengineCursor *cursor, TDengineColumn *col, int32_t nrows, int32_t c)
+{
+    col->values = (const char **) palloc(sizeof(char *) * nrows);
+    col->lengths = (uint32 *) palloc(sizeof(uint32) * nrows);
+
+    for (int32_t r = 0; r < nrows; r++)
+    {
+        uint8_t type = 0;
+        uint32_t len = 0;
+
+        if (ws_is_null(cursor->res, r, c))
+        {
+            col->values[r] = NULL;
+            col->lengths[r] = 0;
+            continue;
+        }
+        col->values[r] = (const char *) ws_get_value_in_block(cursor->res, r, c, &type, &len);
+        col->lengths[r] = len;
+    }
+}
+
+/*
+ * tdengine_parse_raw_block
+ *      解析原始数据块的布局，让各列指向数据块中的类型化缓冲区
+ *
+ * 只做指针运算，不调用任何PostgreSQL函数，可以在预取线程中使用。
+ * 返回数据块的总字节数，头部与结果集不一致时返回0。
+ */
+static size_t
+tdengine_parse_raw_block(const char *data, int32_t nrows, int ncol, TDengineColumn *cols)
+{
+    int32_t rows;
+    int32_t cols_in_block;
+    const char *lengths;
+    const char *p;
+
+    memcpy(&rows, data + 2 * sizeof(int32_t), sizeof(int32_t));
+    memcpy(&cols_in_block, data + 3 * sizeof(int32_t), sizeof(int32_t));
+    if (rows != nrows || cols_in_block != ncol)
+        return 0;
+
+    /* 每列的类型和定长字节数 */
+    p = data + TDENGINE_RAW_BLOCK_HEADER_SIZE;
+    for (int32_t c = 0; c < ncol; c++)
+    {
+        int32_t bytes;
+
+        memcpy(&bytes, p + 1, sizeof(int32_t));
+        cols[c].type = (uint8_t) p[0];
+        cols[c].bytes = bytes;
+        p += TDENGINE_RAW_BLOCK_COLUMN_META_SIZE;
+    }
+
+    /* 每列数据长度(网络字节序) */
+    lengths = p;
+    p += sizeof(int32_t) * ncol;
+
+    for (int32_t c = 0; c < ncol; c++)
+    {
+        TDengineColumn *col = &cols[c];
+        uint32_t len;
+
+        memcpy(&len, lengths + sizeof(int32_t) * c, sizeof(uint32_t));
+        len = pg_ntoh32(len);
+
+        col->values = NULL;
+        col->lengths = NULL;
+        if (tdengine_is_var_type(col->type))
+        {
+            col->offsets = p;
+            col->nulls = NULL;
+            p += sizeof(int32_t) * rows;
+        }
+        else
+        {
+            col->offsets = NULL;
+            col->nulls = p;
+            p += (rows + 7) >> 3;
+        }
+        col->data = p;
+        p += len;
+    }
+
+    return (size_t) (p - data);
+}
+
+/*
+ * tdengine_decode_raw_block
+ *      解析原始数据块，不能直接读取的列退化为逐行取值
+ *
+ * 数据块头部与结果集不一致时返回false，由调用方对所有列使用退化模式。
+ */
+static bool
+tdengine_decode_raw_block(TDengineCursor *cursor, const char *data, int32_t nrows, TDengineBlock *block)
+{
+    if (tdengine_parse_raw_block(data, nrows, cursor->ncol, block->cols) == 0)
+        return false;
+
+    for (int c = 0; c < cursor->ncol; c++)
+    {
+        TDengineColumn *col = &block->cols[c];
+
+        if (!tdengine_is_decodable_type(col->type))
+        {
+            col->offsets = NULL;
+            col->nulls = NULL;
+            col->data = NULL;
+            tdengine_fill_column_values(cursor, col, nrows, c);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * tdengine_spawn_thread
+ *      在屏蔽所有信号的情况下创建后台线程
+ *
+ * 新线程继承创建者的信号掩码，屏蔽后信号只会投递给后端主线程，
+ * PostgreSQL的信号处理函数不会在后台线程中运行。失败时抛出异常。
+ */
+template <typename Func, typename... Args>
+static std::thread
+tdengine_spawn_thread(Func &&func, Args &&...args)
 {
-    TDengineQuery_return *res = (TDengineQuery_return *) palloc0(sizeof(TDengineQuery_return));
-    auto influx = tdengine_get_connection(user, opts);
-    auto params = bindParameter(ctypes, cvalues, cparamNum);
+    sigset_t all;
+    sigset_t old;
+    std::thread worker;
 
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
     try
     {
-        auto result_set = influx->query(std::string(cquery), params);
+        worker = std::thread(std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        throw;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return worker;
+}
+
+/*
+ * tdengine_now_ms
+ *      单调时钟的当前时间(毫秒)
+ */
+static int64_t
+tdengine_now_ms(void)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * tdengine_deadline
+ *      由超时时间(毫秒)计算截止时间，0表示不限
+ */
+static int64_t
+tdengine_deadline(int timeout_ms)
+{
+    return timeout_ms > 0 ? tdengine_now_ms() + timeout_ms : 0;
+}
+
+/*
+ * tdengine_cancel_pending
+ *      后端是否收到了需要中止远程查询的中断
+ *
+ * 只读取信号处理函数设置的标志，真正的中断处理留给返回C代码之后的
+ * CHECK_FOR_INTERRUPTS，不在C++栈帧中长跳转。看护线程也会读取这两个标志。
+ */
+static inline bool
+tdengine_cancel_pending(void)
+{
+    return QueryCancelPending || ProcDiePending;
+}
+
+/*
+ * tdengine_wait_error
+ *      远程调用被中止时返回给调用方的错误信息
+ */
+static char *
+tdengine_wait_error(TDengineWaitStatus status)
+{
+    if (status == TDENGINE_WAIT_TIMEOUT)
+        return pstrdup("canceling remote query due to query_timeout");
+    return pstrdup("canceling remote query due to user request");
+}
+
+/*
+ * tdengine_wait_readable
+ *      在锁存器上等待描述符可读，期间响应取消请求和截止时间
+ */
+static TDengineWaitStatus
+tdengine_wait_readable(int fd, int64_t deadline)
+{
+    for (;;)
+    {
+        int events = WL_LATCH_SET | WL_SOCKET_READABLE | WL_EXIT_ON_PM_DEATH;
+        long timeout = -1;
+        int rc;
+
+        if (tdengine_cancel_pending())
+            return TDENGINE_WAIT_CANCELED;
 
-        /* Use first statement result */
-        if (result_set.size() > 0)
+        if (deadline > 0)
         {
-            auto query_result = result_set.at(0);
-            if (query_result.error.length() > 0)
-            {
-                res->r1 = (char *) palloc0(sizeof(char) * (query_result.error.length()) + 1);
-                strcpy(res->r1, query_result.error.c_str());
-            }
-            else
-                res->r0 = TDengineSeries_to_TDengineResult(query_result.series);
+            int64_t now = tdengine_now_ms();
+
+            if (now >= deadline)
+                return TDENGINE_WAIT_TIMEOUT;
+            timeout = (long) (deadline - now);
+            events |= WL_TIMEOUT;
+        }
+
+        rc = WaitLatchOrSocket(MyLatch, events, fd, timeout, PG_WAIT_EXTENSION);
+        if (rc & WL_LATCH_SET)
+            ResetLatch(MyLatch);
+        if (rc & WL_SOCKET_READABLE)
+            return TDENGINE_WAIT_READY;
+    }
+}
+
+/*
+ * tdengine_guard_worker
+ *      看护线程主循环
+ */
+static void
+tdengine_guard_worker(TDengineGuard *guard)
+{
+    std::unique_lock<std::mutex> lk(guard->lock);
+
+    for (;;)
+    {
+        if (guard->res == NULL)
+        {
+            guard->cv.wait(lk);
+            continue;
+        }
+
+        if (guard->stopped == TDENGINE_WAIT_READY)
+        {
+            if (tdengine_cancel_pending())
+                guard->stopped = TDENGINE_WAIT_CANCELED;
+            else if (guard->deadline > 0 && tdengine_now_ms() >= guard->deadline)
+                guard->stopped = TDENGINE_WAIT_TIMEOUT;
+
+            if (guard->stopped != TDENGINE_WAIT_READY)
+                ws_stop_query(guard->res);
         }
+
+        guard->cv.wait_for(lk, std::chrono::milliseconds(TDENGINE_GUARD_INTERVAL_MS));
     }
-    catch (const std::exception& e)
+}
+
+/*
+ * tdengine_guard_arm
+ *      登记即将阻塞的远程调用，看护线程在首次使用时创建
+ *
+ * 看护线程无法创建时调用不受保护，仍按原方式阻塞。
+ */
+static void
+tdengine_guard_arm(WS_RES *res, int64_t deadline)
+{
+    if (tdengine_guard == NULL)
     {
-        res->r1 = (char *) palloc0(sizeof(char) * (strlen(e.what()) + 1));
-        strcpy(res->r1, e.what());
+        TDengineGuard *guard = NULL;
+
+        try
+        {
+            guard = new TDengineGuard();
+            guard->worker = tdengine_spawn_thread(tdengine_guard_worker, guard);
+        }
+        catch (...)
+        {
+            delete guard;
+            return;
+        }
+        tdengine_guard = guard;
     }
 
-    return *res;
-}
\ No newline at end of file
+    {
+        std::lock_guard<std::mutex> lk(tdengine_guard->lock);
+
+        tdengine_guard->res = res;
+        tdengine_guard->deadline = deadline;
+        tdengine_guard->stopped = TDENGINE_WAIT_READY;
+    }
+    tdengine_guard->cv.notify_all();
+}
+
+/*
+ * tdengine_guard_disarm
+ *      远程调用已返回，撤销登记并返回调用是否被看护线程停止
+ */
+static TDengineWaitStatus
+tdengine_guard_disarm(void)
+{
+    std::lock_guard<std::mutex> lk(tdengine_guard->lock);
+
+    tdengine_guard->res = NULL;
+    return tdengine_guard->stopped;
+}
+
+/*
+ * tdengine_guarded_fetch
+ *      在看护线程保护下同步拉取下一个原始数据块
+ *
+ * 调用被取消请求或query_timeout中止时游标标记为已读完并返回错误信息。
+ */
+static bool
+tdengine_guarded_fetch(TDengineCursor *cursor, const void **data, int32_t *rows, char **error)
+{
+    TDengineWaitStatus stopped = TDENGINE_WAIT_READY;
+    bool guarded;
+    int code;
+
+    tdengine_guard_arm(cursor->res, cursor->deadline);
+    guarded = (tdengine_guard != NULL);
+    code = ws_fetch_raw_block(cursor->res, data, rows);
+    if (guarded)
+        stopped = tdengine_guard_disarm();
+
+    if (stopped != TDENGINE_WAIT_READY)
+    {
+        *error = tdengine_wait_error(stopped);
+        cursor->eof = true;
+        return false;
+    }
+    if (code != 0)
+    {
+        *error = pstrdup(ws_errstr(cursor->res));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * tdengine_prefetch_notify
+ *      更新head/tail之后唤醒等待的一方
+ *
+ * 先获取一次互斥锁，保证对方不会在检查条件之后、开始休眠之前错过通知。
+ */
+static void
+tdengine_prefetch_notify(TDenginePrefetch *pf)
+{
+    {
+        std::lock_guard<std::mutex> guard(pf->lock);
+    }
+    pf->cv.notify_all();
+}
+
+/*
+ * tdengine_prefetch_fill
+ *      拉取下一个原始数据块并复制到槽位中
+ */
+static void
+tdengine_prefetch_fill(WS_RES *res, int ncol, TDenginePrefetchSlot *slot)
+{
+    const void *data = NULL;
+    int32_t rows = 0;
+    size_t len;
+
+    slot->rows = 0;
+    if (ws_fetch_raw_block(res, &data, &rows) != 0)
+    {
+        slot->error = strdup(ws_errstr(res));
+        return;
+    }
+    if (rows == 0 || data == NULL)
+        return;
+
+    len = tdengine_parse_raw_block((const char *) data, rows, ncol, slot->cols);
+    if (len == 0)
+    {
+        slot->error = strdup("unexpected raw block layout");
+        return;
+    }
+
+    if (len > slot->capacity)
+    {
+        char *arena = (char *) realloc(slot->arena, len);
+
+        if (arena == NULL)
+        {
+            slot->error = strdup("out of memory while prefetching result block");
+            return;
+        }
+        slot->arena = arena;
+        slot->capacity = len;
+    }
+    memcpy(slot->arena, data, len);
+
+    /* 列描述改为指向副本，客户端库的数据块在下一次拉取后即失效 */
+    (void) tdengine_parse_raw_block(slot->arena, rows, ncol, slot->cols);
+    slot->rows = rows;
+}
+
+/*
+ * tdengine_prefetch_worker
+ *      预取线程主循环: 有空闲槽位时拉取下一个数据块，读完或出错后退出
+ *
+ * 设置了max_rows时，按上一个数据块的行数估计，再拉一块会使缓冲的行数
+ * 超过max_rows就等后端归还槽位；没有缓冲任何行时总是拉取，
+ * 数据块大于fetch_size时预取退化为一次一块。
+ */
+static void
+tdengine_prefetch_worker(WS_RES *res, int ncol, TDenginePrefetch *pf)
+{
+    char byte = 1;
+    int64_t last_rows = 0;
+
+    for (;;)
+    {
+        uint32_t tail = pf->tail.load(std::memory_order_relaxed);
+        TDenginePrefetchSlot *slot = &pf->slots[tail % TDENGINE_PREFETCH_SLOTS];
+        bool last;
+
+        {
+            std::unique_lock<std::mutex> guard(pf->lock);
+
+            pf->cv.wait(guard, [pf, tail, last_rows] {
+                int64_t buffered = pf->buffered_rows.load(std::memory_order_acquire);
+
+                return pf->stop.load(std::memory_order_acquire) ||
+                       (tail - pf->head.load(std::memory_order_acquire) <
+                            pf->depth.load(std::memory_order_acquire) &&
+                        (pf->max_rows == 0 || buffered == 0 || buffered + last_rows <= pf->max_rows));
+            });
+        }
+        if (pf->stop.load(std::memory_order_acquire))
+            return;
+
+        tdengine_prefetch_fill(res, ncol, slot);
+        last = (slot->rows == 0);
+        if (last)
+            pf->finished.store(true, std::memory_order_release);
+        last_rows = slot->rows;
+        pf->buffered_rows.fetch_add(slot->rows, std::memory_order_acq_rel);
+
+        pf->tail.store(tail + 1, std::memory_order_release);
+        tdengine_prefetch_notify(pf);
+        while (write(pf->pipefd[1], &byte, 1) < 0 && errno == EINTR)
+            ;
+
+        if (last)
+            return;
+    }
+}
+
+/*
+ * tdengine_prefetch_stop
+ *      停止预取线程并释放所有槽位
+ *
+ * 后台线程可能阻塞在ws_fetch_raw_block中，结果尚未读完时先停止远程查询。
+ */
+static void
+tdengine_prefetch_stop(TDenginePrefetch *pf)
+{
+    pf->stop.store(true, std::memory_order_release);
+    if (!pf->finished.load(std::memory_order_acquire))
+        ws_stop_query(pf->res);
+    tdengine_prefetch_notify(pf);
+
+    try
+    {
+        if (pf->worker.joinable())
+            pf->worker.join();
+    }
+    catch (...)
+    {
+        /* 内存上下文回调中不能抛出异常 */
+    }
+
+    for (int i = 0; i < TDENGINE_PREFETCH_SLOTS; i++)
+    {
+        free(pf->slots[i].arena);
+        free(pf->slots[i].cols);
+        free(pf->slots[i].error);
+    }
+    if (pf->pipefd[0] >= 0)
+        close(pf->pipefd[0]);
+    if (pf->pipefd[1] >= 0)
+        close(pf->pipefd[1]);
+    delete pf;
+}
+
+/*
+ * tdengine_prefetch_next
+ *      从预取环中取下一个数据块
+ *
+ * 上一次返回的槽位在此时才归还给后台线程，因此数据块在下一次拉取之前有效。
+ * 环空时在锁存器上等待通知管道，收到取消请求或超过query_timeout时停止远程查询。
+ */
+static bool
+tdengine_prefetch_next(TDengineCursor *cursor, TDengineBlock *block, char **error)
+{
+    TDenginePrefetch *pf = cursor->prefetch;
+    uint32_t head = pf->head.load(std::memory_order_relaxed);
+    TDenginePrefetchSlot *slot;
+
+    if (pf->holding)
+    {
+        uint32_t depth = pf->depth.load(std::memory_order_relaxed);
+
+        pf->holding = false;
+        pf->buffered_rows.fetch_sub(pf->slots[head % TDENGINE_PREFETCH_SLOTS].rows, std::memory_order_acq_rel);
+        pf->head.store(++head, std::memory_order_release);
+        /* 扫描持续消费数据时逐步加深预读 */
+        if (depth < TDENGINE_PREFETCH_SLOTS)
+            pf->depth.store(Min(depth * 2, (uint32_t) TDENGINE_PREFETCH_SLOTS), std::memory_order_release);
+        tdengine_prefetch_notify(pf);
+    }
+
+    while (pf->tail.load(std::memory_order_acquire) == head)
+    {
+        TDengineWaitStatus status = tdengine_wait_readable(pf->pipefd[0], cursor->deadline);
+        char buf[16];
+
+        if (status != TDENGINE_WAIT_READY)
+        {
+            *error = tdengine_wait_error(status);
+            cursor->eof = true;
+            return false;
+        }
+        while (read(pf->pipefd[0], buf, sizeof(buf)) > 0)
+            ;
+    }
+
+    slot = &pf->slots[head % TDENGINE_PREFETCH_SLOTS];
+    pf->holding = true;
+
+    if (slot->error != NULL)
+    {
+        *error = pstrdup(slot->error);
+        cursor->eof = true;
+        return false;
+    }
+    if (slot->rows == 0)
+    {
+        cursor->eof = true;
+        return true;
+    }
+
+    block->nrow = slot->rows;
+    block->cols = slot->cols;
+    return true;
+}
+
+/*
+ * tdengine_pending_query_discard
+ *      释放异步查询的结果、连接和通知管道
+ */
+static void
+tdengine_pending_query_discard(TDenginePendingQuery *pq)
+{
+    /* 预编译语句的结果随语句一起释放 */
+    if (pq->stmt != NULL)
+    {
+        if (pq->own_stmt)
+            ws_stmt2_close(pq->stmt);
+    }
+    else if (pq->res != NULL)
+        ws_free_result(pq->res);
+    if (pq->taos != NULL)
+        ws_close(pq->taos);
+    if (pq->pipefd[0] >= 0)
+        close(pq->pipefd[0]);
+    if (pq->pipefd[1] >= 0)
+        close(pq->pipefd[1]);
+    delete pq;
+}
+
+/*
+ * tdengine_pending_query_exec_stmt
+ *      绑定参数并执行预编译语句
+ */
+static void
+tdengine_pending_query_exec_stmt(TDenginePendingQuery *pq)
+{
+    WS_STMT2_BIND *cols = pq->binds.cols.data();
+    WS_STMT2_BINDV bindv = {};
+    int affected = 0;
+
+    bindv.count = 1;
+    bindv.bind_cols = &cols;
+
+    if (ws_stmt2_bind_param(pq->stmt, &bindv, -1) != 0 ||
+        ws_stmt2_exec(pq->stmt, &affected) != 0)
+    {
+        const char *err = ws_stmt2_error(pq->stmt);
+
+        try
+        {
+            pq->error = err != NULL ? err : "unknown error";
+        }
+        catch (...)
+        {
+        }
+        return;
+    }
+    pq->res = ws_stmt2_result(pq->stmt);
+}
+
+/*
+ * tdengine_pending_query_run
+ *      执行异步查询的远程调用(建立连接、执行预编译语句或普通查询)
+ */
+static void
+tdengine_pending_query_run(TDenginePendingQuery *pq)
+{
+    if (pq->conn == NULL)
+    {
+        pq->taos = ws_connect(pq->dsn.c_str());
+        if (pq->taos == NULL)
+        {
+            const char *err = ws_errstr(NULL);
+
+            try
+            {
+                pq->error = err != NULL ? err : "unknown error";
+            }
+            catch (...)
+            {
+            }
+        }
+    }
+    else if (pq->stmt != NULL)
+        tdengine_pending_query_exec_stmt(pq);
+    else if (pq->sml_precision >= 0)
+    {
+        int32_t total = 0;
+
+        pq->res = ws_schemaless_insert_raw(pq->conn, (char *) pq->sql.data(), (int) pq->sql.size(), &total,
+                                           WS_TSDB_SML_LINE_PROTOCOL, pq->sml_precision);
+    }
+    else
+        pq->res = ws_query(pq->conn, pq->sql.c_str());
+}
+
+/*
+ * tdengine_pending_query_worker
+ *      异步查询线程: 执行查询并通过管道通知后端
+ */
+static void
+tdengine_pending_query_worker(TDenginePendingQuery *pq)
+{
+    std::shared_ptr<std::atomic<bool>> returned = pq->returned;
+    char byte = 1;
+
+    tdengine_pending_query_run(pq);
+    pq->done.store(true, std::memory_order_release);
+    while (write(pq->pipefd[1], &byte, 1) < 0 && errno == EINTR)
+        ;
+
+    /* 后端已放弃等待，由本线程释放结果和预编译语句 */
+    if (pq->released.exchange(true))
+        tdengine_pending_query_discard(pq);
+
+    /* 此后本线程不再使用连接，移出缓存的连接可以关闭 */
+    if (returned)
+        returned->store(true, std::memory_order_release);
+}
+
+/*
+ * tdengine_pending_query_join
+ *      等待异步查询线程退出
+ */
+static void
+tdengine_pending_query_join(TDenginePendingQuery *pq)
+{
+    try
+    {
+        if (pq->worker.joinable())
+            pq->worker.join();
+    }
+    catch (...)
+    {
+        /* 内存上下文回调中不能抛出异常 */
+    }
+}
+
+/*
+ * tdengine_pending_query_finish
+ *      等待异步查询线程退出，释放通知管道并返回查询结果
+ *
+ * 预编译语句执行失败时没有结果，返回NULL并通过error返回错误信息。
+ */
+static WS_RES *
+tdengine_pending_query_finish(TDenginePendingQuery *pq, char **error)
+{
+    WS_RES *res;
+
+    tdengine_pending_query_join(pq);
+    res = pq->res;
+    pq->res = NULL;
+    if (res == NULL && error != NULL)
+        *error = pstrdup(pq->error.empty() ? "unknown error" : pq->error.c_str());
+    tdengine_pending_query_discard(pq);
+
+    return res;
+}
+
+/*
+ * tdengine_pending_query_wait
+ *      在锁存器上等待异步查询返回
+ */
+static TDengineWaitStatus
+tdengine_pending_query_wait(TDenginePendingQuery *pq, int64_t deadline)
+{
+    if (pq->done.load(std::memory_order_acquire))
+        return TDENGINE_WAIT_READY;
+    return tdengine_wait_readable(pq->pipefd[0], deadline);
+}
+
+/*
+ * tdengine_kill_worker
+ *      在新连接上终止放弃的查询，由分离的后台线程执行
+ *
+ * 只在performance_schema.perf_queries中查找放弃的连接(conn_id)上正在执行的查询，
+ * 逐个执行KILL QUERY，不影响其他会话。与其他后台线程一样不调用任何
+ * PostgreSQL函数，失败时不做处理。
+ */
+static void
+tdengine_kill_worker(std::string dsn, int64 conn_id)
+{
+    WS_TAOS *taos = ws_connect(dsn.c_str());
+    std::vector<std::string> ids;
+    WS_RES *res;
+
+    if (taos == NULL)
+        return;
+
+    try
+    {
+        std::string list("SELECT kill_id FROM performance_schema.perf_queries WHERE conn_id = ");
+
+        list += std::to_string(conn_id);
+        res = ws_query(taos, list.c_str());
+        if (ws_errno(res) == 0)
+        {
+            const void *data = NULL;
+            int32_t rows = 0;
+
+            while (ws_fetch_raw_block(res, &data, &rows) == 0 && rows > 0)
+            {
+                for (int32_t r = 0; r < rows; r++)
+                {
+                    uint8_t type;
+                    uint32_t len;
+                    const char *id = (const char *) ws_get_value_in_block(res, r, 0, &type, &len);
+
+                    if (id != NULL && len > 0)
+                        ids.push_back(std::string(id, len));
+                }
+            }
+        }
+        ws_free_result(res);
+
+        for (const std::string &id : ids)
+        {
+            std::string kill = "KILL QUERY " + tdengine_quote_literal(id.c_str());
+
+            ws_free_result(ws_query(taos, kill.c_str()));
+        }
+    }
+    catch (...)
+    {
+    }
+
+    ws_close(taos);
+}
+
+/*
+ * tdengine_pending_query_abandon
+ *      放弃尚未返回的异步查询，不等待后台线程
+ *
+ * 线程已结束时在此释放；否则分离线程，由其在远程调用返回后自行释放。
+ * 仍在执行的查询所用的连接移出缓存，不再借给其他查询，线程返回后才关闭。
+ * 知道该连接的服务端ID时，再由另一个分离的线程另建连接，只终止该连接上的
+ * 查询，使线程尽快返回；不知道时不在服务端终止任何查询。
+ */
+static void
+tdengine_pending_query_abandon(TDenginePendingQuery *pq)
+{
+    /* 线程已返回时只差退出，等待它结束后在此释放 */
+    if (pq->done.load(std::memory_order_acquire))
+    {
+        tdengine_pending_query_join(pq);
+        tdengine_pending_query_discard(pq);
+        return;
+    }
+
+    if (pq->conn != NULL)
+    {
+        tdengine_retire_connection(pq->conn, pq->returned);
+        if (!pq->dsn.empty() && pq->conn_id != 0)
+        {
+            try
+            {
+                std::thread killer = tdengine_spawn_thread(tdengine_kill_worker, pq->dsn, pq->conn_id);
+
+                killer.detach();
+            }
+            catch (...)
+            {
+                /* 无法终止时只能等查询自行结束 */
+            }
+        }
+    }
+
+    /* 先分离线程，released交换之后本结构可能随时被线程释放 */
+    try
+    {
+        if (pq->worker.joinable())
+            pq->worker.detach();
+    }
+    catch (...)
+    {
+    }
+
+    if (pq->released.exchange(true))
+        tdengine_pending_query_discard(pq);
+}
+
+/*
+ * tdengine_stmt_close
+ *      关闭预编译语句并释放缓存项
+ */
+static void
+tdengine_stmt_close(TDenginePreparedStmt *ps)
+{
+    if (ps->stmt != NULL)
+        ws_stmt2_close(ps->stmt);
+    delete ps;
+}
+
+/*
+ * tdengine_stmt_unlink
+ *      把缓存项从所属连接的缓存中移除，不关闭语句
+ */
+static void
+tdengine_stmt_unlink(TDenginePreparedStmt *ps)
+{
+    auto conn_it = tdengine_stmt_cache.find(ps->conn);
+
+    if (conn_it == tdengine_stmt_cache.end())
+        return;
+    conn_it->second.erase(ps->query);
+    if (conn_it->second.empty())
+        tdengine_stmt_cache.erase(conn_it);
+}
+
+/*
+ * tdengine_conn_precision
+ *      查询连接所用数据库的时间精度(0毫秒/1微秒/2纳秒)，失败时返回-1
+ *
+ * 每个连接只查询一次。与准备语句一样在后端中直接执行。
+ */
+static int
+tdengine_conn_precision(WS_TAOS *conn)
+{
+    auto it = tdengine_precision_cache.find(conn);
+    int precision = -1;
+    WS_RES *res;
+
+    if (it != tdengine_precision_cache.end())
+        return it->second;
+
+    res = ws_query(conn, "SELECT `precision` FROM information_schema.ins_databases WHERE name = DATABASE()");
+    if (ws_errno(res) == 0)
+    {
+        const void *data = NULL;
+        int32_t rows = 0;
+
+        if (ws_fetch_raw_block(res, &data, &rows) == 0 && rows > 0 && !ws_is_null(res, 0, 0))
+        {
+            uint8_t type = 0;
+            uint32_t len = 0;
+            const char *val = (const char *) ws_get_value_in_block(res, 0, 0, &type, &len);
+
+            if (val != NULL && len == 2)
+            {
+                if (strncmp(val, "ms", 2) == 0)
+                    precision = 0;
+                else if (strncmp(val, "us", 2) == 0)
+                    precision = 1;
+                else if (strncmp(val, "ns", 2) == 0)
+                    precision = 2;
+            }
+        }
+    }
+    ws_free_result(res);
+
+    try
+    {
+        tdengine_precision_cache[conn] = precision;
+    }
+    catch (...)
+    {
+        /* 下次再查询 */
+    }
+    return precision;
+}
+
+/*
+ * tdengine_stmt_lookup
+ *      取得参数化查询在连接上的预编译语句，首次使用时准备
+ *
+ * 只有带参数的SELECT使用预编译语句。语句正被另一个游标读取、服务端
+ * 不能准备该语句或出现任何异常时返回NULL，由调用方把参数直接拼入查询。
+ */
+static TDenginePreparedStmt *
+tdengine_stmt_lookup(WS_TAOS *conn, const char *query, int param_num)
+{
+    const char *p = query;
+    TDenginePreparedStmt *ps = NULL;
+    WS_STMT2_OPTION option = {};
+    std::string sql;
+
+    if (param_num <= 0)
+        return NULL;
+    while (isspace((unsigned char) *p))
+        p++;
+    if (strncasecmp(p, "SELECT", 6) != 0)
+        return NULL;
+
+    try
+    {
+        TDengineStmtMap &stmts = tdengine_stmt_cache[conn];
+        auto it = stmts.find(query);
+
+        if (it != stmts.end())
+        {
+            ps = it->second;
+            if (ps->stmt == NULL || ps->busy)
+                return NULL;
+            return ps;
+        }
+
+        ps = new TDenginePreparedStmt();
+        ps->conn = conn;
+        ps->query = query;
+        sql = tdengine_rewrite_params(query, param_num, [ps](std::string &out, int i) {
+            out.push_back('?');
+            ps->order.push_back(i);
+        });
+        ps->sql = sql;
+        stmts[ps->query] = ps;
+    }
+    catch (...)
+    {
+        delete ps;
+        return NULL;
+    }
+
+    /* 准备失败的语句也留在缓存中，之后的执行不再尝试准备 */
+    ps->stmt = ws_stmt2_init(conn, &option);
+    if (ps->stmt != NULL && ws_stmt2_prepare(ps->stmt, sql.c_str(), (int) sql.size()) != 0)
+    {
+        elog(DEBUG1, "tdengine_fdw : could not prepare statement, binding parameters as literals: %s",
+             ws_stmt2_error(ps->stmt));
+        ws_stmt2_close(ps->stmt);
+        ps->stmt = NULL;
+    }
+    if (ps->stmt != NULL)
+        ps->precision = tdengine_conn_precision(conn);
+
+    return ps->stmt != NULL ? ps : NULL;
+}
+
+/*
+ * tdengine_stmt_fill_binds
+ *      按"?"的出现顺序把参数值复制到绑定数组中
+ *
+ * 时间参数换算为数据库精度后以TIMESTAMP类型绑定，不经过文本转换；
+ * 数据库精度未知(precision为-1)时退回以RFC3339文本绑定，由服务端转换。
+ */
+static void
+tdengine_stmt_fill_binds(TDengineStmtBinds &b, const std::vector<int> &order, int precision,
+                         TDengineType *types, TDengineValue *values)
+{
+    size_t n = order.size();
+
+    /* 先定长分配，绑定项中的指针在此之后不再失效 */
+    b.cols.assign(n, WS_STMT2_BIND());
+    b.ints.assign(n, 0);
+    b.doubles.assign(n, 0);
+    b.bools.assign(n, 0);
+    b.strs.assign(n, std::string());
+    b.lengths.assign(n, 0);
+    b.nulls.assign(n, 0);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        WS_STMT2_BIND *col = &b.cols[i];
+        int idx = order[i];
+
+        col->num = 1;
+        col->is_null = &b.nulls[i];
+        col->length = &b.lengths[i];
+
+        switch (types[idx])
+        {
+            case TDENGINE_INT64:
+                b.ints[i] = values[idx].i;
+                b.lengths[i] = sizeof(int64_t);
+                col->buffer_type = TSDB_DATA_TYPE_BIGINT;
+                col->buffer = &b.ints[i];
+                break;
+            case TDENGINE_DOUBLE:
+                b.doubles[i] = values[idx].d;
+                b.lengths[i] = sizeof(double);
+                col->buffer_type = TSDB_DATA_TYPE_DOUBLE;
+                col->buffer = &b.doubles[i];
+                break;
+            case TDENGINE_BOOLEAN:
+                b.bools[i] = values[idx].b ? 1 : 0;
+                b.lengths[i] = sizeof(int8_t);
+                col->buffer_type = TSDB_DATA_TYPE_BOOL;
+                col->buffer = &b.bools[i];
+                break;
+            case TDENGINE_TIME:
+                if (precision >= 0)
+                {
+                    b.ints[i] = tdengine_insert_time_value(values[idx].i, precision);
+                    b.lengths[i] = sizeof(int64_t);
+                    col->buffer_type = TSDB_DATA_TYPE_TIMESTAMP;
+                    col->buffer = &b.ints[i];
+                    break;
+                }
+                /* FALLTHROUGH */
+            case TDENGINE_STRING:
+                if (types[idx] == TDENGINE_STRING)
+                    b.strs[i] = values[idx].s;
+                else
+                {
+                    /* 去掉常量形式的引号 */
+                    std::string lit = tdengine_format_param_time(values[idx].i);
+
+                    b.strs[i] = lit.substr(1, lit.size() - 2);
+                }
+                b.lengths[i] = (int32_t) b.strs[i].size();
+                col->buffer_type = TSDB_DATA_TYPE_BINARY;
+                col->buffer = (void *) b.strs[i].data();
+                break;
+            case TDENGINE_NULL:
+                b.nulls[i] = 1;
+                col->buffer_type = TSDB_DATA_TYPE_NULL;
+                break;
+        }
+    }
+}
+
+/*
+ * tdengine_stmt_cache_forget
+ *      关闭连接之前释放该连接上的所有预编译语句
+ */
+void
+tdengine_stmt_cache_forget(WS_TAOS *conn)
+{
+    auto conn_it = tdengine_stmt_cache.find(conn);
+
+    tdengine_precision_cache.erase(conn);
+    if (conn_it == tdengine_stmt_cache.end())
+        return;
+    for (auto &entry : conn_it->second)
+        tdengine_stmt_close(entry.second);
+    tdengine_stmt_cache.erase(conn_it);
+}
+
+/*
+ * tdengine_cursor_release_stmt
+ *      游标不再读取预编译语句的结果，语句可以再次执行
+ *
+ * 执行或读取出错的语句状态不明，从缓存中移除并关闭。
+ */
+static void
+tdengine_cursor_release_stmt(TDengineCursor *cursor)
+{
+    TDenginePreparedStmt *ps = cursor->prepared;
+
+    cursor->prepared = NULL;
+    ps->busy = false;
+    if (cursor->failed)
+    {
+        tdengine_stmt_unlink(ps);
+        tdengine_stmt_close(ps);
+    }
+}
+
+/*
+ * tdengine_cursor_abandon_pending
+ *      放弃游标尚未返回的异步查询
+ *
+ * 后台线程可能仍在执行预编译语句，语句移出缓存，改由后到的一方关闭。
+ */
+static void
+tdengine_cursor_abandon_pending(TDengineCursor *cursor)
+{
+    TDenginePendingQuery *pq = cursor->pending;
+
+    cursor->pending = NULL;
+    if (cursor->prepared != NULL)
+    {
+        tdengine_stmt_unlink(cursor->prepared);
+        pq->own_stmt = true;
+        delete cursor->prepared;
+        cursor->prepared = NULL;
+    }
+    tdengine_pending_query_abandon(pq);
+}
+
+/*
+ * tdengine_cursor_attach_result
+ *      将查询结果交给游标，并读取结果列的元数据
+ *
+ * 查询失败时释放结果并返回错误信息。
+ */
+static char *
+tdengine_cursor_attach_result(TDengineCursor *cursor, WS_RES *res)
+{
+    const WS_FIELD *fields;
+
+    if (ws_errno(res) != 0)
+    {
+        char *err = pstrdup(ws_errstr(res));
+
+        if (cursor->prepared == NULL)
+            ws_free_result(res);
+        cursor->failed = true;
+        return err;
+    }
+
+    cursor->res = res;
+    cursor->ncol = ws_field_count(res);
+    cursor->precision = ws_result_precision(res);
+    cursor->columns = (char **) palloc0(sizeof(char *) * (cursor->ncol > 0 ? cursor->ncol : 1));
+    fields = ws_fetch_fields(res);
+    for (int i = 0; i < cursor->ncol; i++)
+        cursor->columns[i] = pstrdup(fields[i].name);
+
+    return NULL;
+}
+
+/*
+ * tdengine_cursor_reset_callback
+ *      游标所在内存上下文被重置或删除时释放远程结果集
+ */
+static void
+tdengine_cursor_reset_callback(void *arg)
+{
+    TDengineCursor *cursor = (TDengineCursor *) arg;
+
+    /* 异步查询尚未取回时不再等待，由后台线程在查询返回后释放结果 */
+    if (cursor->pending != NULL)
+        tdengine_cursor_abandon_pending(cursor);
+
+    /* 后台线程可能仍在使用WS_RES，必须先等待其退出 */
+    if (cursor->prefetch != NULL)
+    {
+        tdengine_prefetch_stop(cursor->prefetch);
+        cursor->prefetch = NULL;
+    }
+
+    /*
+     * 扫描提前结束(如本地LIMIT已满足)时结果尚未读完，先停止远程查询，
+     * 不再把剩余数据块拉到客户端
+     */
+    if (cursor->res != NULL)
+    {
+        if (!cursor->eof)
+            ws_stop_query(cursor->res);
+        /* 预编译语句的结果归语句所有，下次执行时替换 */
+        if (cursor->prepared == NULL)
+            ws_free_result(cursor->res);
+        cursor->res = NULL;
+    }
+
+    if (cursor->prepared != NULL)
+        tdengine_cursor_release_stmt(cursor);
+
+    if (cursor->lease_slot > 0)
+    {
+        tdengine_release_connection(cursor->lease_umid, cursor->lease_slot);
+        cursor->lease_slot = 0;
+    }
+}
+
+/*
+ * tdengine_cursor_open_direct
+ *      在后端线程中直接提交查询，仅在无法创建后台线程时使用
+ */
+static TDengineCursorOpen_return
+tdengine_cursor_open_direct(WS_TAOS *conn, const std::string &sql, int64_t deadline)
+{
+    TDengineCursorOpen_return ret = {NULL, NULL};
+    WS_RES *res;
+    TDengineCursor *cursor;
+
+    res = ws_query(conn, sql.c_str());
+    if (ws_errno(res) != 0)
+    {
+        ret.r1 = pstrdup(ws_errstr(res));
+        ws_free_result(res);
+        return ret;
+    }
+
+    cursor = (TDengineCursor *) palloc0(sizeof(TDengineCursor));
+    cursor->deadline = deadline;
+    cursor->cb.func = tdengine_cursor_reset_callback;
+    cursor->cb.arg = cursor;
+    MemoryContextRegisterResetCallback(CurrentMemoryContext, &cursor->cb);
+
+    (void) tdengine_cursor_attach_result(cursor, res);
+
+    ret.r0 = cursor;
+    return ret;
+}
+
+/*
+ * tdengine_pending_query_set_target
+ *      记录放弃查询时终止它所需的连接字符串和连接的服务端ID，须先设置pq->conn
+ */
+static void
+tdengine_pending_query_set_target(TDenginePendingQuery *pq, tdengine_opt *opts)
+{
+    pq->dsn = tdengine_connection_dsn(opts);
+    pq->conn_id = tdengine_connection_id(pq->conn);
+    pq->returned = std::make_shared<std::atomic<bool>>(false);
+}
+
+/*
+ * tdengine_cursor_open_async
+ *      在指定连接上由后台线程提交查询，无法创建线程时退化为同步提交
+ */
+static TDengineCursorOpen_return
+tdengine_cursor_open_async(WS_TAOS *conn, tdengine_opt *opts, const std::string &sql, int64_t deadline)
+{
+    TDengineCursorOpen_return ret = {NULL, NULL};
+    TDenginePendingQuery *pq = NULL;
+    TDengineCursor *cursor;
+
+    try
+    {
+        pq = new TDenginePendingQuery();
+        pq->conn = conn;
+        pq->sql = sql;
+        tdengine_pending_query_set_target(pq, opts);
+        if (pipe(pq->pipefd) != 0)
+            throw std::runtime_error("could not create pipe");
+        (void) fcntl(pq->pipefd[0], F_SETFL, O_NONBLOCK);
+        (void) fcntl(pq->pipefd[0], F_SETFD, FD_CLOEXEC);
+        (void) fcntl(pq->pipefd[1], F_SETFD, FD_CLOEXEC);
+        pq->worker = tdengine_spawn_thread(tdengine_pending_query_worker, pq);
+    }
+    catch (...)
+    {
+        if (pq != NULL)
+            (void) tdengine_pending_query_finish(pq, NULL);
+        return tdengine_cursor_open_direct(conn, sql, deadline);
+    }
+
+    cursor = (TDengineCursor *) palloc0(sizeof(TDengineCursor));
+    cursor->pending = pq;
+    cursor->deadline = deadline;
+    cursor->cb.func = tdengine_cursor_reset_callback;
+    cursor->cb.arg = cursor;
+    MemoryContextRegisterResetCallback(CurrentMemoryContext, &cursor->cb);
+
+    ret.r0 = cursor;
+    return ret;
+}
+
+/*
+ * tdengine_cursor_open_prepared
+ *      由后台线程绑定参数并执行预编译语句，立即返回尚未就绪的游标
+ *
+ * 无法创建线程时在后端中直接执行。
+ */
+static TDengineCursorOpen_return
+tdengine_cursor_open_prepared(TDenginePreparedStmt *ps, tdengine_opt *opts, TDengineType *types,
+                              TDengineValue *values, int64_t deadline)
+{
+    TDengineCursorOpen_return ret = {NULL, NULL};
+    TDenginePendingQuery *pq = NULL;
+    TDengineCursor *cursor;
+    bool bound = false;
+    bool spawned = false;
+
+    try
+    {
+        pq = new TDenginePendingQuery();
+        pq->conn = ps->conn;
+        pq->stmt = ps->stmt;
+        pq->sql = ps->sql;
+        tdengine_pending_query_set_target(pq, opts);
+        tdengine_stmt_fill_binds(pq->binds, ps->order, ps->precision, types, values);
+        bound = true;
+        if (pipe(pq->pipefd) != 0)
+            throw std::runtime_error("could not create pipe");
+        (void) fcntl(pq->pipefd[0], F_SETFL, O_NONBLOCK);
+        (void) fcntl(pq->pipefd[0], F_SETFD, FD_CLOEXEC);
+        (void) fcntl(pq->pipefd[1], F_SETFD, FD_CLOEXEC);
+        pq->worker = tdengine_spawn_thread(tdengine_pending_query_worker, pq);
+        spawned = true;
+    }
+    catch (...)
+    {
+        /* 参数已绑定时在后端中直接执行，否则报告内存不足 */
+        if (!bound)
+        {
+            if (pq != NULL)
+                tdengine_pending_query_discard(pq);
+            ret.r1 = pstrdup("out of memory while binding query parameters");
+            return ret;
+        }
+    }
+
+    cursor = (TDengineCursor *) palloc0(sizeof(TDengineCursor));
+    cursor->deadline = deadline;
+    cursor->prepared = ps;
+    ps->busy = true;
+    cursor->cb.func = tdengine_cursor_reset_callback;
+    cursor->cb.arg = cursor;
+    MemoryContextRegisterResetCallback(CurrentMemoryContext, &cursor->cb);
+
+    if (spawned)
+        cursor->pending = pq;
+    else
+    {
+        WS_RES *res;
+
+        tdengine_pending_query_run(pq);
+        res = tdengine_pending_query_finish(pq, &ret.r1);
+        if (res == NULL)
+            cursor->failed = true;
+        else
+            ret.r1 = tdengine_cursor_attach_result(cursor, res);
+        if (ret.r1 != NULL)
+        {
+            TDengineCursorClose(cursor);
+            return ret;
+        }
+    }
+
+    ret.r0 = cursor;
+    return ret;
+}
+
+/*
+ * tdengine_cursor_submit
+ *      提交查询，立即返回可能尚未就绪的游标
+ *
+ * 带参数的SELECT执行连接上缓存的预编译语句，只传输参数值；
+ * 其余语句把参数格式化为常量写入查询文本。
+ */
+static TDengineCursorOpen_return
+tdengine_cursor_submit(WS_TAOS *conn, tdengine_opt *opts, const char *query, TDengineType *types,
+                       TDengineValue *values, int param_num, int64_t deadline)
+{
+    TDenginePreparedStmt *ps = tdengine_stmt_lookup(conn, query, param_num);
+
+    if (ps != NULL)
+        return tdengine_cursor_open_prepared(ps, opts, types, values, deadline);
+    return tdengine_cursor_open_async(conn, opts, bindParameter(query, types, values, param_num), deadline);
+}
+
+/*
+ * tdengine_cursor_open
+ *      在指定连接上提交查询并等待其返回
+ *
+ * 查询由后台线程提交，后端在锁存器上等待，期间可以响应取消请求和query_timeout。
+ */
+static TDengineCursorOpen_return
+tdengine_cursor_open(WS_TAOS *conn, tdengine_opt *opts, const char *query, TDengineType *types,
+                     TDengineValue *values, int param_num, int64_t deadline)
+{
+    TDengineCursorOpen_return ret = tdengine_cursor_submit(conn, opts, query, types, values, param_num, deadline);
+
+    if (ret.r0 != NULL && ret.r0->pending != NULL)
+    {
+        char *err = TDengineCursorWait(ret.r0);
+
+        if (err != NULL)
+        {
+            TDengineCursorClose(ret.r0);
+            ret.r0 = NULL;
+            ret.r1 = err;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * TDengineCursorOpen
+ *      提交查询并打开流式游标
+ *
+ * 只获取结果列的元数据，不拉取任何数据行。游标及列名在当前内存上下文中分配。
+ */
+extern "C" struct TDengineCursorOpen_return
+TDengineCursorOpen(char *cquery, UserMapping *user, tdengine_opt *opts, TDengineType *ctypes, TDengineValue *cvalues, int cparamNum)
+{
+    WS_TAOS *conn = tdengine_get_connection(user, opts);
+
+    return tdengine_cursor_open(conn, opts, cquery, ctypes, cvalues, cparamNum,
+                                tdengine_deadline(opts->query_timeout));
+}
+
+/*
+ * TDengineCursorOpenAsync
+ *      在后台线程中提交查询，立即返回尚未就绪的游标
+ *
+ * 查询完成后TDengineCursorEventFd返回的描述符变为可读。游标就绪之前
+ * 调用TDengineCursorWait取回结果；无法创建线程时退化为同步提交。
+ *
+ * 查询在借来的独占连接上执行，后台线程的ws_query不会与默认连接上
+ * 其他扫描的远程调用交错；游标关闭时归还连接。
+ */
+extern "C" struct TDengineCursorOpen_return
+TDengineCursorOpenAsync(char *cquery, UserMapping *user, tdengine_opt *opts, TDengineType *ctypes, TDengineValue *cvalues, int cparamNum)
+{
+    TDengineCursorOpen_return ret;
+    int slot;
+    WS_TAOS *conn = tdengine_acquire_connection(user, opts, &slot);
+
+    ret = tdengine_cursor_submit(conn, opts, cquery, ctypes, cvalues, cparamNum,
+                                 tdengine_deadline(opts->query_timeout));
+    if (ret.r0 != NULL)
+    {
+        ret.r0->lease_umid = user->umid;
+        ret.r0->lease_slot = slot;
+    }
+    else
+        tdengine_release_connection(user->umid, slot);
+
+    return ret;
+}
+
+/*
+ * TDengineCursorReady
+ *      游标的查询是否已返回(同步打开的游标总是就绪)
+ */
+extern "C" bool
+TDengineCursorReady(TDengineCursor *cursor)
+{
+    return cursor->pending == NULL ||
+           cursor->pending->done.load(std::memory_order_acquire);
+}
+
+/*
+ * TDengineCursorEventFd
+ *      返回异步查询完成时变为可读的文件描述符，游标已取回结果时返回-1
+ */
+extern "C" int
+TDengineCursorEventFd(TDengineCursor *cursor)
+{
+    return cursor->pending != NULL ? cursor->pending->pipefd[0] : -1;
+}
+
+/*
+ * TDengineCursorWait
+ *      等待异步查询返回并取回结果，查询失败时返回错误信息
+ *
+ * 在锁存器上等待，收到取消请求或超过query_timeout时放弃查询并返回错误信息。
+ * 列名在游标所在的内存上下文中分配。
+ */
+extern "C" char *
+TDengineCursorWait(TDengineCursor *cursor)
+{
+    MemoryContext oldcontext;
+    TDengineWaitStatus status;
+    WS_RES *res;
+    char *err = NULL;
+
+    if (cursor->pending == NULL)
+        return NULL;
+
+    status = tdengine_pending_query_wait(cursor->pending, cursor->deadline);
+    if (status != TDENGINE_WAIT_READY)
+    {
+        tdengine_cursor_abandon_pending(cursor);
+        cursor->eof = true;
+        return tdengine_wait_error(status);
+    }
+
+    oldcontext = MemoryContextSwitchTo(GetMemoryChunkContext(cursor));
+    res = tdengine_pending_query_finish(cursor->pending, &err);
+    cursor->pending = NULL;
+    if (res == NULL)
+        cursor->failed = true;
+    else
+        err = tdengine_cursor_attach_result(cursor, res);
+    MemoryContextSwitchTo(oldcontext);
+
+    if (err != NULL)
+        cursor->eof = true;
+    return err;
+}
+
+/*
+ * TDengineCursorFetch
+ *      从游标中拉取至多max_rows行
+ *
+ * 当前数据块读完后才向服务端请求下一个数据块，结果在当前内存上下文中分配。
+ * 返回的结果集行数为0表示远程结果已读完。
+ */
+extern "C" struct TDengineQuery_return
+TDengineCursorFetch(TDengineCursor *cursor, int max_rows)
+{
+    TDengineQuery_return ret = {NULL, NULL};
+    TDengineResult *result = (TDengineResult *) palloc0(sizeof(TDengineResult));
+
+    result->ncol = cursor->ncol;
+    result->columns = cursor->columns;
+    result->rows = (TDengineRow *) palloc(sizeof(TDengineRow) * max_rows);
+
+    while (result->nrow < max_rows && !cursor->eof)
+    {
+        TDengineRow *row;
+
+        if (cursor->block_pos >= cursor->block_rows)
+        {
+            const void *data = NULL;
+            int32_t rows = 0;
+
+            if (!tdengine_guarded_fetch(cursor, &data, &rows, &ret.r1))
+                return ret;
+            if (rows == 0)
+            {
+                cursor->eof = true;
+                break;
+            }
+            cursor->block_rows = rows;
+            cursor->block_pos = 0;
+        }
+
+        row = &result->rows[result->nrow++];
+        row->tuple = (char **) palloc(sizeof(char *) * (cursor->ncol > 0 ? cursor->ncol : 1));
+        for (int i = 0; i < cursor->ncol; i++)
+            row->tuple[i] = tdengine_cursor_value(cursor, cursor->block_pos, i);
+        cursor->block_pos++;
+    }
+
+    ret.r0 = result;
+    return ret;
+}
+
+/*
+ * TDengineCursorFetchBlock
+ *      从游标拉取下一个数据块，以列格式返回
+ *
+ * 返回的TDengineBlock描述结构在当前内存上下文中分配，其中的列缓冲区
+ * 直接指向客户端库持有的原始数据块，在下一次拉取或关闭游标之前有效。
+ * 行数为0表示远程结果已读完。
+ */
+extern "C" struct TDengineBlock_return
+TDengineCursorFetchBlock(TDengineCursor *cursor)
+{
+    TDengineBlock_return ret = {NULL, NULL};
+    TDengineBlock *block = (TDengineBlock *) palloc0(sizeof(TDengineBlock));
+    const void *data = NULL;
+    int32_t rows = 0;
+
+    /* 异步提交的查询先取回结果 */
+    if (cursor->pending != NULL)
+    {
+        char *err = TDengineCursorWait(cursor);
+
+        if (err != NULL)
+        {
+            ret.r1 = err;
+            return ret;
+        }
+    }
+
+    block->ncol = cursor->ncol;
+    block->columns = cursor->columns;
+    block->precision = cursor->precision;
+    ret.r0 = block;
+
+    if (cursor->eof)
+        return ret;
+
+    /* 第一个数据块已同步返回，扫描还要继续时才启动预取 */
+    if (cursor->want_prefetch && cursor->nblocks > 0)
+        tdengine_prefetch_launch(cursor);
+
+    if (cursor->prefetch != NULL)
+    {
+        if (!tdengine_prefetch_next(cursor, block, &ret.r1))
+            ret.r0 = NULL;
+        return ret;
+    }
+
+    if (!tdengine_guarded_fetch(cursor, &data, &rows, &ret.r1))
+    {
+        ret.r0 = NULL;
+        return ret;
+    }
+    if (rows == 0 || data == NULL)
+    {
+        cursor->eof = true;
+        return ret;
+    }
+
+    block->nrow = rows;
+    block->cols = (TDengineColumn *) palloc0(sizeof(TDengineColumn) * (cursor->ncol > 0 ? cursor->ncol : 1));
+    if (!tdengine_decode_raw_block(cursor, (const char *) data, rows, block))
+    {
+        const WS_FIELD *fields = ws_fetch_fields(cursor->res);
+
+        for (int c = 0; c < cursor->ncol; c++)
+        {
+            block->cols[c].type = fields[c].type;
+            block->cols[c].bytes = fields[c].bytes;
+            tdengine_fill_column_values(cursor, &block->cols[c], rows, c);
+        }
+    }
+
+    /* 数据块整体交给调用方，逐行拉取的游标位置随之失效 */
+    cursor->block_rows = 0;
+    cursor->block_pos = 0;
+    cursor->nblocks++;
+
+    return ret;
+}
+
+/*
+ * tdengine_cursor_decodable
+ *      结果的所有列是否都能按原始数据块直接解码
+ */
+static bool
+tdengine_cursor_decodable(TDengineCursor *cursor)
+{
+    const WS_FIELD *fields = ws_fetch_fields(cursor->res);
+
+    for (int c = 0; c < cursor->ncol; c++)
+    {
+        if (!tdengine_is_decodable_type(fields[c].type))
+            return false;
+    }
+    return true;
+}
+
+/*
+ * tdengine_prefetch_launch
+ *      第一个数据块同步返回之后创建预取线程
+ *
+ * 线程无法创建时取消预取请求，游标继续同步拉取。
+ */
+static void
+tdengine_prefetch_launch(TDengineCursor *cursor)
+{
+    TDenginePrefetch *pf = NULL;
+
+    cursor->want_prefetch = false;
+    if (cursor->res == NULL || cursor->prefetch != NULL || cursor->eof ||
+        !tdengine_cursor_decodable(cursor))
+        return;
+
+    try
+    {
+        pf = new TDenginePrefetch();
+        pf->res = cursor->res;
+        pf->max_rows = cursor->prefetch_rows;
+        if (pipe(pf->pipefd) != 0)
+            throw std::runtime_error("could not create pipe");
+        /* 写端也不阻塞: 管道已满时读端必然可读，丢弃这次通知即可 */
+        (void) fcntl(pf->pipefd[0], F_SETFL, O_NONBLOCK);
+        (void) fcntl(pf->pipefd[1], F_SETFL, O_NONBLOCK);
+        (void) fcntl(pf->pipefd[0], F_SETFD, FD_CLOEXEC);
+        (void) fcntl(pf->pipefd[1], F_SETFD, FD_CLOEXEC);
+        for (int i = 0; i < TDENGINE_PREFETCH_SLOTS; i++)
+        {
+            pf->slots[i].cols = (TDengineColumn *) calloc(cursor->ncol > 0 ? cursor->ncol : 1, sizeof(TDengineColumn));
+            if (pf->slots[i].cols == NULL)
+                throw std::bad_alloc();
+        }
+        pf->worker = tdengine_spawn_thread(tdengine_prefetch_worker, cursor->res, cursor->ncol, pf);
+    }
+    catch (...)
+    {
+        if (pf != NULL)
+        {
+            for (int i = 0; i < TDENGINE_PREFETCH_SLOTS; i++)
+                free(pf->slots[i].cols);
+            if (pf->pipefd[0] >= 0)
+                close(pf->pipefd[0]);
+            if (pf->pipefd[1] >= 0)
+                close(pf->pipefd[1]);
+            delete pf;
+        }
+        pf = NULL;
+    }
+
+    cursor->prefetch = pf;
+}
+
+/*
+ * TDengineCursorStartPrefetch
+ *      为游标请求后台预取
+ *
+ * 后台线程在后端处理当前数据块时拉取并复制后续数据块，使网络延迟与
+ * 元组处理重叠。第一个数据块总是同步拉取，线程在请求第二个数据块时才启动，
+ * 预读深度随后逐步加深，这样本地LIMIT很快满足的扫描不会多拉数据块。
+ * 预取槽位中缓冲的行数不超过fetch_size(至少一个数据块)，扫描的内存因此有界。
+ * 结果中有需要逐行取值的列(如JSON)时保持同步拉取并返回false。
+ * 请求之后只能使用TDengineCursorFetchBlock。
+ */
+extern "C" bool
+TDengineCursorStartPrefetch(TDengineCursor *cursor, int fetch_size)
+{
+    cursor->prefetch_rows = fetch_size > 0 ? fetch_size : 0;
+
+    /* 异步查询尚未返回时，结果列要等取回结果之后才能检查 */
+    if (cursor->pending != NULL)
+    {
+        cursor->want_prefetch = true;
+        return true;
+    }
+
+    if (cursor->res == NULL || cursor->prefetch != NULL || cursor->eof ||
+        !tdengine_cursor_decodable(cursor))
+        return false;
+
+    cursor->want_prefetch = true;
+    return true;
+}
+
+/*
+ * TDengineCursorClose
+ *      关闭游标并释放远程结果集
+ *
+ * 结果尚未读完时停止远程查询而不是把剩余数据读完，
+ * EndForeignScan和ReScan因此不受远程结果大小影响。
+ */
+extern "C" void
+TDengineCursorClose(TDengineCursor *cursor)
+{
+    if (cursor == NULL)
+        return;
+
+    tdengine_cursor_reset_callback(cursor);
+}
+
+/*
+ * TDengineQuery
+ *      执行单条查询并物化全部结果
+ *
+ * 用于DELETE等结果很小的语句；扫描路径使用流式游标。
+ */
+extern "C" struct TDengineQuery_return
+TDengineQuery(char *cquery, UserMapping *user, tdengine_opt *opts, TDengineType *ctypes, TDengineValue *cvalues, int cparamNum)
+{
+    TDengineQuery_return ret = {NULL, NULL};
+    TDengineCursorOpen_return cur = TDengineCursorOpen(cquery, user, opts, ctypes, cvalues, cparamNum);
+    TDengineResult *result;
+
+    if (cur.r1 != NULL)
+    {
+        ret.r1 = cur.r1;
+        return ret;
+    }
+
+    result = (TDengineResult *) palloc0(sizeof(TDengineResult));
+    result->ncol = cur.r0->ncol;
+    result->columns = cur.r0->columns;
+
+    for (;;)
+    {
+        TDengineQuery_return batch = TDengineCursorFetch(cur.r0, opts->fetch_size > 0 ? opts->fetch_size : TDENGINE_DEFAULT_FETCH_SIZE);
+
+        if (batch.r1 != NULL)
+        {
+            TDengineCursorClose(cur.r0);
+            ret.r1 = batch.r1;
+            return ret;
+        }
+        if (batch.r0->nrow == 0)
+            break;
+
+        if (result->rows == NULL)
+            result->rows = (TDengineRow *) palloc(sizeof(TDengineRow) * batch.r0->nrow);
+        else
+            result->rows = (TDengineRow *) repalloc(result->rows, sizeof(TDengineRow) * (result->nrow + batch.r0->nrow));
+        memcpy(result->rows + result->nrow, batch.r0->rows, sizeof(TDengineRow) * batch.r0->nrow);
+        result->nrow += batch.r0->nrow;
+        pfree(batch.r0->rows);
+        pfree(batch.r0);
+    }
+
+    TDengineCursorClose(cur.r0);
+    ret.r0 = result;
+    return ret;
+}
+
+/*
+ * TDengineQueryTimeBounds
+ *      执行时间范围查询(SELECT FIRST(time), LAST(time) ...)，读取原始时间戳
+ *
+ * 时间戳按数据库精度原样返回，可直接用作查询条件中的整数常量，
+ * precision不为NULL时返回该精度。
+ * 结果为空时*found为false。查询失败时返回错误信息。
+ */
+extern "C" char *
+TDengineQueryTimeBounds(char *cquery, UserMapping *user, tdengine_opt *opts, TDengineType *ctypes, TDengineValue *cvalues, int cparamNum,
+                        int64 *lower, int64 *upper, bool *found, int *precision)
+{
+    TDengineCursorOpen_return cur = TDengineCursorOpen(cquery, user, opts, ctypes, cvalues, cparamNum);
+    TDengineCursor *cursor = cur.r0;
+    const void *data = NULL;
+    int32_t rows = 0;
+    char *err = NULL;
+
+    *found = false;
+
+    if (cur.r1 != NULL)
+        return cur.r1;
+
+    if (tdengine_guarded_fetch(cursor, &data, &rows, &err) &&
+        rows > 0 && cursor->ncol >= 2 &&
+        !ws_is_null(cursor->res, 0, 0) && !ws_is_null(cursor->res, 0, 1))
+    {
+        uint8_t type = 0;
+        uint32_t len = 0;
+        const void *val;
+
+        val = ws_get_value_in_block(cursor->res, 0, 0, &type, &len);
+        memcpy(lower, val, sizeof(int64));
+        val = ws_get_value_in_block(cursor->res, 0, 1, &type, &len);
+        memcpy(upper, val, sizeof(int64));
+        if (precision != NULL)
+            *precision = cursor->precision;
+        *found = true;
+    }
+
+    TDengineCursorClose(cursor);
+    return err;
+}
+
+/*
+ * tdengine_bind_buffer_free
+ *      释放一列的绑定缓冲区
+ */
+static void
+tdengine_bind_buffer_free(TDengineBindBuffer *bb)
+{
+    free(bb->is_null);
+    free(bb->lengths);
+    free(bb->texts);
+    free(bb->data);
+    memset(bb, 0, sizeof(TDengineBindBuffer));
+}
+
+/*
+ * tdengine_insert_flight_discard
+ *      释放一次写入的通知管道，以及转归其所有的语句和绑定缓冲区
+ */
+static void
+tdengine_insert_flight_discard(TDengineInsertFlight *fl)
+{
+    if (fl->own)
+    {
+        if (fl->stmt != NULL)
+            ws_stmt_close(fl->stmt);
+        for (TDengineBindBuffer &bb : fl->owned)
+            tdengine_bind_buffer_free(&bb);
+    }
+    if (fl->pipefd[0] >= 0)
+        close(fl->pipefd[0]);
+    if (fl->pipefd[1] >= 0)
+        close(fl->pipefd[1]);
+    delete fl;
+}
+
+/*
+ * tdengine_insert_flight_run
+ *      依次设置各组的子表和标签、绑定各组数据，最后执行一次
+ */
+static void
+tdengine_insert_flight_run(TDengineInsertFlight *fl)
+{
+    size_t ngroup = fl->col_binds.size() / fl->ncol;
+    const char *err;
+    int affected = 0;
+
+    for (size_t g = 0; g < ngroup && !fl->failed; g++)
+    {
+        if (fl->ntag > 0 &&
+            ws_stmt_set_tbname_tags(fl->stmt, fl->names[g].c_str(), &fl->tag_binds[g * fl->ntag], fl->ntag) != 0)
+            fl->failed = true;
+        else if (ws_stmt_bind_param_batch(fl->stmt, &fl->col_binds[g * fl->ncol], fl->ncol) != 0 ||
+                 ws_stmt_add_batch(fl->stmt) != 0)
+            fl->failed = true;
+    }
+    if (!fl->failed && ws_stmt_execute(fl->stmt, &affected) == 0)
+        return;
+
+    fl->failed = true;
+    err = ws_stmt_errstr(fl->stmt);
+    try
+    {
+        fl->error = err != NULL ? err : "unknown error";
+    }
+    catch (...)
+    {
+    }
+}
+
+/*
+ * tdengine_insert_flight_worker
+ *      写入线程: 执行写入并通过管道通知后端
+ */
+static void
+tdengine_insert_flight_worker(TDengineInsertFlight *fl)
+{
+    std::shared_ptr<std::atomic<bool>> returned = fl->returned;
+    char byte = 1;
+
+    tdengine_insert_flight_run(fl);
+    fl->done.store(true, std::memory_order_release);
+    while (write(fl->pipefd[1], &byte, 1) < 0 && errno == EINTR)
+        ;
+
+    /* 后端已放弃等待，由本线程释放语句和缓冲区 */
+    if (fl->released.exchange(true))
+        tdengine_insert_flight_discard(fl);
+
+    /* 此后本线程不再使用连接，移出缓存的连接可以关闭 */
+    if (returned)
+        returned->store(true, std::memory_order_release);
+}
+
+/*
+ * tdengine_insert_flight_join
+ *      等待写入线程退出
+ */
+static void
+tdengine_insert_flight_join(TDengineInsertFlight *fl)
+{
+    try
+    {
+        if (fl->worker.joinable())
+            fl->worker.join();
+    }
+    catch (...)
+    {
+        /* 内存上下文回调中不能抛出异常 */
+    }
+}
+
+/*
+ * tdengine_insert_abandon
+ *      放弃进行中的写入，不等待后台线程
+ *
+ * 线程仍在使用语句和这组绑定缓冲区，二者转归写入所有，插入语句随之不可再用。
+ * 语句所在的连接移出缓存，线程返回后才关闭，期间不会借给其他查询或写入。
+ * 服务端的写入无法中途终止。
+ */
+static void
+tdengine_insert_abandon(TDengineInsertStmt *ins)
+{
+    TDengineInsertFlight *fl = ins->flight;
+    int nbuf = ins->ncol + ins->ntag;
+    TDengineBindBuffer *set = &ins->bufs[ins->flight_set * nbuf];
+
+    ins->flight = NULL;
+    try
+    {
+        fl->owned.assign(set, set + nbuf);
+    }
+    catch (...)
+    {
+        /* 无法转交时只能等待线程结束 */
+        tdengine_insert_flight_join(fl);
+        tdengine_insert_flight_discard(fl);
+        return;
+    }
+    memset(set, 0, sizeof(TDengineBindBuffer) * nbuf);
+    fl->own = true;
+    ins->stmt = NULL;
+
+    /* 线程即使已返回也可能还要关闭语句，连接一律移出缓存 */
+    if (fl->returned)
+        tdengine_retire_connection(ins->conn, fl->returned);
+
+    /* 先分离线程，released交换之后本结构可能随时被线程释放 */
+    try
+    {
+        if (fl->worker.joinable())
+            fl->worker.detach();
+    }
+    catch (...)
+    {
+    }
+
+    if (fl->released.exchange(true))
+        tdengine_insert_flight_discard(fl);
+}
+
+/*
+ * tdengine_insert_wait
+ *      等待进行中的写入返回，并取回其错误信息
+ *
+ * 等待期间响应取消请求和query_timeout，放弃等待时插入语句不可再用。
+ */
+static char *
+tdengine_insert_wait(TDengineInsertStmt *ins)
+{
+    TDengineInsertFlight *fl = ins->flight;
+    TDengineWaitStatus status = TDENGINE_WAIT_READY;
+    char *err = NULL;
+
+    if (fl == NULL)
+        return NULL;
+
+    if (!fl->done.load(std::memory_order_acquire))
+        status = tdengine_wait_readable(fl->pipefd[0], tdengine_deadline(ins->query_timeout));
+    if (status != TDENGINE_WAIT_READY)
+    {
+        tdengine_insert_abandon(ins);
+        return tdengine_wait_error(status);
+    }
+
+    tdengine_insert_flight_join(fl);
+    ins->flight = NULL;
+    if (fl->failed)
+        err = pstrdup(fl->error.empty() ? "unknown error" : fl->error.c_str());
+    tdengine_insert_flight_discard(fl);
+
+    return err;
+}
+
+/*
+ * tdengine_insert_reset_callback
+ *      插入语句所在内存上下文被重置或删除时关闭语句
+ *
+ * 查询出错中止时可能仍有异步写入在途，放弃等待并把语句交给写入线程关闭。
+ */
+static void
+tdengine_insert_reset_callback(void *arg)
+{
+    TDengineInsertStmt *ins = (TDengineInsertStmt *) arg;
+
+    if (ins->flight != NULL)
+        tdengine_insert_abandon(ins);
+
+    if (ins->stmt != NULL)
+    {
+        ws_stmt_close(ins->stmt);
+        ins->stmt = NULL;
+    }
+
+    if (ins->bufs != NULL)
+    {
+        for (int i = 0; i < 2 * (ins->ncol + ins->ntag); i++)
+            tdengine_bind_buffer_free(&ins->bufs[i]);
+    }
+
+    if (ins->lease_slot > 0)
+    {
+        tdengine_release_connection(ins->lease_umid, ins->lease_slot);
+        ins->lease_slot = 0;
+    }
+}
+
+/*
+ * tdengine_insert_fixed_size
+ *      定长类型绑定时每个值的字节数，不支持绑定的类型返回0
+ */
+static int
+tdengine_insert_fixed_size(int type)
+{
+    switch (type)
+    {
+        case TSDB_DATA_TYPE_BOOL:
+        case TSDB_DATA_TYPE_TINYINT:
+        case TSDB_DATA_TYPE_UTINYINT:
+            return sizeof(int8_t);
+        case TSDB_DATA_TYPE_SMALLINT:
+        case TSDB_DATA_TYPE_USMALLINT:
+            return sizeof(int16_t);
+        case TSDB_DATA_TYPE_INT:
+        case TSDB_DATA_TYPE_UINT:
+            return sizeof(int32_t);
+        case TSDB_DATA_TYPE_FLOAT:
+            return sizeof(float);
+        case TSDB_DATA_TYPE_BIGINT:
+        case TSDB_DATA_TYPE_UBIGINT:
+        case TSDB_DATA_TYPE_TIMESTAMP:
+            return sizeof(int64_t);
+        case TSDB_DATA_TYPE_DOUBLE:
+            return sizeof(double);
+        default:
+            return 0;
+    }
+}
+
+/*
+ * tdengine_insert_parsed
+ *      strtoll/strtod是否完整解析了字符串(允许前后空白)且没有溢出
+ */
+static bool
+tdengine_insert_parsed(const char *str, const char *end)
+{
+    if (end == str || errno == ERANGE)
+        return false;
+    while (isspace((unsigned char) *end))
+        end++;
+    return *end == '\0';
+}
+
+/*
+ * tdengine_insert_store_fixed
+ *      把一个参数值按远程列类型写入列缓冲区
+ *
+ * 整数和浮点数之间按C语言规则转换，字符串须完整解析为数字(布尔列另接受
+ * t/true/f/false)。时间戳以纳秒传入，写入TIMESTAMP列时换算为数据库精度。
+ * 成功时返回NULL，否则返回错误信息。
+ */
+static char *
+tdengine_insert_store_fixed(const TDengineInsertColumn *col, char *dst, TDengineType vtype,
+                            const TDengineValue *val, int precision)
+{
+    int64_t iv = 0;
+    double dv = 0;
+
+    switch (vtype)
+    {
+        case TDENGINE_INT64:
+            iv = val->i;
+            dv = (double) iv;
+            break;
+        case TDENGINE_DOUBLE:
+            dv = val->d;
+            iv = (int64_t) dv;
+            break;
+        case TDENGINE_BOOLEAN:
+            iv = val->b ? 1 : 0;
+            dv = (double) iv;
+            break;
+        case TDENGINE_TIME:
+            iv = col->type == TSDB_DATA_TYPE_TIMESTAMP ?
+                tdengine_insert_time_value(val->i, precision) : val->i;
+            dv = (double) iv;
+            break;
+        case TDENGINE_STRING:
+        {
+            char *end;
+
+            if (col->type == TSDB_DATA_TYPE_TIMESTAMP)
+                return psprintf("cannot insert a string value into a TIMESTAMP field");
+            if (col->type == TSDB_DATA_TYPE_BOOL &&
+                (strcasecmp(val->s, "t") == 0 || strcasecmp(val->s, "true") == 0))
+                iv = 1;
+            else if (col->type == TSDB_DATA_TYPE_BOOL &&
+                     (strcasecmp(val->s, "f") == 0 || strcasecmp(val->s, "false") == 0))
+                iv = 0;
+            else if (col->type == TSDB_DATA_TYPE_FLOAT || col->type == TSDB_DATA_TYPE_DOUBLE)
+            {
+                errno = 0;
+                dv = strtod(val->s, &end);
+                if (!tdengine_insert_parsed(val->s, end))
+                    return psprintf("invalid input syntax for a floating-point field: \"%s\"", val->s);
+                break;
+            }
+            else
+            {
+                errno = 0;
+                iv = strtoll(val->s, &end, 10);
+                if (!tdengine_insert_parsed(val->s, end))
+                    return psprintf("invalid input syntax for an integer field: \"%s\"", val->s);
+            }
+            dv = (double) iv;
+            break;
+        }
+        case TDENGINE_NULL:
+            return NULL;
+    }
+
+    switch (col->type)
+    {
+        case TSDB_DATA_TYPE_BOOL:
+        {
+            int8_t v = iv != 0 ? 1 : 0;
+
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        case TSDB_DATA_TYPE_TINYINT:
+        case TSDB_DATA_TYPE_UTINYINT:
+        {
+            int8_t v = (int8_t) iv;
+
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        case TSDB_DATA_TYPE_SMALLINT:
+        case TSDB_DATA_TYPE_USMALLINT:
+        {
+            int16_t v = (int16_t) iv;
+
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        case TSDB_DATA_TYPE_INT:
+        case TSDB_DATA_TYPE_UINT:
+        {
+            int32_t v = (int32_t) iv;
+
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        case TSDB_DATA_TYPE_FLOAT:
+        {
+            float v = (float) dv;
+
+            memcpy(dst, &v, sizeof(v));
+            break;
+        }
+        case TSDB_DATA_TYPE_DOUBLE:
+            memcpy(dst, &dv, sizeof(dv));
+            break;
+        default:
+            memcpy(dst, &iv, sizeof(iv));
+            break;
+    }
+    return NULL;
+}
+
+/*
+ * tdengine_insert_value_text
+ *      把一个参数值格式化为写入变长列的文本，在当前内存上下文中分配
+ */
+static char *
+tdengine_insert_value_text(TDengineType vtype, const TDengineValue *val)
+{
+    switch (vtype)
+    {
+        case TDENGINE_INT64:
+            return psprintf("%lld", val->i);
+        case TDENGINE_DOUBLE:
+            return psprintf("%.*g", DBL_DIG + 3, val->d);
+        case TDENGINE_BOOLEAN:
+            return pstrdup(val->b ? "true" : "false");
+        case TDENGINE_TIME:
+        {
+            std::string lit = tdengine_format_param_time(val->i);
+
+            return pnstrdup(lit.c_str() + 1, lit.size() - 2);
+        }
+        case TDENGINE_STRING:
+            return val->s;
+        case TDENGINE_NULL:
+            break;
+    }
+    return NULL;
+}
+
+/*
+ * tdengine_insert_row_param
+ *      取得第row行中绑定到列col的参数下标，-1表示该列为NULL
+ *
+ * time和time_text都写入远程的time列，取第一个非空的时间参数。
+ */
+static int
+tdengine_insert_row_param(const TDengineInsertStmt *ins, const TDengineInsertColumn *col,
+                          TDengineType *types, int row, int nparam)
+{
+    if (col->param >= 0)
+        return col->param;
+    for (int i = 0; i < ins->ntime; i++)
+    {
+        if (types[row * nparam + ins->time_params[i]] != TDENGINE_NULL)
+            return ins->time_params[i];
+    }
+    return -1;
+}
+
+/*
+ * tdengine_bind_buffer_grow
+ *      保证*ptr至少有need字节，容纳不下时释放后按倍数重新分配，原有内容不保留
+ */
+static bool
+tdengine_bind_buffer_grow(void **ptr, size_t *cap, size_t need)
+{
+    size_t n;
+    void *p;
+
+    if (need <= *cap)
+        return true;
+
+    n = Max(need, *cap * 2);
+    p = malloc(n);
+    if (p == NULL)
+        return false;
+    free(*ptr);
+    *ptr = p;
+    *cap = n;
+
+    return true;
+}
+
+/*
+ * tdengine_bind_buffer_reserve
+ *      保证绑定缓冲区能容纳rows行、bytes字节的值，并清零本次使用的部分
+ */
+static bool
+tdengine_bind_buffer_reserve(TDengineBindBuffer *bb, size_t rows, size_t bytes)
+{
+    if (rows > bb->rows)
+    {
+        size_t n = Max(rows, bb->rows * 2);
+        char *is_null = (char *) malloc(n);
+        int32_t *lengths = (int32_t *) malloc(sizeof(int32_t) * n);
+        char **texts = (char **) malloc(sizeof(char *) * n);
+
+        if (is_null == NULL || lengths == NULL || texts == NULL)
+        {
+            free(is_null);
+            free(lengths);
+            free(texts);
+            return false;
+        }
+        free(bb->is_null);
+        free(bb->lengths);
+        free(bb->texts);
+        bb->is_null = is_null;
+        bb->lengths = lengths;
+        bb->texts = texts;
+        bb->rows = n;
+    }
+    if (!tdengine_bind_buffer_grow((void **) &bb->data, &bb->bytes, bytes))
+        return false;
+
+    memset(bb->is_null, 0, rows);
+    memset(bb->lengths, 0, sizeof(int32_t) * rows);
+    memset(bb->texts, 0, sizeof(char *) * rows);
+    if (bytes > 0)
+        memset(bb->data, 0, bytes);
+
+    return true;
+}
+
+/*
+ * tdengine_insert_fill_column
+ *      把rows中各行的一列参数写入WS_MULTI_BIND的列缓冲区
+ *
+ * 值、长度和空值标记各放在bb的一段连续缓冲区中，变长列以这些行中最长的值为步长。
+ * 缓冲区在语句存续期间复用。失败时返回错误信息。
+ */
+static char *
+tdengine_insert_fill_column(const TDengineInsertStmt *ins, const TDengineInsertColumn *col,
+                            TDengineBindBuffer *bb, WS_MULTI_BIND *bind,
+                            TDengineType *ctypes, TDengineValue *cvalues,
+                            int nparam, const int *rows, int nrows)
+{
+    bind->buffer_type = col->type;
+    bind->num = nrows;
+
+    if (tdengine_is_var_type(col->type))
+    {
+        int32_t stride = 1;
+
+        if (!tdengine_bind_buffer_reserve(bb, nrows, 0))
+            return pstrdup("out of memory while binding insert values");
+        for (int k = 0; k < nrows; k++)
+        {
+            int row = rows[k];
+            int idx = tdengine_insert_row_param(ins, col, ctypes, row, nparam);
+
+            if (idx >= 0)
+                bb->texts[k] = tdengine_insert_value_text(ctypes[row * nparam + idx],
+                                                          &cvalues[row * nparam + idx]);
+            if (bb->texts[k] == NULL)
+                bb->is_null[k] = 1;
+            else
+            {
+                bb->lengths[k] = (int32_t) strlen(bb->texts[k]);
+                stride = Max(stride, bb->lengths[k]);
+            }
+        }
+
+        /* 步长要等取得各值的文本后才能确定，此时再扩大数据区 */
+        if (!tdengine_bind_buffer_grow((void **) &bb->data, &bb->bytes, (size_t) stride * nrows))
+            return pstrdup("out of memory while binding insert values");
+        memset(bb->data, 0, (size_t) stride * nrows);
+        for (int k = 0; k < nrows; k++)
+        {
+            if (bb->texts[k] != NULL)
+                memcpy(bb->data + (size_t) stride * k, bb->texts[k], bb->lengths[k]);
+        }
+        bind->buffer_length = stride;
+    }
+    else
+    {
+        int width = tdengine_insert_fixed_size(col->type);
+
+        if (!tdengine_bind_buffer_reserve(bb, nrows, (size_t) width * nrows))
+            return pstrdup("out of memory while binding insert values");
+        for (int k = 0; k < nrows; k++)
+        {
+            int row = rows[k];
+            int idx = tdengine_insert_row_param(ins, col, ctypes, row, nparam);
+            TDengineType vtype = idx >= 0 ? ctypes[row * nparam + idx] : TDENGINE_NULL;
+
+            bb->lengths[k] = width;
+            if (vtype == TDENGINE_NULL)
+                bb->is_null[k] = 1;
+            else
+            {
+                char *err = tdengine_insert_store_fixed(col, bb->data + (size_t) width * k, vtype,
+                                                        &cvalues[row * nparam + idx], ins->precision);
+
+                if (err != NULL)
+                    return err;
+            }
+        }
+        bind->buffer_length = width;
+    }
+    bind->buffer = bb->data;
+    bind->is_null = bb->is_null;
+    bind->length = bb->lengths;
+
+    return NULL;
+}
+
+/*
+ * tdengine_child_key_append
+ *      向标签组合的缓存键追加一个标签值，NULL与空串互不相同
+ *
+ * 定长标签追加按远程类型存放的字节，变长标签追加文本，
+ * 新行的参数值和已有子表的标签值因此不受文本格式差异影响。
+ */
+static void
+tdengine_child_key_append(std::string &key, const char *value, size_t len)
+{
+    if (value == NULL)
+        key.push_back('\x01');
+    else
+    {
+        key.push_back('\x02');
+        key.append(value, len);
+    }
+    key.push_back('\0');
+}
+
+/*
+ * tdengine_child_key_param
+ *      把一行的标签参数值按远程标签类型追加到缓存键
+ *
+ * 定长类型与绑定时一样经tdengine_insert_store_fixed转换，时间戳换算为数据库精度；
+ * 无法转换的值按文本追加，写入时绑定同一个值会报告错误。
+ */
+static void
+tdengine_child_key_param(std::string &key, const TDengineInsertColumn *col, TDengineType vtype,
+                         const TDengineValue *val, int precision)
+{
+    char buf[sizeof(int64_t)];
+    char *text;
+    char *err;
+
+    if (vtype == TDENGINE_NULL)
+    {
+        tdengine_child_key_append(key, NULL, 0);
+        return;
+    }
+    if (!tdengine_is_var_type(col->type))
+    {
+        err = tdengine_insert_store_fixed(col, buf, vtype, val, precision);
+        if (err == NULL)
+        {
+            tdengine_child_key_append(key, buf, tdengine_insert_fixed_size(col->type));
+            return;
+        }
+        pfree(err);
+    }
+    text = tdengine_insert_value_text(vtype, val);
+    tdengine_child_key_append(key, text, strlen(text));
+}
+
+/*
+ * tdengine_child_table_name
+ *      由超级表名和标签组合推导子表名
+ *
+ * 使用FNV-1a散列，同一标签组合在所有后端得到相同的子表名，
+ * 并发写入同一设备的会话不会各自建出不同的子表。
+ */
+static std::string
+tdengine_child_table_name(const char *stable, const std::string &key)
+{
+    uint64_t hash = UINT64CONST(14695981039346656037);
+    char hex[17];
+
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= UINT64CONST(1099511628211);
+    }
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+
+    return std::string(stable) + "_" + hex;
+}
+
+/*
+ * tdengine_insert_load_children
+ *      载入超级表已有子表的标签值，使已有设备的数据写入原来的子表
+ *
+ * SELECT TAGS每个子表只返回一行，不扫描数据。标签值直接取数据块中的类型化值，
+ * 与新行参数按相同的规则组成缓存键(见tdengine_child_key_param)。
+ * 查询失败时只记录日志。
+ */
+static void
+tdengine_insert_load_children(TDengineInsertStmt *ins, WS_TAOS *conn, tdengine_opt *opts,
+                              TDengineColumnInfo *ccolumns)
+{
+    std::string sql("SELECT TAGS tbname");
+    TDengineCursorOpen_return cur;
+    char *err = NULL;
+
+    for (int t = 0; t < ins->ntag; t++)
+        sql += ", " + tdengine_quote_identifier(ccolumns[ins->tags[t].param].column_name);
+    sql += " FROM " + tdengine_quote_identifier(ins->stable);
+
+    cur = tdengine_cursor_open(conn, opts, sql.c_str(), NULL, NULL, 0,
+                               tdengine_deadline(opts->query_timeout));
+    if (cur.r1 != NULL)
+    {
+        elog(DEBUG1, "tdengine_fdw : could not list child tables of \"%s\": %s", ins->stable, cur.r1);
+        return;
+    }
+
+    for (;;)
+    {
+        const void *data = NULL;
+        int32_t rows = 0;
+
+        if (!tdengine_guarded_fetch(cur.r0, &data, &rows, &err))
+        {
+            elog(DEBUG1, "tdengine_fdw : could not list child tables of \"%s\": %s", ins->stable, err);
+            break;
+        }
+        if (rows == 0 || data == NULL)
+            break;
+        for (int32_t r = 0; r < rows; r++)
+        {
+            const void *val;
+            uint8_t type = 0;
+            uint32_t len = 0;
+            std::string key;
+
+            if (ws_is_null(cur.r0->res, r, 0))
+                continue;
+            for (int t = 0; t < ins->ntag; t++)
+            {
+                const TDengineInsertColumn *col = &ins->tags[t];
+
+                if (ws_is_null(cur.r0->res, r, t + 1))
+                {
+                    tdengine_child_key_append(key, NULL, 0);
+                    continue;
+                }
+                val = ws_get_value_in_block(cur.r0->res, r, t + 1, &type, &len);
+                if (val == NULL)
+                    len = 0;
+                else if (!tdengine_is_var_type(col->type))
+                    len = tdengine_insert_fixed_size(col->type);
+                tdengine_child_key_append(key, (const char *) val, len);
+            }
+            val = ws_get_value_in_block(cur.r0->res, r, 0, &type, &len);
+            if (val != NULL)
+                (*ins->children)[key] = std::string((const char *) val, len);
+        }
+    }
+
+    TDengineCursorClose(cur.r0);
+}
+
+/*
+ * TDengineInsertPrepare
+ *      准备参数绑定的INSERT语句
+ *
+ * query为tdengine_deparse_insert生成的"INSERT INTO ... VALUES (?, ...)"，
+ * using_stable时为tdengine_deparse_stable_insert生成的"INSERT INTO ? USING ..."。
+ * 绑定时缓冲区类型必须与远程列类型一致，因此先以LIMIT 0查询一次列清单(含标签列)，
+ * 记下各列的类型和数据库时间精度。语句和写入缓冲区在当前内存上下文中分配，
+ * 上下文重置时自动关闭。异步写入为每个语句借用一条独占连接，上下文重置时归还。
+ */
+extern "C" struct TDengineInsertPrepare_return
+TDengineInsertPrepare(char *query, char *table_name, UserMapping *user, tdengine_opt *opts,
+                      TDengineColumnInfo *ccolumns, int cparamNum, bool using_stable)
+{
+    TDengineInsertPrepare_return ret = {NULL, NULL};
+    WS_TAOS *conn;
+    TDengineInsertStmt *ins;
+    TDengineCursorOpen_return cur;
+    const WS_FIELD *fields;
+    std::string probe("SELECT ");
+    int nalloc = cparamNum > 0 ? cparamNum : 1;
+
+    ins = (TDengineInsertStmt *) palloc0(sizeof(TDengineInsertStmt));
+
+    /* 出错返回时也要归还借用的连接，回调须在借用之前注册 */
+    ins->cb.func = tdengine_insert_reset_callback;
+    ins->cb.arg = ins;
+    MemoryContextRegisterResetCallback(CurrentMemoryContext, &ins->cb);
+
+    /*
+     * 异步写入在借来的独占连接上进行，不与同一查询中的扫描共用连接，
+     * 多个外部表的写入线程也不会在同一连接上同时执行
+     */
+    if (opts->async_insert)
+    {
+        conn = tdengine_acquire_connection(user, opts, &ins->lease_slot);
+        ins->lease_umid = user->umid;
+    }
+    else
+        conn = tdengine_get_connection(user, opts);
+    ins->conn = conn;
+
+    ins->cols = (TDengineInsertColumn *) palloc0(sizeof(TDengineInsertColumn) * nalloc);
+    ins->tags = (TDengineInsertColumn *) palloc0(sizeof(TDengineInsertColumn) * nalloc);
+    ins->time_params = (int *) palloc0(sizeof(int) * nalloc);
+
+    /* 列清单和标签清单的顺序与deparse.c一致 */
+    for (int i = 0; i < cparamNum; i++)
+    {
+        const char *name = ccolumns[i].column_name;
+
+        if (ccolumns[i].column_type == TDENGINE_TIME_KEY)
+        {
+            ins->time_params[ins->ntime++] = i;
+            if (ins->ntime > 1)
+                continue;
+            ins->cols[ins->ncol].param = -1;
+            name = TDENGINE_TIME_COLUMN;
+        }
+        else if (ccolumns[i].column_type == TDENGINE_FIELD_KEY)
+            ins->cols[ins->ncol].param = i;
+        else
+        {
+            if (using_stable && ccolumns[i].column_type == TDENGINE_TAG_KEY)
+                ins->tags[ins->ntag++].param = i;
+            continue;
+        }
+
+        if (ins->ncol > 0)
+            probe += ", ";
+        probe += tdengine_quote_identifier(name);
+        ins->ncol++;
+    }
+    if (ins->ncol == 0)
+    {
+        ret.r1 = psprintf("no insertable columns in table \"%s\"", table_name);
+        return ret;
+    }
+    for (int t = 0; t < ins->ntag; t++)
+        probe += ", " + tdengine_quote_identifier(ccolumns[ins->tags[t].param].column_name);
+    probe += " FROM " + tdengine_quote_identifier(table_name) + " LIMIT 0";
+
+    cur = tdengine_cursor_open(conn, opts, probe.c_str(), NULL, NULL, 0,
+                               tdengine_deadline(opts->query_timeout));
+    if (cur.r1 != NULL)
+    {
+        ret.r1 = cur.r1;
+        return ret;
+    }
+    if (cur.r0->ncol != ins->ncol + ins->ntag)
+    {
+        TDengineCursorClose(cur.r0);
+        ret.r1 = psprintf("column list of table \"%s\" does not match the remote table", table_name);
+        return ret;
+    }
+    fields = ws_fetch_fields(cur.r0->res);
+    for (int c = 0; c < ins->ncol + ins->ntag; c++)
+    {
+        TDengineInsertColumn *col = c < ins->ncol ? &ins->cols[c] : &ins->tags[c - ins->ncol];
+
+        col->type = fields[c].type;
+        col->bytes = fields[c].bytes;
+        if (!tdengine_is_var_type(fields[c].type) &&
+            tdengine_insert_fixed_size(fields[c].type) == 0)
+        {
+            ret.r1 = psprintf("column \"%s\" of table \"%s\" has a type that cannot be inserted",
+                              fields[c].name, table_name);
+            TDengineCursorClose(cur.r0);
+            return ret;
+        }
+    }
+    ins->precision = cur.r0->precision;
+    TDengineCursorClose(cur.r0);
+
+    if (ins->ntag > 0)
+    {
+        std::string cache_key = std::string(opts->svr_address) + ":" + std::to_string(opts->svr_port) +
+            "/" + opts->svr_database + "." + table_name;
+        auto it = tdengine_child_cache.find(cache_key);
+
+        ins->stable = pstrdup(table_name);
+        if (it != tdengine_child_cache.end())
+            ins->children = &it->second;
+        else
+        {
+            ins->children = &tdengine_child_cache[cache_key];
+            tdengine_insert_load_children(ins, conn, opts, ccolumns);
+        }
+    }
+
+    ins->stmt = ws_stmt_init(conn);
+    if (ins->stmt == NULL)
+    {
+        ret.r1 = pstrdup(ws_stmt_errstr(NULL));
+        return ret;
+    }
+    if (ws_stmt_prepare(ins->stmt, query, 0) != 0)
+    {
+        ret.r1 = pstrdup(ws_stmt_errstr(ins->stmt));
+        ws_stmt_close(ins->stmt);
+        ins->stmt = NULL;
+        return ret;
+    }
+
+    ins->nparam = cparamNum;
+    ins->bufs = (TDengineBindBuffer *) palloc0(sizeof(TDengineBindBuffer) * 2 * (ins->ncol + ins->ntag));
+    ins->async = opts->async_insert;
+    ins->query_timeout = opts->query_timeout;
+    ins->flush_rows = opts->flush_rows > 0 ? opts->flush_rows : TDENGINE_DEFAULT_FLUSH_ROWS;
+    ins->flush_bytes = opts->flush_bytes > 0 ? opts->flush_bytes : TDENGINE_DEFAULT_FLUSH_BYTES;
+    ins->pending_cxt = AllocSetContextCreate(CurrentMemoryContext,
+                                             "tdengine_fdw insert buffer",
+                                             ALLOCSET_DEFAULT_SIZES);
+
+    ret.r0 = ins;
+    return ret;
+}
+
+/*
+ * tdengine_insert_group_rows
+ *      按标签组合把各行分组，同组的行在order中连续排列
+ *
+ * 子表名先查本后端的子表缓存，没有时按标签值推导；
+ * 子表不存在时由服务端按USING子句自动创建。写入普通表时所有行为一组。
+ * firsts为各组第一行的行号，用于绑定该组的标签值。
+ */
+static void
+tdengine_insert_group_rows(TDengineInsertStmt *ins, TDengineType *ctypes, TDengineValue *cvalues,
+                           int nparam, int nrows, TDengineInsertFlight *fl,
+                           std::vector<int> &order, std::vector<int> &firsts,
+                           std::vector<int> &starts, std::vector<int> &counts)
+{
+    std::vector<std::vector<int>> groups;
+    std::unordered_map<std::string, size_t> group_of;
+
+    if (ins->ntag == 0)
+    {
+        order.resize(nrows);
+        for (int row = 0; row < nrows; row++)
+            order[row] = row;
+        firsts.push_back(0);
+        starts.push_back(0);
+        counts.push_back(nrows);
+        return;
+    }
+
+    for (int row = 0; row < nrows; row++)
+    {
+        std::string key;
+
+        for (int t = 0; t < ins->ntag; t++)
+        {
+            int idx = row * nparam + ins->tags[t].param;
+
+            tdengine_child_key_param(key, &ins->tags[t], ctypes[idx], &cvalues[idx], ins->precision);
+        }
+
+        auto it = group_of.find(key);
+        if (it == group_of.end())
+        {
+            auto child = ins->children->find(key);
+
+            if (child == ins->children->end())
+                child = ins->children->emplace(key, tdengine_child_table_name(ins->stable, key)).first;
+            it = group_of.emplace(key, groups.size()).first;
+            groups.emplace_back();
+            fl->names.push_back(child->second);
+        }
+        groups[it->second].push_back(row);
+    }
+
+    order.reserve(nrows);
+    for (const std::vector<int> &group : groups)
+    {
+        firsts.push_back(group[0]);
+        starts.push_back((int) order.size());
+        counts.push_back((int) group.size());
+        order.insert(order.end(), group.begin(), group.end());
+    }
+}
+
+/*
+ * tdengine_insert_submit
+ *      按列绑定cnumSlots行参数并发起一次插入
+ *
+ * ctypes/cvalues按行排列，每行cparamNum个参数。写入超级表时各行按标签组合
+ * 分到各自的子表，所有子表的数据在一次执行中写入。
+ *
+ * 先把本批数据填入空闲的一组绑定缓冲区，再等待上一次写入返回，
+ * 因此上一次写入在途时后端仍在转换下一批。写入一律交给后台线程执行：
+ * 异步写入时立即返回，其错误在下一次发起写入或TDengineInsertFlush时返回；
+ * 同步写入时随即在锁存器上等待，与查询一样可以响应取消请求、
+ * statement_timeout和query_timeout，放弃等待时连接移出缓存。
+ */
+static char *
+tdengine_insert_submit(TDengineInsertStmt *ins, TDengineType *ctypes, TDengineValue *cvalues,
+                       int cparamNum, int cnumSlots)
+{
+    int nbuf = ins->ncol + ins->ntag;
+    TDengineBindBuffer *set = &ins->bufs[ins->fill_set * nbuf];
+    WS_MULTI_BIND *whole = (WS_MULTI_BIND *) palloc0(sizeof(WS_MULTI_BIND) * nbuf);
+    TDengineInsertFlight *fl = NULL;
+    std::vector<int> order;
+    std::vector<int> firsts;
+    std::vector<int> starts;
+    std::vector<int> counts;
+    size_t ngroup = 0;
+    char *err;
+
+    try
+    {
+        fl = new TDengineInsertFlight();
+        tdengine_insert_group_rows(ins, ctypes, cvalues, cparamNum, cnumSlots, fl,
+                                   order, firsts, starts, counts);
+        ngroup = starts.size();
+        fl->col_binds.resize(ngroup * ins->ncol);
+        fl->tag_binds.resize(ngroup * ins->ntag);
+    }
+    catch (...)
+    {
+        delete fl;
+        return pstrdup("out of memory while grouping rows by child table");
+    }
+
+    for (int c = 0; c < ins->ncol; c++)
+    {
+        err = tdengine_insert_fill_column(ins, &ins->cols[c], &set[c], &whole[c],
+                                          ctypes, cvalues, cparamNum, order.data(), cnumSlots);
+        if (err != NULL)
+        {
+            delete fl;
+            return err;
+        }
+    }
+    for (int t = 0; t < ins->ntag; t++)
+    {
+        /* 同组各行的标签值相同，取各组的第一行 */
+        err = tdengine_insert_fill_column(ins, &ins->tags[t], &set[ins->ncol + t], &whole[ins->ncol + t],
+                                          ctypes, cvalues, cparamNum, firsts.data(), (int) ngroup);
+        if (err != NULL)
+        {
+            delete fl;
+            return err;
+        }
+    }
+
+    /* 各组的绑定描述指向整列缓冲区中的连续片段 */
+    for (size_t g = 0; g < ngroup; g++)
+    {
+        for (int c = 0; c < nbuf; c++)
+        {
+            size_t start = c < ins->ncol ? starts[g] : g;
+            WS_MULTI_BIND *b = c < ins->ncol ? &fl->col_binds[g * ins->ncol + c]
+                                             : &fl->tag_binds[g * ins->ntag + c - ins->ncol];
+
+            *b = whole[c];
+            b->buffer = (char *) whole[c].buffer + start * whole[c].buffer_length;
+            b->length = whole[c].length + start;
+            b->is_null = whole[c].is_null + start;
+            b->num = c < ins->ncol ? counts[g] : 1;
+        }
+    }
+
+    /* 语句同一时间只能有一次写入 */
+    err = tdengine_insert_wait(ins);
+    if (err != NULL)
+    {
+        delete fl;
+        return err;
+    }
+    if (ins->stmt == NULL)
+    {
+        delete fl;
+        return pstrdup("insert statement is not prepared");
+    }
+    fl->stmt = ins->stmt;
+    fl->ncol = ins->ncol;
+    fl->ntag = ins->ntag;
+
+    try
+    {
+        if (pipe(fl->pipefd) != 0)
+            throw std::runtime_error("could not create pipe");
+        (void) fcntl(fl->pipefd[0], F_SETFL, O_NONBLOCK);
+        (void) fcntl(fl->pipefd[0], F_SETFD, FD_CLOEXEC);
+        (void) fcntl(fl->pipefd[1], F_SETFD, FD_CLOEXEC);
+        fl->returned = std::make_shared<std::atomic<bool>>(false);
+        fl->worker = tdengine_spawn_thread(tdengine_insert_flight_worker, fl);
+    }
+    catch (...)
+    {
+        /* 无法创建线程时在后端中直接执行 */
+        tdengine_insert_flight_run(fl);
+        err = NULL;
+        if (fl->failed)
+            err = pstrdup(fl->error.empty() ? "unknown error" : fl->error.c_str());
+        tdengine_insert_flight_discard(fl);
+        return err;
+    }
+
+    ins->flight = fl;
+    ins->flight_set = ins->fill_set;
+    ins->fill_set = 1 - ins->fill_set;
+
+    /* 同步写入在锁存器上等待本次写入返回 */
+    if (!ins->async)
+        return tdengine_insert_wait(ins);
+    return NULL;
+}
+
+/*
+ * tdengine_insert_send
+ *      发起写入缓冲区中所有行的写入，缓冲区为空时什么也不做
+ *
+ * 不论成功与否，发起后都清空缓冲区。错误信息在调用方的内存上下文中分配。
+ */
+static char *
+tdengine_insert_send(TDengineInsertStmt *ins)
+{
+    MemoryContext oldcontext;
+    char *err;
+
+    if (ins->pending_rows == 0)
+        return NULL;
+    if (ins->stmt == NULL)
+        return pstrdup("insert statement is not prepared");
+
+    oldcontext = MemoryContextSwitchTo(ins->pending_cxt);
+    err = tdengine_insert_submit(ins, ins->pending_types, ins->pending_values,
+                                 ins->nparam, ins->pending_rows);
+    MemoryContextSwitchTo(oldcontext);
+
+    if (err != NULL)
+        err = pstrdup(err);
+
+    ins->sent_rows += ins->pending_rows;
+    MemoryContextReset(ins->pending_cxt);
+    ins->pending_types = NULL;
+    ins->pending_values = NULL;
+    ins->pending_rows = 0;
+    ins->pending_cap = 0;
+    ins->pending_bytes = 0;
+
+    return err;
+}
+
+/*
+ * TDengineInsertAppend
+ *      把cnumSlots行参数追加到写入缓冲区，攒够flush_rows行或flush_bytes字节时发送
+ *
+ * 参数值(包括字符串)复制到缓冲区自己的内存上下文中，调用方可以随即重置
+ * 参数所在的上下文。跨多次调用攒下的行合并为一次写入，
+ * 写入超级表时这些行可以分属许多子表。
+ * 异步写入时返回的可能是上一次写入的错误。
+ */
+extern "C" char *
+TDengineInsertAppend(TDengineInsertStmt *ins, TDengineType *ctypes, TDengineValue *cvalues,
+                     int cnumSlots)
+{
+    MemoryContext oldcontext;
+    int nparam;
+
+    if (ins == NULL || ins->stmt == NULL)
+        return pstrdup("insert statement is not prepared");
+    if (cnumSlots <= 0)
+        return NULL;
+
+    nparam = ins->nparam;
+    oldcontext = MemoryContextSwitchTo(ins->pending_cxt);
+
+    if (ins->pending_rows + cnumSlots > ins->pending_cap)
+    {
+        int cap = Max(ins->pending_cap * 2, ins->pending_rows + cnumSlots);
+        size_t n = (size_t) cap * Max(nparam, 1);
+
+        if (ins->pending_types == NULL)
+        {
+            ins->pending_types = (TDengineType *) palloc(sizeof(TDengineType) * n);
+            ins->pending_values = (TDengineValue *) palloc(sizeof(TDengineValue) * n);
+        }
+        else
+        {
+            ins->pending_types = (TDengineType *) repalloc(ins->pending_types, sizeof(TDengineType) * n);
+            ins->pending_values = (TDengineValue *) repalloc(ins->pending_values, sizeof(TDengineValue) * n);
+        }
+        ins->pending_cap = cap;
+    }
+
+    for (int i = 0; i < cnumSlots * nparam; i++)
+    {
+        size_t dst = (size_t) ins->pending_rows * nparam + i;
+
+        ins->pending_types[dst] = ctypes[i];
+        ins->pending_values[dst] = cvalues[i];
+        if (ctypes[i] == TDENGINE_STRING)
+        {
+            ins->pending_values[dst].s = pstrdup(cvalues[i].s);
+            ins->pending_bytes += strlen(cvalues[i].s) + 1;
+        }
+        else
+            ins->pending_bytes += sizeof(TDengineValue);
+    }
+    ins->pending_rows += cnumSlots;
+
+    MemoryContextSwitchTo(oldcontext);
+
+    if (ins->pending_rows >= ins->flush_rows || ins->pending_bytes >= ins->flush_bytes)
+        return tdengine_insert_send(ins);
+
+    return NULL;
+}
+
+/*
+ * TDengineInsertPosition
+ *      返回写入位置，即到目前为止追加的累计行数
+ */
+extern "C" int64
+TDengineInsertPosition(TDengineInsertStmt *ins)
+{
+    if (ins == NULL)
+        return 0;
+    return ins->sent_rows + ins->pending_rows;
+}
+
+/*
+ * TDengineInsertRewind
+ *      丢弃写入位置position之后追加的、仍在缓冲区中的行
+ *
+ * 返回position之后已经发起写入、无法撤回的行数。
+ * 丢弃的字符串参数留在缓冲区的内存上下文中，下一次发送后释放。
+ */
+extern "C" int64
+TDengineInsertRewind(TDengineInsertStmt *ins, int64 position)
+{
+    int keep;
+
+    if (ins == NULL || position >= TDengineInsertPosition(ins))
+        return 0;
+
+    keep = position > ins->sent_rows ? (int) (position - ins->sent_rows) : 0;
+    if (keep == 0)
+    {
+        MemoryContextReset(ins->pending_cxt);
+        ins->pending_types = NULL;
+        ins->pending_values = NULL;
+        ins->pending_cap = 0;
+    }
+    ins->pending_rows = keep;
+    ins->pending_bytes = 0;
+    for (size_t i = 0; i < (size_t) keep * ins->nparam; i++)
+    {
+        if (ins->pending_types[i] == TDENGINE_STRING)
+            ins->pending_bytes += strlen(ins->pending_values[i].s) + 1;
+        else
+            ins->pending_bytes += sizeof(TDengineValue);
+    }
+
+    return position < ins->sent_rows ? ins->sent_rows - position : 0;
+}
+
+/*
+ * TDengineInsertFlush
+ *      发送写入缓冲区中的所有行，并等待所有写入返回
+ *
+ * 返回最先出现的错误，错误信息在调用方的内存上下文中分配。
+ */
+extern "C" char *
+TDengineInsertFlush(TDengineInsertStmt *ins)
+{
+    char *err;
+    char *wait_err;
+
+    if (ins == NULL)
+        return NULL;
+
+    err = tdengine_insert_send(ins);
+    wait_err = tdengine_insert_wait(ins);
+
+    return err != NULL ? err : wait_err;
+}
+
+/*
+ * TDengineInsertClose
+ *      关闭插入语句
+ */
+extern "C" void
+TDengineInsertClose(TDengineInsertStmt *ins)
+{
+    if (ins == NULL)
+        return;
+
+    tdengine_insert_reset_callback(ins);
+}
+
+/*
+ * tdengine_schemaless_precision
+ *      把schemaless_precision选项换算为行协议写入的时间戳精度
+ */
+static int
+tdengine_schemaless_precision(const char *precision)
+{
+    if (strcmp(precision, "h") == 0)
+        return WS_TSDB_SML_TIMESTAMP_HOURS;
+    if (strcmp(precision, "m") == 0)
+        return WS_TSDB_SML_TIMESTAMP_MINUTES;
+    if (strcmp(precision, "s") == 0)
+        return WS_TSDB_SML_TIMESTAMP_SECONDS;
+    if (strcmp(precision, "ms") == 0)
+        return WS_TSDB_SML_TIMESTAMP_MILLI_SECONDS;
+    if (strcmp(precision, "ns") == 0)
+        return WS_TSDB_SML_TIMESTAMP_NANO_SECONDS;
+    return WS_TSDB_SML_TIMESTAMP_MICRO_SECONDS;
+}
+
+/*
+ * TDengineSchemalessInsert
+ *      以InfluxDB行协议写入一批记录
+ *
+ * lines中每条记录占一行，时间戳按opts->schemaless_precision换算。
+ * 子表和新出现的列由服务端自动创建，不需要逐列绑定。
+ *
+ * 与查询一样由后台线程写入，后端在锁存器上等待，期间可以响应取消请求、
+ * statement_timeout和query_timeout。记录复制给后台线程，放弃等待时
+ * 连接移出缓存，线程返回后才关闭。无法创建线程时在后端中直接写入。
+ */
+extern "C" char *
+TDengineSchemalessInsert(char *lines, int len, UserMapping *user, tdengine_opt *opts)
+{
+    WS_TAOS *conn;
+    TDenginePendingQuery *pq = NULL;
+    TDengineWaitStatus status;
+    WS_RES *res;
+    char *err = NULL;
+
+    if (len <= 0)
+        return NULL;
+
+    conn = tdengine_get_connection(user, opts);
+    try
+    {
+        pq = new TDenginePendingQuery();
+        pq->conn = conn;
+        pq->sql.assign(lines, len);
+        pq->sml_precision = tdengine_schemaless_precision(opts->schemaless_precision);
+        tdengine_pending_query_set_target(pq, opts);
+        if (pipe(pq->pipefd) != 0)
+            throw std::runtime_error("could not create pipe");
+        (void) fcntl(pq->pipefd[0], F_SETFL, O_NONBLOCK);
+        (void) fcntl(pq->pipefd[0], F_SETFD, FD_CLOEXEC);
+        (void) fcntl(pq->pipefd[1], F_SETFD, FD_CLOEXEC);
+        pq->worker = tdengine_spawn_thread(tdengine_pending_query_worker, pq);
+    }
+    catch (...)
+    {
+        int32_t total = 0;
+
+        if (pq != NULL)
+            tdengine_pending_query_discard(pq);
+
+        res = ws_schemaless_insert_raw(conn, lines, len, &total, WS_TSDB_SML_LINE_PROTOCOL,
+                                       tdengine_schemaless_precision(opts->schemaless_precision));
+        if (ws_errno(res) != 0)
+            err = pstrdup(ws_errstr(res));
+        ws_free_result(res);
+        return err;
+    }
+
+    status = tdengine_pending_query_wait(pq, tdengine_deadline(opts->query_timeout));
+    if (status != TDENGINE_WAIT_READY)
+    {
+        tdengine_pending_query_abandon(pq);
+        return tdengine_wait_error(status);
+    }
+
+    res = tdengine_pending_query_finish(pq, &err);
+    if (res != NULL)
+    {
+        if (ws_errno(res) != 0)
+            err = pstrdup(ws_errstr(res));
+        ws_free_result(res);
+    }
+
+    return err;
+}
+
+/*
+ * tdengine_connect_interruptible
+ *      由后台线程建立连接，后端在锁存器上等待
+ *
+ * 超过connect_timeout(毫秒，0表示不限)或收到取消请求时放弃这次连接，
+ * 后台线程在ws_connect返回后自行关闭连接。失败时返回NULL并设置*error。
+ */
+WS_TAOS *
+tdengine_connect_interruptible(const char *dsn, int connect_timeout, char **error)
+{
+    TDenginePendingQuery *pq = NULL;
+    TDengineWaitStatus status;
+    WS_TAOS *taos;
+
+    try
+    {
+        pq = new TDenginePendingQuery();
+        pq->dsn = dsn;
+        if (pipe(pq->pipefd) != 0)
+            throw std::runtime_error("could not create pipe");
+        (void) fcntl(pq->pipefd[0], F_SETFL, O_NONBLOCK);
+        (void) fcntl(pq->pipefd[0], F_SETFD, FD_CLOEXEC);
+        (void) fcntl(pq->pipefd[1], F_SETFD, FD_CLOEXEC);
+        pq->worker = tdengine_spawn_thread(tdengine_pending_query_worker, pq);
+    }
+    catch (...)
+    {
+        if (pq != NULL)
+            tdengine_pending_query_discard(pq);
+
+        /* 无法创建线程时在后端中直接连接 */
+        taos = ws_connect(dsn);
+        if (taos == NULL)
+            *error = pstrdup(ws_errstr(NULL));
+        return taos;
+    }
+
+    status = tdengine_pending_query_wait(pq, tdengine_deadline(connect_timeout));
+    if (status != TDENGINE_WAIT_READY)
+    {
+        tdengine_pending_query_abandon(pq);
+        *error = pstrdup(status == TDENGINE_WAIT_TIMEOUT ?
+                         "connect_timeout expired" : "connection attempt was canceled");
+        return NULL;
+    }
+
+    tdengine_pending_query_join(pq);
+    taos = pq->taos;
+    pq->taos = NULL;
+    if (taos == NULL)
+        *error = pstrdup(pq->error.c_str());
+    tdengine_pending_query_discard(pq);
+
+    return taos;
+}
+
+/*
+ * TDengineFreeResult
+ *      释放TDengineQuery/TDengineCursorFetch返回的结果集
+ *
+ * 列名归游标所有，不在此释放。
+ */
+extern "C" void
+TDengineFreeResult(TDengineResult *result)
+{
+    if (result == NULL)
+        return;
+
+    for (int i = 0; i < result->nrow; i++)
+    {
+        for (int j = 0; j < result->ncol; j++)
+        {
+            if (result->rows[i].tuple[j] != NULL)
+                pfree(result->rows[i].tuple[j]);
+        }
+        pfree(result->rows[i].tuple);
+    }
+    if (result->rows != NULL)
+        pfree(result->rows);
+    pfree(result);
+}
@@ -41,6 +41,76 @@ typedef struct TDengineRow
     char **tuple; // 元组数据数组
 } TDengineRow;
 
+/*
+ * 结果数据块中的一列
+ *
+ * 指向原始数据块中的类型化列缓冲区，不做任何拷贝和文本格式化：
+ *   - 定长类型: nulls为空值位图(置位表示NULL，高位在前)，data为值数组
+ *   - 变长类型: offsets为每行在data中的偏移(-1表示NULL)，
+ *     每个值以2字节长度开头，后跟实际内容
+ *   - 无法直接解码的类型: 退化为values/lengths逐行保存的值指针
+ * 原始数据块中的缓冲区不保证对齐，读取时统一使用memcpy。
+ */
+typedef struct TDengineColumn
+{
+    int type;            /* TDengine数据类型(TSDB_DATA_TYPE_*) */
+    int bytes;           /* 定长类型每个值的字节数 */
+    const char *data;    /* 值数组或变长数据区 */
+    const char *nulls;   /* 定长类型的空值位图 */
+    const char *offsets; /* 变长类型的偏移数组(int32) */
+    const char **values; /* 退化模式下逐行的值指针，NULL表示空值 */
+    uint32 *lengths;     /* 退化模式下逐行的值长度 */
+} TDengineColumn;
+
+/* 表示一个结果数据块，列缓冲区在拉取下一个数据块之前有效 */
+typedef struct TDengineBlock
+{
+    int nrow;             /* 行数，0表示结果已读完 */
+    int ncol;             /* 列数 */
+    int precision;        /* 时间戳精度: 0毫秒/1微秒/2纳秒 */
+    char **columns;       /* 列名数组 */
+    TDengineColumn *cols; /* 列数据数组 */
+} TDengineBlock;
+
+/* 判断列中第row行的值是否为NULL */
+static inline bool
+tdengine_column_isnull(const TDengineColumn *col, int row)
+{
+    int32 offset;
+
+    if (col->values != NULL)
+        return col->values[row] == NULL;
+    if (col->offsets != NULL)
+    {
+        memcpy(&offset, col->offsets + sizeof(int32) * row, sizeof(int32));
+        return offset < 0;
+    }
+    return (((const uint8 *) col->nulls)[row >> 3] & (1u << (7 - (row & 7)))) != 0;
+}
+
+/* 取得列中第row行的值及其长度(调用前须确认非NULL) */
+static inline const char *
+tdengine_column_value(const TDengineColumn *col, int row, uint32 *len)
+{
+    int32 offset;
+    uint16 vlen;
+
+    if (col->values != NULL)
+    {
+        *len = col->lengths[row];
+        return col->values[row];
+    }
+    if (col->offsets != NULL)
+    {
+        memcpy(&offset, col->offsets + sizeof(int32) * row, sizeof(int32));
+        memcpy(&vlen, col->data + offset, sizeof(uint16));
+        *len = vlen;
+        return col->data + offset + sizeof(uint16);
+    }
+    *len = col->bytes;
+    return col->data + (size_t) col->bytes * row;
+}
+
 /* 表示 TDengine 查询结果集的信息 */
 typedef struct TDengineResult
 {
@@ -83,6 +153,33 @@ struct TDengineQuery_return
     char *r1;           // 错误信息
 };
 
+/* 流式游标句柄(定义在query.cpp中，对C代码不透明) */
+typedef struct TDengineCursor TDengineCursor;
+
+/* TDengineCursorFetchBlock 函数的返回类型 */
+struct TDengineBlock_return
+{
+    TDengineBlock *r0; // 数据块
+    char *r1;          // 错误信息
+};
+
+/* TDengineCursorOpen 函数的返回类型 */
+struct TDengineCursorOpen_return
+{
+    TDengineCursor *r0; // 已打开的游标
+    char *r1;           // 错误信息
+};
+
+/* 插入用的预编译语句句柄(定义在query.cpp中，对C代码不透明) */
+typedef struct TDengineInsertStmt TDengineInsertStmt;
+
+/* TDengineInsertPrepare 函数的返回类型 */
+struct TDengineInsertPrepare_return
+{
+    TDengineInsertStmt *r0; // 已准备的插入语句
+    char *r1;               // 错误信息
+};
+
 /* 执行 TDengine 的 DDL 命令。
    参数依次为：地址、端口、用户名、密码、数据库名、DDL 查询语句、版本、认证令牌、保留策略
    返回值为错误信息字符串，如果执行成功则可能返回空指针。
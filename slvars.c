@@ -5,6 +5,7 @@
  #include "parser/parse_oper.h"
  #include "parser/parse_type.h"
  #include "utils/builtins.h"
+ #include "utils/jsonb.h"
  #include "utils/lsyscache.h"
  #include "utils/syscache.h"
  #include "tdengine_fdw.h"
@@ -596,4 +597,253 @@ tdengine_is_att_dropped(Oid relid, AttrNumber attnum)
          attnum++;
      }
  }
- 
\ No newline at end of file
+ 
+
+/*
+ * tdengine_slvar_to_jsonb: 由数据块中一行的若干列直接构造jsonb值
+ *
+ * 参数:
+ *   @block: 当前数据块
+ *   @row: 行号
+ *   @nkeys: 键数
+ *   @key_colidx: 每个键对应的结果列下标
+ *   @keys: 键名
+ *   @keep_nulls: true时NULL值写为json null，false时跳过该键
+ *   @is_null: 输出参数，没有写入任何键时为true
+ *
+ * 注意事项:
+ *   - 值统一作为json字符串写入，与tags/fields列的"->>"取值方式一致
+ *   - 直接调用pushJsonbValue构造，不经过JSON文本的转义和jsonb_in解析
+ */
+Datum
+tdengine_slvar_to_jsonb(const TDengineBlock *block, int row, int nkeys, const int *key_colidx,
+                        char *const *keys, bool keep_nulls, bool *is_null)
+{
+    JsonbParseState *state = NULL;
+    JsonbValue *result;
+    int nitems = 0;
+    int i;
+
+    pushJsonbValue(&state, WJB_BEGIN_OBJECT, NULL);
+    for (i = 0; i < nkeys; i++)
+    {
+        const TDengineColumn *col = &block->cols[key_colidx[i]];
+        JsonbValue key;
+        JsonbValue val;
+
+        if (tdengine_column_isnull(col, row))
+        {
+            if (!keep_nulls)
+                continue;
+            val.type = jbvNull;
+        }
+        else if (col->type == TSDB_DATA_TYPE_BINARY ||
+                 (col->type == TSDB_DATA_TYPE_NCHAR && col->values != NULL))
+        {
+            /* UTF-8文本直接引用数据块中的值，由JsonbValueToJsonb复制 */
+            uint32 len;
+
+            val.type = jbvString;
+            val.val.string.val = (char *)tdengine_column_value(col, row, &len);
+            val.val.string.len = len;
+        }
+        else
+        {
+            val.type = jbvString;
+            val.val.string.val = tdengine_column_to_cstring(col, row, block->precision);
+            val.val.string.len = strlen(val.val.string.val);
+        }
+
+        key.type = jbvString;
+        key.val.string.val = keys[i];
+        key.val.string.len = strlen(keys[i]);
+
+        pushJsonbValue(&state, WJB_KEY, &key);
+        pushJsonbValue(&state, WJB_VALUE, &val);
+        nitems++;
+    }
+    result = pushJsonbValue(&state, WJB_END_OBJECT, NULL);
+
+    *is_null = (nitems == 0);
+    if (nitems == 0)
+        return (Datum)0;
+
+    return JsonbPGetDatum(JsonbValueToJsonb(result));
+}
+
+/*
+ * tdengine_line_append_escaped: 按行协议的规则转义并追加一段文本
+ *
+ * 参数:
+ *   @buf: 输出缓冲区
+ *   @str: 文本(不要求以'\0'结尾)
+ *   @len: 文本长度
+ *   @special: 需要加反斜杠的字符
+ */
+static void
+tdengine_line_append_escaped(StringInfo buf, const char *str, int len, const char *special)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (strchr(special, str[i]) != NULL)
+            appendStringInfoChar(buf, '\\');
+        appendStringInfoChar(buf, str[i]);
+    }
+}
+
+/*
+ * tdengine_line_check_text: 行协议以换行分隔记录，键和值中不能出现换行，转义也无济于事
+ */
+static void
+tdengine_line_check_text(const char *str, int len, const char *what, const char *key, int keylen)
+{
+    if (memchr(str, '\n', len) != NULL)
+        elog(ERROR, "tdengine_fdw : %s \"%.*s\" contains a newline, which the line protocol cannot carry",
+             what, keylen, key);
+}
+
+/*
+ * tdengine_line_append_pairs: 把jsonb对象的各个键值追加为行协议的key=value列表
+ *
+ * 参数:
+ *   @buf: 输出缓冲区
+ *   @jb: jsonb对象
+ *   @is_fields: true时按字段的写法输出值，false时按标签输出
+ *
+ * 返回值:
+ *   写入的键值对个数
+ *
+ * 注意事项:
+ *   - 标签值一律按文本写入；字段值中数字写为双精度，布尔写为t/f，
+ *     字符串加双引号，嵌套的对象和数组以json文本作为字符串写入
+ *   - json null的键被跳过，由TDengine写为NULL；值为空串的标签同样跳过，
+ *     行协议中"k="不是合法的标签
+ *   - 键、标签值和字段的字符串值中含有换行时报错
+ */
+static int
+tdengine_line_append_pairs(StringInfo buf, Jsonb *jb, bool is_fields)
+{
+    JsonbIterator *it;
+    JsonbValue  v;
+    JsonbIteratorToken r;
+    char       *key = NULL;
+    int         keylen = 0;
+    int         npairs = 0;
+
+    if (!JB_ROOT_IS_OBJECT(jb))
+        elog(ERROR, "tdengine_fdw : %s column must be a jsonb object in schemaless mode",
+             is_fields ? "fields" : "tags");
+
+    it = JsonbIteratorInit(&jb->root);
+    while ((r = JsonbIteratorNext(&it, &v, true)) != WJB_DONE)
+    {
+        char   *text;
+        int     textlen;
+
+        if (r == WJB_KEY)
+        {
+            key = v.val.string.val;
+            keylen = v.val.string.len;
+            continue;
+        }
+        if (r != WJB_VALUE || v.type == jbvNull)
+            continue;
+
+        switch (v.type)
+        {
+            case jbvString:
+                text = v.val.string.val;
+                textlen = v.val.string.len;
+                break;
+            case jbvNumeric:
+                text = DatumGetCString(DirectFunctionCall1(numeric_out, NumericGetDatum(v.val.numeric)));
+                textlen = strlen(text);
+                break;
+            case jbvBool:
+                text = v.val.boolean ? "true" : "false";
+                textlen = strlen(text);
+                break;
+            default:
+                text = JsonbToCString(NULL, v.val.binary.data, v.val.binary.len);
+                textlen = strlen(text);
+                break;
+        }
+
+        /* 空串标签写出来是"k="，与json null一样跳过 */
+        if (!is_fields && textlen == 0)
+            continue;
+
+        if (keylen == 0)
+            elog(ERROR, "tdengine_fdw : %s column contains an empty key", is_fields ? "fields" : "tags");
+        tdengine_line_check_text(key, keylen, "key", key, keylen);
+        tdengine_line_check_text(text, textlen, is_fields ? "value of field" : "value of tag", key, keylen);
+
+        if (npairs > 0)
+            appendStringInfoChar(buf, ',');
+        tdengine_line_append_escaped(buf, key, keylen, ",= ");
+        appendStringInfoChar(buf, '=');
+
+        if (!is_fields)
+            tdengine_line_append_escaped(buf, text, textlen, ",= ");
+        else if (v.type == jbvNumeric)
+            appendBinaryStringInfo(buf, text, textlen);
+        else if (v.type == jbvBool)
+            appendStringInfoChar(buf, v.val.boolean ? 't' : 'f');
+        else
+        {
+            appendStringInfoChar(buf, '"');
+            tdengine_line_append_escaped(buf, text, textlen, "\"\\");
+            appendStringInfoChar(buf, '"');
+        }
+        npairs++;
+    }
+
+    return npairs;
+}
+
+/*
+ * tdengine_slvar_append_line: 把无模式表的一行写为一条InfluxDB行协议记录
+ *
+ * 参数:
+ *   @buf: 输出缓冲区，记录之间以换行分隔
+ *   @measurement: 远程表名
+ *   @tags_datum/@tags_isnull: tags列的值
+ *   @fields_datum/@fields_isnull: fields列的值，必须至少有一个非空的键
+ *   @has_time: 是否写入时间戳，false时由服务端取当前时间
+ *   @timestamp: 按schemaless_precision换算后的时间戳
+ *
+ * 注意事项:
+ *   - 格式为"measurement,tag=v,... field=v,... timestamp"
+ *   - 子表和新出现的列由TDengine在服务端自动创建
+ */
+void
+tdengine_slvar_append_line(StringInfo buf, const char *measurement,
+                           Datum tags_datum, bool tags_isnull, Datum fields_datum, bool fields_isnull,
+                           bool has_time, int64 timestamp)
+{
+    Jsonb  *tags = tags_isnull ? NULL : DatumGetJsonbP(tags_datum);
+    Jsonb  *fields = fields_isnull ? NULL : DatumGetJsonbP(fields_datum);
+    int     start;
+
+    if (buf->len > 0)
+        appendStringInfoChar(buf, '\n');
+
+    tdengine_line_append_escaped(buf, measurement, strlen(measurement), ", ");
+    if (tags != NULL && JB_ROOT_COUNT(tags) > 0)
+    {
+        appendStringInfoChar(buf, ',');
+        start = buf->len;
+        if (tdengine_line_append_pairs(buf, tags, false) == 0)
+            buf->len = start - 1;   /* 标签全为NULL或空串，去掉逗号 */
+        buf->data[buf->len] = '\0';
+    }
+
+    appendStringInfoChar(buf, ' ');
+    if (fields == NULL || tdengine_line_append_pairs(buf, fields, true) == 0)
+        elog(ERROR, "tdengine_fdw : fields column must have at least one non-null key in schemaless mode");
+
+    if (has_time)
+        appendStringInfo(buf, " " INT64_FORMAT, timestamp);
+}
@@ -11,9 +11,9 @@
 
 #include "utils/rel.h"
 
-/* 等待超时时间设置(毫秒)，0表示无限等待 */
+/* 建立连接的默认超时时间(毫秒)，0表示无限等待，可由connect_timeout选项覆盖 */
 #define WAIT_TIMEOUT 0
-/* 交互式查询超时时间设置(毫秒)，0表示不超时 */
+/* 远程查询的默认超时时间(毫秒)，0表示不超时，可由query_timeout选项覆盖 */
 #define INTERACTIVE_TIMEOUT 0
 
 /* TDengine兼容模式下的时间列名定义 */
@@ -61,6 +61,44 @@
 
 #define CODE_VERSION 20200
 
+/* 流式扫描每批从远程拉取的默认行数 */
+#define TDENGINE_DEFAULT_FETCH_SIZE 10000
+
+/* 无模式写入默认的时间戳精度，与PostgreSQL时间戳的精度一致 */
+#define TDENGINE_DEFAULT_SCHEMALESS_PRECISION "us"
+
+/* 写入缓冲区默认攒够的行数和字节数，达到其一即发送 */
+#define TDENGINE_DEFAULT_FLUSH_ROWS 10000
+#define TDENGINE_DEFAULT_FLUSH_BYTES (4 * 1024 * 1024)
+
+/* write_buffer选项: 插入的行缓冲到事务提交前再发送 */
+#define TDENGINE_WRITE_BUFFER_STATEMENT "statement"
+#define TDENGINE_WRITE_BUFFER_TRANSACTION "transaction"
+
+/* 批量插入时每批行数据的默认估算字节数上限 */
+#define TDENGINE_DEFAULT_BATCH_BYTES (4 * 1024 * 1024)
+
+/* 超级表扇出扫描最多同时使用的连接数 */
+#define TDENGINE_MAX_FANOUT_CONNECTIONS 64
+
+/*
+ * 扇出扫描一条查询中tbname IN条件的长度上限，远小于服务端1MB的语句长度上限，
+ * 为扫描语句的其余部分留出余量
+ */
+#define TDENGINE_FANOUT_MAX_CONDITION_LEN (256 * 1024)
+
+/* 按需借出的连接从此编号开始，供异步扫描、扇出扫描的各路查询和异步写入独占使用 */
+#define TDENGINE_LEASED_CONNECTION_SLOT 1
+
+/* 超级表扇出扫描合并各路结果的方式 */
+typedef enum TDengineFanoutMerge
+{
+    TDENGINE_FANOUT_DISABLED,  /* 查询不能拆分为多路 */
+    TDENGINE_FANOUT_UNORDERED, /* 各路结果任意交错 */
+    TDENGINE_FANOUT_TIME_ASC,  /* 按时间升序多路归并 */
+    TDENGINE_FANOUT_TIME_DESC, /* 按时间降序多路归并 */
+} TDengineFanoutMerge;
+
 /*
  * 用于存储 TDengine 服务器信息的选项结构体
  * TODO: 支持超级表
@@ -77,6 +115,20 @@ typedef struct tdengine_opt
     char *svr_password; /* TDengine 密码 */
     List *tags_list;    /* 外部表的标签键（若有其他业务需求保留，DSN 中无直接对应） */
     int schemaless;     /* 无模式模式（若有其他业务需求保留，DSN 中无直接对应） */
+    int fetch_size;     /* 扫描预取时缓冲的行数上限，按行物化结果时每批的行数 */
+    bool prefetch;      /* 扫描时是否在后台线程预取下一个数据块 */
+    int parallel_workers; /* 并行扫描的worker数，0表示不使用并行扫描 */
+    bool async_capable; /* 是否允许Append异步执行扫描 */
+    int fanout_connections; /* 超级表扇出扫描的并发连接数，0表示不扇出 */
+    int query_timeout;  /* 远程查询的超时时间(毫秒)，0表示不超时 */
+    int connect_timeout; /* 建立连接的超时时间(毫秒)，0表示无限等待 */
+    char *schemaless_precision; /* 无模式写入行协议的时间戳精度(h/m/s/ms/us/ns) */
+    int flush_rows;     /* 写入缓冲区攒够多少行后发送 */
+    int flush_bytes;    /* 写入缓冲区攒够多少字节后发送 */
+    int batch_bytes;    /* 批量插入时每批行数据的估算字节数上限 */
+    bool async_insert;  /* 是否由后台线程执行写入，与后端转换下一批重叠 */
+    char *write_buffer; /* 插入缓冲的范围(statement/transaction) */
+    int delete_chunk_interval; /* 直接DELETE按时间分块时每块的跨度(秒)，0表示不分块 */
 } tdengine_opt;
 
 typedef struct schemaless_info
@@ -88,6 +140,59 @@ typedef struct schemaless_info
     Oid relid; /* 关系的对象标识符（OID） */
 } schemaless_info;
 
+struct TDengineConvPlan;
+
+/* 将列中一行的值转换为Datum的专用例程，调用前须确认值非NULL */
+typedef Datum (*TDengineConvertFunc)(const TDengineColumn *col, int row, int precision,
+                                     struct TDengineConvPlan *plan);
+
+/*
+ * 星号/正则聚合结果的复合类型构造计划
+ *
+ * 复合类型各属性与结果列的对应关系(functionname_column -> 属性)在拉到
+ * 第一个数据块时计算一次，之后每行按类型化的值直接构造元组。
+ */
+typedef struct TDengineRecordPlan
+{
+    TupleDesc tupdesc;                  /* 复合类型的元组描述符 */
+    int *colidx;                        /* 每个属性对应的结果列下标，-1表示NULL */
+    struct TDengineConvPlan *attplans;  /* 每个属性的类型转换计划 */
+    int fields_att;                     /* 无模式表fields属性下标，-1表示非无模式表 */
+    int nkeys;                          /* fields中的键数 */
+    int *key_colidx;                    /* 每个键对应的结果列下标 */
+    char **keys;                        /* 去掉函数名前缀后的键名 */
+    Datum *values;                      /* 构造元组时复用的值数组 */
+    bool *nulls;                        /* 构造元组时复用的空值数组 */
+} TDengineRecordPlan;
+
+/*
+ * 扫描的类型转换计划，每个retrieved_attrs属性一项
+ *
+ * 在BeginForeignScan中解析PostgreSQL侧的类型信息，拉到第一个数据块、
+ * 得知TDengine列类型后再选定专用的转换例程，逐行转换时不再访问系统目录。
+ */
+typedef struct TDengineConvPlan
+{
+    int attnum;                  /* 目标属性下标(从0开始) */
+    Oid pgtype;                  /* 目标类型 */
+    int32 pgtypmod;              /* 目标类型修饰符 */
+    FmgrInfo input_func;         /* 目标类型的文本输入函数 */
+    Oid typioparam;              /* 文本输入函数的类型参数 */
+    int colidx;                  /* 对应的结果列下标，-1表示无对应列 */
+    bool is_slvar;               /* 是否为无模式表的tags/fields列 */
+    bool is_tags;                /* 无模式列是否为tags列 */
+    bool is_record;              /* 是否为星号/正则聚合返回的复合类型 */
+    char *opername;              /* 复合类型对应的函数名 */
+    int ntags;                   /* 复合类型中的标签列数 */
+    int nfield;                  /* 复合类型中的字段列数 */
+    TDengineRecordPlan *record;  /* 复合类型构造计划，映射结果列后建立 */
+    int nkeys;                   /* 无模式列中的键数 */
+    int *key_colidx;             /* 无模式列每个键对应的结果列下标 */
+    char **keys;                 /* 无模式列的键名 */
+    int tdtype;                  /* 已绑定的TDengine类型，-1表示尚未绑定 */
+    TDengineConvertFunc convert; /* 已选定的转换例程 */
+} TDengineConvPlan;
+
 /*
  * 用于 ForeignScanState 中 fdw_state 的特定于 FDW 的信息
  */
@@ -110,6 +215,7 @@ typedef struct TDengineFdwExecState
     TDengineValue *param_tdengine_values;  /* 用于 TDengine 的参数值 */
     TDengineColumnInfo *param_column_info; /* 列的信息 */
     int p_nums;                            /* 要传输的参数数量 */
+    int p_slots;                           /* 参数数组可容纳的行数 */
     FmgrInfo *p_flinfo;                    /* 参数的输出转换函数 */
 
     tdengine_opt *tdengineFdwOptions; /* TDengine FDW 选项 */
@@ -139,7 +245,45 @@ typedef struct TDengineFdwExecState
     /* 无模式信息 */
     schemaless_info slinfo;
 
-    void *temp_result;
+    void *temp_result;      /* 当前数据块(TDengineBlock) */
+
+    /* 流式扫描 */
+    TDengineCursor *cursor; /* 远程游标，NULL表示尚未打开 */
+    bool eof_reached;       /* 远程结果是否已读完 */
+    bool async_capable;     /* 是否由Append异步执行 */
+    char *bounds_query;     /* 并行扫描的时间范围查询，非并行计划为NULL */
+    bool query_has_where;   /* 扫描语句是否已有WHERE子句 */
+    struct TDengineParallelScanState *pscan; /* 并行扫描的共享状态(DSM) */
+    char *chunk_query;      /* 当前时间块的扫描语句 */
+    int cond_pos;           /* 扫描语句中附加条件的插入位置 */
+    TDengineFanoutMerge fanout_merge; /* 超级表扇出扫描的结果合并方式 */
+    struct TDengineFanoutState *fanout; /* 扇出扫描的各路游标，NULL表示单路扫描 */
+    List *fanout_tables;    /* 超级表的子表名，扫描期间只查询一次 */
+    bool fanout_listed;     /* 是否已查询过子表 */
+    MemoryContext cursor_cxt; /* 保存游标的上下文，关闭游标时重置 */
+    MemoryContext batch_cxt;  /* 保存当前数据块描述信息的上下文，每块重置 */
+    TDengineConvPlan *conv_plan; /* 类型转换计划，与retrieved_attrs一一对应 */
+    int nconv_plan;              /* 转换计划项数 */
+    bool conv_plan_mapped;       /* 结果列映射是否已建立 */
+
+    /*
+     * 重扫复用: 参数不变时回放上一轮的完整结果，不再查询远程。
+     * 第一次以不变的参数重扫时才开始缓存，只扫描一次或每次参数都变化的扫描不缓存。
+     */
+    bool rescan_capable;         /* 扫描是否可能被重扫，决定能否缓存结果 */
+    struct Tuplestorestate *rescan_store; /* 缓存的结果，NULL表示尚未开始缓存 */
+    TupleTableSlot *rescan_slot; /* 从缓存读取元组的槽 */
+    bool rescan_fill;            /* 本轮扫描是否写入缓存 */
+    bool rescan_complete;        /* 缓存中是否已是完整结果 */
+    bool rescan_replay;          /* 本轮扫描是否从缓存回放 */
+    char **rescan_params;        /* 缓存结果对应的参数文本值 */
+
+    /* 插入: 修改状态存续期间复用的预编译语句，自带写入缓冲区 */
+    TDengineInsertStmt *insert_stmt;
+    struct TDengineXactInsert *xact_insert; /* 事务级写缓冲区中的语句，NULL表示语句结束时发送 */
+    StringInfo insert_lines;     /* 无模式表尚未发送的行协议记录 */
+    int insert_line_rows;        /* insert_lines中的记录数 */
+    bool is_update;              /* UPDATE以覆盖写实现，时间列和标签列取自行标识列 */
 } TDengineFdwExecState;
 
 typedef struct TDengineFdwRelationInfo
@@ -191,8 +335,6 @@ typedef struct TDengineFdwRelationInfo
     ForeignServer *server;
     UserMapping *user; /* 仅在使用远程估计模式下设置 */
 
-    int fetch_size; /* 此远程表的获取大小 */
-
     /*
      * 关系的名称，用于在 EXPLAIN ForeignScan 时使用。它用于连接和上层关系，但会为所有关系设置。
      * 对于基础关系，这实际上只是 RT 索引的字符串表示；我们在生成 EXPLAIN 输出时会进行转换。
@@ -213,6 +355,13 @@ typedef struct TDengineFdwRelationInfo
     /* 分组信息 */
     List *grouped_tlist;
 
+    /*
+     * 为 true 表示以 LAST_ROW 取每个分区最新的一行，分区键之外的列
+     * 反解析为 LAST_ROW(列)；分区键为空时对整个扫描取一行
+     */
+    bool last_row;
+    List *last_row_partition; /* PARTITION BY 的表达式列表 */
+
     /* 子查询信息 */
     bool make_outerrel_subquery; /* 我们是否将外部关系解析为子查询？ */
     bool make_innerrel_subquery; /* 我们是否将内部关系解析为子查询？ */
@@ -226,6 +375,12 @@ typedef struct TDengineFdwRelationInfo
     /* 目标列表中的函数下推支持 */
     bool is_tlist_func_pushdown;
 
+    /* 是否允许Append异步执行 */
+    bool async_capable;
+
+    /* 并行扫描的worker数，0表示不生成并行路径 */
+    int parallel_workers;
+
     /* 为 true 表示目标列表中除了时间列之外的所有列 */
     bool all_fieldtag;
     /* 无模式信息 */
@@ -246,7 +401,9 @@ extern bool tdengine_is_foreign_function_tlist(PlannerInfo *root,
 /* option.c headers */
 
 extern tdengine_opt *tdengine_get_options(Oid foreigntableid, Oid userid);
+extern int64 tdengine_schemaless_time_unit(const char *precision);
 extern void tdengine_deparse_insert(StringInfo buf, PlannerInfo *root, Index rtindex, Relation rel, List *targetAttrs);
+extern void tdengine_deparse_stable_insert(StringInfo buf, Relation rel, List *targetAttrs);
 extern void tdengine_deparse_update(StringInfo buf, PlannerInfo *root, Index rtindex, Relation rel, List *targetAttrs, List *attname);
 extern void tdengine_deparse_delete(StringInfo buf, PlannerInfo *root, Index rtindex, Relation rel, List *attname);
 extern bool tdengine_deparse_direct_delete_sql(StringInfo buf, PlannerInfo *root,
@@ -255,14 +412,19 @@ extern bool tdengine_deparse_direct_delete_sql(StringInfo buf, PlannerInfo *root
                                                List *remote_conds,
                                                List **params_list,
                                                List **retrieved_attrs);
-extern void tdengine_deparse_drop_measurement_stmt(StringInfo buf, Relation rel);
+extern void tdengine_deparse_truncate(StringInfo buf, StringInfo bounds, Relation rel);
 
 /* deparse.c headers */
 
 extern void tdengine_deparse_select_stmt_for_rel(StringInfo buf, PlannerInfo *root, RelOptInfo *rel,
                                                  List *tlist, List *remote_conds, List *pathkeys,
                                                  bool is_subquery, List **retrieved_attrs,
-                                                 List **params_list, bool has_limit);
+                                                 List **params_list, bool has_limit, int *cond_pos);
+extern void tdengine_deparse_time_bounds(StringInfo buf, PlannerInfo *root, RelOptInfo *rel,
+                                         List *remote_conds, List **params_list);
+extern TDengineFanoutMerge tdengine_fanout_merge_for_pathkeys(PlannerInfo *root, RelOptInfo *rel,
+                                                              List *pathkeys);
+extern bool tdengine_is_time_pathkey(PlannerInfo *root, RelOptInfo *rel, PathKey *pathkey);
 extern void tdengine_deparse_analyze(StringInfo buf, char *dbname, char *relname);
 extern void tdengine_deparse_string_literal(StringInfo buf, const char *val);
 extern List *tdengine_build_tlist_to_deparse(RelOptInfo *foreignrel);
@@ -287,11 +449,21 @@ extern char *tdengine_get_slvar(Expr *node, schemaless_info *slinfo);
 extern bool tdengine_is_slvar(Oid oid, int attnum, schemaless_info *pslinfo, bool *is_tags, bool *is_fields);
 extern bool tdengine_is_slvar_fetch(Node *node, schemaless_info *pslinfo);
 extern bool tdengine_is_param_fetch(Node *node, schemaless_info *pslinfo);
+extern Datum tdengine_slvar_to_jsonb(const TDengineBlock *block, int row, int nkeys, const int *key_colidx,
+                                     char *const *keys, bool keep_nulls, bool *is_null);
+extern void tdengine_slvar_append_line(StringInfo buf, const char *measurement,
+                                       Datum tags, bool tags_isnull, Datum fields, bool fields_isnull,
+                                       bool has_time, int64 timestamp);
 
 /* tdengine_query.c headers */
 extern Datum tdengine_convert_to_pg(Oid pgtyp, int pgtypmod, char *value);
-extern Datum tdengine_convert_record_to_datum(Oid pgtyp, int pgtypmod, char **row, int attnum, int ntags, int nfield,
-											  char **column, char *opername, Oid relid, int ncol, bool is_schemaless);
+extern void tdengine_init_conv_plan(TDengineConvPlan *plan, int attnum, Oid pgtyp, int32 pgtypmod);
+extern void tdengine_bind_conv_plan(TDengineConvPlan *plan, const TDengineColumn *col);
+extern char *tdengine_column_to_cstring(const TDengineColumn *col, int row, int precision);
+extern void tdengine_build_record_plan(TDengineConvPlan *plan, const TDengineBlock *block,
+									   Oid relid, bool is_schemaless);
+extern void tdengine_bind_record_plan(TDengineConvPlan *plan, const TDengineBlock *block);
+extern Datum tdengine_record_to_datum(TDengineConvPlan *plan, const TDengineBlock *block, int row);
 
 extern void tdengine_bind_sql_var(Oid type, int attnum, Datum value, TDengineColumnInfo *param_column_info,
 								  TDengineType * param_tdengine_types, TDengineValue * param_tdengine_values);
@@ -305,8 +477,41 @@ extern void TDengineFreeSchemaInfo(struct TableInfo* tableInfo, long long length
 extern struct TDengineQuery_return TDengineQuery(char *query, UserMapping *user, tdengine_opt *opts, TDengineType* ctypes, TDengineValue* cvalues, int cparamNum);
 /* 释放查询结果内存 */
 extern void TDengineFreeResult(TDengineResult* result);
-/* 执行数据插入操作，成功返回NULL */
-extern char* TDengineInsert(char *table_name, UserMapping *user, tdengine_opt *opts, struct TDengineColumnInfo* ccolumns, TDengineType* ctypes, TDengineValue* cvalues, int cparamNum, int cnumSlots);
+/* 提交查询并打开流式游标，结果按需分批拉取 */
+extern struct TDengineCursorOpen_return TDengineCursorOpen(char *query, UserMapping *user, tdengine_opt *opts, TDengineType* ctypes, TDengineValue* cvalues, int cparamNum);
+/* 在后台线程中提交查询，立即返回尚未就绪的游标 */
+extern struct TDengineCursorOpen_return TDengineCursorOpenAsync(char *query, UserMapping *user, tdengine_opt *opts, TDengineType* ctypes, TDengineValue* cvalues, int cparamNum);
+/* 游标的远程查询是否已返回 */
+extern bool TDengineCursorReady(TDengineCursor *cursor);
+/* 异步查询完成时变为可读的文件描述符 */
+extern int TDengineCursorEventFd(TDengineCursor *cursor);
+/* 等待异步查询返回并取回结果，失败时返回错误信息 */
+extern char *TDengineCursorWait(TDengineCursor *cursor);
+/* 从游标拉取下一个列格式的数据块，返回0行表示结果已读完 */
+extern struct TDengineBlock_return TDengineCursorFetchBlock(TDengineCursor *cursor);
+/* 从游标拉取至多max_rows行，返回0行表示结果已读完 */
+extern struct TDengineQuery_return TDengineCursorFetch(TDengineCursor *cursor, int max_rows);
+/* 为游标请求后台预取(第二个数据块起生效)，缓冲的行数不超过fetch_size，不支持时返回false */
+extern bool TDengineCursorStartPrefetch(TDengineCursor *cursor, int fetch_size);
+/* 关闭游标并释放远程结果集，结果未读完时停止远程查询 */
+extern void TDengineCursorClose(TDengineCursor *cursor);
+/* 执行时间范围查询，返回按数据库精度的原始时间戳，precision不为NULL时返回该精度(0毫秒/1微秒/2纳秒) */
+extern char *TDengineQueryTimeBounds(char *query, UserMapping *user, tdengine_opt *opts, TDengineType* ctypes, TDengineValue* cvalues, int cparamNum,
+                                     int64 *lower, int64 *upper, bool *found, int *precision);
+/* 准备参数绑定的INSERT语句，using_stable时按标签值把各行路由到子表，语句在当前内存上下文重置时关闭 */
+extern struct TDengineInsertPrepare_return TDengineInsertPrepare(char *query, char *table_name, UserMapping *user, tdengine_opt *opts, struct TDengineColumnInfo* ccolumns, int cparamNum, bool using_stable);
+/* 把cnumSlots行参数追加到写入缓冲区，达到发送阈值时写入远程，异步写入时可能返回上一次写入的错误 */
+extern char* TDengineInsertAppend(TDengineInsertStmt *stmt, TDengineType* ctypes, TDengineValue* cvalues, int cnumSlots);
+/* 返回写入位置，即到目前为止追加的累计行数 */
+extern int64 TDengineInsertPosition(TDengineInsertStmt *stmt);
+/* 丢弃写入位置position之后仍在缓冲区中的行，返回其后已发起写入、无法撤回的行数 */
+extern int64 TDengineInsertRewind(TDengineInsertStmt *stmt, int64 position);
+/* 发送写入缓冲区中的所有行并等待所有写入返回，成功返回NULL */
+extern char* TDengineInsertFlush(TDengineInsertStmt *stmt);
+/* 关闭插入语句 */
+extern void TDengineInsertClose(TDengineInsertStmt *stmt);
+/* 以行协议写入无模式表，成功返回NULL */
+extern char* TDengineSchemalessInsert(char *lines, int len, UserMapping *user, tdengine_opt *opts);
 /* 检查可连接的TDengine版本信息 */
 extern int check_connected_tdengine_version(char* addr, int port, char* user, char* pass, char* db, char* auth_token, char* retention_policy);
 /* 清理所有客户端缓存连接 */
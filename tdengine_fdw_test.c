@@ -7,6 +7,8 @@
 #include "access/reloptions.h"
 #include "access/htup_details.h"
 #include "access/sysattr.h"
+#include "access/xact.h"
+#include "access/parallel.h"
 #include "foreign/fdwapi.h"
 #include "foreign/foreign.h"
 #include "optimizer/appendinfo.h"
@@ -31,6 +33,7 @@
 #include "utils/timestamp.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
+#include "utils/tuplestore.h"
 #include "catalog/pg_collation.h"
 #include "catalog/pg_foreign_server.h"
 #include "catalog/pg_foreign_table.h"
@@ -41,8 +44,10 @@
 #include "commands/defrem.h"
 #include "commands/explain.h"
 #include "commands/vacuum.h"
+#include "executor/execAsync.h"
 #include "storage/ipc.h"
 #include "storage/latch.h"
+#include "port/atomics.h"
 #include "miscadmin.h"
 #include "nodes/makefuncs.h"
 #include "nodes/nodeFuncs.h"
@@ -57,6 +62,9 @@
 extern PGDLLEXPORT void _PG_init(void);
 
 static void tdengine_fdw_exit(int code, Datum arg);
+static void tdengine_xact_callback(XactEvent event, void *arg);
+static void tdengine_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+                                      SubTransactionId parentSubid, void *arg);
 
 extern Datum tdengine_fdw_handler(PG_FUNCTION_ARGS);
 extern Datum tdengine_fdw_validator(PG_FUNCTION_ARGS);
@@ -80,6 +88,30 @@ static ForeignScan *tdengineGetForeignPlan(PlannerInfo *root,
                                            List *tlist,
                                            List *scan_clauses,
                                            Plan *outer_plan);
+// 为排序、LIMIT等上层关系生成下推到远程执行的路径
+static void tdengineGetForeignUpperPaths(PlannerInfo *root,
+                                         UpperRelationKind stage,
+                                         RelOptInfo *input_rel,
+                                         RelOptInfo *output_rel,
+                                         void *extra);
+static void tdengine_add_foreign_ordered_paths(PlannerInfo *root,
+                                               RelOptInfo *input_rel,
+                                               RelOptInfo *ordered_rel);
+static void tdengine_add_foreign_final_paths(PlannerInfo *root,
+                                             RelOptInfo *input_rel,
+                                             RelOptInfo *final_rel,
+                                             FinalPathExtraData *extra);
+static bool tdengine_is_safe_limit_expr(Node *expr);
+static void tdengine_add_foreign_distinct_paths(PlannerInfo *root,
+                                                RelOptInfo *input_rel,
+                                                RelOptInfo *distinct_rel);
+static bool tdengine_is_last_row_var(RelOptInfo *rel, Expr *expr);
+static void tdengine_add_last_row_path(PlannerInfo *root,
+                                       RelOptInfo *input_rel,
+                                       RelOptInfo *output_rel,
+                                       PathTarget *target,
+                                       List *partition,
+                                       double rows);
 // 获取执行ForeignScan算子所需的信息，并将它们组织并保存在ForeignScanState中
 static void tdengineBeginForeignScan(ForeignScanState *node,
                                      int eflags);
@@ -89,6 +121,109 @@ static TupleTableSlot *tdengineIterateForeignScan(ForeignScanState *node);
 static void tdengineReScanForeignScan(ForeignScanState *node);
 // 释放整个ForeignScan算子执行过程中占用的外部资源或FDW中的资源
 static void tdengineEndForeignScan(ForeignScanState *node);
+// 并行扫描: 判断外部表能否在并行worker中扫描
+static bool tdengineIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel,
+                                              RangeTblEntry *rte);
+// 并行扫描: 估算共享状态所需的DSM大小
+static Size tdengineEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt);
+// 并行扫描: leader切分时间范围并初始化共享状态
+static void tdengineInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt,
+                                             void *coordinate);
+// 并行扫描: 重扫前重置共享状态
+static void tdengineReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt,
+                                               void *coordinate);
+// 并行扫描: worker获取共享状态
+static void tdengineInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc,
+                                                void *coordinate);
+static bool tdengine_claim_chunk(ForeignScanState *node);
+static char *tdengine_query_with_condition(TDengineFdwExecState *festate, const char *cond);
+// 超级表扇出扫描: 按子表分组在多个连接上同时执行查询
+static bool tdengine_fanout_begin(ForeignScanState *node);
+static bool tdengine_fanout_next(ForeignScanState *node, TDengineBlock **block, int *rowidx);
+#if (PG_VERSION_NUM >= 140000)
+// 异步执行: 判断路径能否由Append异步执行
+static bool tdengineIsForeignPathAsyncCapable(ForeignPath *path);
+// 异步执行: 请求下一行，远程查询未返回时挂起
+static void tdengineForeignAsyncRequest(AsyncRequest *areq);
+// 异步执行: 注册等待远程查询完成的事件
+static void tdengineForeignAsyncConfigureWait(AsyncRequest *areq);
+// 异步执行: 远程查询完成后继续产生结果行
+static void tdengineForeignAsyncNotify(AsyncRequest *areq);
+static void produce_tuple_asynchronously(AsyncRequest *areq);
+#endif
+
+// 为UPDATE/DELETE添加标识列(时间列和标签列)
+static void tdengineAddForeignUpdateTargets(PlannerInfo *root,
+                                            Index rtindex,
+                                            RangeTblEntry *target_rte,
+                                            Relation target_relation);
+// 规划对外部表的INSERT/DELETE
+static List *tdenginePlanForeignModify(PlannerInfo *root,
+                                       ModifyTable *plan,
+                                       Index resultRelation,
+                                       int subplan_index);
+// 初始化修改操作的执行状态，INSERT在此准备预编译语句
+static void tdengineBeginForeignModify(ModifyTableState *mtstate,
+                                       ResultRelInfo *resultRelInfo,
+                                       List *fdw_private,
+                                       int subplan_index,
+                                       int eflags);
+// 插入一行
+static TupleTableSlot *tdengineExecForeignInsert(EState *estate,
+                                                 ResultRelInfo *resultRelInfo,
+                                                 TupleTableSlot *slot,
+                                                 TupleTableSlot *planSlot);
+#if (PG_VERSION_NUM >= 140000)
+// 批量插入多行
+static TupleTableSlot **tdengineExecForeignBatchInsert(EState *estate,
+                                                       ResultRelInfo *resultRelInfo,
+                                                       TupleTableSlot **slots,
+                                                       TupleTableSlot **planSlots,
+                                                       int *numSlots);
+// 获取批量插入的行数
+static int tdengineGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo);
+#endif
+// 更新一行，以覆盖写实现
+static TupleTableSlot *tdengineExecForeignUpdate(EState *estate,
+                                                 ResultRelInfo *resultRelInfo,
+                                                 TupleTableSlot *slot,
+                                                 TupleTableSlot *planSlot);
+// 删除一行
+static TupleTableSlot *tdengineExecForeignDelete(EState *estate,
+                                                 ResultRelInfo *resultRelInfo,
+                                                 TupleTableSlot *slot,
+                                                 TupleTableSlot *planSlot);
+// 结束修改操作，关闭预编译语句
+static void tdengineEndForeignModify(EState *estate,
+                                     ResultRelInfo *resultRelInfo);
+// 分区表插入(不支持)
+static void tdengineBeginForeignInsert(ModifyTableState *mtstate,
+                                       ResultRelInfo *resultRelInfo);
+static void tdengineEndForeignInsert(EState *estate,
+                                     ResultRelInfo *resultRelInfo);
+// 把条件只涉及时间列和标签列的DELETE整体下推
+static bool tdenginePlanDirectModify(PlannerInfo *root,
+                                     ModifyTable *plan,
+                                     Index resultRelation,
+                                     int subplan_index);
+static void tdengineBeginDirectModify(ForeignScanState *node, int eflags);
+static TupleTableSlot *tdengineIterateDirectModify(ForeignScanState *node);
+static void tdengineEndDirectModify(ForeignScanState *node);
+#if (PG_VERSION_NUM >= 140000)
+// 清空外部表
+static void tdengineExecForeignTruncate(List *rels,
+                                        DropBehavior behavior,
+                                        bool restart_seqs);
+#endif
+static ForeignScan *find_modifytable_subplan(PlannerInfo *root,
+                                             ModifyTable *plan,
+                                             Index rtindex,
+                                             int subplan_index);
+static void tdengine_execute_remote_delete(char *query, UserMapping *user, tdengine_opt *options,
+                                           TDengineType *types, TDengineValue *values, int nparams);
+static void tdengine_execute_delete(char *query, char *bounds_query, bool has_where,
+                                    UserMapping *user, tdengine_opt *options,
+                                    TDengineType *types, TDengineValue *values, int nparams);
 
 static void tdengine_to_pg_type(StringInfo str, char *typname);
 
@@ -115,13 +250,33 @@ static void process_query_params(ExprContext *econtext,
                                  TDengineColumnInfo *param_column_info);
 
 static void create_cursor(ForeignScanState *node);
+static void fetch_more_data(ForeignScanState *node);
+static void close_cursor(TDengineFdwExecState *festate);
+static bool tdengine_rescan_params_changed(ForeignScanState *node);
+static void tdengine_rescan_save_params(ForeignScanState *node);
+static bool tdengine_rescan_replay_next(ForeignScanState *node, TupleTableSlot *tupleSlot);
+static void tdengine_report_remote_error(const char *err) pg_attribute_noreturn();
+static void tdengine_build_conv_plan(ForeignScanState *node, TDengineFdwExecState *festate);
+static void tdengine_map_conv_plan(ForeignScanState *node, TDengineBlock *block);
+static void make_tuple_from_result_row(TDengineBlock *block,
+                                       int rowidx,
+                                       TupleDesc tupleDescriptor,
+                                       Datum *row,
+                                       bool *is_null,
+                                       Oid relid,
+                                       TDengineFdwExecState *festate,
+                                       bool is_agg);
 static void execute_dml_stmt(ForeignScanState *node);
 static TupleTableSlot **execute_foreign_insert_modify(EState *estate,
                                                       ResultRelInfo *resultRelInfo,
                                                       TupleTableSlot **slots,
                                                       TupleTableSlot **planSlots,
                                                       int numSlots);
+static void execute_schemaless_insert(TDengineFdwExecState *fmstate, Relation rel,
+                                      TupleTableSlot **slots, int numSlots);
+static void flush_schemaless_insert(TDengineFdwExecState *fmstate);
 static int tdengine_get_batch_size_option(Relation rel);
+static int tdengine_estimate_insert_row_bytes(Relation rel, List *attrs);
 
 /*
  * 此枚举描述了 ForeignPath 的 fdw_private 列表中存储的内容。
@@ -164,7 +319,9 @@ enum FdwDirectModifyPrivateIndex
     /* set-processed flag (as an Boolean node) */
     FdwDirectModifyPrivateSetProcessed,
     /* remote conditions */
-    FdwDirectModifyRemoteExprs
+    FdwDirectModifyRemoteExprs,
+    /* 按时间分块删除时的时间范围查询(as a String node) */
+    FdwDirectModifyPrivateBoundsSql
 };
 
 /*
@@ -178,6 +335,8 @@ typedef struct TDengineFdwDirectModifyState
 
     /* extracted fdw_private data */
     char *query;           /* text of UPDATE/DELETE command */
+    char *bounds_query;    /* 按时间分块删除时的时间范围查询 */
+    bool query_has_where;  /* DELETE语句是否已有WHERE子句 */
     bool has_returning;    /* is there a RETURNING clause? */
     List *retrieved_attrs; /* attr numbers retrieved by RETURNING */
     bool set_processed;    /* do we set the command es_processed? */
@@ -208,6 +367,87 @@ typedef struct TDengineFdwDirectModifyState
     MemoryContext temp_cxt; /* context for per-tuple temporary data */
 } TDengineFdwDirectModifyState;
 
+/* 并行扫描时每个参与进程平均分到的时间块数 */
+#define TDENGINE_PARALLEL_CHUNKS_PER_WORKER 4
+
+/* 分块删除时报告进度的最小间隔(毫秒) */
+#define TDENGINE_DELETE_PROGRESS_INTERVAL 10000
+
+/*
+ * 并行扫描的共享状态，保存在DSM中
+ *
+ * leader在初始化DSM时查询扫描的时间范围并切分为nchunks个左闭右开的块，
+ * 各参与进程通过原子计数领取下一个块，各自打开连接并只扫描该时间段。
+ * 时间范围未知(如查询带参数)时只有一个不加时间条件的块。
+ */
+typedef struct TDengineParallelScanState
+{
+    pg_atomic_uint32 next_chunk; /* 下一个待领取的块 */
+    int nchunks;                 /* 块数，0表示结果为空 */
+    bool bounded;                /* 块是否带时间条件 */
+    int64 lower;                 /* 时间范围下界(含) */
+    int64 upper;                 /* 时间范围上界(不含) */
+    int64 step;                  /* 每块的时间跨度 */
+} TDengineParallelScanState;
+
+/*
+ * 超级表扇出扫描中的一路远程查询
+ */
+typedef struct TDengineFanoutStream
+{
+    List *conds;              /* 尚未提交的tbname IN条件，每个条件对应一条查询 */
+    MemoryContext cursor_cxt; /* 当前查询的游标，换到下一条查询时重置 */
+    TDengineCursor *cursor;   /* 该路当前查询的游标 */
+    MemoryContext batch_cxt;  /* 当前数据块的描述信息，每块重置 */
+    TDengineBlock *block;     /* 当前数据块，NULL表示尚未拉取 */
+    int rowidx;               /* 当前数据块中下一个待返回的行 */
+    bool mapped;              /* 转换计划是否已按该路的结果列建立 */
+    bool eof;                 /* 该路结果是否已读完 */
+} TDengineFanoutStream;
+
+/*
+ * 超级表扇出扫描状态，保存在cursor_cxt中
+ *
+ * 子表按轮转方式分为nstreams组，每组以"tbname IN (...)"为条件在借来的独占连接上
+ * 异步提交一路查询，多路查询在服务端同时执行。一组的条件超过
+ * TDENGINE_FANOUT_MAX_CONDITION_LEN时拆成多条查询，在该路上依次执行。
+ * 没有排序要求时按数据块轮流返回各路结果；按时间排序时每次返回当前行
+ * 时间最小(降序时最大)的一路。
+ */
+typedef struct TDengineFanoutState
+{
+    int nstreams;                  /* 查询路数 */
+    TDengineFanoutStream *streams; /* 各路查询 */
+    int current;                   /* 无序合并时正在返回的一路 */
+    int time_col;                  /* 有序合并时time列在结果中的位置，-1表示尚未确定 */
+} TDengineFanoutState;
+
+/*
+ * 事务级写缓冲区中的一个插入语句
+ *
+ * write_buffer为transaction时，同一事务中对同一外部表、以同一列清单执行的INSERT
+ * 共用一个预编译语句和它的写入缓冲区，行在提交前一次发送。
+ * 条目和语句都分配在TopTransactionContext中，事务结束时随之释放。
+ */
+typedef struct TDengineXactInsert
+{
+    Oid relid;                /* 外部表OID */
+    Oid userid;               /* 远程访问使用的用户 */
+    char *query;              /* 规划时生成的INSERT语句，区分不同的列清单 */
+    TDengineInsertStmt *stmt; /* 共用的预编译语句 */
+    List *marks;              /* 各层子事务开始写入时的写入位置(TDengineXactMark)，层级由浅到深 */
+} TDengineXactInsert;
+
+/* 子事务第一次向事务级写缓冲区追加行时的写入位置 */
+typedef struct TDengineXactMark
+{
+    int nest_level;           /* 子事务层级 */
+    int64 position;           /* 该子事务追加第一行之前的写入位置 */
+} TDengineXactMark;
+
+/* 当前事务中的TDengineXactInsert */
+static List *tdengine_xact_inserts = NIL;
+
 /*
  * PostgreSQL扩展初始化函数
  * 1. 在PostgreSQL加载扩展时自动调用
@@ -228,6 +468,10 @@ void _PG_init(void)
 {
     /* 注册进程退出回调函数 */
     on_proc_exit(&tdengine_fdw_exit, PointerGetDatum(NULL));
+
+    /* 事务级写缓冲区在提交前发送，中止时丢弃 */
+    RegisterXactCallback(tdengine_xact_callback, NULL);
+    RegisterSubXactCallback(tdengine_subxact_callback, NULL);
 }
 
 /*
@@ -246,6 +490,163 @@ tdengine_fdw_exit(int code, Datum arg)
     cleanup_cxx_client_connection();
 }
 
+/*
+ * tdengine_xact_callback - 发送或丢弃事务级写缓冲区
+ *
+ * 提交前依次发送各语句缓冲的行，发送失败时报错，事务随之中止。
+ * 远程写入无法参与两阶段提交，缓冲了行的事务不能PREPARE。
+ * 中止时只清空条目列表，缓冲的行和语句随TopTransactionContext释放。
+ */
+static void
+tdengine_xact_callback(XactEvent event, void *arg)
+{
+    List *inserts = tdengine_xact_inserts;
+    ListCell *lc;
+
+    switch (event)
+    {
+        case XACT_EVENT_PRE_PREPARE:
+            if (inserts != NIL)
+                ereport(ERROR,
+                        (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                         errmsg("cannot PREPARE a transaction that has buffered writes to TDengine foreign tables")));
+            break;
+        case XACT_EVENT_PRE_COMMIT:
+            /* 先清空列表，发送失败后中止事务时不再重试 */
+            tdengine_xact_inserts = NIL;
+            foreach (lc, inserts)
+            {
+                TDengineXactInsert *entry = (TDengineXactInsert *)lfirst(lc);
+                char *err = TDengineInsertFlush(entry->stmt);
+
+                if (err != NULL)
+                    tdengine_report_remote_error(err);
+            }
+            break;
+        case XACT_EVENT_ABORT:
+        case XACT_EVENT_PARALLEL_ABORT:
+            tdengine_xact_inserts = NIL;
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * tdengine_subxact_callback - 子事务结束时维护事务级写缓冲区
+ *
+ * 回滚到保存点时丢弃该子事务追加的、仍在缓冲区中的行；
+ * 达到发送阈值时已经写入远程的行无法撤回，只对这些行给出警告。
+ * 子事务提交时把它的写入位置交给父事务，父事务已有更早的位置时直接丢弃。
+ */
+static void
+tdengine_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
+                          SubTransactionId parentSubid, void *arg)
+{
+    int level = GetCurrentTransactionNestLevel();
+    ListCell *lc;
+
+    if (event != SUBXACT_EVENT_COMMIT_SUB && event != SUBXACT_EVENT_ABORT_SUB)
+        return;
+
+    foreach (lc, tdengine_xact_inserts)
+    {
+        TDengineXactInsert *entry = (TDengineXactInsert *)lfirst(lc);
+        TDengineXactMark *mark;
+        int n = list_length(entry->marks);
+
+        if (n == 0)
+            continue;
+        mark = (TDengineXactMark *)llast(entry->marks);
+        if (mark->nest_level < level)
+            continue;
+
+        if (event == SUBXACT_EVENT_ABORT_SUB)
+        {
+            int64 sent = TDengineInsertRewind(entry->stmt, mark->position);
+
+            if (sent > 0)
+                ereport(WARNING,
+                        (errmsg(INT64_FORMAT " rows already written to foreign table \"%s\" in the aborted subtransaction cannot be rolled back",
+                                sent, get_rel_name(entry->relid))));
+            entry->marks = list_truncate(entry->marks, n - 1);
+        }
+        else if (level - 1 <= 1 ||
+                 (n > 1 && ((TDengineXactMark *)list_nth(entry->marks, n - 2))->nest_level == level - 1))
+            entry->marks = list_truncate(entry->marks, n - 1);
+        else
+            mark->nest_level = level - 1;
+    }
+}
+
+/*
+ * tdengine_xact_insert_mark - 当前子事务第一次追加行之前记下写入位置
+ *
+ * 顶层事务中追加的行随事务一起提交或丢弃，不需要记录。
+ */
+static void
+tdengine_xact_insert_mark(TDengineXactInsert *entry)
+{
+    int level = GetCurrentTransactionNestLevel();
+    TDengineXactMark *mark;
+    MemoryContext oldcontext;
+
+    if (level <= 1)
+        return;
+    if (entry->marks != NIL && ((TDengineXactMark *)llast(entry->marks))->nest_level >= level)
+        return;
+
+    oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+    mark = (TDengineXactMark *)palloc(sizeof(TDengineXactMark));
+    mark->nest_level = level;
+    mark->position = TDengineInsertPosition(entry->stmt);
+    entry->marks = lappend(entry->marks, mark);
+    MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * tdengine_xact_insert_lookup - 查找事务级写缓冲区中可复用的插入语句
+ */
+static TDengineXactInsert *
+tdengine_xact_insert_lookup(Oid relid, Oid userid, const char *query)
+{
+    ListCell *lc;
+
+    foreach (lc, tdengine_xact_inserts)
+    {
+        TDengineXactInsert *entry = (TDengineXactInsert *)lfirst(lc);
+
+        if (entry->relid == relid && entry->userid == userid && strcmp(entry->query, query) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/*
+ * tdengine_xact_insert_flush_rel - 发送事务级写缓冲区中某张表缓冲的行
+ *
+ * 扫描、直接删除和清空都直接作用于远程数据，先发送该表缓冲的行，
+ * 以免这些行在提交时才写入而读不到或不受删除的影响。
+ */
+static void
+tdengine_xact_insert_flush_rel(Oid relid)
+{
+    ListCell *lc;
+
+    foreach (lc, tdengine_xact_inserts)
+    {
+        TDengineXactInsert *entry = (TDengineXactInsert *)lfirst(lc);
+        char *err;
+
+        if (entry->relid != relid)
+            continue;
+        err = TDengineInsertFlush(entry->stmt);
+        if (err != NULL)
+            tdengine_report_remote_error(err);
+    }
+}
+
 Datum tdengine_fdw_version(PG_FUNCTION_ARGS)
 {
     PG_RETURN_INT32(CODE_VERSION);
@@ -263,12 +664,52 @@ Datum tdengine_fdw_handler(PG_FUNCTION_ARGS)
     fdwroutine->GetForeignRelSize = tdengineGetForeignRelSize;
     fdwroutine->GetForeignPaths = tdengineGetForeignPaths;
     fdwroutine->GetForeignPlan = tdengineGetForeignPlan;
+    fdwroutine->GetForeignUpperPaths = tdengineGetForeignUpperPaths;
 
     fdwroutine->BeginForeignScan = tdengineBeginForeignScan;
     fdwroutine->IterateForeignScan = tdengineIterateForeignScan;
     fdwroutine->ReScanForeignScan = tdengineReScanForeignScan;
     fdwroutine->EndForeignScan = tdengineEndForeignScan;
 
+    /* 并行扫描 */
+    fdwroutine->IsForeignScanParallelSafe = tdengineIsForeignScanParallelSafe;
+    fdwroutine->EstimateDSMForeignScan = tdengineEstimateDSMForeignScan;
+    fdwroutine->InitializeDSMForeignScan = tdengineInitializeDSMForeignScan;
+    fdwroutine->ReInitializeDSMForeignScan = tdengineReInitializeDSMForeignScan;
+    fdwroutine->InitializeWorkerForeignScan = tdengineInitializeWorkerForeignScan;
+
+#if (PG_VERSION_NUM >= 140000)
+    /* 异步执行 */
+    fdwroutine->IsForeignPathAsyncCapable = tdengineIsForeignPathAsyncCapable;
+    fdwroutine->ForeignAsyncRequest = tdengineForeignAsyncRequest;
+    fdwroutine->ForeignAsyncConfigureWait = tdengineForeignAsyncConfigureWait;
+    fdwroutine->ForeignAsyncNotify = tdengineForeignAsyncNotify;
+#endif
+
+    /* 插入、更新和删除 */
+    fdwroutine->AddForeignUpdateTargets = tdengineAddForeignUpdateTargets;
+    fdwroutine->PlanForeignModify = tdenginePlanForeignModify;
+    fdwroutine->BeginForeignModify = tdengineBeginForeignModify;
+    fdwroutine->ExecForeignInsert = tdengineExecForeignInsert;
+#if (PG_VERSION_NUM >= 140000)
+    fdwroutine->ExecForeignBatchInsert = tdengineExecForeignBatchInsert;
+    fdwroutine->GetForeignModifyBatchSize = tdengineGetForeignModifyBatchSize;
+#endif
+    fdwroutine->ExecForeignUpdate = tdengineExecForeignUpdate;
+    fdwroutine->ExecForeignDelete = tdengineExecForeignDelete;
+    fdwroutine->EndForeignModify = tdengineEndForeignModify;
+    fdwroutine->BeginForeignInsert = tdengineBeginForeignInsert;
+    fdwroutine->EndForeignInsert = tdengineEndForeignInsert;
+
+    /* 直接删除和清空 */
+    fdwroutine->PlanDirectModify = tdenginePlanDirectModify;
+    fdwroutine->BeginDirectModify = tdengineBeginDirectModify;
+    fdwroutine->IterateDirectModify = tdengineIterateDirectModify;
+    fdwroutine->EndDirectModify = tdengineEndDirectModify;
+#if (PG_VERSION_NUM >= 140000)
+    fdwroutine->ExecForeignTruncate = tdengineExecForeignTruncate;
+#endif
+
     PG_RETURN_POINTER(fdwroutine);
 }
 
@@ -495,6 +936,11 @@ tdengineGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntab
     // 从外部表OID和用户ID获取TDengine连接选项
     options = tdengine_get_options(foreigntableid, userid);
 
+    // 是否允许Append异步执行该外部表的扫描
+    fpinfo->async_capable = options->async_capable;
+    // 并行扫描的worker数
+    fpinfo->parallel_workers = options->parallel_workers;
+
     // 获取外部表的无模式(schemaless)信息，存储在fpinfo的slinfo字段中
     // 无模式表不需要预定义严格的表结构
     tdengine_get_schemaless_info(&(fpinfo->slinfo), options->schemaless, foreigntableid);
@@ -596,16 +1042,77 @@ tdengineGetForeignRelSize(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntab
 }
 
 //========================== GetForeignPaths ====================
+/*
+ * tdengine_get_useful_pathkeys - 收集值得由远程按时间列排序的排序键
+ *
+ * 参数:
+ *   @root: 规划器信息
+ *   @rel: 基础外部表关系
+ *
+ * 返回值:
+ *   排序键列表的列表:
+ *   1. 查询要求的排序只有时间列一项(升序或降序)时，即为root->query_pathkeys
+ *   2. 时间列参与连接等价类时，按该等价类升序排序，供归并连接使用
+ */
+static List *
+tdengine_get_useful_pathkeys(PlannerInfo *root, RelOptInfo *rel)
+{
+    List *useful_pathkeys_list = NIL;
+    ListCell *lc;
+
+    /* 查询本身要求按时间列排序 */
+    if (list_length(root->query_pathkeys) == 1 &&
+        tdengine_is_time_pathkey(root, rel, (PathKey *)linitial(root->query_pathkeys)))
+        useful_pathkeys_list = lappend(useful_pathkeys_list, root->query_pathkeys);
+
+    /* 时间列与其他关系连接 */
+    if (rel->has_eclass_joins)
+    {
+        foreach (lc, root->eq_classes)
+        {
+            EquivalenceClass *ec = (EquivalenceClass *)lfirst(lc);
+            PathKey *pathkey;
+            List *pathkeys;
+            ListCell *lc2;
+            bool duplicate = false;
+
+            /* 只考虑连接本关系和其他关系的等价类 */
+            if (ec->ec_merged != NULL || ec->ec_has_const || ec->ec_has_volatile ||
+                !bms_is_member(rel->relid, ec->ec_relids) ||
+                bms_is_subset(ec->ec_relids, rel->relids))
+                continue;
+
+            pathkey = make_canonical_pathkey(root, ec, linitial_oid(ec->ec_opfamilies),
+                                             BTLessStrategyNumber, false);
+            if (!tdengine_is_time_pathkey(root, rel, pathkey))
+                continue;
+
+            pathkeys = list_make1(pathkey);
+            foreach (lc2, useful_pathkeys_list)
+            {
+                if (compare_pathkeys(pathkeys, (List *)lfirst(lc2)) == PATHKEYS_EQUAL)
+                    duplicate = true;
+            }
+            if (!duplicate)
+                useful_pathkeys_list = lappend(useful_pathkeys_list, pathkeys);
+        }
+    }
+
+    return useful_pathkeys_list;
+}
+
 /*
  *      为对外表的扫描创建可能的扫描路径
  */
 static void
 tdengineGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntableid)
 {
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)baserel->fdw_private;
     // 启动成本初始化为 10
     Cost startup_cost = 10;
     // 总成本初始化为表的行数加上启动成本
     Cost total_cost = baserel->rows + startup_cost;
+    ListCell *lc;
 
     // 输出调试信息，显示当前函数名
     elog(DEBUG1, "tdengine_fdw : %s", __func__);
@@ -613,7 +1120,7 @@ tdengineGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntable
     // 重新设置总成本为表的行数
     total_cost = baserel->rows;
 
-    /* 创建一个 ForeignPath 节点并将其作为唯一可能的路径添加 */
+    /* 创建一个不排序的 ForeignPath 节点 */
     add_path(baserel, (Path *)
              // 创建一个外部扫描路径
              create_foreignscan_path(root, baserel,
@@ -632,6 +1139,68 @@ tdengineGetForeignPaths(PlannerInfo *root, RelOptInfo *baserel, Oid foreigntable
                                              //                                      NIL, /* 没有 fdw_restrictinfo 列表 */
                                              // #endif
                                      NULL)); /* 没有 fdw_private 数据 */
+
+    /*
+     * 为按时间列排序的需求再生成有序路径，由远程的ORDER BY排序，
+     * 本地不必再对全部结果排序。排序的额外成本取estimate_path_cost_size
+     * 对有序和无序扫描估算的差值，叠加到无序路径的成本上
+     */
+    foreach (lc, tdengine_get_useful_pathkeys(root, baserel))
+    {
+        List *useful_pathkeys = (List *)lfirst(lc);
+        double rows;
+        int width;
+        Cost sorted_startup_cost;
+        Cost sorted_total_cost;
+
+        estimate_path_cost_size(root, baserel, NIL, useful_pathkeys,
+                                &rows, &width, &sorted_startup_cost, &sorted_total_cost);
+
+        /* 查询要求的排序可以由远程完成，供上层的LIMIT下推使用 */
+        if (root->query_pathkeys != NIL &&
+            compare_pathkeys(useful_pathkeys, root->query_pathkeys) == PATHKEYS_EQUAL)
+            fpinfo->qp_is_pushdown_safe = true;
+
+        add_path(baserel, (Path *)
+                 create_foreignscan_path(root, baserel,
+                                         NULL,
+                                         baserel->rows,
+                                         startup_cost + (sorted_startup_cost - fpinfo->startup_cost),
+                                         total_cost + (sorted_total_cost - fpinfo->total_cost),
+                                         useful_pathkeys,
+                                         baserel->lateral_relids,
+                                         NULL,
+                                         NULL));
+    }
+
+    /*
+     * 配置了parallel_workers时再生成一条并行路径，各参与进程按时间块
+     * 分别扫描，行数按参与进程数分摊
+     */
+    if (baserel->consider_parallel && fpinfo->parallel_workers > 0 &&
+        baserel->lateral_relids == NULL)
+    {
+        int nworkers = Min(fpinfo->parallel_workers, max_parallel_workers_per_gather);
+        double divisor = nworkers + 1;
+        Path *path;
+
+        if (nworkers > 0)
+        {
+            path = (Path *)create_foreignscan_path(root, baserel,
+                                                   NULL,
+                                                   baserel->rows / divisor,
+                                                   startup_cost,
+                                                   total_cost / divisor,
+                                                   NIL,
+                                                   NULL,
+                                                   NULL,
+                                                   NULL);
+            path->parallel_aware = true;
+            path->parallel_safe = true;
+            path->parallel_workers = nworkers;
+            add_partial_path(baserel, path);
+        }
+    }
 }
 
 //====================== GetForeignPlan ======================
@@ -675,6 +1244,12 @@ tdengineGetForeignPlan(PlannerInfo *root,
     int for_update;
     // 表示查询是否有 LIMIT 子句的标志
     bool has_limit = false;
+    // 附加条件在查询语句中的插入位置
+    int cond_pos = 0;
+    // 超级表扇出扫描的结果合并方式
+    TDengineFanoutMerge fanout_merge = TDENGINE_FANOUT_DISABLED;
+    // 并行扫描的时间范围查询
+    StringInfoData bounds;
 
     // 调试信息
     elog(DEBUG1, "tdengine_fdw : %s", __func__);
@@ -906,7 +1481,7 @@ tdengineGetForeignPlan(PlannerInfo *root,
     // 为关系解析 SELECT 语句
     tdengine_deparse_select_stmt_for_rel(&sql, root, baserel, fdw_scan_tlist,
                                          remote_exprs, best_path->path.pathkeys,
-                                         false, &retrieved_attrs, &params_list, has_limit);
+                                         false, &retrieved_attrs, &params_list, has_limit, &cond_pos);
 
     // 记住远程表达式，供 tdenginePlanDirectModify 可能使用
     fpinfo->final_remote_exprs = remote_exprs;
@@ -947,6 +1522,25 @@ tdengineGetForeignPlan(PlannerInfo *root,
     // 将远程条件添加到 fdw_private 列表中
     fdw_private = lappend(fdw_private, remote_conds);
 
+    /* 并行路径还需要时间范围查询 */
+    initStringInfo(&bounds);
+    if (best_path->path.parallel_aware)
+        tdengine_deparse_time_bounds(&bounds, root, baserel, remote_exprs, &params_list);
+
+    /*
+     * 只有不含聚合、函数下推和LIMIT的普通扫描才能按子表拆分为多路查询，
+     * 有排序要求时还必须只按时间排序
+     */
+    if (IS_SIMPLE_REL(baserel) && !fpinfo->is_tlist_func_pushdown &&
+        !has_limit && !best_path->path.parallel_aware)
+        fanout_merge = tdengine_fanout_merge_for_pathkeys(root, baserel, best_path->path.pathkeys);
+
+    // 将时间范围查询、是否已有WHERE子句、附加条件位置和扇出合并方式添加到 fdw_private 列表中
+    fdw_private = lappend(fdw_private, makeString(bounds.data));
+    fdw_private = lappend(fdw_private, makeInteger(remote_exprs != NIL));
+    fdw_private = lappend(fdw_private, makeInteger(cond_pos));
+    fdw_private = lappend(fdw_private, makeInteger(fanout_merge));
+
     /*
      * 根据目标列表、本地过滤表达式、远程参数表达式和 FDW 私有信息创建 ForeignScan 节点。
      *
@@ -963,134 +1557,609 @@ tdengineGetForeignPlan(PlannerInfo *root,
                             outer_plan);
 }
 
-//========================== BeginForeignScan =====================
+//====================== GetForeignUpperPaths ======================
 /*
- * tdengineBeginForeignScan - 初始化外部表扫描
- * 功能: 为TDengine外部表扫描初始化执行状态,准备查询参数和连接信息
+ * tdengineGetForeignUpperPaths - 为上层关系生成外部路径
+ * 功能: 将查询的最终排序和LIMIT/OFFSET作为同一条远程语句下推，
+ *       使"ORDER BY time DESC LIMIT 100"这类查询只传输所需的行；
+ *       取每个设备最新值的查询改写为LAST_ROW
+ *
  * 参数:
- *   @node: ForeignScanState节点,包含扫描状态信息
- *   @eflags: 执行标志位,指示扫描的执行方式
- * 处理流程:
- *   1. 初始化执行状态结构体festate
- *   2. 从计划节点(fsplan)中提取查询相关信息:
- *      - SQL查询字符串
- *      - 需要检索的属性列表
- *      - FOR UPDATE标志
- *      - 目标列表
- *      - 函数下推标志
- *      - 无模式(schemaless)标志
- *      - 远程表达式列表
- *   3. 确定扫描关系ID(rtindex)和范围表条目(rte)
- *   4. 获取连接选项(tdengineFdwOptions)和用户映射(user)
- *   5. 初始化无模式信息(slinfo)
- *   6. 如果有查询参数(numParams>0),准备参数转换信息
+ *   @root: 规划器信息
+ *   @stage: 上层关系所处的处理阶段
+ *   @input_rel: 输入关系
+ *   @output_rel: 输出的上层关系
+ *   @extra: 阶段相关的附加信息(UPPERREL_FINAL时为FinalPathExtraData)
+ *
+ * 注意事项:
+ *   - 只处理UPPERREL_DISTINCT、UPPERREL_ORDERED和UPPERREL_FINAL阶段
+ *   - 输入关系不是由本FDW下推的关系时直接返回
  */
 static void
-tdengineBeginForeignScan(ForeignScanState *node, int eflags)
+tdengineGetForeignUpperPaths(PlannerInfo *root, UpperRelationKind stage,
+                             RelOptInfo *input_rel, RelOptInfo *output_rel,
+                             void *extra)
 {
-    // 执行状态结构体
-    TDengineFdwExecState *festate = NULL;
-    // 执行状态
-    EState *estate = node->ss.ps.state;
-    // 外部扫描计划节点
-    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
-    // 范围表条目
-    RangeTblEntry *rte;
-    // 参数数量
-    int numParams;
-    // 扫描关系ID
-    int rtindex;
-    // 无模式标志
-    bool schemaless;
-    // 用户ID
-    Oid userid;
-    // #ifdef CXX_CLIENT
-    // 外部表信息(用于C++客户端)
-    ForeignTable *ftable;
-    // #endif
-    // 远程表达式列表
-    List *remote_exprs;
+    TDengineFdwRelationInfo *fpinfo;
 
-    // 调试日志
     elog(DEBUG1, "tdengine_fdw : %s", __func__);
 
-    /* 初始化执行状态 */
-    festate = (TDengineFdwExecState *)palloc0(sizeof(TDengineFdwExecState));
-    node->fdw_state = (void *)festate;
-    festate->rowidx = 0;
-
-    /* 从计划节点中提取信息 */
-    festate->query = strVal(list_nth(fsplan->fdw_private, 0));                                 // SQL查询字符串
-    festate->retrieved_attrs = list_nth(fsplan->fdw_private, 1);                               // 需要检索的属性
-    festate->for_update = intVal(list_nth(fsplan->fdw_private, 2)) ? true : false;             // FOR UPDATE标志
-    festate->tlist = (List *)list_nth(fsplan->fdw_private, 3);                                 // 目标列表
-    festate->is_tlist_func_pushdown = intVal(list_nth(fsplan->fdw_private, 4)) ? true : false; // 函数下推标志
-    schemaless = intVal(list_nth(fsplan->fdw_private, 5)) ? true : false;                      // 无模式标志
-    remote_exprs = (List *)list_nth(fsplan->fdw_private, 6);                                   // 远程表达式列表
-
-    festate->cursor_exists = false; // 游标存在标志初始化为false
-
-    /* 确定扫描关系ID */
-    if (fsplan->scan.scanrelid > 0)
-        rtindex = fsplan->scan.scanrelid;
-    else
-        rtindex = bms_next_member(fsplan->fs_relids, -1);
-
-    // 获取范围表条目
-    rte = exec_rt_fetch(rtindex, estate);
+    /* 输入关系必须是可以下推的外部关系 */
+    if (!input_rel->fdw_private ||
+        !((TDengineFdwRelationInfo *)input_rel->fdw_private)->pushdown_safe)
+        return;
 
-    /* 获取用户ID */
-    userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+    /* 只支持去重、排序和最终阶段 */
+    if (stage != UPPERREL_DISTINCT && stage != UPPERREL_ORDERED && stage != UPPERREL_FINAL)
+        return;
 
-    /* 获取连接选项和用户映射 */
-    festate->tdengineFdwOptions = tdengine_get_options(rte->relid, userid);
-    ftable = GetForeignTable(rte->relid);
-    festate->user = GetUserMapping(userid, ftable->serverid);
+    /* 同一上层关系可能被多次调用，只处理一次 */
+    if (output_rel->fdw_private)
+        return;
 
-    /* 初始化无模式信息 */
-    tdengine_get_schemaless_info(&(festate->slinfo), schemaless, rte->relid);
+    fpinfo = (TDengineFdwRelationInfo *)palloc0(sizeof(TDengineFdwRelationInfo));
+    fpinfo->pushdown_safe = false;
+    fpinfo->stage = stage;
+    output_rel->fdw_private = fpinfo;
 
-    /* 准备查询参数 */
-    numParams = list_length(fsplan->fdw_exprs);
-    festate->numParams = numParams;
-    if (numParams > 0)
+    switch (stage)
     {
-        prepare_query_params((PlanState *)node,
-                             fsplan->fdw_exprs,
-                             remote_exprs,
-                             rte->relid,
-                             numParams,
-                             &festate->param_flinfo,
-                             &festate->param_exprs,
-                             &festate->param_values,
-                             &festate->param_types,
-                             &festate->param_tdengine_types,
-                             &festate->param_tdengine_values,
-                             &festate->param_column_info);
+        case UPPERREL_DISTINCT:
+            tdengine_add_foreign_distinct_paths(root, input_rel, output_rel);
+            break;
+        case UPPERREL_ORDERED:
+            tdengine_add_foreign_ordered_paths(root, input_rel, output_rel);
+            break;
+        case UPPERREL_FINAL:
+            tdengine_add_foreign_final_paths(root, input_rel, output_rel,
+                                             (FinalPathExtraData *)extra);
+            break;
+        default:
+            elog(ERROR, "unexpected upper relation: %d", (int)stage);
+            break;
     }
 }
 
-//======================== IterateForeignScan ==================
 /*
- * 逐个迭代从 TDengine 获取行，并将其放入元组槽中
+ * tdengine_add_foreign_ordered_paths - 处理最终排序阶段
+ * 功能: 判断查询的最终排序能否由远程完成，供最终阶段与LIMIT一起下推
+ *
+ * 参数:
+ *   @root: 规划器信息
+ *   @input_rel: 排序前的关系
+ *   @ordered_rel: 排序后的上层关系
+ *
+ * 注意事项:
+ *   - 没有分组时root->query_pathkeys即为root->sort_pathkeys，
+ *     基础关系的有序路径已在tdengineGetForeignPaths中生成，这里只记录能否下推
+ *   - 分组关系上的排序(如按聚合结果排序)不下推
  */
-static TupleTableSlot *
-tdengineIterateForeignScan(ForeignScanState *node)
+static void
+tdengine_add_foreign_ordered_paths(PlannerInfo *root, RelOptInfo *input_rel,
+                                   RelOptInfo *ordered_rel)
 {
-    // 获取执行状态
-    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
-    // 获取元组槽
-    TupleTableSlot *tupleSlot = node->ss.ss_ScanTupleSlot;
+    TDengineFdwRelationInfo *ifpinfo = (TDengineFdwRelationInfo *)input_rel->fdw_private;
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)ordered_rel->fdw_private;
+
+    /* 目标列表中有返回集合的函数时不下推 */
+    if (root->parse->hasTargetSRFs)
+        return;
+
+    if (!IS_SIMPLE_REL(input_rel))
+        return;
+
+    Assert(root->query_pathkeys == root->sort_pathkeys);
+
+    fpinfo->outerrel = input_rel;
+    fpinfo->table = ifpinfo->table;
+    fpinfo->server = ifpinfo->server;
+    fpinfo->relation_name = ifpinfo->relation_name;
+    fpinfo->pushdown_safe = ifpinfo->qp_is_pushdown_safe;
+}
+
+/*
+ * tdengine_is_safe_limit_expr - 判断LIMIT/OFFSET表达式能否下推
+ * 功能: TDengine只接受字面量形式的LIMIT/OFFSET，只允许非空、非负的常量
+ *
+ * 参数:
+ *   @expr: LIMIT或OFFSET表达式，可为NULL
+ *
+ * 注意事项:
+ *   - TDengine的LIMIT/OFFSET不接受绑定参数，外部参数交由本地处理
+ *   - LIMIT NULL/LIMIT ALL和负数(由本地报错)同样交由本地处理
+ */
+static bool
+tdengine_is_safe_limit_expr(Node *expr)
+{
+    Const *c;
+
+    if (expr == NULL)
+        return true;
+    if (!IsA(expr, Const))
+        return false;
+
+    c = (Const *)expr;
+    return !c->constisnull && DatumGetInt64(c->constvalue) >= 0;
+}
+
+/*
+ * tdengine_add_foreign_final_paths - 处理最终阶段
+ * 功能: 在输入关系的外部路径上附加远程执行的LIMIT/OFFSET(及最终排序)，
+ *       生成一条完成全部排序和截取工作的外部路径
+ *
+ * 参数:
+ *   @root: 规划器信息
+ *   @input_rel: 最终阶段的输入关系(基础关系、分组关系或排序阶段的上层关系)
+ *   @final_rel: 最终上层关系
+ *   @extra: 最终阶段的附加信息，包括是否需要LIMIT及其估计值
+ *
+ * 处理流程:
+ *   1. 检查查询形态: 只有普通SELECT、无行锁、无返回集合函数且需要LIMIT时才下推
+ *   2. 排序阶段的输入替换为其底层关系，并要求存在按查询排序的外部路径
+ *   3. 检查输入关系没有本地条件，LIMIT/OFFSET可以下推
+ *   4. 以输入关系上已有外部路径的成本为基础，按LIMIT折算后创建路径
+ *
+ * 注意事项:
+ *   - 路径挂在输入关系上，计划由tdengineGetForeignPlan按输入关系生成，
+ *     路径的fdw_private中记录是否带LIMIT
+ *   - 不需要LIMIT时不生成路径，排序已在输入关系的路径上完成
+ */
+static void
+tdengine_add_foreign_final_paths(PlannerInfo *root, RelOptInfo *input_rel,
+                                 RelOptInfo *final_rel, FinalPathExtraData *extra)
+{
+    Query *parse = root->parse;
+    TDengineFdwRelationInfo *ifpinfo = (TDengineFdwRelationInfo *)input_rel->fdw_private;
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)final_rel->fdw_private;
+    List *pathkeys = NIL;
+    Path *input_path = NULL;
+    ForeignPath *final_path;
+    List *fdw_private;
+    double input_rows;
+    double rows;
+    Cost startup_cost;
+    Cost total_cost;
+    ListCell *lc;
+
+    /* 只下推普通SELECT的LIMIT */
+    if (parse->commandType != CMD_SELECT || parse->rowMarks || parse->hasTargetSRFs)
+        return;
+
+    if (!extra->limit_needed)
+        return;
+
+    /* TDengine的LIMIT必须带行数，且不支持WITH TIES */
+    if (!parse->limitCount)
+        return;
+#if (PG_VERSION_NUM >= 130000)
+    if (parse->limitOption == LIMIT_OPTION_WITH_TIES)
+        return;
+#endif
+
+    /* 排序阶段的输入换成其底层关系，排序由底层关系的有序路径完成 */
+    if (input_rel->reloptkind == RELOPT_UPPER_REL &&
+        ifpinfo->stage == UPPERREL_ORDERED)
+    {
+        input_rel = ifpinfo->outerrel;
+        ifpinfo = (TDengineFdwRelationInfo *)input_rel->fdw_private;
+        pathkeys = root->sort_pathkeys;
+    }
+
+    Assert(IS_SIMPLE_REL(input_rel) ||
+           (input_rel->reloptkind == RELOPT_UPPER_REL &&
+            ifpinfo->stage == UPPERREL_GROUP_AGG));
+
+    /* 本地条件需要先于LIMIT执行 */
+    if (ifpinfo->local_conds)
+        return;
+
+    if (!tdengine_is_safe_limit_expr(parse->limitCount) ||
+        !tdengine_is_safe_limit_expr(parse->limitOffset))
+        return;
+
+    /* 在输入关系上找一条排序符合要求、不带参数化的外部路径 */
+    foreach (lc, input_rel->pathlist)
+    {
+        Path *path = (Path *)lfirst(lc);
+
+        if (!IsA(path, ForeignPath) || path->param_info != NULL ||
+            ((ForeignPath *)path)->fdw_private != NIL)
+            continue;
+        if (compare_pathkeys(path->pathkeys, pathkeys) != PATHKEYS_EQUAL)
+            continue;
+        if (input_path == NULL || path->total_cost < input_path->total_cost)
+            input_path = path;
+    }
+    if (input_path == NULL)
+        return;
+
+    fpinfo->outerrel = input_rel;
+    fpinfo->table = ifpinfo->table;
+    fpinfo->server = ifpinfo->server;
+    fpinfo->relation_name = ifpinfo->relation_name;
+    fpinfo->pushdown_safe = true;
+
+    /*
+     * 按LIMIT折算行数和成本。不带LIMIT时服务端仍会执行完整查询并
+     * 传回超出所需的结果块，因此再扣除少传输的行的处理成本
+     */
+    input_rows = input_path->rows;
+    rows = input_path->rows;
+    startup_cost = input_path->startup_cost;
+    total_cost = input_path->total_cost;
+    adjust_limit_rows_costs(&rows, &startup_cost, &total_cost,
+                            extra->offset_est, extra->count_est);
+    total_cost -= cpu_tuple_cost * (input_rows - rows);
+    total_cost = Max(total_cost, startup_cost);
+
+    /* 与tdengineGetForeignPlan约定: 最终排序已在输入路径中完成，远程带LIMIT */
+    fdw_private = list_make2(makeBoolean(false), makeBoolean(true));
+
+    final_path = create_foreign_upper_path(root,
+                                           input_rel,
+                                           root->upper_targets[UPPERREL_FINAL],
+                                           rows,
+                                           startup_cost,
+                                           total_cost,
+                                           pathkeys,
+                                           NULL, /* 没有额外的计划 */
+#if (PG_VERSION_NUM >= 170000)
+                                           NIL, /* 没有 fdw_restrictinfo 列表 */
+#endif
+                                           fdw_private);
+
+    add_path(final_rel, (Path *)final_path);
+
+    /* ORDER BY time DESC LIMIT 1即整个扫描的最新一行，可由LAST_ROW直接给出 */
+    if (IS_SIMPLE_REL(input_rel) && !ifpinfo->slinfo.schemaless &&
+        parse->limitOffset == NULL && IsA(parse->limitCount, Const) &&
+        DatumGetInt64(((Const *)parse->limitCount)->constvalue) == 1 &&
+        list_length(pathkeys) == 1 &&
+        ((PathKey *)linitial(pathkeys))->pk_strategy == BTGreaterStrategyNumber &&
+        tdengine_is_time_pathkey(root, input_rel, (PathKey *)linitial(pathkeys)))
+        tdengine_add_last_row_path(root, input_rel, final_rel,
+                                   root->upper_targets[UPPERREL_FINAL], NIL, 1);
+}
+
+/*
+ * tdengine_add_foreign_distinct_paths - 处理去重阶段
+ * 功能: 把取每个分组最新一行的DISTINCT ON查询改写为LAST_ROW ... PARTITION BY，
+ *       由TDengine的最新行缓存直接给出结果，不必扫描全表再在本地排序去重
+ *
+ * 参数:
+ *   @root: 规划器信息
+ *   @input_rel: 去重前的关系
+ *   @distinct_rel: 去重后的上层关系
+ *
+ * 注意事项:
+ *   - 只识别"DISTINCT ON (键...) ... ORDER BY 键..., time DESC"，
+ *     键和目标列都必须是本表的普通列
+ *   - 结果不带排序，ORDER BY由本地对去重后的少量行完成
+ */
+static void
+tdengine_add_foreign_distinct_paths(PlannerInfo *root, RelOptInfo *input_rel,
+                                    RelOptInfo *distinct_rel)
+{
+    Query *parse = root->parse;
+    TDengineFdwRelationInfo *ifpinfo = (TDengineFdwRelationInfo *)input_rel->fdw_private;
+    RangeTblEntry *rte;
+    SortGroupClause *sgc;
+    Expr *expr;
+    List *partition = NIL;
+    int ndistinct;
+    int i;
+    Oid opfamily;
+    Oid opcintype;
+    int16 strategy;
+    double rows;
+
+    if (parse->commandType != CMD_SELECT || !parse->hasDistinctOn ||
+        parse->hasAggs || parse->groupClause || parse->groupingSets ||
+        parse->hasWindowFuncs || parse->hasTargetSRFs || parse->rowMarks)
+        return;
+
+    if (!IS_SIMPLE_REL(input_rel) || ifpinfo->local_conds || ifpinfo->slinfo.schemaless)
+        return;
+
+    /* ORDER BY由DISTINCT ON的各个键加上最后的时间列组成 */
+    ndistinct = list_length(parse->distinctClause);
+    if (list_length(parse->sortClause) != ndistinct + 1)
+        return;
+
+    rte = planner_rt_fetch(input_rel->relid, root);
+    for (i = 0; i < ndistinct; i++)
+    {
+        sgc = list_nth_node(SortGroupClause, parse->sortClause, i);
+        expr = (Expr *)get_sortgroupclause_expr(sgc, parse->targetList);
+
+        if (!get_sortgroupref_clause_noerr(sgc->tleSortGroupRef, parse->distinctClause) ||
+            !tdengine_is_last_row_var(input_rel, expr) ||
+            TDENGINE_IS_TIME_COLUMN(tdengine_get_column_name(rte->relid, ((Var *)expr)->varattno)))
+            return;
+
+        partition = lappend(partition, expr);
+    }
+
+    /* 最后一项必须是时间列降序 */
+    sgc = llast_node(SortGroupClause, parse->sortClause);
+    expr = (Expr *)get_sortgroupclause_expr(sgc, parse->targetList);
+    if (!tdengine_is_last_row_var(input_rel, expr) ||
+        !TDENGINE_IS_TIME_COLUMN(tdengine_get_column_name(rte->relid, ((Var *)expr)->varattno)))
+        return;
+    if (!get_ordering_op_properties(sgc->sortop, &opfamily, &opcintype, &strategy) ||
+        strategy != BTGreaterStrategyNumber)
+        return;
+
+#if (PG_VERSION_NUM >= 140000)
+    rows = estimate_num_groups(root, partition, input_rel->rows, NULL, NULL);
+#else
+    rows = estimate_num_groups(root, partition, input_rel->rows, NULL);
+#endif
+
+    tdengine_add_last_row_path(root, input_rel, distinct_rel,
+                               root->upper_targets[UPPERREL_DISTINCT], partition, rows);
+}
+
+/*
+ * tdengine_is_last_row_var - 判断表达式是否为本表的普通列
+ */
+static bool
+tdengine_is_last_row_var(RelOptInfo *rel, Expr *expr)
+{
+    Var *var;
+
+    if (expr == NULL || !IsA(expr, Var))
+        return false;
+
+    var = (Var *)expr;
+    return var->varno == rel->relid && var->varlevelsup == 0 && var->varattno > 0;
+}
+
+/*
+ * tdengine_add_last_row_path - 生成以LAST_ROW取最新行的上层路径
+ *
+ * 参数:
+ *   @root: 规划器信息
+ *   @input_rel: 基础外部表关系
+ *   @output_rel: 路径所属的上层关系
+ *   @target: 上层关系的输出目标
+ *   @partition: 分区键表达式列表，为NIL时对整个扫描取一行
+ *   @rows: 估计的结果行数
+ *
+ * 注意事项:
+ *   - 目标中的每一项都必须是本表的普通列，分区键原样输出，其余列反解析为LAST_ROW(列)
+ *   - LAST_ROW不忽略NULL，各列取自同一行，与按时间取最新一行的语义一致
+ */
+static void
+tdengine_add_last_row_path(PlannerInfo *root, RelOptInfo *input_rel, RelOptInfo *output_rel,
+                           PathTarget *target, List *partition, double rows)
+{
+    TDengineFdwRelationInfo *ifpinfo = (TDengineFdwRelationInfo *)input_rel->fdw_private;
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)output_rel->fdw_private;
+    ForeignPath *path;
+    Cost startup_cost;
+    Cost total_cost;
+    ListCell *lc;
+
+    foreach (lc, target->exprs)
+    {
+        if (!tdengine_is_last_row_var(input_rel, (Expr *)lfirst(lc)))
+            return;
+    }
+
+    fpinfo->outerrel = input_rel;
+    fpinfo->table = ifpinfo->table;
+    fpinfo->server = ifpinfo->server;
+    fpinfo->relation_name = ifpinfo->relation_name;
+    fpinfo->pushdown_safe = true;
+    fpinfo->last_row = true;
+    fpinfo->last_row_partition = partition;
+    fpinfo->grouped_tlist = add_to_flat_tlist(NIL, target->exprs);
+
+    /* 最新行由服务端缓存直接给出，成本只取决于返回的行数 */
+    startup_cost = input_rel->cheapest_total_path->startup_cost;
+    total_cost = startup_cost + cpu_tuple_cost * rows;
+
+    path = create_foreign_upper_path(root,
+                                     output_rel,
+                                     target,
+                                     rows,
+                                     startup_cost,
+                                     total_cost,
+                                     NIL,  /* 结果不带排序 */
+                                     NULL, /* 没有额外的计划 */
+#if (PG_VERSION_NUM >= 170000)
+                                     NIL, /* 没有 fdw_restrictinfo 列表 */
+#endif
+                                     NIL);
+
+    add_path(output_rel, (Path *)path);
+}
+
+//========================== BeginForeignScan =====================
+/*
+ * tdengineBeginForeignScan - 初始化外部表扫描
+ * 功能: 为TDengine外部表扫描初始化执行状态,准备查询参数和连接信息
+ * 参数:
+ *   @node: ForeignScanState节点,包含扫描状态信息
+ *   @eflags: 执行标志位,指示扫描的执行方式
+ * 处理流程:
+ *   1. 初始化执行状态结构体festate
+ *   2. 从计划节点(fsplan)中提取查询相关信息:
+ *      - SQL查询字符串
+ *      - 需要检索的属性列表
+ *      - FOR UPDATE标志
+ *      - 目标列表
+ *      - 函数下推标志
+ *      - 无模式(schemaless)标志
+ *      - 远程表达式列表
+ *   3. 确定扫描关系ID(rtindex)和范围表条目(rte)
+ *   4. 获取连接选项(tdengineFdwOptions)和用户映射(user)
+ *   5. 发送事务级写缓冲区中被扫描表的行，再初始化无模式信息(slinfo)
+ *   6. 如果有查询参数(numParams>0),准备参数转换信息
+ *   7. 扫描可能被重扫时创建结果缓存,参数不变的重扫从缓存回放
+ */
+static void
+tdengineBeginForeignScan(ForeignScanState *node, int eflags)
+{
+    // 执行状态结构体
+    TDengineFdwExecState *festate = NULL;
+    // 执行状态
+    EState *estate = node->ss.ps.state;
+    // 外部扫描计划节点
+    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
+    // 范围表条目
+    RangeTblEntry *rte;
+    // 参数数量
+    int numParams;
+    // 扫描关系ID
+    int rtindex;
+    // 无模式标志
+    bool schemaless;
+    // 用户ID
+    Oid userid;
+    // #ifdef CXX_CLIENT
+    // 外部表信息(用于C++客户端)
+    ForeignTable *ftable;
+    // #endif
+    // 远程表达式列表
+    List *remote_exprs;
+
+    // 调试日志
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    /* 初始化执行状态 */
+    festate = (TDengineFdwExecState *)palloc0(sizeof(TDengineFdwExecState));
+    node->fdw_state = (void *)festate;
+    festate->rowidx = 0;
+
+    /* 从计划节点中提取信息 */
+    festate->query = strVal(list_nth(fsplan->fdw_private, 0));                                 // SQL查询字符串
+    festate->retrieved_attrs = list_nth(fsplan->fdw_private, 1);                               // 需要检索的属性
+    festate->for_update = intVal(list_nth(fsplan->fdw_private, 2)) ? true : false;             // FOR UPDATE标志
+    festate->tlist = (List *)list_nth(fsplan->fdw_private, 3);                                 // 目标列表
+    festate->is_tlist_func_pushdown = intVal(list_nth(fsplan->fdw_private, 4)) ? true : false; // 函数下推标志
+    schemaless = intVal(list_nth(fsplan->fdw_private, 5)) ? true : false;                      // 无模式标志
+    remote_exprs = (List *)list_nth(fsplan->fdw_private, 6);                                   // 远程表达式列表
+    festate->bounds_query = strVal(list_nth(fsplan->fdw_private, 7));                          // 并行扫描的时间范围查询
+    if (festate->bounds_query[0] == '\0')
+        festate->bounds_query = NULL;
+    festate->query_has_where = intVal(list_nth(fsplan->fdw_private, 8)) ? true : false;        // 扫描语句是否有WHERE
+    festate->cond_pos = intVal(list_nth(fsplan->fdw_private, 9));                              // 附加条件插入位置
+    festate->fanout_merge = (TDengineFanoutMerge)intVal(list_nth(fsplan->fdw_private, 10));    // 扇出合并方式
+
+    festate->cursor_exists = false; // 游标存在标志初始化为false
+#if (PG_VERSION_NUM >= 140000)
+    festate->async_capable = node->ss.ps.async_capable; // 是否由Append异步执行
+#endif
+
+    /* 确定扫描关系ID */
+    if (fsplan->scan.scanrelid > 0)
+        rtindex = fsplan->scan.scanrelid;
+    else
+        rtindex = bms_next_member(fsplan->fs_relids, -1);
+
+    // 获取范围表条目
+    rte = exec_rt_fetch(rtindex, estate);
+
+    /* 获取用户ID */
+    userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+
+    /* 获取连接选项和用户映射 */
+    festate->tdengineFdwOptions = tdengine_get_options(rte->relid, userid);
+    ftable = GetForeignTable(rte->relid);
+    festate->user = GetUserMapping(userid, ftable->serverid);
+    festate->relid = rte->relid;
+
+    /*
+     * 事务级写缓冲区中该表尚未发送的行先写入远程，之后的SELECT才能读到，
+     * UPDATE也不会漏掉这些行。连接或聚合扫描涉及的每张表都要发送。
+     */
+    if (!(eflags & EXEC_FLAG_EXPLAIN_ONLY))
+    {
+        if (fsplan->scan.scanrelid > 0)
+            tdengine_xact_insert_flush_rel(festate->relid);
+        else
+        {
+            int member = -1;
+
+            while ((member = bms_next_member(fsplan->fs_relids, member)) >= 0)
+                tdengine_xact_insert_flush_rel(exec_rt_fetch(member, estate)->relid);
+        }
+    }
+
+    /* 初始化无模式信息 */
+    tdengine_get_schemaless_info(&(festate->slinfo), schemaless, rte->relid);
+
+    /* 为每个检索列预先确定类型转换方式 */
+    tdengine_build_conv_plan(node, festate);
+
+    /*
+     * 流式扫描: 游标和当前数据块的描述信息分别保存在独立的上下文中，
+     * 内存占用只取决于数据块大小而非结果集大小
+     */
+    festate->cursor_cxt = AllocSetContextCreate(estate->es_query_cxt,
+                                                "tdengine_fdw cursor",
+                                                ALLOCSET_SMALL_SIZES);
+    festate->batch_cxt = AllocSetContextCreate(estate->es_query_cxt,
+                                               "tdengine_fdw tuple data",
+                                               ALLOCSET_DEFAULT_SIZES);
+
+    /* 准备查询参数 */
+    numParams = list_length(fsplan->fdw_exprs);
+    festate->numParams = numParams;
+    if (numParams > 0)
+    {
+        prepare_query_params((PlanState *)node,
+                             fsplan->fdw_exprs,
+                             remote_exprs,
+                             rte->relid,
+                             numParams,
+                             &festate->param_flinfo,
+                             &festate->param_exprs,
+                             &festate->param_values,
+                             &festate->param_types,
+                             &festate->param_tdengine_types,
+                             &festate->param_tdengine_values,
+                             &festate->param_column_info);
+    }
+
+    /*
+     * 可能被重扫的非并行扫描(带参数的内表或要求可回绕的扫描)可以缓存完整结果。
+     * 缓存推迟到第一次以不变的参数重扫时才建立，见tdengineReScanForeignScan
+     */
+    if (!(eflags & EXEC_FLAG_EXPLAIN_ONLY) && !fsplan->scan.plan.parallel_aware &&
+        ((eflags & EXEC_FLAG_REWIND) || numParams > 0))
+    {
+        festate->rescan_capable = true;
+        if (numParams > 0)
+            festate->rescan_params = (char **)MemoryContextAllocZero(estate->es_query_cxt,
+                                                                     sizeof(char *) * numParams);
+    }
+}
+
+//======================== IterateForeignScan ==================
+/*
+ * 逐个迭代从 TDengine 获取行，并将其放入元组槽中
+ *
+ * 结果通过远程游标按数据块拉取，当前数据块消费完后才请求下一块。
+ * 各列直接引用数据块中的类型化缓冲区，按值转换为Datum。
+ */
+static TupleTableSlot *
+tdengineIterateForeignScan(ForeignScanState *node)
+{
+    // 获取执行状态
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    // 获取元组槽
+    TupleTableSlot *tupleSlot = node->ss.ss_ScanTupleSlot;
     // 获取执行状态
     EState *estate = node->ss.ps.state;
     // 获取元组描述符
     TupleDesc tupleDescriptor = tupleSlot->tts_tupleDescriptor;
-    // 获取 TDengine 选项
-    tdengine_opt *options;
-    // 存储查询返回结果
-    struct TDengineQuery_return volatile ret;
-    // 存储查询结果
-    struct TDengineResult volatile *result = NULL;
+    // 当前数据块
+    TDengineBlock *block;
+    // 返回行在数据块中的行号
+    int rowidx;
     // 获取外键扫描计划
     ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
     // 范围表条目
@@ -1125,165 +2194,804 @@ tdengineIterateForeignScan(ForeignScanState *node)
     // 获取范围表条目
     rte = rt_fetch(rtindex, estate->es_range_table);
 
-    // 获取 TDengine 选项
-    options = festate->tdengineFdwOptions;
-
     /*
      * 如果这是在 Begin 或 ReScan 之后的第一次调用，我们需要在远程端创建游标。
      * 绑定参数的操作在这个函数中完成。
      */
-    if (!festate->cursor_exists)
-        // 创建游标
-        create_cursor(node);
+    // 清空元组槽
+    ExecClearTuple(tupleSlot);
+
+    /* 参数不变的重扫从缓存回放上一轮的结果 */
+    if (festate->rescan_replay)
+    {
+        (void) tdengine_rescan_replay_next(node, tupleSlot);
+        return tupleSlot;
+    }
+
+    for (;;)
+    {
+        if (!festate->cursor_exists)
+        {
+            /* 并行扫描时先领取一个时间块，没有剩余的块则扫描结束 */
+            if (festate->pscan != NULL && !tdengine_claim_chunk(node))
+                return tupleSlot;
+            // 创建游标
+            create_cursor(node);
+        }
+
+        /* 扇出扫描从各路查询中合并取行 */
+        if (festate->fanout != NULL)
+        {
+            if (!tdengine_fanout_next(node, &block, &rowidx))
+            {
+                festate->rescan_complete = festate->rescan_fill;
+                return tupleSlot;
+            }
+            break;
+        }
+
+        /* 当前数据块已全部返回，从远程拉取下一块 */
+        if (festate->rowidx >= festate->row_nums && !festate->eof_reached)
+            fetch_more_data(node);
+
+        if (festate->rowidx < festate->row_nums)
+        {
+            block = (TDengineBlock *)festate->temp_result;
+            rowidx = festate->rowidx++;
+            break;
+        }
+
+        /* 没有更多数据，返回空槽表示扫描结束 */
+        if (festate->pscan == NULL)
+        {
+            festate->rescan_complete = festate->rescan_fill;
+            return tupleSlot;
+        }
+
+        /* 当前时间块已读完，关闭游标后领取下一块 */
+        close_cursor(festate);
+        festate->cursor_exists = false;
+    }
+
+    // 从结果行创建元组
+    make_tuple_from_result_row(block,
+                               rowidx,
+                               tupleDescriptor,
+                               tupleSlot->tts_values,
+                               tupleSlot->tts_isnull,
+                               rte->relid,
+                               festate,
+                               is_agg);
+
+    // 存储虚拟元组
+    ExecStoreVirtualTuple(tupleSlot);
+
+    /* 同时写入重扫缓存 */
+    if (festate->rescan_fill)
+        tuplestore_puttupleslot(festate->rescan_store, tupleSlot);
+
+    // 返回元组槽
+    return tupleSlot;
+}
+
+//===================== ReScanForeignScan =====================
+/*
+ * 从扫描的起始位置重新开始扫描。请注意，扫描所依赖的任何参数的值可能已经发生变化，
+ * 因此新的扫描不一定会返回与之前完全相同的行。
+ *
+ * 上一轮已完整缓存结果且下推的参数值没有变化时，从缓存回放而不重新查询远程。
+ * 只有以与上一轮相同的参数重扫时，本轮才把结果写入缓存，参数每次都变化的
+ * 内表和只扫描一次的扫描不付出复制结果的开销。
+ */
+static void
+tdengineReScanForeignScan(ForeignScanState *node)
+{
+
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    bool unchanged;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    /* 关闭旧游标，下一次迭代时重新打开 */
+    close_cursor(festate);
+    festate->cursor_exists = false;
+    festate->rescan_replay = false;
+
+    if (!festate->rescan_capable)
+        return;
+
+    unchanged = (node->ss.ps.chgParam == NULL || !tdengine_rescan_params_changed(node));
+    if (festate->rescan_complete && unchanged)
+    {
+        elog(DEBUG1, "tdengine_fdw : parameters unchanged, replaying cached result");
+        tuplestore_rescan(festate->rescan_store);
+        festate->rescan_replay = true;
+        festate->cursor_exists = true;
+        return;
+    }
+
+    /* 参数已变化或上一轮没有缓存完整结果，丢弃缓存重新查询 */
+    if (festate->rescan_store != NULL)
+        tuplestore_clear(festate->rescan_store);
+    festate->rescan_complete = false;
+
+    /* 参数与上一轮相同时本轮结果很可能被再次用到，开始缓存 */
+    festate->rescan_fill = unchanged;
+    if (unchanged && festate->rescan_store == NULL)
+    {
+        MemoryContext oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+
+        festate->rescan_store = tuplestore_begin_heap(false, false, work_mem);
+        festate->rescan_slot = MakeSingleTupleTableSlot(node->ss.ss_ScanTupleSlot->tts_tupleDescriptor,
+                                                        &TTSOpsMinimalTuple);
+        MemoryContextSwitchTo(oldcontext);
+    }
+}
+
+//===================== EndForeignScan =======================
+/*
+ * 结束对外部表的扫描，并释放本次扫描所使用的对象
+ */
+static void
+tdengineEndForeignScan(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    if (festate != NULL)
+    {
+        close_cursor(festate);
+        festate->cursor_exists = false;
+
+        /* 释放重扫缓存可能占用的临时文件 */
+        if (festate->rescan_store != NULL)
+        {
+            tuplestore_end(festate->rescan_store);
+            festate->rescan_store = NULL;
+        }
+        if (festate->rescan_slot != NULL)
+        {
+            ExecDropSingleTupleTableSlot(festate->rescan_slot);
+            festate->rescan_slot = NULL;
+        }
+    }
+}
+
+//======================== 并行扫描 ==================
+/*
+ * tdengineIsForeignScanParallelSafe
+ *      外部表能否在并行worker中扫描
+ *
+ * 每个worker使用各自的连接，扫描本身不依赖后端本地状态。只有配置了
+ * parallel_workers的外部表才允许，避免改变其他外部表已有的计划。
+ */
+static bool
+tdengineIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte)
+{
+    Oid userid = rte->checkAsUser ? rte->checkAsUser : GetUserId();
+
+    /* 此时GetForeignRelSize尚未调用，直接读取选项 */
+    return tdengine_get_options(rte->relid, userid)->parallel_workers > 0;
+}
+
+/*
+ * tdengineEstimateDSMForeignScan
+ *      并行扫描共享状态所需的DSM大小
+ */
+static Size
+tdengineEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt)
+{
+    return sizeof(TDengineParallelScanState);
+}
+
+/*
+ * tdengineInitializeDSMForeignScan - leader初始化并行扫描的共享状态
+ *
+ * 参数:
+ *   @node: ForeignScanState节点
+ *   @pcxt: 并行上下文
+ *   @coordinate: DSM中的共享状态
+ *
+ * 处理流程:
+ *   1. 执行时间范围查询，得到扫描涉及的第一个和最后一个时间戳
+ *   2. 按参与进程数切分为若干左闭右开的时间块
+ *   3. 查询带参数或时间范围无法确定时退化为一个不加条件的块
+ */
+static void
+tdengineInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    TDengineParallelScanState *pscan = (TDengineParallelScanState *)coordinate;
+    int64 lower = 0;
+    int64 upper = 0;
+    bool found = false;
+
+    memset(pscan, 0, sizeof(TDengineParallelScanState));
+    pg_atomic_init_u32(&pscan->next_chunk, 0);
+    pscan->nchunks = 1;
+    pscan->bounded = false;
+
+    /* 参数值在执行时才确定，此时无法查询时间范围 */
+    if (festate->bounds_query != NULL && festate->numParams == 0)
+    {
+        char *err = TDengineQueryTimeBounds(festate->bounds_query, festate->user,
+                                            festate->tdengineFdwOptions,
+                                            NULL, NULL, 0,
+                                            &lower, &upper, &found, NULL);
+
+        if (err != NULL)
+            tdengine_report_remote_error(err);
+
+        if (!found)
+            pscan->nchunks = 0;
+        else
+        {
+            int nchunks = (pcxt->nworkers + 1) * TDENGINE_PARALLEL_CHUNKS_PER_WORKER;
+            int64 span = upper - lower + 1;
+
+            if (span < nchunks)
+                nchunks = (int)span;
+
+            pscan->bounded = true;
+            pscan->lower = lower;
+            pscan->upper = upper + 1;
+            pscan->step = (span + nchunks - 1) / nchunks;
+            pscan->nchunks = (int)((span + pscan->step - 1) / pscan->step);
+        }
+    }
+
+    elog(DEBUG1, "tdengine_fdw : parallel scan split into %d chunks", pscan->nchunks);
+
+    festate->pscan = pscan;
+}
+
+/*
+ * tdengineReInitializeDSMForeignScan
+ *      重扫前重置块计数，时间块的划分保持不变
+ */
+static void
+tdengineReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate)
+{
+    TDengineParallelScanState *pscan = (TDengineParallelScanState *)coordinate;
+
+    pg_atomic_write_u32(&pscan->next_chunk, 0);
+}
+
+/*
+ * tdengineInitializeWorkerForeignScan
+ *      worker获取leader初始化的共享状态
+ */
+static void
+tdengineInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc, void *coordinate)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+
+    festate->pscan = (TDengineParallelScanState *)coordinate;
+}
+
+/*
+ * tdengine_claim_chunk - 领取下一个时间块并生成其扫描语句
+ *
+ * 参数:
+ *   @node: ForeignScanState节点
+ *
+ * 返回值:
+ *   true - 领取成功，festate->chunk_query为该块的扫描语句
+ *   false - 所有块都已被领取
+ */
+static bool
+tdengine_claim_chunk(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    TDengineParallelScanState *pscan = festate->pscan;
+    uint32 chunk = pg_atomic_fetch_add_u32(&pscan->next_chunk, 1);
+    int64 lower;
+    int64 upper;
+    MemoryContext oldcontext;
+
+    if (chunk >= (uint32)pscan->nchunks)
+        return false;
+
+    if (!pscan->bounded)
+    {
+        festate->chunk_query = festate->query;
+        return true;
+    }
+
+    lower = pscan->lower + pscan->step * chunk;
+    upper = Min(lower + pscan->step, pscan->upper);
+
+    oldcontext = MemoryContextSwitchTo(festate->cursor_cxt);
+    festate->chunk_query = tdengine_query_with_condition(festate,
+                                                         psprintf("time >= " INT64_FORMAT " AND time < " INT64_FORMAT,
+                                                                  lower, upper));
+    MemoryContextSwitchTo(oldcontext);
+    return true;
+}
+
+/*
+ * tdengine_query_with_condition - 在扫描语句的WHERE子句中追加一个条件
+ *
+ * 条件插入在FROM/WHERE子句之后、ORDER BY等子句之前，结果在当前内存上下文中分配。
+ */
+static char *
+tdengine_query_with_condition(TDengineFdwExecState *festate, const char *cond)
+{
+    StringInfoData buf;
+
+    initStringInfo(&buf);
+    appendBinaryStringInfo(&buf, festate->query, festate->cond_pos);
+    appendStringInfo(&buf, "%s(%s)", festate->query_has_where ? " AND " : " WHERE ", cond);
+    appendStringInfoString(&buf, festate->query + festate->cond_pos);
+
+    return buf.data;
+}
+
+/*
+ * tdengine_list_child_tables - 查询外部表对应超级表的所有子表名
+ *
+ * 外部表映射的是普通表或子表时结果为空。子表名在es_query_cxt中分配。
+ */
+static List *
+tdengine_list_child_tables(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    tdengine_opt *options = festate->tdengineFdwOptions;
+    struct TDengineQuery_return ret;
+    StringInfoData sql;
+    List *tables = NIL;
+    MemoryContext oldcontext;
+    int i;
+
+    oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+
+    initStringInfo(&sql);
+    appendStringInfoString(&sql, "SELECT table_name FROM information_schema.ins_tables WHERE db_name = ");
+    tdengine_deparse_string_literal(&sql, options->svr_database);
+    appendStringInfoString(&sql, " AND stable_name = ");
+    tdengine_deparse_string_literal(&sql, tdengine_get_table_name(node->ss.ss_currentRelation));
+
+    ret = TDengineQuery(sql.data, festate->user, options, NULL, NULL, 0);
+    if (ret.r1 != NULL)
+        tdengine_report_remote_error(ret.r1);
+
+    for (i = 0; i < ret.r0->nrow; i++)
+    {
+        char *name = ret.r0->rows[i].tuple[0];
+
+        if (name != NULL)
+            tables = lappend(tables, pstrdup(name));
+    }
+    TDengineFreeResult(ret.r0);
+
+    MemoryContextSwitchTo(oldcontext);
+
+    return tables;
+}
+
+/*
+ * tdengine_fanout_open - 提交一路的下一条查询
+ *
+ * 参数:
+ *   @node: ForeignScanState节点
+ *   @stream: 扇出扫描的一路，conds不为空
+ *
+ * 注意事项:
+ *   - 游标在该路的cursor_cxt中打开，重置该上下文即关闭游标并归还连接
+ *   - 每条查询借用一条独占连接，同时进行的多个扇出扫描不会共用连接
+ */
+static void
+tdengine_fanout_open(ForeignScanState *node, TDengineFanoutStream *stream)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    tdengine_opt *options = festate->tdengineFdwOptions;
+    struct TDengineCursorOpen_return ret;
+    MemoryContext oldcontext;
+    char *query;
+
+    MemoryContextReset(stream->cursor_cxt);
+    stream->cursor = NULL;
+
+    oldcontext = MemoryContextSwitchTo(stream->cursor_cxt);
+    query = tdengine_query_with_condition(festate, (char *)linitial(stream->conds));
+    stream->conds = list_delete_first(stream->conds);
+
+    ret = TDengineCursorOpenAsync(query, festate->user, options,
+                                  festate->param_tdengine_types,
+                                  festate->param_tdengine_values,
+                                  festate->numParams);
+    MemoryContextSwitchTo(oldcontext);
+
+    if (ret.r1 != NULL)
+        tdengine_report_remote_error(ret.r1);
+
+    elog(DEBUG1, "tdengine_fdw : fan-out query: %s", query);
+
+    stream->cursor = ret.r0;
+    if (options->prefetch)
+        (void) TDengineCursorStartPrefetch(stream->cursor, options->fetch_size);
+ * tdengine_is_supertable - 远程表是否为超级表
+ *
+ * 外部表映射超级表时，写入的行须按标签值路由到各自的子表。
+ */
+static bool
+tdengine_is_supertable(Relation rel, UserMapping *user, tdengine_opt *options)
+{
+    struct TDengineQuery_return ret;
+    StringInfoData sql;
+    bool found;
+
+    initStringInfo(&sql);
+    appendStringInfoString(&sql, "SELECT stable_name FROM information_schema.ins_stables WHERE db_name = ");
+    tdengine_deparse_string_literal(&sql, options->svr_database);
+    appendStringInfoString(&sql, " AND stable_name = ");
+    tdengine_deparse_string_literal(&sql, tdengine_get_table_name(rel));
+
+    ret = TDengineQuery(sql.data, user, options, NULL, NULL, 0);
+    if (ret.r1 != NULL)
+        tdengine_report_remote_error(ret.r1);
+
+    found = ret.r0->nrow > 0;
+    TDengineFreeResult(ret.r0);
+    pfree(sql.data);
+
+    return found;
+}
+
+/*
+ * tdengine_fanout_begin - 按子表分组，在多个连接上同时提交扫描查询
+ *
+ * 参数:
+ *   @node: ForeignScanState节点
+ *
+ * 返回值:
+ *   true - 已打开各路游标，festate->fanout指向扇出状态
+ *   false - 子表不足两个或只允许一个连接，或者有序合并时一组子表的条件
+ *           超出单条查询的长度，调用方按单路扫描
+ *
+ * 注意事项:
+ *   - 每路查询借用一条独占连接，不占用其他扫描共用的默认连接
+ *   - 一组的条件过长时拆成多条查询在该路上依次执行，各条查询之间没有时间顺序，
+ *     因此只用于无序合并
+ *   - 各路查询由后台线程提交，打开之后立即返回
+ *   - 查询参数须已由create_cursor处理完毕
+ */
+static bool
+tdengine_fanout_begin(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    tdengine_opt *options = festate->tdengineFdwOptions;
+    TDengineFanoutState *fanout;
+    StringInfoData *conds;
+    MemoryContext oldcontext;
+    ListCell *lc;
+    int nstreams;
+    int i;
+
+    if (!festate->fanout_listed)
+    {
+        festate->fanout_tables = tdengine_list_child_tables(node);
+        festate->fanout_listed = true;
+    }
+
+    nstreams = Min(options->fanout_connections, list_length(festate->fanout_tables));
+    if (nstreams < 2)
+        return false;
+
+    oldcontext = MemoryContextSwitchTo(festate->cursor_cxt);
+
+    fanout = (TDengineFanoutState *)palloc0(sizeof(TDengineFanoutState));
+    fanout->nstreams = nstreams;
+    fanout->streams = (TDengineFanoutStream *)palloc0(sizeof(TDengineFanoutStream) * nstreams);
+    fanout->time_col = -1;
+
+    /*
+     * 子表按轮转方式分组，每组生成tbname IN条件；条件达到长度上限时
+     * 结束当前条件，其余子表进入该组的下一条查询
+     */
+    conds = (StringInfoData *)palloc(sizeof(StringInfoData) * nstreams);
+    for (i = 0; i < nstreams; i++)
+        initStringInfo(&conds[i]);
+    i = 0;
+    foreach (lc, festate->fanout_tables)
+    {
+        TDengineFanoutStream *stream = &fanout->streams[i % nstreams];
+        StringInfo cond = &conds[i++ % nstreams];
+
+        if (cond->len >= TDENGINE_FANOUT_MAX_CONDITION_LEN)
+        {
+            appendStringInfoChar(cond, ')');
+            stream->conds = lappend(stream->conds, cond->data);
+            initStringInfo(cond);
+        }
+        appendStringInfoString(cond, cond->len == 0 ? "tbname IN (" : ", ");
+        tdengine_deparse_string_literal(cond, (char *)lfirst(lc));
+    }
+
+    for (i = 0; i < nstreams; i++)
+    {
+        TDengineFanoutStream *stream = &fanout->streams[i];
+
+        appendStringInfoChar(&conds[i], ')');
+        stream->conds = lappend(stream->conds, conds[i].data);
+
+        /* 一路拆成多条查询时结果不再整体有序，无法参与按时间的多路归并 */
+        if (festate->fanout_merge != TDENGINE_FANOUT_UNORDERED && list_length(stream->conds) > 1)
+        {
+            MemoryContextSwitchTo(oldcontext);
+            elog(DEBUG1, "tdengine_fdw : too many child tables for an ordered fan-out scan");
+            return false;
+        }
+    }
+
+    for (i = 0; i < nstreams; i++)
+    {
+        TDengineFanoutStream *stream = &fanout->streams[i];
+
+        stream->cursor_cxt = AllocSetContextCreate(festate->cursor_cxt,
+                                                   "tdengine_fdw fan-out cursor",
+                                                   ALLOCSET_SMALL_SIZES);
+        stream->batch_cxt = AllocSetContextCreate(festate->cursor_cxt,
+                                                  "tdengine_fdw fan-out data",
+                                                  ALLOCSET_DEFAULT_SIZES);
+        tdengine_fanout_open(node, stream);
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+
+    festate->fanout = fanout;
+    return true;
+}
+
+/*
+ * tdengine_fanout_fill - 确保一路查询有待返回的行
+ *
+ * 当前数据块读完后拉取该路的下一个数据块，当前查询读完后提交该路的下一条查询，
+ * 该路结果已全部读完时返回false。
+ */
+static bool
+tdengine_fanout_fill(ForeignScanState *node, TDengineFanoutStream *stream)
+{
+    struct TDengineBlock_return ret;
+    MemoryContext oldcontext;
+
+    if (stream->block != NULL && stream->rowidx < stream->block->nrow)
+        return true;
+    if (stream->eof)
+        return false;
+
+    for (;;)
+    {
+        stream->block = NULL;
+        stream->rowidx = 0;
+        MemoryContextReset(stream->batch_cxt);
+
+        oldcontext = MemoryContextSwitchTo(stream->batch_cxt);
+        ret = TDengineCursorFetchBlock(stream->cursor);
+        MemoryContextSwitchTo(oldcontext);
+
+        if (ret.r1 != NULL)
+            tdengine_report_remote_error(ret.r1);
+
+        if (ret.r0->nrow > 0)
+            break;
+
+        if (stream->conds == NIL)
+        {
+            /* 该路已读完，提前关闭游标归还连接 */
+            MemoryContextReset(stream->cursor_cxt);
+            stream->cursor = NULL;
+            stream->eof = true;
+            return false;
+        }
+        tdengine_fanout_open(node, stream);
+    }
+
+    /*
+     * 各路查询的结果列相同，转换计划的列映射和转换例程在该路的第一个数据块上
+     * 确定后不再随数据块重新绑定
+     */
+    if (!stream->mapped)
+    {
+        tdengine_map_conv_plan(node, ret.r0);
+        stream->mapped = true;
+    }
+    stream->block = ret.r0;
+    return true;
+}
 
-    // 初始化元组槽的值为 0
-    memset(tupleSlot->tts_values, 0, sizeof(Datum) * tupleDescriptor->natts);
-    // 初始化元组槽的空值标记为 true
-    memset(tupleSlot->tts_isnull, true, sizeof(bool) * tupleDescriptor->natts);
-    // 清空元组槽
-    ExecClearTuple(tupleSlot);
+/*
+ * tdengine_fanout_time - 读取一路查询当前行的时间戳
+ */
+static int64
+tdengine_fanout_time(TDengineFanoutState *fanout, TDengineFanoutStream *stream)
+{
+    TDengineBlock *block = stream->block;
+    uint32 len;
+    int64 ts;
 
-    if (festate->rowidx == 0)
+    if (fanout->time_col < 0)
     {
-        // 保存旧的内存上下文
-        MemoryContext oldcontext = NULL;
+        int c;
 
-        // 异常处理开始
-        PG_TRY();
+        for (c = 0; c < block->ncol; c++)
         {
-            // festate->rows 需要比每行更长的上下文
-            oldcontext = MemoryContextSwitchTo(estate->es_query_cxt);
-            // #ifdef CXX_CLIENT
-            // TODO: 使用 C++ 客户端执行查询
-            ret = TDengineQuery(festate->query, festate->user, options,
-                                // #else
-                                //             // 使用普通方式执行查询
-                                //             ret = TDengineQuery(festate->query, options->svr_address, options->svr_port,
-                                //                                 options->svr_username, options->svr_password,
-                                //                                 options->svr_database,
-                                // #endif
-                                festate->param_tdengine_types,
-                                festate->param_tdengine_values,
-                                festate->numParams);
-            if (ret.r1 != NULL)
+            if (TDENGINE_IS_TIME_COLUMN(block->columns[c]))
             {
-                // 复制错误信息
-                char *err = pstrdup(ret.r1);
-                // 释放原错误信息
-                free(ret.r1);
-                ret.r1 = err;
-                // 打印错误信息
-                elog(ERROR, "tdengine_fdw : %s", err);
+                fanout->time_col = c;
+                break;
             }
+        }
+        if (fanout->time_col < 0)
+            elog(ERROR, "tdengine_fdw : time column is missing from the fan-out scan result");
+    }
+
+    memcpy(&ts, tdengine_column_value(&block->cols[fanout->time_col], stream->rowidx, &len), sizeof(int64));
+    return ts;
+}
+
+/*
+ * tdengine_fanout_next - 从各路查询中取出下一行
+ *
+ * 参数:
+ *   @node: ForeignScanState节点
+ *   @block: 输出该行所在的数据块
+ *   @rowidx: 输出该行在数据块中的行号
+ *
+ * 返回值:
+ *   false表示各路结果都已读完
+ */
+static bool
+tdengine_fanout_next(ForeignScanState *node, TDengineBlock **block, int *rowidx)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    TDengineFanoutState *fanout = festate->fanout;
+    TDengineFanoutStream *best = NULL;
+    int i;
 
-            result = ret.r0;
-            festate->temp_result = (void *)result;
+    if (festate->fanout_merge == TDENGINE_FANOUT_UNORDERED)
+    {
+        TDengineFanoutStream *stream = &fanout->streams[fanout->current];
 
-            // 获取结果集的行数
-            festate->row_nums = result->nrow;
-            // 打印查询信息
-            elog(DEBUG1, "tdengine_fdw : query: %s", festate->query);
+        /* 当前一路的数据块读完后换到下一路，使各路交替推进 */
+        if (stream->block != NULL && stream->rowidx >= stream->block->nrow)
+            fanout->current = (fanout->current + 1) % fanout->nstreams;
 
-            // 切换回旧的内存上下文
-            MemoryContextSwitchTo(oldcontext);
-            // 释放结果集
-            TDengineFreeResult((TDengineResult *)result);
-        }
-        // 异常处理捕获部分
-        PG_CATCH();
+        for (i = 0; i < fanout->nstreams; i++)
         {
-            if (ret.r1 == NULL)
+            stream = &fanout->streams[fanout->current];
+            if (tdengine_fanout_fill(node, stream))
             {
-                // 释放结果集
-                TDengineFreeResult((TDengineResult *)result);
+                best = stream;
+                break;
             }
-
-            if (oldcontext)
-                // 切换回旧的内存上下文
-                MemoryContextSwitchTo(oldcontext);
-
-            // 重新抛出异常
-            PG_RE_THROW();
+            fanout->current = (fanout->current + 1) % fanout->nstreams;
         }
-        // 异常处理结束
-        PG_END_TRY();
     }
-
-    if (festate->rowidx < festate->row_nums)
+    else
     {
-        // 保存旧的内存上下文
-        MemoryContext oldcontext = NULL;
+        int64 best_time = 0;
 
-        // 获取结果集
-        result = (TDengineResult *)festate->temp_result;
-        // 从结果行创建元组
-        make_tuple_from_result_row(&(result->rows[festate->rowidx]),
-                                   (TDengineResult *)result,
-                                   tupleDescriptor,
-                                   tupleSlot->tts_values,
-                                   tupleSlot->tts_isnull,
-                                   rte->relid,
-                                   festate,
-                                   is_agg);
-        // 切换到查询上下文
-        oldcontext = MemoryContextSwitchTo(estate->es_query_cxt);
+        /* 各路结果已按时间排序，逐行选出时间最小(降序时最大)的一路 */
+        for (i = 0; i < fanout->nstreams; i++)
+        {
+            TDengineFanoutStream *stream = &fanout->streams[i];
+            int64 ts;
 
-        // 释放结果行
-        freeTDengineResultRow(festate, festate->rowidx);
+            if (!tdengine_fanout_fill(node, stream))
+                continue;
 
-        if (festate->rowidx == (festate->row_nums - 1))
-        {
-            // 释放结果集
-            freeTDengineResult(festate);
+            ts = tdengine_fanout_time(fanout, stream);
+            if (best == NULL ||
+                (festate->fanout_merge == TDENGINE_FANOUT_TIME_ASC ? ts < best_time : ts > best_time))
+            {
+                best = stream;
+                best_time = ts;
+            }
         }
+    }
 
-        // 切换回旧的内存上下文
-        MemoryContextSwitchTo(oldcontext);
+    if (best == NULL)
+        return false;
 
-        // 存储虚拟元组
-        ExecStoreVirtualTuple(tupleSlot);
-        // 行索引加 1
-        festate->rowidx++;
-    }
+    *block = best->block;
+    *rowidx = best->rowidx++;
+    return true;
+}
 
-    // 返回元组槽
-    return tupleSlot;
+#if (PG_VERSION_NUM >= 140000)
+//======================== 异步执行 ==================
+/*
+ * tdengineIsForeignPathAsyncCapable
+ *      判断外部扫描路径能否由Append异步执行
+ *
+ * 由服务器或外部表的async_capable选项控制。
+ */
+static bool
+tdengineIsForeignPathAsyncCapable(ForeignPath *path)
+{
+    RelOptInfo *rel = ((Path *)path)->parent;
+    TDengineFdwRelationInfo *fpinfo = (TDengineFdwRelationInfo *)rel->fdw_private;
+
+    return fpinfo->async_capable;
 }
 
-//===================== ReScanForeignScan =====================
 /*
- * 从扫描的起始位置重新开始扫描。请注意，扫描所依赖的任何参数的值可能已经发生变化，
- * 因此新的扫描不一定会返回与之前完全相同的行。
+ * tdengineForeignAsyncRequest
+ *      异步请求下一行
  */
 static void
-tdengineReScanForeignScan(ForeignScanState *node)
+tdengineForeignAsyncRequest(AsyncRequest *areq)
 {
+    produce_tuple_asynchronously(areq);
+}
 
+/*
+ * tdengineForeignAsyncConfigureWait
+ *      将远程查询的完成通知描述符加入Append的等待事件集合
+ */
+static void
+tdengineForeignAsyncConfigureWait(AsyncRequest *areq)
+{
+    ForeignScanState *node = (ForeignScanState *)areq->requestee;
     TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    int fd;
 
-    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+    /* 只有挂起的请求才需要等待 */
+    Assert(areq->callback_pending);
 
-    festate->cursor_exists = false;
-    festate->rowidx = 0;
+    fd = TDengineCursorEventFd(festate->cursor);
+    Assert(fd >= 0);
+
+    AddWaitEventToSet(areq->requestor->eventset, WL_SOCKET_READABLE, fd, NULL, areq);
 }
 
-//===================== EndForeignScan =======================
 /*
- * 结束对外部表的扫描，并释放本次扫描所使用的对象
+ * tdengineForeignAsyncNotify
+ *      远程查询已返回，继续产生结果行
  */
 static void
-tdengineEndForeignScan(ForeignScanState *node)
+tdengineForeignAsyncNotify(AsyncRequest *areq)
+{
+    produce_tuple_asynchronously(areq);
+}
+
+/*
+ * produce_tuple_asynchronously - 异步产生一行结果
+ *
+ * 参数:
+ *   @areq: 异步请求
+ *
+ * 处理流程:
+ *   1. 首次请求时在后台提交远程查询
+ *   2. 远程查询尚未返回时挂起请求，由Append等待完成通知
+ *   3. 查询已返回时经由ExecProcNode取下一行(包括本地条件和投影)
+ *
+ * 注意事项:
+ *   - 查询返回之后的数据块拉取与同步扫描相同；启用prefetch时由预取线程重叠
+ */
+static void
+produce_tuple_asynchronously(AsyncRequest *areq)
 {
+    ForeignScanState *node = (ForeignScanState *)areq->requestee;
     TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    TupleTableSlot *result;
 
-    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+    if (!festate->cursor_exists)
+        create_cursor(node);
 
-    if (festate != NULL)
+    /* 扇出扫描没有单一的完成通知，各路查询已在后台提交，直接取行 */
+    if (festate->cursor != NULL && !TDengineCursorReady(festate->cursor))
     {
-        festate->cursor_exists = false;
-        festate->rowidx = 0;
+        ExecAsyncRequestPending(areq);
+        return;
     }
+
+    result = ExecProcNode((PlanState *)node);
+    ExecAsyncRequestDone(areq, result);
 }
+#endif
 
 /*
  * tdengineAddForeignUpdateTargets
@@ -1390,7 +3098,44 @@ tdenginePlanForeignModify(PlannerInfo *root,
         }
     }
     else if (operation == CMD_UPDATE)
-        elog(ERROR, "UPDATE is not supported"); // 不支持UPDATE操作
+    {
+        /*
+         * UPDATE以覆盖写实现: TDengine中相同时间戳的写入覆盖原有的行，
+         * 因此写入行标识列(时间列和标签列)的原值和被更新字段列的新值。
+         * 未被更新的字段列不在列清单中，服务端保留其原值
+         */
+        Oid foreignTableId = RelationGetRelid(rel);
+        Bitmapset *tmpset = bms_union(rte->updatedCols, rte->extraUpdatedCols);
+        AttrNumber col;
+        int i;
+
+        for (i = 0; i < tupdesc->natts; i++)
+        {
+            Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+            char *colname = tdengine_get_column_name(foreignTableId, attr->attnum);
+
+            if (attr->attisdropped)
+                continue;
+            if (TDENGINE_IS_TIME_COLUMN(colname) || tdengine_is_tag_key(colname, foreignTableId))
+                targetAttrs = lappend_int(targetAttrs, attr->attnum);
+        }
+
+        col = -1;
+        while ((col = bms_next_member(tmpset, col)) >= 0)
+        {
+            int attno = col + FirstLowInvalidHeapAttributeNumber;
+            char *colname;
+
+            if (attno <= InvalidAttrNumber) /* 不应出现 */
+                elog(ERROR, "system-column update is not supported");
+
+            // 时间列和标签列标识被覆盖的行，不能更新
+            colname = tdengine_get_column_name(foreignTableId, attno);
+            if (TDENGINE_IS_TIME_COLUMN(colname) || tdengine_is_tag_key(colname, foreignTableId))
+                elog(ERROR, "tdengine_fdw : cannot update time or tag column \"%s\"", colname);
+            targetAttrs = lappend_int(targetAttrs, attno);
+        }
+    }
     else if (operation == CMD_DELETE)
     {
         // DELETE操作: 收集时间列和所有标签列
@@ -1422,8 +3167,13 @@ tdenginePlanForeignModify(PlannerInfo *root,
     switch (operation)
     {
     case CMD_INSERT:
+        // 构建参数绑定的INSERT语句
+        tdengine_deparse_insert(&sql, root, resultRelation, rel, targetAttrs);
+        break;
     case CMD_UPDATE:
-        break; // INSERT和UPDATE操作暂不处理SQL构建
+        // 构建覆盖写的INSERT语句，与INSERT共用预编译语句的写入路径
+        tdengine_deparse_insert(&sql, root, resultRelation, rel, targetAttrs);
+        break;
     case CMD_DELETE:
         // 构建DELETE语句
         tdengine_deparse_delete(&sql, root, resultRelation, rel, targetAttrs);
@@ -1453,7 +3203,11 @@ tdenginePlanForeignModify(PlannerInfo *root,
  *   2. 初始化执行状态结构体fmstate
  *   3. 获取用户身份和连接选项
  *   4. 设置查询语句和检索属性
- *   5. 为INSERT/DELETE操作准备列信息
+ *   5. 为INSERT/UPDATE/DELETE操作准备列信息
+ *   6. INSERT操作准备预编译语句，之后每个批次只绑定参数；
+ *      无模式表改用行协议写入，不准备语句
+ *   7. UPDATE以覆盖写实现，同样准备INSERT的预编译语句，
+ *      只在语句级缓冲，不进入事务级写缓冲区
  */
 static void
 tdengineBeginForeignModify(ModifyTableState *mtstate,
@@ -1519,8 +3273,9 @@ tdengineBeginForeignModify(ModifyTableState *mtstate,
     fmstate->query = strVal(list_nth(fdw_private, FdwModifyPrivateUpdateSql));
     fmstate->retrieved_attrs = (List *)list_nth(fdw_private, FdwModifyPrivateTargetAttnums);
 
-    /* 为INSERT/DELETE操作准备列信息 */
-    if (mtstate->operation == CMD_INSERT || mtstate->operation == CMD_DELETE)
+    /* 为INSERT/UPDATE/DELETE操作准备列信息 */
+    if (mtstate->operation == CMD_INSERT || mtstate->operation == CMD_UPDATE ||
+        mtstate->operation == CMD_DELETE)
     {
         fmstate->column_list = NIL;
 
@@ -1559,6 +3314,7 @@ tdengineBeginForeignModify(ModifyTableState *mtstate,
     fmstate->param_tdengine_types = (TDengineType *)palloc0(sizeof(TDengineType) * n_params);          // TDengine参数类型
     fmstate->param_tdengine_values = (TDengineValue *)palloc0(sizeof(TDengineValue) * n_params);       // TDengine参数值
     fmstate->param_column_info = (TDengineColumnInfo *)palloc0(sizeof(TDengineColumnInfo) * n_params); // 列信息
+    fmstate->p_slots = 1;                                                                              // 参数数组可容纳一行
 
     /* 创建临时内存上下文用于每行数据处理 */
     fmstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
@@ -1603,6 +3359,87 @@ tdengineBeginForeignModify(ModifyTableState *mtstate,
     /* 初始化辅助状态 */
     fmstate->aux_fmstate = NULL;
 
+    /*
+     * INSERT的预编译语句在修改状态存续期间复用，
+     * 分配在查询上下文中，查询出错中止时随上下文关闭。
+     * 写入超级表且给出了标签列时，改用USING子句按标签值写入各子表，
+     * 子表不存在时由服务端自动创建。
+     * write_buffer为transaction时语句分配在TopTransactionContext中，
+     * 同一事务中后续对该表的INSERT复用它，缓冲的行在提交前发送
+     */
+    tdengine_get_schemaless_info(&fmstate->slinfo, fmstate->tdengineFdwOptions->schemaless, foreignTableId);
+    if (mtstate->operation == CMD_UPDATE && fmstate->slinfo.schemaless)
+        elog(ERROR, "tdengine_fdw : UPDATE is not supported for schemaless foreign table \"%s\"",
+             RelationGetRelationName(rel));
+    fmstate->is_update = (mtstate->operation == CMD_UPDATE);
+    if ((mtstate->operation == CMD_INSERT || mtstate->operation == CMD_UPDATE) && !fmstate->slinfo.schemaless)
+    {
+        bool xact_buffer = mtstate->operation == CMD_INSERT &&
+                           strcmp(fmstate->tdengineFdwOptions->write_buffer, TDENGINE_WRITE_BUFFER_TRANSACTION) == 0;
+
+        if (xact_buffer)
+            fmstate->xact_insert = tdengine_xact_insert_lookup(foreignTableId, userid, fmstate->query);
+
+        if (fmstate->xact_insert != NULL)
+            fmstate->insert_stmt = fmstate->xact_insert->stmt;
+        else
+        {
+            struct TDengineInsertPrepare_return ret;
+            TDengineColumnInfo *columns;
+            char *planned_query = fmstate->query;
+            bool has_tags = false;
+            bool using_stable = false;
+            MemoryContext oldcontext = CurrentMemoryContext;
+
+            columns = (TDengineColumnInfo *)palloc0(sizeof(TDengineColumnInfo) * (fmstate->p_nums > 0 ? fmstate->p_nums : 1));
+            i = 0;
+            foreach (lc, fmstate->column_list)
+            {
+                columns[i] = *(TDengineColumnInfo *)lfirst(lc);
+                if (columns[i].column_type == TDENGINE_TAG_KEY)
+                    has_tags = true;
+                i++;
+            }
+
+            if (has_tags && tdengine_is_supertable(rel, fmstate->user, fmstate->tdengineFdwOptions))
+            {
+                StringInfoData sql;
+
+                initStringInfo(&sql);
+                tdengine_deparse_stable_insert(&sql, rel, fmstate->retrieved_attrs);
+                fmstate->query = sql.data;
+                using_stable = true;
+            }
+
+            if (xact_buffer)
+                MemoryContextSwitchTo(TopTransactionContext);
+            ret = TDengineInsertPrepare(fmstate->query, tdengine_get_table_name(rel), fmstate->user,
+                                        fmstate->tdengineFdwOptions, columns, fmstate->p_nums, using_stable);
+            if (ret.r1 != NULL)
+                tdengine_report_remote_error(ret.r1);
+            fmstate->insert_stmt = ret.r0;
+
+            if (xact_buffer)
+            {
+                TDengineXactInsert *entry = (TDengineXactInsert *)palloc0(sizeof(TDengineXactInsert));
+
+                entry->relid = foreignTableId;
+                entry->userid = userid;
+                entry->query = pstrdup(planned_query);
+                entry->stmt = ret.r0;
+                tdengine_xact_inserts = lappend(tdengine_xact_inserts, entry);
+                fmstate->xact_insert = entry;
+            }
+            MemoryContextSwitchTo(oldcontext);
+        }
+    }
+    else if (mtstate->operation == CMD_INSERT)
+    {
+        /* 无模式表的行协议记录同样攒批发送 */
+        fmstate->insert_lines = makeStringInfo();
+        fmstate->insert_line_rows = 0;
+    }
+
     /* 将执行状态设置到结果关系信息中 */
     resultRelInfo->ri_FdwState = fmstate;
 }
@@ -1737,19 +3574,22 @@ tdengineExecForeignBatchInsert(EState *estate,
  *      b. 存在BEFORE/AFTER ROW INSERT触发器
  *      c. 存在WITH CHECK OPTION约束
  *      d. 如果满足任一条件则返回1(禁用批量)
- *   6. 确保批量参数不超过65535限制
+ *   6. 按batch_bytes和每行的估算字节数限制批量大小
  *   7. 返回计算得到的批量大小
  *
  * 注意事项:
  *   - 批量操作可提高性能但受多种限制
  *   - 触发器存在时会禁用批量以保证正确性
- *   - 参数总数限制为65535(uint16最大值)
+ *   - 插入按列绑定，不受文本协议参数个数的限制，宽表与窄表按同样的字节数成批
  */
 static int
 tdengineGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo)
 {
     int batch_size;
+    int batch_bytes;
+    int row_bytes;
     TDengineFdwExecState *fmstate = (TDengineFdwExecState *)resultRelInfo->ri_FdwState;
+    Relation rel = resultRelInfo->ri_RelationDesc;
 
     elog(DEBUG1, "tdengine_fdw : %s", __func__);
 
@@ -1785,16 +3625,61 @@ tdengineGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo)
           resultRelInfo->ri_TrigDesc->trig_insert_after_row)))
         return 1;  // 满足任一条件则禁用批量
 
-    /* 
-     * 确保批量参数不超过65535限制
-     * 计算最大可能的批量大小
+    /*
+     * 按每批的估算字节数限制批量大小
+     * 无执行状态时按表的所有列估算
      */
-    if (fmstate && fmstate->p_nums > 0)
-        batch_size = Min(batch_size, 65535 / fmstate->p_nums);
+    if (fmstate)
+    {
+        batch_bytes = fmstate->tdengineFdwOptions->batch_bytes;
+        row_bytes = tdengine_estimate_insert_row_bytes(rel, fmstate->retrieved_attrs);
+    }
+    else
+    {
+        batch_bytes = tdengine_get_options(RelationGetRelid(rel), GetUserId())->batch_bytes;
+        row_bytes = tdengine_estimate_insert_row_bytes(rel, NIL);
+    }
+    batch_size = Min(batch_size, Max(batch_bytes / row_bytes, 1));
 
     return batch_size;
 }
 
+/*
+ * tdengineExecForeignUpdate - 执行外部表更新操作
+ * 功能: 以覆盖写实现UPDATE，TDengine中相同时间戳的写入覆盖原有的行
+ *
+ * 参数:
+ *   @estate: 执行状态
+ *   @resultRelInfo: 结果关系信息
+ *   @slot: 包含更新后数据的元组槽
+ *   @planSlot: 包含行标识列(时间列和标签列)的计划元组槽
+ *
+ * 返回值: 返回元组槽
+ *
+ * 处理流程:
+ *   1. 时间列和标签列取自planSlot中的行标识列，被更新的字段列取自slot
+ *   2. 与INSERT共用execute_foreign_insert_modify，追加到预编译语句的写入缓冲区，
+ *      攒够flush_rows行或flush_bytes字节时批量发送
+ *
+ * 注意事项:
+ *   - 缓冲区中剩余的行在tdengineEndForeignModify中发送
+ *   - 时间列和标签列不能更新，已在tdenginePlanForeignModify中检查
+ */
+static TupleTableSlot *
+tdengineExecForeignUpdate(EState *estate,
+                          ResultRelInfo *resultRelInfo,
+                          TupleTableSlot *slot,
+                          TupleTableSlot *planSlot)
+{
+    TupleTableSlot **rslot;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    rslot = execute_foreign_insert_modify(estate, resultRelInfo, &slot, &planSlot, 1);
+
+    return rslot ? *rslot : NULL;
+}
+
 /*
  * bindJunkColumnValue - 绑定junk列值到TDengine参数
  * 功能: 将计划节点中的junk列(特殊用途列)值绑定到TDengine查询参数
@@ -1927,14 +3812,14 @@ tdengineExecForeignDelete(EState *estate,
         // 复制错误信息
         char *err = pstrdup(ret.r1);
         // 释放原始错误信息
-        free(ret.r1);
+        pfree(ret.r1);
         ret.r1 = err;
         // 抛出错误
-        elog(ERROR, "tdengine_fdw : %s", err);
+        tdengine_report_remote_error(err);
     }
 
     // 释放查询结果
-    TDengineFreeResult((TDengineResult *)&ret.r0);
+    TDengineFreeResult((TDengineResult *)ret.r0);
     
     /* 返回元组槽 */
     return slot;
@@ -1952,8 +3837,10 @@ tdengineExecForeignDelete(EState *estate,
  * 处理流程:
  *   1. 记录调试日志
  *   2. 检查执行状态是否存在
- *   3. 重置游标状态(cursor_exists = false)
- *   4. 重置行索引(rowidx = 0)
+ *   3. 发送写入缓冲区中剩余的行，关闭INSERT的预编译语句
+ *      (事务级写缓冲区中的语句留待提交前发送)
+ *   4. 重置游标状态(cursor_exists = false)
+ *   5. 重置行索引(rowidx = 0)
  *
  * 注意事项:
  *   - 在修改操作完成后调用
@@ -1973,48 +3860,199 @@ tdengineEndForeignModify(EState *estate,
     // 检查并重置执行状态
     if (fmstate != NULL)
     {
+        char *err;
+
+        /* 写入缓冲区中剩余的行，事务级写缓冲区留到提交前发送 */
+        if (fmstate->xact_insert == NULL)
+        {
+            err = TDengineInsertFlush(fmstate->insert_stmt);
+            if (err != NULL)
+                tdengine_report_remote_error(err);
+            TDengineInsertClose(fmstate->insert_stmt);
+        }
+        if (fmstate->insert_lines != NULL)
+            flush_schemaless_insert(fmstate);
+
+        fmstate->insert_stmt = NULL;
         fmstate->cursor_exists = false;  // 重置游标状态
         fmstate->rowidx = 0;            // 重置行索引
     }
-}
+}
+
+
+// #if (PG_VERSION_NUM >= 110000)
+/*
+ * tdengineBeginForeignInsert - 开始分区表插入操作(不支持)
+ * 功能: 占位函数，用于处理分区表插入操作的开始阶段
+ * 参数:
+ *   @mtstate: 修改表操作状态
+ *   @resultRelInfo: 结果关系信息
+ * 说明:
+ *   - 当前TDengine FDW不支持分区表插入操作
+ *   - 调用此函数会直接抛出错误
+ */
+static void
+tdengineBeginForeignInsert(ModifyTableState *mtstate,
+                           ResultRelInfo *resultRelInfo)
+{
+    elog(ERROR, "Not support partition insert");
+}
+
+/*
+ * tdengineEndForeignInsert - 结束分区表插入操作(不支持)
+ * 功能: 占位函数，用于处理分区表插入操作的结束阶段
+ * 参数:
+ *   @estate: 执行状态
+ *   @resultRelInfo: 结果关系信息
+ * 说明:
+ *   - 当前TDengine FDW不支持分区表插入操作
+ *   - 调用此函数会直接抛出错误
+ */
+static void
+tdengineEndForeignInsert(EState *estate,
+                         ResultRelInfo *resultRelInfo)
+{
+    elog(ERROR, "Not support partition insert");
+}
+
+// #endif
+
+/*
+ * find_modifytable_subplan - 查找扫描目标表的ForeignScan子计划
+ *
+ * 只支持ForeignScan是ModifyTable的直接子节点，或是其下Append的
+ * 第subplan_index个子节点的情况；更深的位置意味着有本地连接，不能直接修改。
+ */
+static ForeignScan *
+find_modifytable_subplan(PlannerInfo *root,
+                         ModifyTable *plan,
+                         Index rtindex,
+                         int subplan_index)
+{
+    Plan *subplan = outerPlan(plan);
+
+    if (IsA(subplan, Append))
+    {
+        Append *appendplan = (Append *)subplan;
+
+        if (subplan_index < list_length(appendplan->appendplans))
+            subplan = (Plan *)list_nth(appendplan->appendplans, subplan_index);
+    }
+    else if (IsA(subplan, Result) &&
+             outerPlan(subplan) != NULL &&
+             IsA(outerPlan(subplan), Append))
+    {
+        Append *appendplan = (Append *)outerPlan(subplan);
+
+        if (subplan_index < list_length(appendplan->appendplans))
+            subplan = (Plan *)list_nth(appendplan->appendplans, subplan_index);
+    }
+
+    if (IsA(subplan, ForeignScan))
+    {
+        ForeignScan *fscan = (ForeignScan *)subplan;
+
+        if (bms_is_member(rtindex, fscan->fs_relids))
+            return fscan;
+    }
+
+    return NULL;
+}
+
+/*
+ * tdenginePlanDirectModify - 尝试把DELETE整体下推到远程执行
+ * 功能: 条件全部可以下推且只涉及时间列和标签列时，把扫描子计划改写为
+ *       直接执行的DELETE，不再逐行扫描和删除
+ *
+ * 参数:
+ *   @root: 规划器信息
+ *   @plan: 修改表操作计划
+ *   @resultRelation: 结果关系索引
+ *   @subplan_index: 子计划索引
+ *
+ * 返回值: 改写成功返回true，否则返回false，退回逐行删除
+ *
+ * 注意事项:
+ *   - UPDATE以覆盖写逐行写入，不在此下推
+ *   - 同时生成待删除数据的时间范围查询，设置了delete_chunk_interval时
+ *     执行阶段据此把DELETE按时间分块依次执行
+ */
+static bool
+tdenginePlanDirectModify(PlannerInfo *root,
+                         ModifyTable *plan,
+                         Index resultRelation,
+                         int subplan_index)
+{
+    RelOptInfo *foreignrel;
+    RangeTblEntry *rte;
+    TDengineFdwRelationInfo *fpinfo;
+    Relation rel;
+    StringInfoData sql;
+    StringInfoData bounds;
+    ForeignScan *fscan;
+    List *remote_exprs;
+    List *params_list = NIL;
+    List *retrieved_attrs = NIL;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    if (plan->operation != CMD_DELETE)
+        return false;
+
+    /* 查找扫描目标表的ForeignScan子计划 */
+    fscan = find_modifytable_subplan(root, plan, resultRelation, subplan_index);
+    if (fscan == NULL)
+        return false;
+
+    /* 有需要在本地计算的条件、连接或RETURNING时不能直接删除 */
+    if (fscan->scan.plan.qual != NIL)
+        return false;
+    if (fscan->scan.scanrelid == 0)
+        return false;
+    if (plan->returningLists)
+        return false;
+
+    foreignrel = root->simple_rel_array[resultRelation];
+    rte = root->simple_rte_array[resultRelation];
+    fpinfo = (TDengineFdwRelationInfo *)foreignrel->fdw_private;
+
+    /* 无模式表的条件落在jsonb列上，TDengine的DELETE无法执行 */
+    if (fpinfo->slinfo.schemaless)
+        return false;
+
+    /* 核心代码已经对每个关系加锁，这里可以使用NoLock */
+    rel = table_open(rte->relid, NoLock);
+
+    /* GetForeignPlan中记下的远程条件 */
+    remote_exprs = fpinfo->final_remote_exprs;
+
+    initStringInfo(&sql);
+    if (!tdengine_deparse_direct_delete_sql(&sql, root, resultRelation, rel, foreignrel,
+                                            remote_exprs, &params_list, &retrieved_attrs))
+    {
+        table_close(rel, NoLock);
+        return false;
+    }
 
+    initStringInfo(&bounds);
+    tdengine_deparse_time_bounds(&bounds, root, foreignrel, remote_exprs, &params_list);
 
-// #if (PG_VERSION_NUM >= 110000)
-/*
- * tdengineBeginForeignInsert - 开始分区表插入操作(不支持)
- * 功能: 占位函数，用于处理分区表插入操作的开始阶段
- * 参数:
- *   @mtstate: 修改表操作状态
- *   @resultRelInfo: 结果关系信息
- * 说明:
- *   - 当前TDengine FDW不支持分区表插入操作
- *   - 调用此函数会直接抛出错误
- */
-static void
-tdengineBeginForeignInsert(ModifyTableState *mtstate,
-                           ResultRelInfo *resultRelInfo)
-{
-    elog(ERROR, "Not support partition insert");
-}
+    /* 改写为直接修改 */
+    fscan->operation = CMD_DELETE;
+    fscan->resultRelation = resultRelation;
+    fscan->fdw_exprs = params_list;
 
-/*
- * tdengineEndForeignInsert - 结束分区表插入操作(不支持)
- * 功能: 占位函数，用于处理分区表插入操作的结束阶段
- * 参数:
- *   @estate: 执行状态
- *   @resultRelInfo: 结果关系信息
- * 说明:
- *   - 当前TDengine FDW不支持分区表插入操作
- *   - 调用此函数会直接抛出错误
- */
-static void
-tdengineEndForeignInsert(EState *estate,
-                         ResultRelInfo *resultRelInfo)
-{
-    elog(ERROR, "Not support partition insert");
-}
+    /* 列表中的项必须与上面的enum FdwDirectModifyPrivateIndex匹配 */
+    fscan->fdw_private = list_make5(makeString(sql.data),
+                                    makeBoolean(retrieved_attrs != NIL),
+                                    retrieved_attrs,
+                                    makeBoolean(plan->canSetTag),
+                                    remote_exprs);
+    fscan->fdw_private = lappend(fscan->fdw_private, makeString(bounds.data));
 
-// #endif
+    table_close(rel, NoLock);
+    return true;
+}
 
 /*
  * tdengineBeginDirectModify - 准备直接修改外部表
@@ -2128,6 +4166,8 @@ tdengineBeginDirectModify(ForeignScanState *node, int eflags)
     /* 从计划节点获取私有信息 */
     dmstate->query = strVal(list_nth(fsplan->fdw_private,
                                      FdwDirectModifyPrivateUpdateSql));
+    dmstate->bounds_query = strVal(list_nth(fsplan->fdw_private,
+                                            FdwDirectModifyPrivateBoundsSql));
 // #if (PG_VERSION_NUM >= 150000)
     dmstate->has_returning = boolVal(list_nth(fsplan->fdw_private,
                                               FdwDirectModifyPrivateHasReturning));
@@ -2148,6 +4188,7 @@ tdengineBeginDirectModify(ForeignScanState *node, int eflags)
         // 从计划节点获取远程表达式列表
     remote_exprs = (List *)list_nth(fsplan->fdw_private,
                                     FdwDirectModifyRemoteExprs);
+    dmstate->query_has_where = (remote_exprs != NIL);
 
     /*
      * 准备远程查询参数处理:
@@ -2517,68 +4558,534 @@ process_query_params(ExprContext *econtext,
         }
         i++;
     }
-    tdengine_reset_transmission_modes(nestlevel);
+    tdengine_reset_transmission_modes(nestlevel);
+}
+
+/*
+ * create_cursor - 为外部扫描创建游标并处理查询参数
+ * 功能: 为给定的ForeignScanState节点处理查询参数，并在远程端打开流式游标
+ *
+ * 参数:
+ *   @node: ForeignScanState节点，包含执行状态和计划信息
+ *
+ * 处理流程:
+ *   1. 获取执行状态(festate)和表达式上下文(econtext)
+ *   2. 检查是否有查询参数需要处理(numParams > 0)
+ *   3. 如果有参数:
+ *      a. 切换到每元组内存上下文(ecxt_per_tuple_memory)避免内存泄漏
+ *      b. 分配参数存储空间
+ *      c. 调用process_query_params处理参数转换和绑定
+ *      d. 切换回原始内存上下文
+ *   4. 在cursor_cxt中打开远程游标(只提交查询，不拉取数据)
+ *   5. 标记游标已创建(cursor_exists = true)
+ *
+ * 注意事项:
+ *   - 使用每元组内存上下文处理参数以避免重复扫描时的内存泄漏
+ *   - 参数处理包括类型转换和值绑定
+ *   - 数据行由fetch_more_data按批拉取
+ */
+static void
+create_cursor(ForeignScanState *node)
+{
+    // 获取执行状态
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    // 获取表达式上下文
+    ExprContext *econtext = node->ss.ps.ps_ExprContext;
+    // 获取参数数量
+    int numParams = festate->numParams;
+    // 获取参数值数组
+    const char **values = festate->param_values;
+    // 打开游标的返回值
+    struct TDengineCursorOpen_return ret;
+    MemoryContext oldcontext;
+    // 并行扫描时使用当前时间块的扫描语句
+    char *query = festate->chunk_query ? festate->chunk_query : festate->query;
+
+    /* 如果有查询参数需要处理 */
+    if (numParams > 0)
+    {
+        /* 切换到每元组内存上下文 */
+        oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+        // 分配参数存储空间
+        festate->params = palloc(numParams);
+        // 处理查询参数(类型转换和绑定)
+        process_query_params(econtext,
+                             festate->param_flinfo,
+                             festate->param_exprs,
+                             values,
+                             festate->param_types,
+                             festate->param_tdengine_types,
+                             festate->param_tdengine_values,
+                             festate->param_column_info);
+
+        /* 切换回原始内存上下文 */
+        MemoryContextSwitchTo(oldcontext);
+
+        /* 记录本轮参数值，重扫时据此判断能否回放缓存 */
+        if (festate->rescan_params != NULL)
+            tdengine_rescan_save_params(node);
+    }
+
+    /*
+     * 映射超级表的外部表开启扇出扫描时，按子表分组在多个连接上同时查询；
+     * 子表不足两个时仍按单路扫描
+     */
+    if (festate->fanout_merge != TDENGINE_FANOUT_DISABLED && festate->pscan == NULL &&
+        festate->tdengineFdwOptions->fanout_connections > 1 &&
+        tdengine_fanout_begin(node))
+    {
+        festate->temp_result = NULL;
+        festate->row_nums = 0;
+        festate->rowidx = 0;
+        festate->cursor_exists = true;
+        return;
+    }
+
+    /*
+     * 打开远程游标，游标的生命周期与cursor_cxt相同。
+     * 异步执行时查询在后台借来的独占连接上提交，Append可以同时等待
+     * 多个外部扫描的远程查询。
+     */
+    oldcontext = MemoryContextSwitchTo(festate->cursor_cxt);
+    if (festate->async_capable)
+        ret = TDengineCursorOpenAsync(query, festate->user, festate->tdengineFdwOptions,
+                                      festate->param_tdengine_types,
+                                      festate->param_tdengine_values,
+                                      festate->numParams);
+    else
+        ret = TDengineCursorOpen(query, festate->user, festate->tdengineFdwOptions,
+                                 festate->param_tdengine_types,
+                                 festate->param_tdengine_values,
+                                 festate->numParams);
+    MemoryContextSwitchTo(oldcontext);
+
+    if (ret.r1 != NULL)
+        tdengine_report_remote_error(ret.r1);
+
+    elog(DEBUG1, "tdengine_fdw : query: %s", query);
+
+    festate->cursor = ret.r0;
+    festate->eof_reached = false;
+
+    /*
+     * 启用预取时，从第二个数据块起由后台线程在处理当前数据块的同时拉取后续数据块；
+     * 第一个数据块同步拉取，本地LIMIT很快满足的扫描不会多拉数据
+     */
+    if (festate->tdengineFdwOptions->prefetch &&
+        !TDengineCursorStartPrefetch(festate->cursor, festate->tdengineFdwOptions->fetch_size))
+        elog(DEBUG1, "tdengine_fdw : prefetch is not available for this query, fetching synchronously");
+
+    festate->temp_result = NULL;
+    festate->row_nums = 0;
+    festate->rowidx = 0;
+
+    /* 标记游标已创建 */
+    festate->cursor_exists = true;
+}
+
+/*
+ * fetch_more_data - 从远程游标拉取下一个数据块
+ * 功能: 释放上一个数据块的描述信息，并拉取下一个列格式的数据块
+ *
+ * 参数:
+ *   @node: ForeignScanState节点
+ *
+ * 注意事项:
+ *   - 数据块的列缓冲区归客户端库所有，下一次拉取后失效
+ *   - 预取时缓冲的行数不超过fetch_size(至少一个数据块)
+ *   - 返回0行说明远程结果已读完，之后不再请求
+ *   - 每个数据块都要为转换计划绑定专用转换例程
+ */
+static void
+fetch_more_data(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    struct TDengineBlock_return ret;
+    MemoryContext oldcontext;
+
+    /* 上一个数据块的行已全部返回，可以整体释放 */
+    festate->temp_result = NULL;
+    festate->row_nums = 0;
+    festate->rowidx = 0;
+    MemoryContextReset(festate->batch_cxt);
+
+    oldcontext = MemoryContextSwitchTo(festate->batch_cxt);
+    ret = TDengineCursorFetchBlock(festate->cursor);
+    MemoryContextSwitchTo(oldcontext);
+
+    if (ret.r1 != NULL)
+        tdengine_report_remote_error(ret.r1);
+
+    festate->temp_result = (void *)ret.r0;
+    festate->row_nums = ret.r0->nrow;
+    if (ret.r0->nrow == 0)
+        festate->eof_reached = true;
+
+    if (ret.r0->nrow > 0)
+        tdengine_map_conv_plan(node, ret.r0);
+}
+
+/*
+ * tdengine_build_conv_plan - 为扫描的每个检索列建立类型转换计划
+ *
+ * 参数:
+ *   @node: ForeignScanState节点
+ *   @festate: 扫描执行状态
+ *
+ * 处理流程:
+ *   1. 按retrieved_attrs逐列解析目标类型的输入函数
+ *   2. 标记无模式表的tags/fields列和需要按记录类型组装的列
+ *   3. 记录类型列预先取得函数名和外部表的标签/字段列数
+ *
+ * 注意事项:
+ *   - 计划在es_query_cxt中分配，在整个扫描(包括重扫)期间有效
+ *   - 结果列映射和专用转换例程在拉到数据块后才能确定
+ */
+static void
+tdengine_build_conv_plan(ForeignScanState *node, TDengineFdwExecState *festate)
+{
+    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
+    TupleDesc tupdesc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
+    bool is_agg = (fsplan->scan.scanrelid == 0);
+    ListCell *lc;
+    int i = 0;
+
+    festate->nconv_plan = list_length(festate->retrieved_attrs);
+    festate->conv_plan = (TDengineConvPlan *)palloc0(sizeof(TDengineConvPlan) * Max(festate->nconv_plan, 1));
+    festate->conv_plan_mapped = false;
+
+    foreach (lc, festate->retrieved_attrs)
+    {
+        TDengineConvPlan *plan = &festate->conv_plan[i++];
+        int attnum = lfirst_int(lc) - 1;
+        Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum);
+
+        tdengine_init_conv_plan(plan, attnum, attr->atttypid, attr->atttypmod);
+
+        /* 无模式表的jsonb列 */
+        if (!is_agg && !festate->is_tlist_func_pushdown &&
+            tdengine_is_slvar(attr->atttypid, attnum + 1, &festate->slinfo, &plan->is_tags, NULL))
+        {
+            plan->is_slvar = true;
+            continue;
+        }
+
+        /* 星号/正则聚合函数的结果按记录类型组装 */
+        if ((is_agg || festate->is_tlist_func_pushdown) && type_is_rowtype(attr->atttypid))
+        {
+            TargetEntry *tle = list_nth_node(TargetEntry, festate->tlist, attnum);
+            int j;
+
+            plan->is_record = true;
+            if (IsA(tle->expr, Aggref))
+                plan->opername = get_func_name(((Aggref *)tle->expr)->aggfnoid);
+            else if (IsA(tle->expr, FuncExpr))
+                plan->opername = get_func_name(((FuncExpr *)tle->expr)->funcid);
+
+            for (j = 1; j <= get_relnatts(festate->relid); j++)
+            {
+                char *colname = get_attname(festate->relid, j, true);
+
+                if (colname == NULL || TDENGINE_IS_TIME_COLUMN(colname))
+                    continue;
+                if (tdengine_is_tag_key(colname, festate->relid))
+                    plan->ntags++;
+                else
+                    plan->nfield++;
+            }
+        }
+    }
+}
+
+/*
+ * tdengine_map_conv_plan - 将转换计划与数据块的结果列对应
+ *
+ * 参数:
+ *   @node: ForeignScanState节点
+ *   @block: 当前数据块
+ *
+ * 注意事项:
+ *   - 结果列映射只在拉到第一个数据块时计算一次
+ *   - 专用转换例程按列类型选定，只有列类型变化时才重新选择
+ */
+static void
+tdengine_map_conv_plan(ForeignScanState *node, TDengineBlock *block)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    ForeignScan *fsplan = (ForeignScan *)node->ss.ps.plan;
+    int i;
+
+    if (!festate->conv_plan_mapped)
+    {
+        for (i = 0; i < festate->nconv_plan; i++)
+        {
+            TDengineConvPlan *plan = &festate->conv_plan[i];
+            int idx = -1;
+
+            if (fsplan->scan.scanrelid == 0 || festate->is_tlist_func_pushdown)
+            {
+                /* 聚合或函数下推时结果列与目标列表按位置一一对应 */
+                if (i < block->ncol)
+                    idx = i;
+            }
+            else
+            {
+                /* 普通扫描按列名匹配 */
+                char *colname = tdengine_get_column_name(festate->relid, plan->attnum + 1);
+                int j;
+
+                for (j = 0; j < block->ncol; j++)
+                {
+                    if (strcmp(colname, block->columns[j]) == 0)
+                    {
+                        idx = j;
+                        break;
+                    }
+                }
+            }
+            plan->colidx = idx;
+
+            /* 无模式列的键按标签/字段预先分类 */
+            if (plan->is_slvar)
+            {
+                MemoryContext oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+                int j;
+
+                plan->key_colidx = (int *)palloc(sizeof(int) * Max(block->ncol, 1));
+                plan->keys = (char **)palloc(sizeof(char *) * Max(block->ncol, 1));
+                for (j = 0; j < block->ncol; j++)
+                {
+                    char *colname = block->columns[j];
+
+                    if (TDENGINE_IS_TIME_COLUMN(colname))
+                        continue;
+                    if (tdengine_is_tag_key(colname, festate->relid) != plan->is_tags)
+                        continue;
+
+                    plan->key_colidx[plan->nkeys] = j;
+                    plan->keys[plan->nkeys] = pstrdup(colname);
+                    plan->nkeys++;
+                }
+                MemoryContextSwitchTo(oldcontext);
+            }
+
+            /* 复合类型的属性到结果列的对应关系同样只计算一次 */
+            if (plan->is_record && plan->opername != NULL && idx >= 0)
+            {
+                MemoryContext oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+
+                tdengine_build_record_plan(plan, block, festate->relid, festate->slinfo.schemaless);
+                MemoryContextSwitchTo(oldcontext);
+            }
+        }
+        festate->conv_plan_mapped = true;
+    }
+
+    for (i = 0; i < festate->nconv_plan; i++)
+    {
+        TDengineConvPlan *plan = &festate->conv_plan[i];
+
+        if (plan->colidx < 0 || plan->is_slvar)
+            continue;
+        if (plan->is_record)
+        {
+            if (plan->record != NULL)
+                tdengine_bind_record_plan(plan, block);
+        }
+        else
+            tdengine_bind_conv_plan(plan, &block->cols[plan->colidx]);
+    }
+}
+
+/*
+ * tdengine_report_remote_error - 报告远程调用返回的错误
+ *
+ * 远程调用因取消请求(包括statement_timeout)中止时，先由CHECK_FOR_INTERRUPTS
+ * 按查询取消报告，与本地查询被取消时的错误一致。
+ */
+static void
+tdengine_report_remote_error(const char *err)
+{
+    CHECK_FOR_INTERRUPTS();
+    elog(ERROR, "tdengine_fdw : %s", err);
+    pg_unreachable();
+}
+
+/*
+ * tdengine_rescan_params_changed - 重新计算下推参数并与缓存结果对应的值比较
+ *
+ * 参数:
+ *   @node: ForeignScanState节点
+ *
+ * 注意事项:
+ *   - 以输出函数得到的文本值比较，与远程查询看到的参数一致
+ *   - 只比较fdw_exprs中的参数，本地条件中的参数在扫描节点之上求值，不影响缓存
+ */
+static bool
+tdengine_rescan_params_changed(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    ExprContext *econtext = node->ss.ps.ps_ExprContext;
+    MemoryContext oldcontext;
+    bool changed = false;
+    int i;
+
+    if (festate->numParams == 0)
+        return false;
+
+    oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+    process_query_params(econtext,
+                         festate->param_flinfo,
+                         festate->param_exprs,
+                         festate->param_values,
+                         festate->param_types,
+                         festate->param_tdengine_types,
+                         festate->param_tdengine_values,
+                         festate->param_column_info);
+    MemoryContextSwitchTo(oldcontext);
+
+    for (i = 0; i < festate->numParams; i++)
+    {
+        if (festate->rescan_params[i] == NULL ||
+            strcmp(festate->rescan_params[i], festate->param_values[i]) != 0)
+        {
+            changed = true;
+            break;
+        }
+    }
+    return changed;
+}
+
+/*
+ * tdengine_rescan_save_params - 保存本轮扫描的参数文本值
+ */
+static void
+tdengine_rescan_save_params(ForeignScanState *node)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    MemoryContext query_cxt = node->ss.ps.state->es_query_cxt;
+    int i;
+
+    for (i = 0; i < festate->numParams; i++)
+    {
+        if (festate->rescan_params[i] != NULL)
+            pfree(festate->rescan_params[i]);
+        festate->rescan_params[i] = MemoryContextStrdup(query_cxt, festate->param_values[i]);
+    }
 }
 
 /*
- * create_cursor - 为外部扫描创建游标并处理查询参数
- * 功能: 为给定的ForeignScanState节点创建游标，处理查询参数并准备执行
+ * tdengine_rescan_replay_next - 从重扫缓存取下一行
  *
  * 参数:
- *   @node: ForeignScanState节点，包含执行状态和计划信息
+ *   @node: ForeignScanState节点
+ *   @tupleSlot: 扫描元组槽，缓存读完时保持为空
  *
- * 处理流程:
- *   1. 获取执行状态(festate)和表达式上下文(econtext)
- *   2. 检查是否有查询参数需要处理(numParams > 0)
- *   3. 如果有参数:
- *      a. 切换到每元组内存上下文(ecxt_per_tuple_memory)避免内存泄漏
- *      b. 分配参数存储空间
- *      c. 调用process_query_params处理参数转换和绑定
- *      d. 切换回原始内存上下文
- *   4. 标记游标已创建(cursor_exists = true)
+ * 注意事项:
+ *   - 扫描槽不能直接存放最小元组，先读到rescan_slot再以虚拟元组的形式引用其中的值
+ */
+static bool
+tdengine_rescan_replay_next(ForeignScanState *node, TupleTableSlot *tupleSlot)
+{
+    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
+    TupleTableSlot *cached = festate->rescan_slot;
+    int natts = tupleSlot->tts_tupleDescriptor->natts;
+
+    if (!tuplestore_gettupleslot(festate->rescan_store, true, false, cached))
+        return false;
+
+    slot_getallattrs(cached);
+    memcpy(tupleSlot->tts_values, cached->tts_values, sizeof(Datum) * natts);
+    memcpy(tupleSlot->tts_isnull, cached->tts_isnull, sizeof(bool) * natts);
+    ExecStoreVirtualTuple(tupleSlot);
+    return true;
+}
+
+/*
+ * close_cursor - 关闭远程游标并释放已拉取的结果
+ */
+static void
+close_cursor(TDengineFdwExecState *festate)
+{
+    if (festate->cursor != NULL)
+        TDengineCursorClose(festate->cursor);
+
+    /*
+     * 扇出扫描的各路游标和并行扫描当前时间块的语句都分配在cursor_cxt中，
+     * 随其重置一起释放，不能留下悬空指针
+     */
+    festate->cursor = NULL;
+    festate->fanout = NULL;
+    festate->chunk_query = NULL;
+    festate->temp_result = NULL;
+    festate->row_nums = 0;
+    festate->rowidx = 0;
+    festate->eof_reached = false;
+
+    if (festate->batch_cxt != NULL)
+        MemoryContextReset(festate->batch_cxt);
+    if (festate->cursor_cxt != NULL)
+        MemoryContextReset(festate->cursor_cxt);
+}
+
+/*
+ * make_tuple_from_result_row - 将数据块中的一行转换为PostgreSQL元组的值数组
+ *
+ * 参数:
+ *   @block: 当前数据块
+ *   @rowidx: 行号
+ *   @tupleDescriptor: 扫描元组描述符
+ *   @row/@is_null: 输出的值数组和空值标记
+ *   @relid: 外部表OID
+ *   @festate: 扫描执行状态(提供每列的类型转换计划)
+ *   @is_agg: 是否为聚合(上层关系)扫描
  *
  * 注意事项:
- *   - 使用每元组内存上下文处理参数以避免重复扫描时的内存泄漏
- *   - 参数处理包括类型转换和值绑定
- *   - 游标创建后需要后续操作来实际执行查询
+ *   - 普通列使用转换计划中预先选定的例程，逐行转换时不查询系统缓存
+ *   - 无模式表的tags/fields列由预先分类的标签列和字段列直接构造为jsonb
+ *   - 星号/正则聚合函数返回的复合类型由类型化的值直接构造，不经过record_in
  */
 static void
-create_cursor(ForeignScanState *node)
+make_tuple_from_result_row(TDengineBlock *block,
+                           int rowidx,
+                           TupleDesc tupleDescriptor,
+                           Datum *row,
+                           bool *is_null,
+                           Oid relid,
+                           TDengineFdwExecState *festate,
+                           bool is_agg)
 {
-    // 获取执行状态
-    TDengineFdwExecState *festate = (TDengineFdwExecState *)node->fdw_state;
-    // 获取表达式上下文
-    ExprContext *econtext = node->ss.ps.ps_ExprContext;
-    // 获取参数数量
-    int numParams = festate->numParams;
-    // 获取参数值数组
-    const char **values = festate->param_values;
+    int i;
 
-    /* 如果有查询参数需要处理 */
-    if (numParams > 0)
+    memset(row, 0, sizeof(Datum) * tupleDescriptor->natts);
+    memset(is_null, true, sizeof(bool) * tupleDescriptor->natts);
+
+    for (i = 0; i < festate->nconv_plan; i++)
     {
-        MemoryContext oldcontext;
+        TDengineConvPlan *plan = &festate->conv_plan[i];
+        int attnum = plan->attnum;
 
-        /* 切换到每元组内存上下文 */
-        oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
-        // 分配参数存储空间
-        festate->params = palloc(numParams);
-        // 处理查询参数(类型转换和绑定)
-        process_query_params(econtext,
-                             festate->param_flinfo,
-                             festate->param_exprs,
-                             values,
-                             festate->param_types,
-                             festate->param_tdengine_types,
-                             festate->param_tdengine_values,
-                             festate->param_column_info);
+        /* 无模式表的jsonb列 */
+        if (plan->is_slvar)
+        {
+            row[attnum] = tdengine_slvar_to_jsonb(block, rowidx, plan->nkeys, plan->key_colidx,
+                                                  plan->keys, false, &is_null[attnum]);
+            continue;
+        }
 
-        /* 切换回原始内存上下文 */
-        MemoryContextSwitchTo(oldcontext);
-    }
+        if (plan->colidx < 0 || tdengine_column_isnull(&block->cols[plan->colidx], rowidx))
+            continue;
 
-    /* 标记游标已创建 */
-    festate->cursor_exists = true;
+        if (plan->is_record)
+        {
+            if (plan->record == NULL)
+                continue;
+            row[attnum] = tdengine_record_to_datum(plan, block, rowidx);
+        }
+        else
+            row[attnum] = plan->convert(&block->cols[plan->colidx], rowidx, block->precision, plan);
+        is_null[attnum] = false;
+    }
 }
 
 /*
@@ -2595,18 +5102,12 @@ create_cursor(ForeignScanState *node)
  *      b. 分配参数存储空间
  *      c. 调用process_query_params处理参数转换和绑定
  *      d. 切换回原始内存上下文
- *   3. 执行远程查询:
- *      a. 使用C++客户端或普通方式连接TDengine
- *      b. 传递参数类型和值
- *   4. 处理查询结果:
- *      a. 错误处理: 复制错误信息并抛出异常
- *      b. 释放查询结果资源
+ *   3. 发送事务级写缓冲区中该表的行
+ *   4. 调用tdengine_execute_delete执行远程DELETE，
+ *      设置了delete_chunk_interval时按时间分块执行
  *   5. 设置处理元组数为0(TDengine DELETE不返回行)
  *
  * 注意事项:
- *   - 使用volatile修饰ret防止编译器优化
- *   - 错误信息需要复制后再释放原始指针
- *   - 无论操作成功与否都需释放查询结果
  *   - TDengine的DELETE操作不返回受影响行数，默认设为0
  */
 static void
@@ -2620,8 +5121,6 @@ execute_dml_stmt(ForeignScanState *node)
     int numParams = dmstate->numParams;
     // 获取参数值数组
     const char **values = dmstate->param_values;
-    // 存储查询返回结果(volatile防止优化)
-    struct TDengineQuery_return volatile ret;
 
     /* 处理查询参数 */
     if (numParams > 0)
@@ -2646,30 +5145,15 @@ execute_dml_stmt(ForeignScanState *node)
         MemoryContextSwitchTo(oldcontext);
     }
 
-    /* 执行查询 */
-    // #ifdef CXX_CLIENT
-    ret = TDengineQuery(dmstate->query, dmstate->user, dmstate->tdengineFdwOptions,
-    // #else
-    // 普通连接方式(注释掉的备选方案)
-    // #endif
-                        dmstate->param_tdengine_types, 
-                        dmstate->param_tdengine_values, 
-                        dmstate->numParams);
-
-    // 错误处理
-    if (ret.r1 != NULL)
-    {
-        // 复制错误信息
-        char *err = pstrdup(ret.r1);
-        // 释放原始错误信息
-        free(ret.r1);
-        ret.r1 = err;
-        // 抛出错误
-        elog(ERROR, "tdengine_fdw : %s", err);
-    }
+    /* 事务级写缓冲区中该表的行先写入，再执行删除 */
+    tdengine_xact_insert_flush_rel(RelationGetRelid(dmstate->rel));
 
-    // 释放查询结果
-    TDengineFreeResult((TDengineResult *)&ret.r0);
+    /* 执行删除，设置了delete_chunk_interval时按时间分块执行 */
+    tdengine_execute_delete(dmstate->query, dmstate->bounds_query, dmstate->query_has_where,
+                            dmstate->user, dmstate->tdengineFdwOptions,
+                            dmstate->param_tdengine_types,
+                            dmstate->param_tdengine_values,
+                            dmstate->numParams);
 
     /* 
      * TDengine的DELETE操作不返回受影响行数
@@ -2678,6 +5162,163 @@ execute_dml_stmt(ForeignScanState *node)
     dmstate->num_tuples = 0;
 }
 
+/*
+ * tdengine_execute_remote_delete - 执行一条远程DELETE语句，失败时报错
+ */
+static void
+tdengine_execute_remote_delete(char *query, UserMapping *user, tdengine_opt *options,
+                               TDengineType *types, TDengineValue *values, int nparams)
+{
+    struct TDengineQuery_return volatile ret;
+
+    ret = TDengineQuery(query, user, options, types, values, nparams);
+    if (ret.r1 != NULL)
+    {
+        char *err = pstrdup(ret.r1);
+
+        pfree(ret.r1);
+        tdengine_report_remote_error(err);
+    }
+    TDengineFreeResult((TDengineResult *)ret.r0);
+}
+
+/*
+ * tdengine_execute_delete - 执行远程DELETE，需要时按时间分块依次执行
+ *
+ * 参数:
+ *   @query: DELETE语句，以FROM/WHERE子句结尾
+ *   @bounds_query: 查询待删除数据时间范围的语句，NULL或空串表示不能分块
+ *   @has_where: DELETE语句是否已有WHERE子句
+ *   @user: 用户映射
+ *   @options: 连接选项，delete_chunk_interval为每块的跨度
+ *   @types/@values/@nparams: 语句参数
+ *
+ * 处理流程:
+ *   1. 未设置delete_chunk_interval、语句带参数或不能分块时一次删除
+ *   2. 否则先查询待删除数据的第一个和最后一个时间戳，没有数据时直接返回
+ *   3. 按delete_chunk_interval把时间范围切分为左闭右开的时间块，
+ *      每块追加时间条件后作为一条独立的DELETE执行
+ *
+ * 注意事项:
+ *   - 每块完成时只输出DEBUG1日志，块数较多时每隔TDENGINE_DELETE_PROGRESS_INTERVAL
+ *     以NOTICE报告一次进度，最后汇总一次
+ *   - 每块的远程语句只占用服务端有限的时间，长时间的清理不会持续占用vnode
+ *   - TDengine的DELETE不在事务中，中途出错或取消时已删除的块不会恢复
+ */
+static void
+tdengine_execute_delete(char *query, char *bounds_query, bool has_where,
+                        UserMapping *user, tdengine_opt *options,
+                        TDengineType *types, TDengineValue *values, int nparams)
+{
+    int64 lower = 0;
+    int64 upper = 0;
+    int64 step;
+    int64 chunk_lower;
+    bool found = false;
+    int precision = 0;
+    int nchunks;
+    int chunk = 0;
+    TimestampTz last_report;
+    char *err;
+
+    if (options->delete_chunk_interval <= 0 || nparams > 0 ||
+        bounds_query == NULL || bounds_query[0] == '\0')
+    {
+        tdengine_execute_remote_delete(query, user, options, types, values, nparams);
+        return;
+    }
+
+    err = TDengineQueryTimeBounds(bounds_query, user, options, NULL, NULL, 0,
+                                  &lower, &upper, &found, &precision);
+    if (err != NULL)
+        tdengine_report_remote_error(err);
+    if (!found)
+        return;
+
+    /* 时间戳按数据库精度(0毫秒/1微秒/2纳秒)换算每块的跨度 */
+    step = (int64)options->delete_chunk_interval *
+           (precision == 2 ? INT64CONST(1000000000) : precision == 1 ? INT64CONST(1000000) : INT64CONST(1000));
+    nchunks = (int)Min((upper - lower) / step + 1, (int64)INT_MAX);
+    last_report = GetCurrentTimestamp();
+
+    for (chunk_lower = lower; chunk_lower <= upper; chunk_lower += step)
+    {
+        int64 chunk_upper = Min(chunk_lower + step, upper + 1);
+        char *sql;
+
+        CHECK_FOR_INTERRUPTS();
+
+        sql = psprintf("%s%s(time >= " INT64_FORMAT " AND time < " INT64_FORMAT ")",
+                       query, has_where ? " AND " : " WHERE ", chunk_lower, chunk_upper);
+        tdengine_execute_remote_delete(sql, user, options, NULL, NULL, 0);
+        pfree(sql);
+
+        chunk++;
+        elog(DEBUG1, "tdengine_fdw : deleted time chunk %d of %d", chunk, nchunks);
+        if (chunk < nchunks &&
+            TimestampDifferenceExceeds(last_report, GetCurrentTimestamp(), TDENGINE_DELETE_PROGRESS_INTERVAL))
+        {
+            ereport(NOTICE,
+                    (errmsg("tdengine_fdw : deleted %d of %d time chunks", chunk, nchunks)));
+            last_report = GetCurrentTimestamp();
+        }
+    }
+
+    if (nchunks > 1)
+        ereport(NOTICE,
+                (errmsg("tdengine_fdw : deleted %d time chunks", chunk)));
+}
+
+#if (PG_VERSION_NUM >= 140000)
+/*
+ * tdengineExecForeignTruncate - 清空外部表
+ * 功能: 把TRUNCATE映射为远程不带条件的DELETE
+ *
+ * 参数:
+ *   @rels: 要清空的外部表
+ *   @behavior: CASCADE/RESTRICT，外部表没有依赖对象，忽略
+ *   @restart_seqs: 是否重置序列，TDengine没有序列，忽略
+ *
+ * 处理流程:
+ *   1. 发送事务级写缓冲区中该表的行
+ *   2. 对每张表执行"DELETE FROM 表"，设置了delete_chunk_interval时
+ *      同样按时间分块执行
+ *
+ * 注意事项:
+ *   - 超级表的子表和标签值保留，只删除数据；删除并重建子表需要重新
+ *     提供标签值，不能由FDW完成
+ *   - 远程DELETE在执行时立即生效，TDengine没有事务，之后本地事务ROLLBACK
+ *     (包括回滚到TRUNCATE之前的保存点)不会恢复已删除的数据
+ */
+static void
+tdengineExecForeignTruncate(List *rels,
+                            DropBehavior behavior,
+                            bool restart_seqs)
+{
+    ListCell *lc;
+
+    elog(DEBUG1, "tdengine_fdw : %s", __func__);
+
+    foreach (lc, rels)
+    {
+        Relation rel = (Relation)lfirst(lc);
+        Oid relid = RelationGetRelid(rel);
+        ForeignTable *ftable = GetForeignTable(relid);
+        tdengine_opt *options = tdengine_get_options(relid, GetUserId());
+        UserMapping *user = GetUserMapping(GetUserId(), ftable->serverid);
+        StringInfoData sql;
+        StringInfoData bounds;
+
+        tdengine_xact_insert_flush_rel(relid);
+
+        initStringInfo(&sql);
+        initStringInfo(&bounds);
+        tdengine_deparse_truncate(&sql, &bounds, rel);
+        tdengine_execute_delete(sql.data, bounds.data, false, user, options, NULL, NULL, 0);
+    }
+}
+#endif
+
 
 /*
  * execute_foreign_insert_modify - 执行外部表插入/修改操作
@@ -2687,7 +5328,7 @@ execute_dml_stmt(ForeignScanState *node)
  *   @estate: 执行状态
  *   @resultRelInfo: 结果关系信息
  *   @slots: 包含待插入数据的元组槽数组
- *   @planSlots: 计划元组槽数组(未使用)
+ *   @planSlots: 计划元组槽数组，UPDATE从中取行标识列的值
  *   @numSlots: 要处理的元组数量
  *
  * 返回值: 返回处理后的元组槽数组
@@ -2695,13 +5336,19 @@ execute_dml_stmt(ForeignScanState *node)
  * 处理流程:
  *   1. 获取执行状态和表信息
  *   2. 切换到临时内存上下文处理参数
- *   3. 重新分配参数存储空间以适应批量操作
+ *   3. 参数数组容纳不下本批时按倍数扩大，之后各批复用
  *   4. 遍历每个元组槽，绑定参数值:
  *      a. 处理非空约束检查
- *      b. 特殊处理时间列(time和time_text)
+ *      b. 特殊处理时间列(time和time_text)，time_text的文本解析为时间戳
  *      c. 绑定普通列值
- *   5. 调用TDengine接口执行批量插入
+ *   5. 追加到BeginForeignModify准备的预编译语句的写入缓冲区，
+ *      攒够flush_rows行或flush_bytes字节时按列绑定并执行
  *   6. 清理临时内存并返回结果
+ *
+ * 注意事项:
+ *   - 缓冲区中剩余的行在tdengineEndForeignModify中发送
+ *   - async_insert时写入由后台线程执行，其错误在下一次发送或
+ *     tdengineEndForeignModify中报告
  */
 static TupleTableSlot **
 execute_foreign_insert_modify(EState *estate,
@@ -2726,10 +5373,29 @@ execute_foreign_insert_modify(EState *estate,
     // 切换到临时内存上下文处理参数
     oldcontext = MemoryContextSwitchTo(fmstate->temp_cxt);
 
-    // 重新分配参数存储空间以适应批量操作
-    fmstate->param_tdengine_types = (TDengineType *)repalloc(fmstate->param_tdengine_types, sizeof(TDengineType) * fmstate->p_nums * numSlots);
-    fmstate->param_tdengine_values = (TDengineValue *)repalloc(fmstate->param_tdengine_values, sizeof(TDengineValue) * fmstate->p_nums * numSlots);
-    fmstate->param_column_info = (TDengineColumnInfo *)repalloc(fmstate->param_column_info, sizeof(TDengineColumnInfo) * fmstate->p_nums * numSlots);
+    /* 无模式表以行协议写入，不逐列绑定 */
+    if (fmstate->slinfo.schemaless)
+    {
+        execute_schemaless_insert(fmstate, rel, slots, numSlots);
+        MemoryContextSwitchTo(oldcontext);
+        MemoryContextReset(fmstate->temp_cxt);
+        return slots;
+    }
+
+    /*
+     * 参数数组容纳不下本批时按倍数扩大，之后各批复用。
+     * 数组分配在查询上下文中，repalloc不改变所属的上下文
+     */
+    if (numSlots > fmstate->p_slots)
+    {
+        int p_slots = Max(numSlots, fmstate->p_slots * 2);
+        Size n = (Size) Max(fmstate->p_nums, 1) * p_slots;
+
+        fmstate->param_tdengine_types = (TDengineType *)repalloc(fmstate->param_tdengine_types, sizeof(TDengineType) * n);
+        fmstate->param_tdengine_values = (TDengineValue *)repalloc(fmstate->param_tdengine_values, sizeof(TDengineValue) * n);
+        fmstate->param_column_info = (TDengineColumnInfo *)repalloc(fmstate->param_column_info, sizeof(TDengineColumnInfo) * n);
+        fmstate->p_slots = p_slots;
+    }
 
     /* 从元组槽获取参数并绑定 */
     if (slots != NULL && fmstate->retrieved_attrs != NIL)
@@ -2743,6 +5409,9 @@ execute_foreign_insert_modify(EState *estate,
         // 遍历每个元组槽
         for (i = 0; i < numSlots; i++)
         {
+            // 每行各自取时间列的值
+            time_had_value = false;
+
             /* 绑定值到参数 */
             foreach (lc, fmstate->retrieved_attrs)
             {
@@ -2756,8 +5425,11 @@ execute_foreign_insert_modify(EState *estate,
                 // 设置列名和类型
                 fmstate->param_column_info[bindnum].column_name = col->column_name;
                 fmstate->param_column_info[bindnum].column_type = col->column_type;
-                // 获取属性值
-                value = slot_getattr(slots[i], attnum + 1, &is_null);
+                // 获取属性值，UPDATE的时间列和标签列取自计划输出的行标识列
+                if (fmstate->is_update && col->column_type != TDENGINE_FIELD_KEY)
+                    value = ExecGetJunkAttribute(planSlots[i], fmstate->junk_idx[attnum], &is_null);
+                else
+                    value = slot_getattr(slots[i], attnum + 1, &is_null);
 
                 /* 检查值是否为空 */
                 if (is_null)
@@ -2775,6 +5447,16 @@ execute_foreign_insert_modify(EState *estate,
                     // 特殊处理时间列
                     if (TDENGINE_IS_TIME_COLUMN(col->column_name))
                     {
+                        /* 预编译语句的时间列按时间戳绑定，time_text的文本先解析 */
+                        if (type == TEXTOID || type == VARCHAROID || type == BPCHAROID)
+                        {
+                            value = DirectFunctionCall3(timestamptz_in,
+                                                        CStringGetDatum(TextDatumGetCString(value)),
+                                                        ObjectIdGetDatum(InvalidOid),
+                                                        Int32GetDatum(-1));
+                            type = TIMESTAMPTZOID;
+                        }
+
                         /* 时间列处理逻辑 */
                         if (!time_had_value)
                         {
@@ -2816,12 +5498,14 @@ execute_foreign_insert_modify(EState *estate,
     // 验证绑定参数数量
     Assert(bindnum == fmstate->p_nums * numSlots);
 
-    /* 执行插入操作 */
-    ret = TDengineInsert(tablename, fmstate->user, fmstate->tdengineFdwOptions,
-                         fmstate->param_column_info, fmstate->param_tdengine_types, fmstate->param_tdengine_values, fmstate->p_nums, numSlots);
+    /* 追加到写入缓冲区，达到发送阈值时执行插入 */
+    if (fmstate->xact_insert != NULL)
+        tdengine_xact_insert_mark(fmstate->xact_insert);
+    ret = TDengineInsertAppend(fmstate->insert_stmt, fmstate->param_tdengine_types, fmstate->param_tdengine_values,
+                               numSlots);
     // 检查插入结果
     if (ret != NULL)
-        elog(ERROR, "tdengine_fdw : %s", ret);
+        tdengine_report_remote_error(ret);
 
     // 恢复原始内存上下文并清理临时内存
     MemoryContextSwitchTo(oldcontext);
@@ -2830,6 +5514,176 @@ execute_foreign_insert_modify(EState *estate,
     return slots;
 }
 
+/*
+ * execute_schemaless_insert - 以行协议写入无模式表
+ * 功能: 把一批元组序列化为InfluxDB行协议，一次调用写入TDengine
+ *
+ * 参数:
+ *   @fmstate: 执行状态
+ *   @rel: 目标关系
+ *   @slots: 包含待插入数据的元组槽数组
+ *   @numSlots: 要处理的元组数量
+ *
+ * 处理流程:
+ *   1. 遍历每个元组槽，取time/time_text列中第一个非空值作为时间戳，
+ *      按schemaless_precision换算
+ *   2. tags/fields两个jsonb列分别写为标签和字段
+ *   3. 记录以换行连接追加到fmstate->insert_lines，
+ *      攒够flush_rows行或flush_bytes字节时调用flush_schemaless_insert写入
+ *
+ * 注意事项:
+ *   - 子表和新出现的列由TDengine在服务端自动创建
+ *   - 在调用方的临时内存上下文中执行，insert_lines分配在查询上下文中
+ */
+static void
+execute_schemaless_insert(TDengineFdwExecState *fmstate, Relation rel,
+                          TupleTableSlot **slots, int numSlots)
+{
+    Oid relid = RelationGetRelid(rel);
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    char *measurement = tdengine_get_table_name(rel);
+    int64 unit = tdengine_schemaless_time_unit(fmstate->tdengineFdwOptions->schemaless_precision);
+    const int64 epoch_diff = (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY;
+    StringInfo lines = fmstate->insert_lines;
+    int i;
+
+    for (i = 0; i < numSlots; i++)
+    {
+        Datum tags = (Datum) 0;
+        Datum fields = (Datum) 0;
+        bool tags_isnull = true;
+        bool fields_isnull = true;
+        bool has_time = false;
+        int64 timestamp = 0;
+        ListCell *lc;
+
+        foreach (lc, fmstate->retrieved_attrs)
+        {
+            int attnum = lfirst_int(lc);
+            Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+            char *colname = tdengine_get_column_name(relid, attnum);
+            bool is_tags = false;
+            bool is_fields = false;
+            bool is_null;
+            Datum value = slot_getattr(slots[i], attnum, &is_null);
+
+            if (is_null)
+            {
+                if (attr->attnotnull)
+                    elog(ERROR, "tdengine_fdw : null value in column \"%s\" of relation \"%s\" violates not-null constraint",
+                         colname, measurement);
+                continue;
+            }
+
+            if (TDENGINE_IS_TIME_COLUMN(colname))
+            {
+                Timestamp ts;
+
+                if (has_time)
+                    continue;
+                if (attr->atttypid == TEXTOID || attr->atttypid == VARCHAROID || attr->atttypid == BPCHAROID)
+                    value = DirectFunctionCall3(timestamptz_in,
+                                                CStringGetDatum(TextDatumGetCString(value)),
+                                                ObjectIdGetDatum(InvalidOid),
+                                                Int32GetDatum(-1));
+                ts = DatumGetTimestamp(value);
+                if (TIMESTAMP_NOT_FINITE(ts))
+                    elog(ERROR, "tdengine_fdw : cannot insert an infinite timestamp");
+                /* 先换算为纳秒，再按精度截断 */
+                timestamp = (ts + epoch_diff) * 1000 / unit;
+                has_time = true;
+            }
+            else if (tdengine_is_slvar(attr->atttypid, attnum, &fmstate->slinfo, &is_tags, &is_fields))
+            {
+                if (is_tags)
+                {
+                    tags = value;
+                    tags_isnull = false;
+                }
+                else
+                {
+                    fields = value;
+                    fields_isnull = false;
+                }
+            }
+        }
+
+        tdengine_slvar_append_line(lines, measurement, tags, tags_isnull, fields, fields_isnull,
+                                   has_time, timestamp);
+        fmstate->insert_line_rows++;
+    }
+
+    if (fmstate->insert_line_rows >= fmstate->tdengineFdwOptions->flush_rows ||
+        lines->len >= fmstate->tdengineFdwOptions->flush_bytes)
+        flush_schemaless_insert(fmstate);
+}
+
+/*
+ * flush_schemaless_insert - 发送攒下的行协议记录
+ *
+ * 记录为空时什么也不做。发送后清空缓冲区，保留已分配的空间供后续复用。
+ */
+static void
+flush_schemaless_insert(TDengineFdwExecState *fmstate)
+{
+    StringInfo lines = fmstate->insert_lines;
+    char *ret;
+
+    if (lines->len == 0)
+        return;
+
+    ret = TDengineSchemalessInsert(lines->data, lines->len, fmstate->user, fmstate->tdengineFdwOptions);
+    resetStringInfo(lines);
+    fmstate->insert_line_rows = 0;
+    if (ret != NULL)
+        tdengine_report_remote_error(ret);
+}
+
+/*
+ * tdengine_estimate_insert_row_bytes - 估算插入一行时绑定数据的字节数
+ * 功能: 供按batch_bytes确定批量大小时使用
+ *
+ * 参数:
+ *   @rel: 关系描述符
+ *   @attrs: 插入的属性编号列表，NIL表示表的所有列
+ *
+ * 返回值: 每行的估算字节数，至少为1
+ *
+ * 注意事项:
+ *   - 定长类型取类型长度，变长类型取类型的平均宽度
+ */
+static int
+tdengine_estimate_insert_row_bytes(Relation rel, List *attrs)
+{
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    int row_bytes = 0;
+    ListCell *lc;
+    int i;
+
+    if (attrs != NIL)
+    {
+        foreach (lc, attrs)
+        {
+            Form_pg_attribute attr = TupleDescAttr(tupdesc, lfirst_int(lc) - 1);
+
+            row_bytes += attr->attlen > 0 ? attr->attlen : get_typavgwidth(attr->atttypid, attr->atttypmod);
+        }
+    }
+    else
+    {
+        for (i = 0; i < tupdesc->natts; i++)
+        {
+            Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+            if (attr->attisdropped)
+                continue;
+            row_bytes += attr->attlen > 0 ? attr->attlen : get_typavgwidth(attr->atttypid, attr->atttypmod);
+        }
+    }
+
+    return Max(row_bytes, 1);
+}
+
 // #if (PG_VERSION_NUM >= 140000)
 /*
  * tdengine_get_batch_size_option - 获取外部表的批量操作大小
@@ -23,6 +23,7 @@
 #include "utils/formatting.h"
 #include "utils/memutils.h"
 #include "utils/guc.h"
+#include "utils/typcache.h"
 #include "access/htup_details.h"
 #include "access/sysattr.h"
 #include "access/reloptions.h"
@@ -45,10 +46,14 @@
 #include "catalog/pg_type.h"
 #include "funcapi.h"
 #include "miscadmin.h"
+#include "mb/pg_wchar.h"
 #include "postmaster/syslogger.h"
 #include "storage/fd.h"
 #include "catalog/pg_type.h"
 
+#include <float.h>
+#include <taosws.h>
+
 extern char *tdengine_replace_function(char *in);
 
 /*
@@ -80,183 +85,581 @@ tdengine_convert_to_pg(Oid pgtyp, int pgtypmod, char *value)
 }
 
 /*
- * tdengine_convert_record_to_datum: Convert tdengine string data into PostgreSQL's compatible data types
+ * tdengine_time_to_pg: 将TDengine时间戳(按结果集精度)转换为PostgreSQL时间戳
+ *
+ * PostgreSQL时间戳精度为微秒，纳秒精度的值向下取整到微秒。
  */
-Datum
-tdengine_convert_record_to_datum(Oid pgtyp, int pgtypmod, char **row, int attnum, int ntags, int nfield,
-								 char **column, char *opername, Oid relid, int ncol, bool is_schemaless)
+static Timestamp
+tdengine_time_to_pg(int64 ts, int precision)
 {
-	Datum		value_datum = 0;
-	Datum		valueDatum = 0;
-	regproc		typeinput;
-	HeapTuple	tuple;
-	int			typemod;
+	const int64 epoch_diff = (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY;
+	int64		usecs;
+
+	switch (precision)
+	{
+		case 1:					/* 微秒 */
+			usecs = ts;
+			break;
+		case 2:					/* 纳秒 */
+			usecs = ts / 1000 - ((ts % 1000) < 0 ? 1 : 0);
+			break;
+		default:				/* 毫秒 */
+			usecs = ts * 1000;
+			break;
+	}
+
+	return usecs - epoch_diff;
+}
+
+/*
+ * tdengine_read_int64: 按TDengine整数类型(含布尔和时间戳)读取一个值
+ */
+static int64
+tdengine_read_int64(int type, const char *val)
+{
+	switch (type)
+	{
+		case TSDB_DATA_TYPE_BOOL:
+		case TSDB_DATA_TYPE_TINYINT:
+			{
+				int8		v;
+
+				memcpy(&v, val, sizeof(v));
+				return v;
+			}
+		case TSDB_DATA_TYPE_SMALLINT:
+			{
+				int16		v;
+
+				memcpy(&v, val, sizeof(v));
+				return v;
+			}
+		case TSDB_DATA_TYPE_INT:
+			{
+				int32		v;
+
+				memcpy(&v, val, sizeof(v));
+				return v;
+			}
+		case TSDB_DATA_TYPE_UTINYINT:
+			{
+				uint8		v;
+
+				memcpy(&v, val, sizeof(v));
+				return v;
+			}
+		case TSDB_DATA_TYPE_USMALLINT:
+			{
+				uint16		v;
+
+				memcpy(&v, val, sizeof(v));
+				return v;
+			}
+		case TSDB_DATA_TYPE_UINT:
+			{
+				uint32		v;
+
+				memcpy(&v, val, sizeof(v));
+				return v;
+			}
+		default:				/* BIGINT/UBIGINT/TIMESTAMP */
+			{
+				int64		v;
+
+				memcpy(&v, val, sizeof(v));
+				return v;
+			}
+	}
+}
+
+/*
+ * tdengine_read_float8: 读取FLOAT/DOUBLE类型的值
+ */
+static float8
+tdengine_read_float8(int type, const char *val)
+{
+	if (type == TSDB_DATA_TYPE_FLOAT)
+	{
+		float4		v;
+
+		memcpy(&v, val, sizeof(v));
+		return (float8) v;
+	}
+	else
+	{
+		float8		v;
+
+		memcpy(&v, val, sizeof(v));
+		return v;
+	}
+}
+
+/*
+ * tdengine_ucs4_to_text: 将原始数据块中UCS-4编码的NCHAR值转换为text
+ */
+static text *
+tdengine_ucs4_to_text(const char *val, uint32 len)
+{
+	int			nchars = len / sizeof(uint32);
+	text	   *result = (text *) palloc(VARHDRSZ + nchars * 4 + 1);
+	unsigned char *p = (unsigned char *) VARDATA(result);
 	int			i;
-	StringInfoData fields_jsstr;
-	StringInfo	record = makeStringInfo();
-	bool		first = true;
-	bool		is_sc_agg_starregex = false;
-	bool		need_enclose_brace = false;
-	char	   *foreignColName = NULL;
-	char	   *tdengineFuncName = tdengine_replace_function(opername);
-	int			nmatch = 0;
 
-	/* get the type's output function */
-	tuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(pgtyp));
-	if (!HeapTupleIsValid(tuple))
-		elog(ERROR, "cache lookup failed for type%u", pgtyp);
+	for (i = 0; i < nchars; i++)
+	{
+		uint32		c;
 
-	typeinput = ((Form_pg_type) GETSTRUCT(tuple))->typinput;
-	typemod = ((Form_pg_type) GETSTRUCT(tuple))->typtypmod;
-	ReleaseSysCache(tuple);
+		memcpy(&c, val + sizeof(uint32) * i, sizeof(uint32));
+		if (c == 0)
+			break;
+		unicode_to_utf8((pg_wchar) c, p);
+		p += pg_utf_mblen(p);
+	}
+	SET_VARSIZE(result, (char *) p - (char *) result);
 
-	/* Build the fields json string value */
-	if (is_schemaless)
-		initStringInfo(&fields_jsstr);
+	return result;
+}
+
+/*
+ * tdengine_column_is_ucs4: 判断列值是否为原始数据块中的UCS-4编码NCHAR
+ *
+ * 逐行退化模式下客户端库已经将NCHAR转换为UTF-8。
+ */
+static inline bool
+tdengine_column_is_ucs4(const TDengineColumn *col, uint32 len)
+{
+	return col->type == TSDB_DATA_TYPE_NCHAR && col->values == NULL &&
+		(len % sizeof(uint32)) == 0;
+}
+
+/*
+ * tdengine_column_to_cstring: 将列中第row行的值格式化为文本
+ *
+ * 仅用于没有直接转换路径的类型组合，调用前须确认值非NULL。
+ */
+char *
+tdengine_column_to_cstring(const TDengineColumn *col, int row, int precision)
+{
+	uint32		len;
+	const char *val = tdengine_column_value(col, row, &len);
 
-	/* Append time column */
-	appendStringInfo(record, "(%s,", row[0]);
+	switch (col->type)
+	{
+		case TSDB_DATA_TYPE_BOOL:
+			return pstrdup(tdengine_read_int64(col->type, val) ? "true" : "false");
+		case TSDB_DATA_TYPE_TINYINT:
+		case TSDB_DATA_TYPE_SMALLINT:
+		case TSDB_DATA_TYPE_INT:
+		case TSDB_DATA_TYPE_BIGINT:
+		case TSDB_DATA_TYPE_UTINYINT:
+		case TSDB_DATA_TYPE_USMALLINT:
+		case TSDB_DATA_TYPE_UINT:
+			return psprintf(INT64_FORMAT, tdengine_read_int64(col->type, val));
+		case TSDB_DATA_TYPE_UBIGINT:
+			return psprintf(UINT64_FORMAT, (uint64) tdengine_read_int64(col->type, val));
+		case TSDB_DATA_TYPE_FLOAT:
+			return psprintf("%.*g", FLT_DIG + 3, tdengine_read_float8(col->type, val));
+		case TSDB_DATA_TYPE_DOUBLE:
+			return psprintf("%.*g", DBL_DIG + 3, tdengine_read_float8(col->type, val));
+		case TSDB_DATA_TYPE_TIMESTAMP:
+			{
+				Timestamp	ts = tdengine_time_to_pg(tdengine_read_int64(col->type, val), precision);
 
-	if (is_schemaless)
+				return DatumGetCString(DirectFunctionCall1(timestamptz_out, TimestampTzGetDatum(ts)));
+			}
+		default:
+			if (tdengine_column_is_ucs4(col, len))
+				return text_to_cstring(tdengine_ucs4_to_text(val, len));
+			return pnstrdup(val, len);
+	}
+}
+
+/*
+ * 以下为类型转换计划使用的专用转换例程
+ *
+ * 整数、浮点、布尔和时间戳按值转换，BINARY/NCHAR转换为text，
+ * 均不经过文本格式化；没有专用例程的类型组合使用tdengine_conv_generic，
+ * 经由计划中预先解析的文本输入函数转换。
+ */
+static Datum
+tdengine_conv_generic(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	char	   *str = tdengine_column_to_cstring(col, row, precision);
+
+	return InputFunctionCall(&plan->input_func, str, plan->typioparam, plan->pgtypmod);
+}
+
+static Datum
+tdengine_conv_int_to_bool(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+
+	return BoolGetDatum(tdengine_read_int64(col->type, tdengine_column_value(col, row, &len)) != 0);
+}
+
+static Datum
+tdengine_conv_int_to_int2(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+	int64		v = tdengine_read_int64(col->type, tdengine_column_value(col, row, &len));
+
+	/* 超出范围时由输入函数报告错误 */
+	if (v < PG_INT16_MIN || v > PG_INT16_MAX)
+		return tdengine_conv_generic(col, row, precision, plan);
+	return Int16GetDatum((int16) v);
+}
+
+static Datum
+tdengine_conv_int_to_int4(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+	int64		v = tdengine_read_int64(col->type, tdengine_column_value(col, row, &len));
+
+	/* 超出范围时由输入函数报告错误 */
+	if (v < PG_INT32_MIN || v > PG_INT32_MAX)
+		return tdengine_conv_generic(col, row, precision, plan);
+	return Int32GetDatum((int32) v);
+}
+
+static Datum
+tdengine_conv_int_to_int8(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+	int64		v = tdengine_read_int64(col->type, tdengine_column_value(col, row, &len));
+
+	/* 超出int64范围的无符号值由输入函数报告错误 */
+	if (col->type == TSDB_DATA_TYPE_UBIGINT && v < 0)
+		return tdengine_conv_generic(col, row, precision, plan);
+	return Int64GetDatum(v);
+}
+
+static Datum
+tdengine_conv_int_to_float4(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+	int64		v = tdengine_read_int64(col->type, tdengine_column_value(col, row, &len));
+
+	if (col->type == TSDB_DATA_TYPE_UBIGINT)
+		return Float4GetDatum((float4) (uint64) v);
+	return Float4GetDatum((float4) v);
+}
+
+static Datum
+tdengine_conv_int_to_float8(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+	int64		v = tdengine_read_int64(col->type, tdengine_column_value(col, row, &len));
+
+	if (col->type == TSDB_DATA_TYPE_UBIGINT)
+		return Float8GetDatum((float8) (uint64) v);
+	return Float8GetDatum((float8) v);
+}
+
+static Datum
+tdengine_conv_float_to_float4(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+
+	return Float4GetDatum((float4) tdengine_read_float8(col->type, tdengine_column_value(col, row, &len)));
+}
+
+static Datum
+tdengine_conv_float_to_float8(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+
+	return Float8GetDatum(tdengine_read_float8(col->type, tdengine_column_value(col, row, &len)));
+}
+
+static Datum
+tdengine_conv_float_to_numeric(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+	float8		v = tdengine_read_float8(col->type, tdengine_column_value(col, row, &len));
+
+	return DirectFunctionCall1(float8_numeric, Float8GetDatum(v));
+}
+
+static Datum
+tdengine_conv_time_to_timestamp(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+	int64		v = tdengine_read_int64(col->type, tdengine_column_value(col, row, &len));
+
+	return TimestampGetDatum(tdengine_time_to_pg(v, precision));
+}
+
+static Datum
+tdengine_conv_var_to_text(const TDengineColumn *col, int row, int precision, TDengineConvPlan *plan)
+{
+	uint32		len;
+	const char *val = tdengine_column_value(col, row, &len);
+
+	if (tdengine_column_is_ucs4(col, len))
+		return PointerGetDatum(tdengine_ucs4_to_text(val, len));
+	return PointerGetDatum(cstring_to_text_with_len(val, len));
+}
+
+/*
+ * tdengine_init_conv_plan: 初始化一个属性的类型转换计划
+ *
+ * 解析目标类型的文本输入函数，专用例程在得知TDengine列类型后由
+ * tdengine_bind_conv_plan选定。
+ */
+void
+tdengine_init_conv_plan(TDengineConvPlan *plan, int attnum, Oid pgtyp, int32 pgtypmod)
+{
+	Oid			typinput;
+
+	memset(plan, 0, sizeof(TDengineConvPlan));
+	plan->attnum = attnum;
+	plan->pgtype = pgtyp;
+	plan->pgtypmod = pgtypmod;
+	plan->colidx = -1;
+	plan->tdtype = -1;
+
+	getTypeInputInfo(pgtyp, &typinput, &plan->typioparam);
+	fmgr_info(typinput, &plan->input_func);
+}
+
+/*
+ * tdengine_bind_conv_plan: 根据(TDengine类型, PostgreSQL类型)选定专用转换例程
+ */
+void
+tdengine_bind_conv_plan(TDengineConvPlan *plan, const TDengineColumn *col)
+{
+	TDengineConvertFunc convert = tdengine_conv_generic;
+
+	if (plan->tdtype == col->type && plan->convert != NULL)
+		return;
+
+	switch (col->type)
+	{
+		case TSDB_DATA_TYPE_BOOL:
+		case TSDB_DATA_TYPE_TINYINT:
+		case TSDB_DATA_TYPE_SMALLINT:
+		case TSDB_DATA_TYPE_INT:
+		case TSDB_DATA_TYPE_BIGINT:
+		case TSDB_DATA_TYPE_UTINYINT:
+		case TSDB_DATA_TYPE_USMALLINT:
+		case TSDB_DATA_TYPE_UINT:
+		case TSDB_DATA_TYPE_UBIGINT:
+			switch (plan->pgtype)
+			{
+				case BOOLOID:
+					convert = tdengine_conv_int_to_bool;
+					break;
+				case INT2OID:
+					convert = tdengine_conv_int_to_int2;
+					break;
+				case INT4OID:
+					convert = tdengine_conv_int_to_int4;
+					break;
+				case INT8OID:
+					convert = tdengine_conv_int_to_int8;
+					break;
+				case FLOAT4OID:
+					convert = tdengine_conv_int_to_float4;
+					break;
+				case FLOAT8OID:
+					convert = tdengine_conv_int_to_float8;
+					break;
+				default:
+					break;
+			}
+			break;
+		case TSDB_DATA_TYPE_FLOAT:
+		case TSDB_DATA_TYPE_DOUBLE:
+			switch (plan->pgtype)
+			{
+				case FLOAT4OID:
+					convert = tdengine_conv_float_to_float4;
+					break;
+				case FLOAT8OID:
+					convert = tdengine_conv_float_to_float8;
+					break;
+				case NUMERICOID:
+					if (plan->pgtypmod < 0)
+						convert = tdengine_conv_float_to_numeric;
+					break;
+				default:
+					break;
+			}
+			break;
+		case TSDB_DATA_TYPE_TIMESTAMP:
+			switch (plan->pgtype)
+			{
+				case TIMESTAMPTZOID:
+				case TIMESTAMPOID:
+					convert = tdengine_conv_time_to_timestamp;
+					break;
+				case INT8OID:
+					convert = tdengine_conv_int_to_int8;
+					break;
+				default:
+					break;
+			}
+			break;
+		case TSDB_DATA_TYPE_BINARY:
+		case TSDB_DATA_TYPE_NCHAR:
+			if (plan->pgtype == TEXTOID ||
+				(plan->pgtype == VARCHAROID && plan->pgtypmod < 0))
+				convert = tdengine_conv_var_to_text;
+			break;
+		default:
+			break;
+	}
+
+	plan->tdtype = col->type;
+	plan->convert = convert;
+}
+
+/*
+ * tdengine_build_record_plan: 建立星号/正则聚合结果的复合类型构造计划
+ *
+ * TDengine返回的结果列名格式为"函数名_列名"(例如last_value1)。复合类型
+ * 的第一个属性为时间列，随后是标签列(始终为NULL)，再后是按外部表列顺序
+ * 排列的字段列；无模式表的复合类型为(time, tags, fields)，fields中的键
+ * 为去掉函数名前缀的结果列名。
+ *
+ * 计划在当前内存上下文中分配，调用方须切换到扫描生命周期的上下文。
+ */
+void
+tdengine_build_record_plan(TDengineConvPlan *plan, const TDengineBlock *block,
+						   Oid relid, bool is_schemaless)
+{
+	TDengineRecordPlan *rec = (TDengineRecordPlan *) palloc0(sizeof(TDengineRecordPlan));
+	char	   *funcname = tdengine_replace_function(plan->opername);
+	int			prefixlen = strlen(funcname);
+	int			natts;
+	int			i;
+
+	rec->tupdesc = BlessTupleDesc(lookup_rowtype_tupdesc_copy(plan->pgtype, plan->pgtypmod));
+	natts = rec->tupdesc->natts;
+	rec->colidx = (int *) palloc(sizeof(int) * Max(natts, 1));
+	rec->attplans = (TDengineConvPlan *) palloc0(sizeof(TDengineConvPlan) * Max(natts, 1));
+	rec->values = (Datum *) palloc(sizeof(Datum) * Max(natts, 1));
+	rec->nulls = (bool *) palloc(sizeof(bool) * Max(natts, 1));
+	rec->fields_att = -1;
+
+	for (i = 0; i < natts; i++)
 	{
-		/*
-		 * Dummy value for tags jsonb schemaless column,
-		 * it is not number of actual tag keys.
-		 */
-		ntags = 1;
+		Form_pg_attribute attr = TupleDescAttr(rec->tupdesc, i);
+
+		rec->colidx[i] = -1;
+		if (!attr->attisdropped)
+			tdengine_init_conv_plan(&rec->attplans[i], i, attr->atttypid, attr->atttypmod);
 	}
 
-	/* Append tags column as NULL */
-	for (i = 0; i < ntags; i++)
-		appendStringInfo(record, ",");
+	/* 时间列 */
+	if (natts > 0)
+		rec->colidx[0] = 0;
 
-	/* Append fields column */
-	i = 0;
-	do
+	if (is_schemaless)
 	{
-		if (is_schemaless)
+		/* 标签列固定为NULL，其余结果列作为fields中的键 */
+		rec->fields_att = 2;
+		rec->key_colidx = (int *) palloc(sizeof(int) * Max(block->ncol, 1));
+		rec->keys = (char **) palloc(sizeof(char *) * Max(block->ncol, 1));
+		for (i = plan->colidx; i < block->ncol; i++)
 		{
-			if (i < ncol)
-				foreignColName = column[i];
-			else
-				foreignColName = NULL;
-			i++;
+			char	   *colname = block->columns[i];
 
-			is_sc_agg_starregex = true;
+			if (TDENGINE_IS_TIME_COLUMN(colname) || tdengine_is_tag_key(colname, relid))
+				continue;
+
+			rec->key_colidx[rec->nkeys] = i;
+			if (strncmp(colname, funcname, prefixlen) == 0 && colname[prefixlen] == '_')
+				rec->keys[rec->nkeys] = pstrdup(colname + prefixlen + 1);
+			else
+				rec->keys[rec->nkeys] = pstrdup(colname);
+			rec->nkeys++;
 		}
-		else
-		foreignColName = get_attname(relid, ++i
-#if (PG_VERSION_NUM >= 110000)
-									 ,
-									 true
-#endif
-			);
-
-		if (foreignColName != NULL &&
-			!TDENGINE_IS_TIME_COLUMN(foreignColName) &&
-			!tdengine_is_tag_key(foreignColName, relid))
+	}
+	else
+	{
+		int			att = 1 + plan->ntags;
+		int			nmatch = 0;
+		char	   *foreignColName;
+
+		for (i = 1; nmatch < plan->nfield &&
+			 (foreignColName = get_attname(relid, i, true)) != NULL; i++)
 		{
-			bool		match = false;
+			char	   *tdengineColName;
 			int			j;
 
-			for (j = attnum; j < ncol; j++)
+			if (TDENGINE_IS_TIME_COLUMN(foreignColName) || tdengine_is_tag_key(foreignColName, relid))
+				continue;
+
+			tdengineColName = psprintf("%s_%s", funcname, foreignColName);
+			for (j = plan->colidx; j < block->ncol; j++)
 			{
-				/*
-				 * TDengine returns column name of result in format:
-				 * functionname_columnname (Example: last_value1). We need to
-				 * concatenate string to compare with the column returned from
-				 * TDengine.
-				 */
-				char	   *tdengineColName = column[j];
-				char	   *tmpName;
-
-				if (is_sc_agg_starregex)
-					tmpName = foreignColName;
-				else
-					tmpName = psprintf("%s_%s", tdengineFuncName, foreignColName);
-
-				if (strcmp(tmpName, tdengineColName) == 0)
+				if (strcmp(tdengineColName, block->columns[j]) == 0)
 				{
-					match = true;
+					if (att < natts)
+						rec->colidx[att] = j;
 					nmatch++;
-
-					if (is_schemaless)
-					{
-						char *colname = NULL;
-						char *escaped_key = NULL;
-						char *escaped_value = NULL;
-
-						/* Escape comma charater in PostgreSQL composite type */
-						if (!first)
-							appendStringInfoChar(&fields_jsstr, ',');
-
-						/* Get actual column name */
-						colname = pstrdup(tmpName + strlen(tdengineFuncName) + 1); /* Skip "functionname_" */
-
-						escaped_key = tdengine_escape_json_string(colname);
-						pfree(colname);
-
-						if (escaped_key == NULL)
-							elog(ERROR, "Cannot escape json column key");
-
-						escaped_value = tdengine_escape_json_string(row[j]);
-
-						if (need_enclose_brace == false)
-						{
-							appendStringInfoChar(&fields_jsstr, '{');
-							need_enclose_brace = true;
-						}
-
-						/* Build json string value for fields column */
-						appendStringInfo(&fields_jsstr, "\"%s\" : ", escaped_key); /* \"key\" : */
-						if (escaped_value)
-							appendStringInfo(&fields_jsstr, "\"%s\"", escaped_value); /* \"value\" */
-						else
-							appendStringInfoString(&fields_jsstr, "null"); /* null */
-					}
-					else
-					{
-						if (!first)
-							appendStringInfoChar(record, ',');
-
-						appendStringInfo(record, "%s", row[j] != NULL ? row[j] : "");
-					}
-					first = false;
 					break;
 				}
 			}
-			if (!is_sc_agg_starregex && nmatch == nfield)
-				break;
+			pfree(tdengineColName);
 
-			/* Column of temp table does not match regex, fill as NULL */
-			if (!is_schemaless && match == false)
-				appendStringInfo(record, ",");
+			/* 没有匹配的字段列保持为NULL */
+			att++;
 		}
+	}
 
-		is_sc_agg_starregex = false;
-	} while (foreignColName != NULL);
+	plan->record = rec;
+}
 
-	if (is_schemaless)
+/*
+ * tdengine_bind_record_plan: 为复合类型的每个属性选定专用转换例程
+ */
+void
+tdengine_bind_record_plan(TDengineConvPlan *plan, const TDengineBlock *block)
+{
+	TDengineRecordPlan *rec = plan->record;
+	int			i;
+
+	for (i = 0; i < rec->tupdesc->natts; i++)
 	{
-		char *escaped_fields_jsstr = NULL;
+		if (rec->colidx[i] >= 0 && i != rec->fields_att)
+			tdengine_bind_conv_plan(&rec->attplans[i], &block->cols[rec->colidx[i]]);
+	}
+}
 
-		if (need_enclose_brace)
-			appendStringInfoString(&fields_jsstr, " }");
+/*
+ * tdengine_record_to_datum: 由数据块中的一行直接构造复合类型值
+ */
+Datum
+tdengine_record_to_datum(TDengineConvPlan *plan, const TDengineBlock *block, int row)
+{
+	TDengineRecordPlan *rec = plan->record;
+	int			i;
 
-		/* Escape json string value in PostgreSQL composite type */
-		escaped_fields_jsstr = tdengine_escape_record_string(fields_jsstr.data);
+	for (i = 0; i < rec->tupdesc->natts; i++)
+	{
+		int			colidx = rec->colidx[i];
 
-		/* Nested the escaped json string value in record */
-		appendStringInfo(record, "%s", (escaped_fields_jsstr != NULL) ? escaped_fields_jsstr : "");
-	}
+		rec->values[i] = (Datum) 0;
+		rec->nulls[i] = true;
 
-	appendStringInfo(record, ")");
-	valueDatum = CStringGetDatum(record->data);
+		if (i == rec->fields_att)
+		{
+			rec->values[i] = tdengine_slvar_to_jsonb(block, row, rec->nkeys, rec->key_colidx,
+													 rec->keys, true, &rec->nulls[i]);
+			continue;
+		}
 
-	/* convert string value to appropriate type value */
-	value_datum = OidFunctionCall3(typeinput, valueDatum, ObjectIdGetDatum(InvalidOid), Int32GetDatum(typemod));
+		if (colidx < 0 || tdengine_column_isnull(&block->cols[colidx], row))
+			continue;
 
-	return value_datum;
+		rec->values[i] = rec->attplans[i].convert(&block->cols[colidx], row, block->precision,
+												  &rec->attplans[i]);
+		rec->nulls[i] = false;
+	}
+
+	return HeapTupleGetDatum(heap_form_tuple(rec->tupdesc, rec->values, rec->nulls));
 }
 
 /*
@@ -278,10 +681,9 @@ tdengine_convert_record_to_datum(Oid pgtyp, int pgtypmod, char **row, int attnum
  *      b. 浮点类型(FLOAT4/FLOAT8/NUMERIC): 转为TDENGINE_DOUBLE
  *      c. 布尔类型: 转为TDENGINE_BOOLEAN
  *      d. 字符串类型: 转为TDENGINE_STRING
- *      e. 时间类型: 根据列类型决定转换方式
- *         - 时间键列: 转为纳秒时间戳(TDENGINE_TIME)
- *         - 其他列: 转为字符串(TDENGINE_STRING)
- *   3. 不支持的类型抛出错误
+ *      e. 时间戳类型: 转为纳秒时间戳(TDENGINE_TIME)，写入TIMESTAMP列时按数据库精度换算
+ *      f. TIME类型: 时间键列按时间戳处理，其他列转为字符串(TDENGINE_STRING)
+ *   3. 不支持的类型和无穷大的时间戳抛出错误
  */
 void
 tdengine_bind_sql_var(Oid type, int idx, Datum value, TDengineColumnInfo *param_column_info,
@@ -400,15 +802,22 @@ tdengine_bind_sql_var(Oid type, int idx, Datum value, TDengineColumnInfo *param_
         case TIMESTAMPOID:
         case TIMESTAMPTZOID:
             {
-                // 检查是否为时间键列
-                if (param_column_info[idx].column_type == TDENGINE_TIME_KEY)
+                // 时间戳(包括非时间键的TIMESTAMP列)一律以纳秒传递，TIME类型只在时间键列上按时间戳处理
+                if (type != TIMEOID || param_column_info[idx].column_type == TDENGINE_TIME_KEY)
                 {
                     // 计算PostgreSQL和Unix时间戳的差异(微秒)
                     const int64 epoch_diff = (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * USECS_PER_DAY;
                     // 获取时间戳值
                     Timestamp ts = DatumGetTimestamp(value);
                     // 转换为纳秒时间戳
-                    int64 nanos = (ts + epoch_diff) * 1000;
+                    int64 nanos;
+
+                    // TDengine没有无穷大的时间戳
+                    if (TIMESTAMP_NOT_FINITE(ts))
+                        ereport(ERROR,
+                                (errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+                                 errmsg("timestamp out of range for TDengine")));
+                    nanos = (ts + epoch_diff) * 1000;
                     
                     // 存储为时间类型
                     param_tdengine_values[idx].i = nanos;
@@ -416,7 +825,7 @@ tdengine_bind_sql_var(Oid type, int idx, Datum value, TDengineColumnInfo *param_
                 }
                 else
                 {
-                    // 非时间键列处理为字符串
+                    // 非时间键的TIME值处理为字符串
                     char *outputString = NULL;
                     outputFunctionId = InvalidOid;
                     typeVarLength = false;